@@ -0,0 +1,58 @@
+/*
+ * ntcompat.h - the subset of the NT kernel types and helpers used by the
+ * shared core in ../sys, mapped onto their Linux user-space equivalents.
+ */
+#ifndef _NTCOMPAT_H_
+#define _NTCOMPAT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+typedef void                VOID;
+typedef void               *PVOID;
+typedef uint8_t             UCHAR, *PUCHAR;
+typedef int16_t             SHORT, *PSHORT;
+typedef uint16_t            USHORT, *PUSHORT;
+typedef int32_t             LONG, *PLONG;
+typedef uint32_t            ULONG, *PULONG;
+typedef int64_t             LONGLONG;
+typedef uint64_t            ULONGLONG;
+typedef uint8_t             BOOLEAN;
+
+#ifndef TRUE
+#define TRUE                1
+#define FALSE               0
+#endif
+
+#define UNREFERENCED_PARAMETER(P)   ((void)(P))
+#define ARRAYSIZE(a)                (sizeof(a) / sizeof((a)[0]))
+
+#define RtlCopyMemory(d, s, n)      memcpy((d), (s), (n))
+#define RtlMoveMemory(d, s, n)      memmove((d), (s), (n))
+#define RtlZeroMemory(d, n)         memset((d), 0, (n))
+#define RtlEqualMemory(a, b, n)     (memcmp((a), (b), (n)) == 0)
+
+#define C_ASSERT(e)                 _Static_assert(e, #e)
+
+#define InterlockedXor(p, v)        __atomic_fetch_xor((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedIncrement(p)     __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define MemoryBarrier()             __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#if defined(__i386__) || defined(__x86_64__)
+#define ReadTimeStampCounter()      __rdtsc()
+#else
+static inline ULONGLONG ReadTimeStampCounter(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ULONGLONG)ts.tv_sec * 1000000000ULL + (ULONGLONG)ts.tv_nsec;
+}
+#endif
+
+#endif /* _NTCOMPAT_H_ */
@@ -0,0 +1,378 @@
+/*
+ * nvshldbatch.c - bulk decoding of gamepad input reports, see
+ * nvshldbatch.h.
+ *
+ * The SIMD kernels load 8 (SSE2) or 16 (AVX2) reports, transpose them as
+ * 8x8 matrices of 16-bit words so that each register holds the same word
+ * of every report, then extract each control with the shifts and masks
+ * derived from the layout and store it straight into its array.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+#include "nvshldbatch.h"
+
+#define SIMD_REPORT_SIZE    16
+#define SIMD_WORDS          (SIMD_REPORT_SIZE / 2)
+
+/*
+ * A control as seen from the transposed words: bits Shift and up of
+ * word Word, continued in word Word + 1 when Spill.
+ */
+struct word_field {
+    unsigned int word;
+    unsigned int shift;
+    unsigned int spill;
+    USHORT mask;
+};
+
+static int word_field(NVSHIELD_INPUT_FIELD field, struct word_field *wf)
+{
+    memset(wf, 0, sizeof(*wf));
+
+    if (field.BitSize == 0)
+        return 1;   /* absent, decodes as 0 */
+
+    wf->word = field.BitOffset / 16;
+    wf->shift = field.BitOffset % 16;
+    wf->spill = wf->shift + field.BitSize > 16;
+    wf->mask = (USHORT)((1UL << field.BitSize) - 1);
+
+    return field.BitSize <= 16 && wf->word + wf->spill < SIMD_WORDS;
+}
+
+static int simd_layout(const NVSHIELD_INPUT_LAYOUT *layout)
+{
+    struct word_field wf;
+    int i;
+
+    if (layout->ReportSize != SIMD_REPORT_SIZE ||
+        !word_field(layout->Buttons, &wf) ||
+        !word_field(layout->Consumer, &wf) ||
+        !word_field(layout->Hat, &wf))
+        return 0;
+
+    for (i = 0; i < NvShieldAxisCount; i++) {
+        if (layout->Axes[i].BitSize != 0 &&
+            (layout->Axes[i].BitSize != 16 || layout->Axes[i].BitOffset % 16))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Scalar
+ */
+
+static void decode_scalar(const NVSHIELD_INPUT_LAYOUT *layout,
+                          const UCHAR *reports, size_t first, size_t count,
+                          struct nvshield_input_batch *out)
+{
+    NVSHIELD_GAMEPAD_STATE state;
+    size_t n;
+    int i;
+
+    for (n = first; n < count; n++) {
+        memset(&state, 0, sizeof(state));
+        NvShieldDecodeInputReport(layout, reports + n * layout->ReportSize,
+                                  layout->ReportSize, &state);
+
+        out->buttons[n] = state.Buttons;
+        out->hat[n] = state.Hat;
+        out->consumer[n] = state.Consumer;
+        for (i = 0; i < NvShieldAxisCount; i++)
+            out->axes[i][n] = state.Axes[i];
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/*
+ * SSE2
+ */
+
+__attribute__((target("sse2")))
+static inline void transpose_8x16(__m128i w[SIMD_WORDS])
+{
+    __m128i a0 = _mm_unpacklo_epi16(w[0], w[1]);
+    __m128i a1 = _mm_unpackhi_epi16(w[0], w[1]);
+    __m128i a2 = _mm_unpacklo_epi16(w[2], w[3]);
+    __m128i a3 = _mm_unpackhi_epi16(w[2], w[3]);
+    __m128i a4 = _mm_unpacklo_epi16(w[4], w[5]);
+    __m128i a5 = _mm_unpackhi_epi16(w[4], w[5]);
+    __m128i a6 = _mm_unpacklo_epi16(w[6], w[7]);
+    __m128i a7 = _mm_unpackhi_epi16(w[6], w[7]);
+
+    __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+    __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+    __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+    __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+    __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+    __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+    __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+    __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+    w[0] = _mm_unpacklo_epi64(b0, b4);
+    w[1] = _mm_unpackhi_epi64(b0, b4);
+    w[2] = _mm_unpacklo_epi64(b1, b5);
+    w[3] = _mm_unpackhi_epi64(b1, b5);
+    w[4] = _mm_unpacklo_epi64(b2, b6);
+    w[5] = _mm_unpackhi_epi64(b2, b6);
+    w[6] = _mm_unpacklo_epi64(b3, b7);
+    w[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i extract_sse2(const __m128i w[SIMD_WORDS],
+                                   const struct word_field *wf)
+{
+    __m128i v;
+
+    if (wf->mask == 0)
+        return _mm_setzero_si128();
+
+    v = _mm_srl_epi16(w[wf->word], _mm_cvtsi32_si128((int)wf->shift));
+    if (wf->spill)
+        v = _mm_or_si128(v, _mm_sll_epi16(w[wf->word + 1],
+                                          _mm_cvtsi32_si128(16 - (int)wf->shift)));
+    return _mm_and_si128(v, _mm_set1_epi16((short)wf->mask));
+}
+
+__attribute__((target("sse2")))
+static size_t decode_sse2(const NVSHIELD_INPUT_LAYOUT *layout,
+                          const UCHAR *reports, size_t count,
+                          struct nvshield_input_batch *out)
+{
+    struct word_field buttons, hat, consumer;
+    __m128i w[SIMD_WORDS];
+    size_t n;
+    int i;
+
+    word_field(layout->Buttons, &buttons);
+    word_field(layout->Hat, &hat);
+    word_field(layout->Consumer, &consumer);
+
+    for (n = 0; n + 8 <= count; n += 8) {
+        for (i = 0; i < SIMD_WORDS; i++)
+            w[i] = _mm_loadu_si128((const __m128i *)(reports + (n + i) * SIMD_REPORT_SIZE));
+
+        transpose_8x16(w);
+
+        _mm_storeu_si128((__m128i *)&out->buttons[n], extract_sse2(w, &buttons));
+        _mm_storel_epi64((__m128i *)&out->hat[n],
+                         _mm_packus_epi16(extract_sse2(w, &hat), _mm_setzero_si128()));
+        _mm_storel_epi64((__m128i *)&out->consumer[n],
+                         _mm_packus_epi16(extract_sse2(w, &consumer), _mm_setzero_si128()));
+
+        for (i = 0; i < NvShieldAxisCount; i++) {
+            __m128i v = layout->Axes[i].BitSize ?
+                w[layout->Axes[i].BitOffset / 16] : _mm_setzero_si128();
+            _mm_storeu_si128((__m128i *)&out->axes[i][n], v);
+        }
+    }
+
+    return n;
+}
+
+/*
+ * AVX2: the low lane of register i holds report i, the high lane report
+ * i + 8, so the in-lane transpose leaves 16 consecutive reports' words in
+ * each register.
+ */
+
+__attribute__((target("avx2")))
+static inline void transpose_16x16(__m256i w[SIMD_WORDS])
+{
+    __m256i a0 = _mm256_unpacklo_epi16(w[0], w[1]);
+    __m256i a1 = _mm256_unpackhi_epi16(w[0], w[1]);
+    __m256i a2 = _mm256_unpacklo_epi16(w[2], w[3]);
+    __m256i a3 = _mm256_unpackhi_epi16(w[2], w[3]);
+    __m256i a4 = _mm256_unpacklo_epi16(w[4], w[5]);
+    __m256i a5 = _mm256_unpackhi_epi16(w[4], w[5]);
+    __m256i a6 = _mm256_unpacklo_epi16(w[6], w[7]);
+    __m256i a7 = _mm256_unpackhi_epi16(w[6], w[7]);
+
+    __m256i b0 = _mm256_unpacklo_epi32(a0, a2);
+    __m256i b1 = _mm256_unpackhi_epi32(a0, a2);
+    __m256i b2 = _mm256_unpacklo_epi32(a1, a3);
+    __m256i b3 = _mm256_unpackhi_epi32(a1, a3);
+    __m256i b4 = _mm256_unpacklo_epi32(a4, a6);
+    __m256i b5 = _mm256_unpackhi_epi32(a4, a6);
+    __m256i b6 = _mm256_unpacklo_epi32(a5, a7);
+    __m256i b7 = _mm256_unpackhi_epi32(a5, a7);
+
+    w[0] = _mm256_unpacklo_epi64(b0, b4);
+    w[1] = _mm256_unpackhi_epi64(b0, b4);
+    w[2] = _mm256_unpacklo_epi64(b1, b5);
+    w[3] = _mm256_unpackhi_epi64(b1, b5);
+    w[4] = _mm256_unpacklo_epi64(b2, b6);
+    w[5] = _mm256_unpackhi_epi64(b2, b6);
+    w[6] = _mm256_unpacklo_epi64(b3, b7);
+    w[7] = _mm256_unpackhi_epi64(b3, b7);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i extract_avx2(const __m256i w[SIMD_WORDS],
+                                   const struct word_field *wf)
+{
+    __m256i v;
+
+    if (wf->mask == 0)
+        return _mm256_setzero_si256();
+
+    v = _mm256_srl_epi16(w[wf->word], _mm_cvtsi32_si128((int)wf->shift));
+    if (wf->spill)
+        v = _mm256_or_si256(v, _mm256_sll_epi16(w[wf->word + 1],
+                                                _mm_cvtsi32_si128(16 - (int)wf->shift)));
+    return _mm256_and_si256(v, _mm256_set1_epi16((short)wf->mask));
+}
+
+__attribute__((target("avx2")))
+static inline void store_bytes_avx2(UCHAR *dst, __m256i v)
+{
+    /* packus works per lane: keep qwords 0 and 2 */
+    v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+    _mm_storeu_si128((__m128i *)dst, _mm256_castsi256_si128(v));
+}
+
+__attribute__((target("avx2")))
+static size_t decode_avx2(const NVSHIELD_INPUT_LAYOUT *layout,
+                          const UCHAR *reports, size_t count,
+                          struct nvshield_input_batch *out)
+{
+    struct word_field buttons, hat, consumer;
+    __m256i w[SIMD_WORDS];
+    size_t n;
+    int i;
+
+    word_field(layout->Buttons, &buttons);
+    word_field(layout->Hat, &hat);
+    word_field(layout->Consumer, &consumer);
+
+    for (n = 0; n + 16 <= count; n += 16) {
+        const UCHAR *src = reports + n * SIMD_REPORT_SIZE;
+
+        for (i = 0; i < SIMD_WORDS; i++)
+            w[i] = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + i * SIMD_REPORT_SIZE))),
+                _mm_loadu_si128((const __m128i *)(src + (i + 8) * SIMD_REPORT_SIZE)), 1);
+
+        transpose_16x16(w);
+
+        _mm256_storeu_si256((__m256i *)&out->buttons[n], extract_avx2(w, &buttons));
+        store_bytes_avx2(&out->hat[n], extract_avx2(w, &hat));
+        store_bytes_avx2(&out->consumer[n], extract_avx2(w, &consumer));
+
+        for (i = 0; i < NvShieldAxisCount; i++) {
+            __m256i v = layout->Axes[i].BitSize ?
+                w[layout->Axes[i].BitOffset / 16] : _mm256_setzero_si256();
+            _mm256_storeu_si256((__m256i *)&out->axes[i][n], v);
+        }
+    }
+
+    return n;
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+enum nvshield_batch_kernel
+nvshield_batch_init(struct nvshield_batch_decoder *dec,
+                    const NVSHIELD_INPUT_LAYOUT *layout,
+                    enum nvshield_batch_kernel kernel)
+{
+    dec->layout = *layout;
+    dec->kernel = NVSHIELD_BATCH_SCALAR;
+
+#ifdef HAVE_X86_KERNELS
+    if (!simd_layout(layout) || kernel == NVSHIELD_BATCH_SCALAR)
+        return dec->kernel;
+
+    __builtin_cpu_init();
+
+    if ((kernel == NVSHIELD_BATCH_AUTO || kernel == NVSHIELD_BATCH_AVX2) &&
+        __builtin_cpu_supports("avx2"))
+        dec->kernel = NVSHIELD_BATCH_AVX2;
+    else if (__builtin_cpu_supports("sse2"))
+        dec->kernel = NVSHIELD_BATCH_SSE2;
+#else
+    (void)simd_layout;
+    (void)kernel;
+#endif
+
+    return dec->kernel;
+}
+
+const char *nvshield_batch_kernel_name(enum nvshield_batch_kernel kernel)
+{
+    switch (kernel) {
+    case NVSHIELD_BATCH_SSE2:   return "sse2";
+    case NVSHIELD_BATCH_AVX2:   return "avx2";
+    case NVSHIELD_BATCH_SCALAR: return "scalar";
+    default:                    return "auto";
+    }
+}
+
+size_t nvshield_batch_decode(const struct nvshield_batch_decoder *dec,
+                             const UCHAR *reports, size_t count,
+                             struct nvshield_input_batch *out)
+{
+    size_t done = 0;
+
+    if (count > out->capacity)
+        count = out->capacity;
+
+#ifdef HAVE_X86_KERNELS
+    if (dec->kernel == NVSHIELD_BATCH_AVX2)
+        done = decode_avx2(&dec->layout, reports, count, out);
+    else if (dec->kernel == NVSHIELD_BATCH_SSE2)
+        done = decode_sse2(&dec->layout, reports, count, out);
+#endif
+
+    /* whatever is left over from the SIMD kernels */
+    decode_scalar(&dec->layout, reports, done, count, out);
+
+    return count;
+}
+
+int nvshield_batch_alloc(struct nvshield_input_batch *batch, size_t capacity)
+{
+    int i;
+
+    memset(batch, 0, sizeof(*batch));
+    batch->capacity = capacity;
+
+    batch->buttons = aligned_alloc(32, (capacity * sizeof(USHORT) + 31) & ~(size_t)31);
+    batch->hat = aligned_alloc(32, (capacity + 31) & ~(size_t)31);
+    batch->consumer = aligned_alloc(32, (capacity + 31) & ~(size_t)31);
+    for (i = 0; i < NvShieldAxisCount; i++)
+        batch->axes[i] = aligned_alloc(32, (capacity * sizeof(USHORT) + 31) & ~(size_t)31);
+
+    if (batch->buttons == NULL || batch->hat == NULL || batch->consumer == NULL)
+        goto fail;
+    for (i = 0; i < NvShieldAxisCount; i++) {
+        if (batch->axes[i] == NULL)
+            goto fail;
+    }
+    return 0;
+
+fail:
+    nvshield_batch_free(batch);
+    return -1;
+}
+
+void nvshield_batch_free(struct nvshield_input_batch *batch)
+{
+    int i;
+
+    free(batch->buttons);
+    free(batch->hat);
+    free(batch->consumer);
+    for (i = 0; i < NvShieldAxisCount; i++)
+        free(batch->axes[i]);
+    memset(batch, 0, sizeof(*batch));
+}
@@ -0,0 +1,61 @@
+/*
+ * nvshldbatch.h - decodes recorded gamepad input reports in bulk.
+ *
+ * Reports are read from a contiguous array, one every layout->ReportSize
+ * bytes, and decoded into one array per control (structure of arrays) so
+ * that analytics can sweep a single control over millions of reports.
+ * The layout comes from NvShieldGetInputLayout(); when it fits the SIMD
+ * kernels (16-byte reports, byte-aligned 16-bit axes) those are used,
+ * otherwise every report goes through NvShieldDecodeInputReport().
+ */
+#ifndef _NVSHLDBATCH_H_
+#define _NVSHLDBATCH_H_
+
+#include <stddef.h>
+
+#include "shield.h"
+
+enum nvshield_batch_kernel {
+    NVSHIELD_BATCH_AUTO,        /* best one the CPU and layout allow */
+    NVSHIELD_BATCH_SCALAR,
+    NVSHIELD_BATCH_SSE2,
+    NVSHIELD_BATCH_AVX2,
+};
+
+struct nvshield_input_batch {
+    size_t capacity;
+    USHORT *buttons;
+    UCHAR *hat;
+    UCHAR *consumer;
+    USHORT *axes[NvShieldAxisCount];
+};
+
+struct nvshield_batch_decoder {
+    NVSHIELD_INPUT_LAYOUT layout;
+    enum nvshield_batch_kernel kernel;
+};
+
+/*
+ * Picks the kernel for a layout: the requested one if the CPU and the
+ * layout support it, the scalar one otherwise. Returns the kernel picked.
+ */
+enum nvshield_batch_kernel
+nvshield_batch_init(struct nvshield_batch_decoder *dec,
+                    const NVSHIELD_INPUT_LAYOUT *layout,
+                    enum nvshield_batch_kernel kernel);
+
+const char *nvshield_batch_kernel_name(enum nvshield_batch_kernel kernel);
+
+/*
+ * Decodes up to out->capacity of the count reports. Every report must be
+ * the one the layout describes; the report ID isn't checked. Returns the
+ * number of reports decoded.
+ */
+size_t nvshield_batch_decode(const struct nvshield_batch_decoder *dec,
+                             const UCHAR *reports, size_t count,
+                             struct nvshield_input_batch *out);
+
+int nvshield_batch_alloc(struct nvshield_input_batch *batch, size_t capacity);
+void nvshield_batch_free(struct nvshield_input_batch *batch);
+
+#endif /* _NVSHLDBATCH_H_ */
@@ -0,0 +1,1271 @@
+/*
+ * nvshldbench.c - microbenchmarks of the hot paths of the shared core.
+ *
+ * Every case runs its operation in a tight loop and reports wall time,
+ * and, when perf_event is available, CPU cycles and retired instructions
+ * per operation. Results are printed as JSON on stdout so that they can
+ * be diffed between two builds. -c checks the rumble mixer against a
+ * reference model instead, and -d measures how the core scales over
+ * several controllers processed on as many threads.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include <linux/perf_event.h>
+
+#include "shield.h"
+#include "public.h"
+#include "nvshldbatch.h"
+#include "sim2017.h"
+
+#define DEFAULT_ITERATIONS  10000000UL
+#define DECODE_BATCH        256
+
+struct bench_ctx {
+    NVSHIELD_STATE state;
+    NVSHIELD_REPORT_CACHE cache;
+    UCHAR buf[4096];
+    ULONG len;
+    NVSHIELD_INPUT_LAYOUT layout;
+    NVSHIELD_REPORT_SIZES sizes;
+    UCHAR reports[DECODE_BATCH * NVSHIELD_INPUT_REPORT_SIZE];
+    struct nvshield_input_batch batch;
+    volatile ULONG sink;
+};
+
+struct bench_case {
+    const char *name;
+    void (*run)(struct bench_ctx *ctx, unsigned long iterations);
+};
+
+struct perf_counters {
+    int cycles_fd;
+    int instructions_fd;
+};
+
+/*
+ * Input reports
+ */
+
+static const UCHAR sample_report_01[NVSHIELD_INPUT_REPORT_SIZE] = {
+    0x01, 0x00, 0x00, 0x0F, 0x00, 0x80, 0x00, 0x80,
+    0x00, 0x80, 0x00, 0x80, 0x00, 0x00, 0x00, 0x00,
+};
+
+static const UCHAR sample_report_02[NVSHIELD_INPUT_REPORT_SIZE] = {
+    0x02, 0x08, 0x40, 0x00, 0x20, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static void bench_passthrough(struct bench_ctx *ctx, unsigned long n)
+{
+    while (n--) {
+        memcpy(ctx->buf, sample_report_01, sizeof(sample_report_01));
+        ctx->sink += NvShieldTransformInputReport(&ctx->state, ctx->buf,
+                                                  sizeof(sample_report_01));
+    }
+}
+
+static void bench_consumer_control(struct bench_ctx *ctx, unsigned long n)
+{
+    while (n--) {
+        memcpy(ctx->buf, sample_report_01, sizeof(sample_report_01));
+        ctx->buf[2] = (n & 1) ? 0x08 : 0x10;   /* volume up/down */
+        ctx->sink += NvShieldTransformInputReport(&ctx->state, ctx->buf,
+                                                  sizeof(sample_report_01));
+    }
+}
+
+static void bench_trackpad(struct bench_ctx *ctx, unsigned long n)
+{
+    while (n--) {
+        memcpy(ctx->buf, sample_report_02, sizeof(sample_report_02));
+        ctx->buf[2] = (UCHAR)n;
+        ctx->buf[4] = (UCHAR)(n >> 1);
+        ctx->sink += NvShieldTransformInputReport(&ctx->state, ctx->buf,
+                                                  sizeof(sample_report_02));
+    }
+}
+
+/*
+ * Mixed traffic, as a 2015 controller in use sends it: mostly gamepad
+ * reports that go up untouched, some trackpad reports, a volume key
+ * press and release, and reports of IDs no rewrite is registered for.
+ * Dispatched through the handler table of the core, and through the
+ * chain of tests on the report ID it replaced, kept below as it was.
+ */
+
+#define DISPATCH_MIX    16
+
+/* Out of line, as it was in shield.c */
+static __attribute__((noinline)) ULONG
+chain_transform(NVSHIELD_STATE *state, PUCHAR buf, ULONG length)
+{
+    const NVSHIELD_MODEL *model = state->model;
+
+    if (buf == NULL || length < 2 || buf[0] == 0)
+        return length;
+
+    if (buf[0] == model->GamepadReportId && model->ConsumerReportId != 0
+        && length > model->ConsumerByte) {
+        UCHAR cc = buf[model->ConsumerByte] & model->ConsumerMask;
+
+        if (state->lastCCState != cc) {
+            buf[0] = model->ConsumerReportId;
+            buf[1] = state->lastCCState = cc;
+            return 2;
+        }
+    } else if (buf[0] == model->TrackpadReportId && length >= 6) {
+        UCHAR x = buf[2], y = buf[4];
+        SHORT *dx = (SHORT *)&buf[2], *dy = (SHORT *)&buf[4];
+
+        state->trackpadButtons = buf[1] & 0x0F;
+
+        if (buf[1] & 0x08) {
+            if (state->isTrackpadPressed) {
+                SHORT sx = (SHORT)x - (SHORT)state->origX;
+                SHORT sy = ((SHORT)y - (SHORT)state->origY) * 2;
+
+                *dx = (sx > 0 ? sx : -sx) * sx;
+                *dy = (sy > 0 ? sy : -sy) * sy;
+            } else {
+                state->isTrackpadPressed = TRUE;
+                *dx = 0;
+                *dy = 0;
+            }
+            state->origX = x;
+            state->origY = y;
+        } else {
+            state->isTrackpadPressed = FALSE;
+            *dx = 0;
+            *dy = 0;
+        }
+    }
+
+    return length;
+}
+
+static void dispatch_mix(UCHAR mix[DISPATCH_MIX][NVSHIELD_INPUT_REPORT_SIZE])
+{
+    static const UCHAR other_ids[] = { 0x03, 0x1E, 0xFD };
+    unsigned i;
+
+    for (i = 0; i < DISPATCH_MIX; i++) {
+        memcpy(mix[i], sample_report_01, NVSHIELD_INPUT_REPORT_SIZE);
+        mix[i][5] = (UCHAR)i;
+    }
+    memcpy(mix[3], sample_report_02, NVSHIELD_INPUT_REPORT_SIZE);
+    memcpy(mix[11], sample_report_02, NVSHIELD_INPUT_REPORT_SIZE);
+    mix[6][2] = 0x08;                   /* volume up */
+    for (i = 0; i < sizeof(other_ids); i++)
+        mix[8 + 2 * i][0] = other_ids[i];
+}
+
+static void bench_dispatch(struct bench_ctx *ctx, unsigned long n, int table)
+{
+    UCHAR mix[DISPATCH_MIX][NVSHIELD_INPUT_REPORT_SIZE];
+    UCHAR *report;
+
+    dispatch_mix(mix);
+
+    while (n--) {
+        report = mix[n % DISPATCH_MIX];
+        memcpy(ctx->buf, report, NVSHIELD_INPUT_REPORT_SIZE);
+        if (table)
+            ctx->sink += NvShieldTransformInputReport(&ctx->state, ctx->buf,
+                                                      NVSHIELD_INPUT_REPORT_SIZE);
+        else
+            ctx->sink += chain_transform(&ctx->state, ctx->buf,
+                                         NVSHIELD_INPUT_REPORT_SIZE);
+    }
+}
+
+static void bench_dispatch_table(struct bench_ctx *ctx, unsigned long n)
+{
+    bench_dispatch(ctx, n, 1);
+}
+
+static void bench_dispatch_chain(struct bench_ctx *ctx, unsigned long n)
+{
+    bench_dispatch(ctx, n, 0);
+}
+
+/*
+ * A transfer packing a gamepad, a trackpad and a gamepad report, the last
+ * one pressing a volume key on every other transfer
+ */
+static void bench_transfer_split(struct bench_ctx *ctx, unsigned long n)
+{
+    UCHAR transfer[2 * NVSHIELD_INPUT_REPORT_SIZE + NVSHIELD_INPUT_REPORT_SIZE];
+    ULONG len = 0, last;
+
+    memcpy(transfer, sample_report_01, sizeof(sample_report_01));
+    len += sizeof(sample_report_01);
+    memcpy(transfer + len, sample_report_02, ctx->sizes.Input[0x02]);
+    len += ctx->sizes.Input[0x02];
+    last = len;
+    memcpy(transfer + len, sample_report_01, sizeof(sample_report_01));
+    len += sizeof(sample_report_01);
+
+    while (n--) {
+        memcpy(ctx->buf, transfer, len);
+        ctx->buf[last + 2] = (n & 1) ? 0x08 : 0x00;     /* volume up */
+        ctx->sink += NvShieldTransformInputTransfer(&ctx->state, &ctx->sizes,
+                                                    ctx->buf, len, NULL, NULL);
+    }
+}
+
+/*
+ * Three stages reading the gamepad controls of every report, as the
+ * mouse emulation, shared state and condition effects do, then the
+ * rewrite: sharing one decode through NvShieldInputGamepad, as the input
+ * pipeline runs them, and each decoding the report on its own, as they
+ * did before it.
+ */
+
+static ULONG bench_stage(const NVSHIELD_GAMEPAD_STATE *gamepad, unsigned axis)
+{
+    return gamepad != NULL ? gamepad->Axes[axis] + gamepad->Buttons : 0;
+}
+
+static void bench_stages_fused(struct bench_ctx *ctx, unsigned long n)
+{
+    NVSHIELD_INPUT input;
+
+    while (n--) {
+        memcpy(ctx->buf, sample_report_01, sizeof(sample_report_01));
+        ctx->buf[5] = (UCHAR)n;
+        NvShieldInputInit(&input, &ctx->layout, ctx->buf, sizeof(sample_report_01));
+
+        ctx->sink += bench_stage(NvShieldInputGamepad(&input), NvShieldAxisZ);
+        ctx->sink += bench_stage(NvShieldInputGamepad(&input), NvShieldAxisRx);
+        ctx->sink += bench_stage(NvShieldInputGamepad(&input), NvShieldAxisX);
+        ctx->sink += NvShieldTransformInputReport(&ctx->state, input.Report, input.Length);
+    }
+}
+
+static void bench_stages_separate(struct bench_ctx *ctx, unsigned long n)
+{
+    NVSHIELD_GAMEPAD_STATE gamepad;
+    unsigned axis, i;
+
+    while (n--) {
+        memcpy(ctx->buf, sample_report_01, sizeof(sample_report_01));
+        ctx->buf[5] = (UCHAR)n;
+
+        for (i = 0; i < 3; i++) {
+            axis = i == 0 ? NvShieldAxisZ : i == 1 ? NvShieldAxisRx : NvShieldAxisX;
+            ctx->sink += bench_stage(NvShieldDecodeInputReport(&ctx->layout, ctx->buf,
+                                         sizeof(sample_report_01), &gamepad) ? &gamepad : NULL,
+                                     axis);
+        }
+        ctx->sink += NvShieldTransformInputReport(&ctx->state, ctx->buf,
+                                                  sizeof(sample_report_01));
+    }
+}
+
+/*
+ * The Calibrate stage on a left stick jittering around a drifted rest,
+ * the tables rebuilt in line whenever the estimate asks for it
+ */
+static void bench_calibrate(struct bench_ctx *ctx, unsigned long n)
+{
+    static NVSHIELD_CONFIG config;
+    NVSHIELD_AXIS_CALIBRATION calibration[NVSHIELD_CALIBRATION_AXES];
+    NVSHIELD_SETTINGS settings;
+    NVSHIELD_INPUT input;
+
+    NvShieldDefaultSettings(&settings);
+    settings.Calibrate = 1;
+    NvShieldCompileConfig(&config, ctx->state.model, &settings, ctx->state.calibration);
+    ctx->state.config = &config;
+
+    while (n--) {
+        memcpy(ctx->buf, sample_report_01, sizeof(sample_report_01));
+        ctx->buf[4] = (UCHAR)(n & 0x3F);
+        ctx->buf[5] = 0x86;
+        NvShieldInputInit(&input, &ctx->layout, ctx->buf, sizeof(sample_report_01));
+
+        if (NvShieldCalibrateInput(&ctx->state, &input)) {
+            NvShieldTakeCalibration(&ctx->state, calibration);
+            NvShieldCompileConfig(&config, ctx->state.model, &settings, calibration);
+        }
+        ctx->sink += input.Report[5];
+    }
+
+    ctx->state.config = &ctx->state.defaultConfig;
+}
+
+/*
+ * The unchanged report check on a controller at rest, a stick moving
+ * every 64 reports, the keep-alive set long enough to hold back the rest
+ */
+static void bench_unchanged(struct bench_ctx *ctx, unsigned long n)
+{
+    static NVSHIELD_CONFIG config;
+    NVSHIELD_SETTINGS settings;
+
+    NvShieldDefaultSettings(&settings);
+    settings.InputKeepAlive = NVSHIELD_INPUT_KEEPALIVE_MAX;
+    NvShieldCompileConfig(&config, ctx->state.model, &settings, ctx->state.calibration);
+    ctx->state.config = &config;
+
+    while (n--) {
+        memcpy(ctx->buf, sample_report_01, sizeof(sample_report_01));
+        ctx->buf[4] = (UCHAR)((n >> 6) & 0x3F);
+        ctx->sink += NvShieldInputUnchanged(&ctx->state, ctx->buf,
+                                            sizeof(sample_report_01), 0);
+    }
+
+    ctx->state.config = &ctx->state.defaultConfig;
+}
+
+/*
+ * Decoding recorded 0x01 reports, one operation per report
+ */
+
+static void bench_decode_scalar(struct bench_ctx *ctx, unsigned long n)
+{
+    NVSHIELD_GAMEPAD_STATE state;
+
+    while (n--) {
+        NvShieldDecodeInputReport(&ctx->layout,
+            &ctx->reports[(n % DECODE_BATCH) * NVSHIELD_INPUT_REPORT_SIZE],
+            NVSHIELD_INPUT_REPORT_SIZE, &state);
+        ctx->sink += state.Buttons + state.Axes[NvShieldAxisRx];
+    }
+}
+
+static void bench_decode_batch(struct bench_ctx *ctx, unsigned long n,
+                               enum nvshield_batch_kernel kernel)
+{
+    struct nvshield_batch_decoder dec;
+    size_t count;
+
+    nvshield_batch_init(&dec, &ctx->layout, kernel);
+
+    while (n) {
+        count = n < DECODE_BATCH ? n : DECODE_BATCH;
+        nvshield_batch_decode(&dec, ctx->reports, count, &ctx->batch);
+        ctx->sink += ctx->batch.buttons[count - 1] + ctx->batch.axes[NvShieldAxisRx][0];
+        n -= count;
+    }
+}
+
+static void bench_decode_batch_scalar(struct bench_ctx *ctx, unsigned long n)
+{
+    bench_decode_batch(ctx, n, NVSHIELD_BATCH_SCALAR);
+}
+
+static void bench_decode_batch_sse2(struct bench_ctx *ctx, unsigned long n)
+{
+    bench_decode_batch(ctx, n, NVSHIELD_BATCH_SSE2);
+}
+
+static void bench_decode_batch_avx2(struct bench_ctx *ctx, unsigned long n)
+{
+    bench_decode_batch(ctx, n, NVSHIELD_BATCH_AVX2);
+}
+
+/*
+ * Descriptors
+ */
+
+static void bench_descriptor(struct bench_ctx *ctx, unsigned long n)
+{
+    static const UCHAR config[NVSHIELD_CONFIG_DESCRIPTOR_SIZE] = {
+        0x09, 0x02, 0x22, 0x00, 0x01, 0x01, 0x00, 0xA0, 0xFA,
+        0x09, 0x04, 0x00, 0x00, 0x01, 0x03, 0x00, 0x00, 0x00,
+        0x09, 0x21, 0x11, 0x01, 0x00, 0x01, 0x22, 0xF1, 0x00,
+        0x07, 0x05, 0x81, 0x03, 0x10, 0x00, 0x01,
+    };
+
+    while (n--) {
+        memcpy(ctx->buf, config, sizeof(config));
+        ctx->sink += NvShieldPatchHidDescriptor(ctx->buf, sizeof(config),
+                                                G_DefaultReportDescriptorLength);
+        memcpy(ctx->buf, G_DefaultReportDescriptor,
+               G_DefaultReportDescriptorLength);
+        ctx->sink += ctx->buf[n % G_DefaultReportDescriptorLength];
+    }
+}
+
+/*
+ * Walks the descriptor of a PID profile the way a HID parser does,
+ * counting the data fields it declares. The descriptor is built once, as
+ * the driver does when the controller is added.
+ */
+static void bench_descriptor_profile(struct bench_ctx *ctx, unsigned long n,
+                                     NVSHIELD_PID_PROFILE profile)
+{
+    NVSHIELD_HID_ITEM item;
+    ULONG offset;
+
+    ctx->len = NvShieldBuildReportDescriptor(NvShieldPidProfileEffects(profile),
+                                             ctx->buf, sizeof(ctx->buf));
+
+    while (n--) {
+        offset = 0;
+        while (NvShieldHidNextItem(ctx->buf, ctx->len, &offset, &item)) {
+            if (item.Type == NVSHIELD_HID_ITEM_MAIN &&
+                (item.Tag == NVSHIELD_HID_TAG_INPUT ||
+                 item.Tag == NVSHIELD_HID_TAG_OUTPUT ||
+                 item.Tag == NVSHIELD_HID_TAG_FEATURE))
+                ctx->sink++;
+        }
+    }
+}
+
+static void bench_descriptor_full(struct bench_ctx *ctx, unsigned long n)
+{
+    bench_descriptor_profile(ctx, n, NvShieldPidProfileFull);
+}
+
+static void bench_descriptor_rumble(struct bench_ctx *ctx, unsigned long n)
+{
+    bench_descriptor_profile(ctx, n, NvShieldPidProfileRumble);
+}
+
+static void bench_descriptor_constant(struct bench_ctx *ctx, unsigned long n)
+{
+    bench_descriptor_profile(ctx, n, NvShieldPidProfileConstant);
+}
+
+/*
+ * The descriptor of a 2017 controller patched with the full PID profile,
+ * as the driver does once per controller, on the stand-in of sim2017.h.
+ */
+static void bench_descriptor_2017(struct bench_ctx *ctx, unsigned long n)
+{
+    const NVSHIELD_MODEL *model = NvShieldFindModel(NVSHIELD_PRODUCT_ID_2017);
+    ULONG effects = NvShieldPidProfileEffects(NvShieldPidProfileFull);
+    UCHAR id_map[256];
+
+    while (n--) {
+        ctx->len = NvShieldPatchReportDescriptor(model, effects, sim_2017_descriptor,
+                                                 sizeof(sim_2017_descriptor),
+                                                 ctx->buf, sizeof(ctx->buf), id_map);
+        ctx->sink += ctx->len;
+    }
+}
+
+/*
+ * Force feedback
+ */
+
+/* Creates and starts effect blocks 1 to count, spread around the compass */
+static void bench_effects(NVSHIELD_STATE *state, ULONG count)
+{
+    UCHAR report[13];
+    ULONG i;
+
+    for (i = 0; i < count; i++) {
+        report[0] = 0x09;
+        report[1] = NvShieldEffectConstant;
+        NvShieldSetReport(state, 0x0309, report, 2);
+
+        memset(report, 0, sizeof(report));
+        report[0] = 0x21;
+        report[1] = (UCHAR)(i + 1);
+        report[2] = NvShieldEffectConstant;
+        report[3] = 0xFF;
+        report[4] = 0x7F;
+        report[9] = 0xFF;
+        report[11] = NVSHIELD_EFFECT_AXIS_X | NVSHIELD_EFFECT_AXIS_Y | NVSHIELD_EFFECT_POLAR;
+        report[12] = (UCHAR)(i * 256 / count);
+        NvShieldSetReport(state, 0x0221, report, sizeof(report));
+
+        report[0] = 0x05;
+        report[2] = 0x80;
+        report[3] = 0x00;
+        NvShieldSetReport(state, 0x0205, report, 4);
+
+        report[0] = 0x0A;
+        report[2] = 1;
+        report[3] = 1;
+        NvShieldSetReport(state, 0x020A, report, 4);
+    }
+}
+
+static void bench_rumble_report(struct bench_ctx *ctx, unsigned long n)
+{
+    bench_effects(&ctx->state, 2);
+
+    while (n--) {
+        ctx->state.effects[0].magnitude = (SHORT)(n & 0xFF);
+        ctx->state.effects[1].magnitude = (SHORT)((n >> 3) & 0xFF);
+        ctx->sink += NvShieldBuildRumbleReport(&ctx->state, ctx->buf);
+    }
+}
+
+static void bench_rumble_mix(struct bench_ctx *ctx, unsigned long n)
+{
+    USHORT left, right;
+
+    bench_effects(&ctx->state, NVSHIELD_MAX_EFFECTS);
+
+    while (n--) {
+        ctx->state.effects[n % NVSHIELD_MAX_EFFECTS].magnitude = (SHORT)(n & 0x1FF) - 255;
+        NvShieldMixRumble(&ctx->state, &left, &right);
+        ctx->sink += left + right;
+    }
+}
+
+/* A custom force of 12 samples played every ms, ticked once per sample */
+static void bench_custom_tick(struct bench_ctx *ctx, unsigned long n)
+{
+    static const UCHAR create[] = { 0x09, NvShieldEffectCustom };
+    static const UCHAR data[] = { 0x07, 0x01, 0x00, 0x00,
+        127, 96, 64, 32, 0, 0xE0, 0xC0, 0xA0, 0x81, 0, 64, 0 };
+    static const UCHAR custom[] = { 0x0E, 0x01, 12, 0x01, 0x00 };
+    static const UCHAR start[] = { 0x0A, 0x01, 0x01, 0xFF };
+    ULONGLONG now = 1;
+
+    NvShieldSetReport(&ctx->state, 0x0309, create, sizeof(create));
+    NvShieldSetReport(&ctx->state, 0x0207, data, sizeof(data));
+    NvShieldSetReport(&ctx->state, 0x020E, custom, sizeof(custom));
+    NvShieldSetReport(&ctx->state, 0x020A, start, sizeof(start));
+    NvShieldRumbleExpiry(&ctx->state, now, 0);
+
+    while (n--) {
+        now = NvShieldEffectNextTick(&ctx->state);
+        if (NvShieldEffectTick(&ctx->state, now))
+            ctx->sink += NvShieldBuildRumbleReport(&ctx->state, ctx->buf);
+    }
+}
+
+/* A spring and a damper on both axes, fed a stick swinging every report */
+static void bench_condition(struct bench_ctx *ctx, unsigned long n)
+{
+    static const UCHAR types[] = { NvShieldEffectSpring, NvShieldEffectDamper };
+    UCHAR report[13];
+    ULONGLONG now = 1;
+    size_t i;
+
+    for (i = 0; i < sizeof(types); i++) {
+        report[0] = 0x09;
+        report[1] = types[i];
+        NvShieldSetReport(&ctx->state, 0x0309, report, 2);
+
+        memset(report, 0, sizeof(report));
+        report[0] = 0x21;
+        report[1] = (UCHAR)(i + 1);
+        report[2] = types[i];
+        report[9] = 0xFF;
+        report[11] = NVSHIELD_EFFECT_AXIS_X | NVSHIELD_EFFECT_AXIS_Y;
+        NvShieldSetReport(&ctx->state, 0x0221, report, sizeof(report));
+
+        report[0] = 0x03;
+        report[3] = 0;
+        report[4] = report[5] = 100;
+        report[6] = report[7] = 0xFF;
+        report[8] = 8;
+        for (report[2] = 0; report[2] < NVSHIELD_CONDITION_AXES; report[2]++)
+            NvShieldSetReport(&ctx->state, 0x0203, report, 9);
+
+        report[0] = 0x0A;
+        report[2] = 1;
+        report[3] = 0xFF;
+        NvShieldSetReport(&ctx->state, 0x020A, report, 4);
+    }
+
+    while (n--) {
+        now += 1000;
+        if (NvShieldConditionPlaying(&ctx->state)
+            && NvShieldConditionUpdate(&ctx->state, (USHORT)(n << 9), (USHORT)(n << 10), now))
+            ctx->sink += NvShieldBuildRumbleReport(&ctx->state, ctx->buf);
+    }
+}
+
+static void bench_pid(struct bench_ctx *ctx, unsigned long n,
+                      USHORT value, const UCHAR *report, ULONG len)
+{
+    bench_effects(&ctx->state, 1);
+
+    while (n--)
+        ctx->sink += NvShieldSetReport(&ctx->state, value, report, len);
+}
+
+static void bench_pid_0205(struct bench_ctx *ctx, unsigned long n)
+{
+    static const UCHAR report[] = { 0x05, 0x01, 0x80, 0x00 };
+    bench_pid(ctx, n, 0x0205, report, sizeof(report));
+}
+
+static void bench_pid_020A(struct bench_ctx *ctx, unsigned long n)
+{
+    static const UCHAR report[] = { 0x0A, 0x01, 0x01, 0x00 };
+    bench_pid(ctx, n, 0x020A, report, sizeof(report));
+}
+
+static void bench_pid_020C(struct bench_ctx *ctx, unsigned long n)
+{
+    static const UCHAR report[] = { 0x0C, 0x03 };
+    bench_pid(ctx, n, 0x020C, report, sizeof(report));
+}
+
+static void bench_pid_020D(struct bench_ctx *ctx, unsigned long n)
+{
+    static const UCHAR report[] = { 0x0D, 0xFF };
+    bench_pid(ctx, n, 0x020D, report, sizeof(report));
+}
+
+/*
+ * Reference model of the rumble mixer, for -c: random PID reports go
+ * through both the core and a plain restatement of the mixing rules,
+ * in 64-bit arithmetic with the panning computed by libm, and the motor
+ * strengths must agree bit for bit.
+ */
+
+struct ref_effect {
+    int type, gain, axes, direction, magnitude, playing;
+    int count;
+    int samples[NVSHIELD_CUSTOM_SAMPLES];
+};
+
+struct ref_model {
+    struct ref_effect effects[NVSHIELD_MAX_EFFECTS];
+    int loaded, custom, gain, enabled, paused;
+};
+
+static long long ref_clamp(long long v, long long lo, long long hi)
+{
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+static struct ref_effect *ref_block(struct ref_model *m, int index)
+{
+    if (index < 1 || index > NVSHIELD_MAX_EFFECTS || m->effects[index - 1].type == 0)
+        return NULL;
+    return &m->effects[index - 1];
+}
+
+static void ref_set_report(struct ref_model *m, USHORT value, const UCHAR *r, ULONG len)
+{
+    struct ref_effect *e;
+    int i;
+
+    switch (value) {
+    case 0x0309:
+        m->loaded = 0;
+        if (r[1] < 1 || r[1] >= NvShieldEffectTypeCount)
+            break;
+        for (i = 0; i < NVSHIELD_MAX_EFFECTS && m->effects[i].type != 0; i++)
+            ;
+        if (i < NVSHIELD_MAX_EFFECTS) {
+            memset(&m->effects[i], 0, sizeof(m->effects[i]));
+            m->effects[i].type = r[1];
+            m->effects[i].gain = 255;
+            m->loaded = i + 1;
+            if (r[1] == NvShieldEffectCustom)
+                m->custom = i + 1;
+        }
+        break;
+    case 0x020B:
+        if ((e = ref_block(m, r[1])) != NULL)
+            memset(e, 0, sizeof(*e));
+        if (m->custom == r[1])
+            m->custom = 0;
+        break;
+    case 0x020C:
+        if (r[1] == 1 || r[1] == 2)
+            m->enabled = r[1] == 1;
+        else if (r[1] == 3 || r[1] == 4)
+            for (i = 0; i < NVSHIELD_MAX_EFFECTS; i++)
+                if (r[1] == 3)
+                    m->effects[i].playing = 0;
+                else
+                    memset(&m->effects[i], 0, sizeof(m->effects[i])), m->custom = 0;
+        else if (r[1] == 5 || r[1] == 6)
+            m->paused = r[1] == 5;
+        if (r[1] == 4)
+            m->enabled = 1, m->paused = 0;
+        break;
+    case 0x020D:
+        m->gain = r[1];
+        break;
+    case 0x0205:
+        if ((e = ref_block(m, r[1])) != NULL)
+            e->magnitude = (int)ref_clamp((int16_t)(r[2] | r[3] << 8), -255, 255);
+        break;
+    case 0x0204:
+        if ((e = ref_block(m, r[1])) != NULL)
+            e->magnitude = r[2];
+        break;
+    case 0x0206:
+        if ((e = ref_block(m, r[1])) != NULL) {
+            int start = (int8_t)r[2], end = (int8_t)r[3];
+            e->magnitude = (int)ref_clamp(2 * (abs(start) > abs(end) ? start : end), -255, 255);
+        }
+        break;
+    case 0x0207:
+        if ((e = ref_block(m, r[1])) == NULL)
+            break;
+        m->custom = r[1];
+        for (i = 0; i < (int)len - 4 && (r[2] | r[3] << 8) + i < NVSHIELD_CUSTOM_SAMPLES; i++)
+            e->samples[(r[2] | r[3] << 8) + i] = (int8_t)r[4 + i];
+        if ((r[2] | r[3] << 8) + i > e->count)
+            e->count = (r[2] | r[3] << 8) + i;
+        break;
+    case 0x0208:
+        if ((e = ref_block(m, m->custom)) != NULL && e->count < NVSHIELD_CUSTOM_SAMPLES)
+            e->samples[e->count++] = abs((int8_t)r[1]) > abs((int8_t)r[2]) ? (int8_t)r[1] : (int8_t)r[2];
+        break;
+    case 0x020E:
+        if ((e = ref_block(m, r[1])) != NULL)
+            m->custom = r[1], e->count = r[2];
+        break;
+    case 0x0221:
+        if ((e = ref_block(m, r[1])) == NULL)
+            break;
+        if (r[2] >= 1 && r[2] < NvShieldEffectTypeCount)
+            e->type = r[2];
+        e->gain = r[9];
+        e->axes = r[11] & 7;
+        e->direction = r[12];
+        break;
+    case 0x020A:
+        if ((e = ref_block(m, r[1] & 0x7F)) == NULL)
+            break;
+        if (r[2] == 2)
+            for (i = 0; i < NVSHIELD_MAX_EFFECTS; i++)
+                m->effects[i].playing = 0;
+        if (r[2] == 1 || r[2] == 2) {
+            e->playing = 1;
+            if (e->type == NvShieldEffectCustom)
+                e->magnitude = e->count != 0 ? 2 * e->samples[0] : 0;
+            else if (e->type >= NvShieldEffectSpring && e->type <= NvShieldEffectFriction)
+                e->magnitude = 0;
+        } else if (r[2] == 3)
+            e->playing = 0;
+        break;
+    }
+}
+
+static long long ref_pan(int direction)
+{
+    /* share of the left motor, in 1/32768 */
+    double s = sin(2 * M_PI * direction / 256);
+
+    return s <= 0 ? 32768 : llround(32768 * (1 - s));
+}
+
+static void ref_mix(const struct ref_model *m, long long *left, long long *right)
+{
+    long long l = 0, r = 0;
+    int i;
+
+    for (i = 0; m->enabled && !m->paused && i < NVSHIELD_MAX_EFFECTS; i++) {
+        const struct ref_effect *e = &m->effects[i];
+        long long level = (long long)abs(e->magnitude) * e->gain;
+        int direction = e->magnitude < 0 ? (e->direction + 128) % 256 : e->direction;
+
+        if (!e->playing)
+            continue;
+
+        if (e->axes & NVSHIELD_EFFECT_POLAR) {
+            l += level * ref_pan(direction) / 32768;
+            r += level * ref_pan((256 - direction) % 256) / 32768;
+        } else if (!(e->axes & (NVSHIELD_EFFECT_AXIS_X | NVSHIELD_EFFECT_AXIS_Y))) {
+            l += level;
+            r += level;
+        } else {
+            l += e->axes & NVSHIELD_EFFECT_AXIS_X ? level : 0;
+            r += e->axes & NVSHIELD_EFFECT_AXIS_Y ? level : 0;
+        }
+    }
+
+    *left = ref_clamp(l * m->gain / 255, 0, 0xFFFF);
+    *right = ref_clamp(r * m->gain / 255, 0, 0xFFFF);
+}
+
+static int check_mixer(unsigned long iterations)
+{
+    static const USHORT values[] = {
+        0x0309, 0x0309, 0x020B, 0x020C, 0x020D, 0x0205, 0x0205,
+        0x0204, 0x0206, 0x0221, 0x0221, 0x020A, 0x020A, 0x020A,
+        0x0207, 0x0208, 0x020E, 0x0203,
+    };
+    NVSHIELD_STATE state;
+    struct ref_model model;
+    UCHAR report[16];
+    USHORT left, right;
+    long long refLeft, refRight;
+    unsigned long i;
+    size_t j;
+
+    NvShieldInitState(&state);
+    memset(&model, 0, sizeof(model));
+    model.gain = 255;
+    model.enabled = 1;
+    srand(2);
+
+    for (i = 0; i < iterations; i++) {
+        USHORT value = values[rand() % (sizeof(values) / sizeof(values[0]))];
+
+        for (j = 0; j < sizeof(report); j++)
+            report[j] = (UCHAR)rand();
+        report[0] = (UCHAR)value;
+
+        /* mostly blocks that exist, operations and controls that do something */
+        report[1] = value == 0x0309 ? (UCHAR)(rand() % (NvShieldEffectTypeCount + 1))
+                  : value == 0x020C ? (UCHAR)(rand() % 7 + 1)
+                  : value == 0x020D || value == 0x0208 ? report[1]
+                  : (UCHAR)(rand() % (NVSHIELD_MAX_EFFECTS + 2));
+        if (value == 0x020A)
+            report[2] = (UCHAR)(rand() % 4 + 1);
+        if (value == 0x0207)
+            report[3] = (UCHAR)(rand() % 2);
+
+        NvShieldSetReport(&state, value, report, sizeof(report));
+        ref_set_report(&model, value, report, sizeof(report));
+
+        NvShieldMixRumble(&state, &left, &right);
+        ref_mix(&model, &refLeft, &refRight);
+
+        if (left != refLeft || right != refRight) {
+            fprintf(stderr, "mixer mismatch after report %lu (%04X): %u/%u, reference %lld/%lld\n",
+                    i, value, left, right, refLeft, refRight);
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "mixer matches the reference model over %lu reports\n", iterations);
+    return 0;
+}
+
+/*
+ * Mouse emulation, one timer period each
+ */
+
+static void bench_mouse_tick(struct bench_ctx *ctx, unsigned long n)
+{
+    ctx->state.mouseCurve = NvShieldMouseNormal;
+
+    while (n--) {
+        if (NvShieldMouseTick(&ctx->state, (USHORT)(0xC000 + (n & 0xFFF)), 0x6000))
+            ctx->sink += NvShieldBuildMouseReport(&ctx->state, ctx->buf);
+    }
+
+    ctx->state.mouseCurve = NvShieldMouseOff;
+}
+
+/*
+ * GET_REPORT cache
+ */
+
+static void bench_report_cache_hit(struct bench_ctx *ctx, unsigned long n)
+{
+    static const UCHAR report[] = { 0xFC, 0x01, 0x02, 0x03, 0x04, 0x05 };
+    ULONG len;
+
+    NvShieldReportCacheInit(&ctx->cache);
+    NvShieldReportCacheStore(&ctx->cache, 0x03FC, report, sizeof(report), 0);
+
+    while (n--) {
+        len = sizeof(ctx->buf);
+        ctx->sink += NvShieldReportCacheLookup(&ctx->cache, 0x03FC, ctx->buf,
+                                               &len, 1);
+    }
+}
+
+/*
+ * Latency histograms, spread over a few ms as interrupt IN requests are
+ */
+
+static void bench_latency_record(struct bench_ctx *ctx, unsigned long n)
+{
+    static NVSHIELD_LATENCY_HISTOGRAM histogram;
+
+    while (n--)
+        NvShieldLatencyRecord(&histogram, (n * 2654435761UL) & 0x1FFF);
+
+    ctx->sink += NvShieldLatencyPercentile(&histogram, 999);
+}
+
+static const struct bench_case cases[] = {
+    { "input_passthrough_01",             bench_passthrough },
+    { "input_consumer_control",           bench_consumer_control },
+    { "input_trackpad",                   bench_trackpad },
+    { "input_transfer_split",             bench_transfer_split },
+    { "input_dispatch_mixed_table",       bench_dispatch_table },
+    { "input_dispatch_mixed_chain",       bench_dispatch_chain },
+    { "input_stages_fused",               bench_stages_fused },
+    { "input_stages_separate",            bench_stages_separate },
+    { "input_calibrate",                  bench_calibrate },
+    { "input_unchanged",                  bench_unchanged },
+    { "input_decode_scalar",              bench_decode_scalar },
+    { "input_decode_batch_scalar",        bench_decode_batch_scalar },
+    { "input_decode_batch_sse2",          bench_decode_batch_sse2 },
+    { "input_decode_batch_avx2",          bench_decode_batch_avx2 },
+    { "descriptor_patch_copy",            bench_descriptor },
+    { "descriptor_parse_full",            bench_descriptor_full },
+    { "descriptor_parse_rumble",          bench_descriptor_rumble },
+    { "descriptor_parse_constant",        bench_descriptor_constant },
+    { "descriptor_patch_2017",            bench_descriptor_2017 },
+    { "rumble_report",                    bench_rumble_report },
+    { "rumble_mix_16",                    bench_rumble_mix },
+    { "rumble_custom_tick",               bench_custom_tick },
+    { "rumble_condition_input",           bench_condition },
+    { "pid_set_report_0205",              bench_pid_0205 },
+    { "pid_set_report_020A",              bench_pid_020A },
+    { "pid_set_report_020C",              bench_pid_020C },
+    { "pid_set_report_020D",              bench_pid_020D },
+    { "mouse_tick",                       bench_mouse_tick },
+    { "report_cache_hit",                 bench_report_cache_hit },
+    { "latency_record",                   bench_latency_record },
+};
+
+/*
+ * perf_event plumbing
+ */
+
+static int perf_open(__u64 config, int group_fd)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = group_fd < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static void perf_init(struct perf_counters *pc)
+{
+    pc->cycles_fd = perf_open(PERF_COUNT_HW_CPU_CYCLES, -1);
+    pc->instructions_fd = pc->cycles_fd < 0 ? -1 :
+        perf_open(PERF_COUNT_HW_INSTRUCTIONS, pc->cycles_fd);
+}
+
+static void perf_start(struct perf_counters *pc)
+{
+    if (pc->cycles_fd < 0)
+        return;
+    ioctl(pc->cycles_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(pc->cycles_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static void perf_stop(struct perf_counters *pc, long long *cycles,
+                      long long *instructions)
+{
+    *cycles = *instructions = -1;
+
+    if (pc->cycles_fd < 0)
+        return;
+    ioctl(pc->cycles_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    if (read(pc->cycles_fd, cycles, sizeof(*cycles)) != sizeof(*cycles))
+        *cycles = -1;
+    if (pc->instructions_fd < 0 ||
+        read(pc->instructions_fd, instructions, sizeof(*instructions)) !=
+            sizeof(*instructions))
+        *instructions = -1;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void print_per_op(const char *key, long long total, unsigned long n,
+                         const char *sep)
+{
+    if (total < 0)
+        printf("      \"%s\": null%s\n", key, sep);
+    else
+        printf("      \"%s\": %.3f%s\n", key, (double)total / n, sep);
+}
+
+/*
+ * Multi-controller scaling, for -d: every thread plays one controller
+ * with its own NVSHIELD_STATE, as every filter device has its own
+ * DEVICE_EXTENSION, and processes reports as fast as it can: each one is
+ * decoded, like the shared state does, and rewritten, and every eighth
+ * also carries a constant force update and its motor report, as a game
+ * running rumble at 125 Hz would. The driver-wide counters are kept both
+ * ways: in one cache line per thread, as the driver keeps them per
+ * processor, and in a single shared line, to show what that would cost.
+ */
+
+struct scale_counters {
+    volatile long long reports;
+    volatile long long rewrites;
+    volatile long long rumble;
+    char pad[64 - 3 * sizeof(long long)];
+} __attribute__((aligned(64)));
+
+struct scale_thread {
+    pthread_t thread;
+    pthread_barrier_t *barrier;
+    const NVSHIELD_INPUT_LAYOUT *layout;
+    struct scale_counters *counters;    /* own slot, or the shared one */
+    unsigned long iterations;
+    double elapsed;                     /* ns, from the barrier on */
+    ULONG sink;
+};
+
+static void *scale_device(void *arg)
+{
+    struct scale_thread *t = arg;
+    struct scale_counters *c = t->counters;
+    NVSHIELD_STATE *state = calloc(1, sizeof(*state));
+    NVSHIELD_GAMEPAD_STATE gamepad;
+    UCHAR report[NVSHIELD_INPUT_REPORT_SIZE];
+    UCHAR pid[4] = { 0x05, 0x01, 0x00, 0x00 };
+    UCHAR rumble[NVSHIELD_RUMBLE_REPORT_MAX];
+    unsigned long n;
+    double start;
+    ULONG len;
+
+    if (state == NULL)
+        return NULL;
+
+    NvShieldInitState(state);
+    bench_effects(state, 1);
+
+    pthread_barrier_wait(t->barrier);
+    start = now_ns();
+
+    for (n = 0; n < t->iterations; n++) {
+        memcpy(report, n & 0x10 ? sample_report_02 : sample_report_01, sizeof(report));
+        report[5] = (UCHAR)n;
+
+        if (NvShieldDecodeInputReport(t->layout, report, sizeof(report), &gamepad))
+            t->sink += gamepad.Axes[NvShieldAxisX];
+
+        len = NvShieldTransformInputReport(state, report, sizeof(report));
+        __atomic_fetch_add(&c->reports, 1, __ATOMIC_RELAXED);
+        if (len != sizeof(report) || report[0] == 0x02)
+            __atomic_fetch_add(&c->rewrites, 1, __ATOMIC_RELAXED);
+
+        if ((n & 7) == 0) {
+            pid[2] = (UCHAR)(n >> 3);
+            NvShieldSetReport(state, 0x0205, pid, sizeof(pid));
+            if (NvShieldBuildRumbleReport(state, rumble))
+                __atomic_fetch_add(&c->rumble, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    t->elapsed = now_ns() - start;
+    free(state);
+    return NULL;
+}
+
+static int scale_run(unsigned devices, int shared, unsigned long iterations,
+                     const NVSHIELD_INPUT_LAYOUT *layout, const char *sep)
+{
+    struct scale_counters *slots;
+    struct scale_thread *threads;
+    pthread_barrier_t barrier;
+    long long reports = 0, rewrites = 0, rumble = 0;
+    double slowest = 0;
+    unsigned i;
+
+    slots = aligned_alloc(64, devices * sizeof(*slots));
+    threads = calloc(devices, sizeof(*threads));
+    if (slots == NULL || threads == NULL)
+        return -1;
+    memset(slots, 0, devices * sizeof(*slots));
+    pthread_barrier_init(&barrier, NULL, devices);
+
+    for (i = 0; i < devices; i++) {
+        threads[i].barrier = &barrier;
+        threads[i].layout = layout;
+        threads[i].counters = &slots[shared ? 0 : i];
+        threads[i].iterations = iterations;
+        if (pthread_create(&threads[i].thread, NULL, scale_device, &threads[i]) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    for (i = 0; i < devices; i++) {
+        pthread_join(threads[i].thread, NULL);
+        if (threads[i].elapsed > slowest)
+            slowest = threads[i].elapsed;
+    }
+
+    /* what a query of the driver does */
+    for (i = 0; i < devices; i++) {
+        reports += slots[i].reports;
+        rewrites += slots[i].rewrites;
+        rumble += slots[i].rumble;
+    }
+
+    printf("%s\n    {\n      \"devices\": %u,\n", sep, devices);
+    printf("      \"counters\": \"%s\",\n", shared ? "shared" : "per_cpu");
+    printf("      \"ns_per_report\": %.3f,\n", slowest / iterations);
+    printf("      \"reports_per_second\": %.0f,\n", reports / (slowest / 1e9));
+    printf("      \"reports\": %lld,\n", reports);
+    printf("      \"rewrites\": %lld,\n", rewrites);
+    printf("      \"rumble_reports\": %lld\n    }", rumble);
+
+    pthread_barrier_destroy(&barrier);
+    free(threads);
+    free(slots);
+
+    return reports == (long long)devices * (long long)iterations ? 0 : -1;
+}
+
+static int check_scaling(unsigned max_devices, unsigned long iterations)
+{
+    NVSHIELD_INPUT_LAYOUT layout;
+    const char *sep = "";
+    unsigned devices;
+    int shared, status = 0;
+
+    NvShieldGetInputLayout(G_DefaultReportDescriptor,
+                           G_DefaultReportDescriptorLength, 0x01, &layout);
+
+    printf("{\n  \"iterations\": %lu,\n  \"scaling\": [", iterations);
+
+    /* 1, 2, 4... and max_devices last */
+    for (devices = 1; ; devices *= 2) {
+        if (devices > max_devices)
+            devices = max_devices;
+
+        for (shared = 0; shared <= 1; shared++) {
+            if (scale_run(devices, shared, iterations, &layout, sep) < 0)
+                status = 1;
+            sep = ",";
+        }
+
+        if (devices == max_devices)
+            break;
+    }
+
+    printf("\n  ]\n}\n");
+
+    if (status != 0)
+        fprintf(stderr, "counters lost reports\n");
+    return status;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-n iterations] [-f filter] [-c] [-d devices]\n"
+            "\n"
+            "  -n  iterations per case (default %lu)\n"
+            "  -f  only run the cases whose name contains filter\n"
+            "  -c  check the rumble mixer against its reference model instead\n"
+            "  -d  run 1, 2, 4... up to devices controllers on as many threads\n"
+            "      instead, with iterations reports each\n",
+            prog, DEFAULT_ITERATIONS);
+}
+
+int main(int argc, char **argv)
+{
+    struct perf_counters pc;
+    struct bench_ctx *ctx;
+    unsigned long iterations = DEFAULT_ITERATIONS;
+    const char *filter = NULL;
+    const char *sep = "";
+    long long cycles, instructions;
+    double start, elapsed;
+    size_t i;
+    unsigned devices = 0;
+    int check = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:f:cd:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        case 'c':
+            check = 1;
+            break;
+        case 'd':
+            devices = (unsigned)strtoul(optarg, NULL, 0);
+            if (devices == 0 || devices > 64) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (iterations == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (check)
+        return check_mixer(iterations);
+    if (devices != 0)
+        return check_scaling(devices, iterations);
+
+    ctx = calloc(1, sizeof(*ctx));
+    if (ctx == NULL || nvshield_batch_alloc(&ctx->batch, DECODE_BATCH) < 0)
+        return 1;
+
+    NvShieldGetInputLayout(G_DefaultReportDescriptor,
+                           G_DefaultReportDescriptorLength, 0x01, &ctx->layout);
+    NvShieldGetInputReportSizes(G_DefaultReportDescriptor,
+                                G_DefaultReportDescriptorLength, NULL, &ctx->sizes);
+    srand(1);
+    for (i = 0; i < sizeof(ctx->reports); i++)
+        ctx->reports[i] = (UCHAR)rand();
+    for (i = 0; i < sizeof(ctx->reports); i += NVSHIELD_INPUT_REPORT_SIZE)
+        ctx->reports[i] = 0x01;
+
+    perf_init(&pc);
+    if (pc.cycles_fd < 0)
+        fprintf(stderr, "perf_event unavailable (%s), reporting time only\n",
+                strerror(errno));
+
+    printf("{\n  \"iterations\": %lu,\n  \"benchmarks\": [", iterations);
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (filter != NULL && strstr(cases[i].name, filter) == NULL)
+            continue;
+
+        NvShieldInitState(&ctx->state);
+        cases[i].run(ctx, iterations / 10 + 1);     /* warm up */
+
+        NvShieldInitState(&ctx->state);
+        start = now_ns();
+        perf_start(&pc);
+        cases[i].run(ctx, iterations);
+        perf_stop(&pc, &cycles, &instructions);
+        elapsed = now_ns() - start;
+
+        printf("%s\n    {\n      \"name\": \"%s\",\n", sep, cases[i].name);
+        printf("      \"ns_per_op\": %.3f,\n", elapsed / iterations);
+        print_per_op("cycles_per_op", cycles, iterations, ",");
+        print_per_op("instructions_per_op", instructions, iterations, "");
+        printf("    }");
+        sep = ",";
+    }
+
+    printf("\n  ]\n}\n");
+
+    nvshield_batch_free(&ctx->batch);
+    free(ctx);
+    return 0;
+}
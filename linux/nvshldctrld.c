@@ -0,0 +1,1754 @@
+/*
+ * nvshldctrld.c - user-space counterpart of the Windows filter driver.
+ *
+ * Reads the raw reports of a Shield controller from hidraw (or generates
+ * them when simulating), runs them through the same core as the KMDF
+ * filter (../sys/shield.c) and re-exposes the result as a uhid device
+ * using G_DefaultReportDescriptor, or the variant of it declaring only the
+ * PID reports of the profile given with -p. A 2017 controller, or one
+ * simulated with -P 7214, keeps its own descriptor patched with those PID
+ * reports instead, see NvShieldPatchReportDescriptor(); the simulated one
+ * is the stand-in of sim2017.h. The time the kernel takes
+ * from UHID_CREATE2 to UHID_START, which covers parsing the descriptor,
+ * is printed to compare the profiles. Force feedback is accepted both as PID
+ * output reports on the uhid device and as EV_FF effects on a companion
+ * uinput device, and is translated into the controller's motor report.
+ *
+ * Motor reports go to hidraw with write(), which usbhid sends on the
+ * interrupt OUT endpoint when the controller has one, or with
+ * HIDIOCSOUTPUT, always a SET_REPORT control transfer, when -c is given.
+ * The time spent in either is reported on exit to compare the two.
+ *
+ * The motors are stopped once the effect started last has played for its
+ * duration, or once no force feedback update came for the -t timeout,
+ * through a timerfd armed with the deadline NvShieldRumbleExpiry() gives,
+ * as the driver's watchdog does. Custom force effects move on to their
+ * next sample from another timerfd, armed with NvShieldEffectNextTick(),
+ * as the driver's playback timer does. Condition effects (spring, damper,
+ * inertia, friction) are computed from the left stick of every report.
+ *
+ * A motor report identical to the last one sent is dropped by the core.
+ * With -r at most one goes out every given ms; the latest state held back
+ * goes out once the interval has passed, from a timerfd, as the driver's
+ * RumbleInterval setting does.
+ *
+ * With -M the right stick also moves the pointer of the trackpad
+ * collection: a timerfd ticks every NVSHIELD_MOUSE_PERIOD_MS while the
+ * stick is out of its dead zone and each tick that adds up to a whole
+ * pixel sends a synthesized report 0x02, as the driver's timer does.
+ *
+ * Every input report goes through the stages of NVSHIELD_INPUT_STAGES in
+ * turn, as in the driver; built with STAGE_TIMING=1, the time spent in
+ * each is printed on exit.
+ *
+ * With -C the settings the driver keeps in the registry (NVSHIELD_SETTINGS:
+ * trackpad scales, volume buttons, rumble gain and flags) are read from a
+ * file of Name=value lines instead, and read again on SIGHUP. Each read
+ * compiles a new snapshot that replaces the old one between two reports,
+ * as IOCTL_NVSHIELD_SETTINGS_SET does in the driver.
+ *
+ * With Calibrate=1 in there, the Calibrate stage corrects the sticks from
+ * an estimate of their resting position and reach. When it has moved, the
+ * tables are rebuilt once the reports at hand have been handled, at most
+ * every NVSHIELD_CALIBRATION_PERIOD_MS, as the driver's work item does,
+ * and the estimate is saved to the file given with -K, which the next run
+ * starts from, every NVSHIELD_CALIBRATION_SAVE_MS and on exit.
+ *
+ * With InputKeepAlive=ms in there, a gamepad report identical to the last
+ * one sent goes out again only once that many ms have passed, as the
+ * driver does by sending the request straight back to the controller.
+ * Each report written to uhid runs the HID core and input layers, so the
+ * CPU time printed on exit, against the time the daemon ran, shows what
+ * holding them back saves.
+ *
+ * The latencies of NVSHIELD_LATENCIES the daemon has a counterpart for go
+ * to histograms like the driver's, whose percentiles are printed on exit:
+ * InputFilter from a report read to its uhid write, RumbleFilter from the
+ * first update a motor report carries to its write, and RumbleDevice for
+ * the write or HIDIOCSOUTPUT itself. Nothing here stands for a request
+ * waiting at the device, so InputDevice stays empty.
+ *
+ * The latest decoded state of the controller is published in a POSIX
+ * shared memory object laid out like one slot of the driver's shared
+ * state area (NVSHIELD_SHARED_STATE), which -w polls from another process.
+ *
+ * All file descriptors are multiplexed through a single epoll instance;
+ * every wakeup drains each ready descriptor until EAGAIN so that a burst
+ * of reports costs one epoll_wait() rather than one per report.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include <linux/hidraw.h>
+#include <linux/input.h>
+#include <linux/uhid.h>
+#include <linux/uinput.h>
+
+#include "shield.h"
+#include "public.h"
+#include "sim2017.h"
+
+#define MAX_EVENTS          8
+#define MAX_BATCH           64
+#define FF_EFFECTS_MAX      16
+
+#define HID_REPORT_TYPE_OUTPUT  2
+#define HID_REPORT_TYPE_FEATURE 3
+
+#define TRACKPAD_REPORT_SIZE    5
+
+#define DEFAULT_SHM_NAME        "/nvshldctrld"
+#define DEFAULT_RUMBLE_TIMEOUT  0       /* ms, as the driver's INF sets it */
+#define WATCH_INTERVAL_MS       100
+
+struct shield_dev {
+    NVSHIELD_STATE state;
+    NVSHIELD_REPORT_CACHE report_cache;
+
+    int hidraw_fd;          /* -1 when simulating */
+    int sim_fd;             /* timerfd driving the simulated source */
+    int mouse_fd;           /* timerfd of the mouse emulation, -1 when off */
+    int watchdog_fd;        /* timerfd stopping the motors */
+    int playback_fd;        /* timerfd playing custom force samples */
+    int rumble_fd;          /* timerfd ending the -r interval, -1 when none */
+    int uhid_fd;
+    int uinput_fd;
+    int signal_fd;
+    int epoll_fd;
+
+    int verbose;
+    int rumble_control;     /* send motor reports as SET_REPORT on EP0 */
+    ULONG rumble_timeout;   /* ms, 0 for none */
+    ULONG rumble_interval;  /* ms, 0 for none */
+    NVSHIELD_PID_PROFILE pid_profile;
+    unsigned long long create_ns;
+    const char *settings_path;  /* -C, NULL for the defaults */
+    const char *calibration_path; /* -K, NULL not to keep the calibration */
+    NVSHIELD_SETTINGS settings;
+    int recalibrate;        /* the stick tables are due for a rebuild */
+    ULONGLONG recalibrate_due;  /* now_ms() before which they aren't rebuilt */
+    ULONGLONG calibration_save_due; /* now_ms() before which -K isn't written */
+    int calibration_unsaved; /* tables newer than what -K holds */
+
+    /* shared state, NULL if it couldn't be created */
+    const char *shm_name;
+    NVSHIELD_SHARED_STATE *shared;
+    NVSHIELD_INPUT_LAYOUT layout;
+    NVSHIELD_REPORT_SIZES sizes;
+    int has_sizes;
+    UCHAR device_ids[256];  /* see NvShieldGetDeviceReportIds() */
+    unsigned long sim_tick;
+
+    /* right stick for the mouse emulation, 16 bits centered on 0x8000 */
+    USHORT stick_x, stick_y;
+    int mouse_active;       /* mouse_fd is armed */
+
+    /* motor state held back by the -r interval */
+    ULONGLONG rumble_last;  /* ms, when the last report went out */
+    int rumble_pending;
+    unsigned long rumble_merged;
+
+    /* time spent in each stage of the input pipeline, NVSHIELD_STAGE_TIMING */
+    NVSHIELD_STAGE_COUNTER stage_counters[NvShieldStageCount];
+
+    /* see NVSHIELD_LATENCIES; rumble_arrived is the first update the next
+     * motor report carries, in ns, 0 if none */
+    NVSHIELD_LATENCY_HISTOGRAM latencies[NvShieldLatencyCount];
+    unsigned long long rumble_arrived;
+
+    /* input reports written to uhid, and since when */
+    unsigned long input_sent;
+    unsigned long long start_ns;
+
+    /* time spent sending motor reports */
+    unsigned long rumble_count;
+    unsigned long long rumble_ns_total;
+    unsigned long long rumble_ns_max;
+
+    /* PID effect blocks of each uinput effect, 0 when unused; a rumble
+     * effect takes one per motor */
+    UCHAR effect_blocks[FF_EFFECTS_MAX][2];
+};
+
+static int running = 1;
+
+static int add_fd(struct shield_dev *dev, int fd)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(dev->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Device side
+ */
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static ULONGLONG now_ms(void)
+{
+    return now_ns() / 1000000;
+}
+
+static void put_le16(UCHAR *p, unsigned v)
+{
+    p[0] = (UCHAR)(v & 0xFF);
+    p[1] = (UCHAR)(v >> 8);
+}
+
+static int rumble_hold(struct shield_dev *dev)
+{
+    ULONGLONG next = dev->rumble_last + dev->rumble_interval;
+    struct itimerspec its;
+
+    if (dev->rumble_interval == 0 || now_ms() >= next)
+        return 0;
+
+    /* a held back update is replaced by this one */
+    if (dev->rumble_pending)
+        dev->rumble_merged++;
+    dev->rumble_pending = 1;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = (time_t)(next / 1000);
+    its.it_value.tv_nsec = (long)(next % 1000) * 1000000;
+    timerfd_settime(dev->rumble_fd, TFD_TIMER_ABSTIME, &its, NULL);
+    return 1;
+}
+
+static unsigned rumble_level(const UCHAR *report, UCHAR offset,
+                             const NVSHIELD_RUMBLE_FORMAT *format)
+{
+    if (format->MotorMax != 0)
+        return report[offset];
+    return report[offset] | (report[offset + 1] << 8);
+}
+
+static void send_rumble(struct shield_dev *dev)
+{
+    const NVSHIELD_RUMBLE_FORMAT *format = &dev->state.model->Rumble;
+    UCHAR report[NVSHIELD_RUMBLE_REPORT_MAX];
+    unsigned long long start, sent, elapsed, arrived;
+    int ret = 0;
+
+    if (rumble_hold(dev))
+        return;
+
+    start = now_ns();
+    dev->rumble_pending = 0;
+    arrived = dev->rumble_arrived;
+    dev->rumble_arrived = 0;
+
+    if (!NvShieldBuildRumbleReport(&dev->state, report))
+        return;
+
+    if (arrived != 0)
+        NvShieldLatencyRecord(&dev->latencies[NvShieldLatencyRumbleFilter],
+                              (start - arrived) / 1000);
+
+    dev->rumble_last = start / 1000000;
+
+    if (dev->verbose || dev->hidraw_fd < 0)
+        fprintf(stderr, "rumble: left=%u right=%u\n",
+                rumble_level(report, format->LeftOffset, format),
+                rumble_level(report, format->RightOffset, format));
+
+    if (dev->hidraw_fd >= 0) {
+        sent = now_ns();
+        if (dev->rumble_control)
+            ret = ioctl(dev->hidraw_fd, HIDIOCSOUTPUT(format->Size), report);
+        else
+            ret = write(dev->hidraw_fd, report, format->Size);
+        if (ret < 0) {
+            perror("hidraw rumble");
+            NvShieldRumbleReportLost(&dev->state);
+        }
+        NvShieldLatencyRecord(&dev->latencies[NvShieldLatencyRumbleDevice],
+                              (now_ns() - sent) / 1000);
+    }
+
+    elapsed = now_ns() - start;
+    dev->rumble_count++;
+    dev->rumble_ns_total += elapsed;
+    if (elapsed > dev->rumble_ns_max)
+        dev->rumble_ns_max = elapsed;
+}
+
+static void handle_rumble(struct shield_dev *dev)
+{
+    uint64_t expirations;
+
+    if (read(dev->rumble_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+
+    if (dev->rumble_pending)
+        send_rumble(dev);
+}
+
+static int rumble_create(struct shield_dev *dev)
+{
+    dev->rumble_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (dev->rumble_fd < 0) {
+        perror("timerfd_create");
+        return -1;
+    }
+    return 0;
+}
+
+static void print_rumble_stats(const struct shield_dev *dev)
+{
+    fprintf(stderr, "rumble: %u reports sent, %lu suppressed\n",
+            dev->state.rumbleSent, dev->state.rumbleSuppressed + dev->rumble_merged);
+
+    if (dev->rumble_count == 0)
+        return;
+
+    fprintf(stderr, "rumble: %lu reports via %s, mean %.1f us, max %.1f us\n",
+            dev->rumble_count,
+            dev->hidraw_fd < 0 ? "simulator" :
+                dev->rumble_control ? "control SET_REPORT" : "output report",
+            dev->rumble_ns_total / 1000.0 / dev->rumble_count,
+            dev->rumble_ns_max / 1000.0);
+}
+
+/*
+ * Shared state
+ */
+
+static int shared_create(struct shield_dev *dev)
+{
+    void *p;
+    int fd;
+
+    fd = shm_open(dev->shm_name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror(dev->shm_name);
+        return -1;
+    }
+
+    if (ftruncate(fd, NVSHIELD_SHARED_STATE_SLOT_SIZE) < 0) {
+        perror("ftruncate");
+        close(fd);
+        return -1;
+    }
+
+    p = mmap(NULL, NVSHIELD_SHARED_STATE_SLOT_SIZE, PROT_READ | PROT_WRITE,
+             MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    dev->shared = p;
+    memset(dev->shared, 0, sizeof(*dev->shared));
+    dev->shared->Magic = NVSHIELD_SHARED_STATE_MAGIC;
+    dev->shared->Frequency = 1000000000;
+    return 0;
+}
+
+static void shared_destroy(struct shield_dev *dev)
+{
+    if (dev->shared == NULL)
+        return;
+
+    munmap(dev->shared, NVSHIELD_SHARED_STATE_SLOT_SIZE);
+    shm_unlink(dev->shm_name);
+    dev->shared = NULL;
+}
+
+/*
+ * The equivalent of NvShieldSharedStatePublish, from the report as read
+ * from the controller. The daemon is the only writer.
+ */
+static void shared_publish(struct shield_dev *dev, NVSHIELD_INPUT *input)
+{
+    NVSHIELD_SHARED_STATE *slot = dev->shared;
+    const NVSHIELD_GAMEPAD_STATE *gamepad;
+    const UCHAR *buf = input->Report;
+
+    if (slot == NULL || input->Length == 0)
+        return;
+
+    gamepad = NvShieldInputGamepad(input);
+    /* the model's trackpad report; ID 0 means it has none */
+    if (gamepad == NULL && (buf[0] == 0 || buf[0] != dev->state.model->TrackpadReportId ||
+                            input->Length < TRACKPAD_REPORT_SIZE))
+        return;
+
+    InterlockedIncrement(&slot->Sequence);
+
+    slot->DeviceIndex = 1;
+    slot->Timestamp = (LONGLONG)now_ns();
+
+    if (gamepad != NULL) {
+        slot->Buttons = gamepad->Buttons;
+        slot->Hat = gamepad->Hat;
+        slot->Consumer = gamepad->Consumer;
+        memcpy(slot->Axes, gamepad->Axes, sizeof(slot->Axes));
+    } else {
+        slot->TrackpadButtons = buf[1];
+        slot->TrackpadX = buf[2];
+        slot->TrackpadY = buf[4];
+    }
+
+    InterlockedIncrement(&slot->Sequence);
+}
+
+/*
+ * -w: what nvshldcap -l does on Windows
+ */
+static int watch_shared(const char *name)
+{
+    const NVSHIELD_SHARED_STATE *slot;
+    NVSHIELD_SHARED_STATE state;
+    struct timespec interval = { 0, WATCH_INTERVAL_MS * 1000000L };
+    LONG last_sequence = 0;
+    void *p;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        perror(name);
+        return 1;
+    }
+
+    p = mmap(NULL, NVSHIELD_SHARED_STATE_SLOT_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    slot = p;
+
+    for (;;) {
+        if (NvShieldReadSharedState(slot, &state) &&
+            state.Sequence != last_sequence) {
+            last_sequence = state.Sequence;
+
+            printf("buttons %03x hat %u consumer %02x axes %04x %04x %04x %04x"
+                   " triggers %04x %04x trackpad %x %3u,%3u (%.3f s)\n",
+                   state.Buttons, state.Hat, state.Consumer,
+                   state.Axes[0], state.Axes[1], state.Axes[2], state.Axes[3],
+                   state.Axes[4], state.Axes[5],
+                   state.TrackpadButtons, state.TrackpadX, state.TrackpadY,
+                   (double)state.Timestamp / state.Frequency);
+            fflush(stdout);
+        }
+        nanosleep(&interval, NULL);
+    }
+
+    return 0;
+}
+
+static void timer_arm(int fd, ULONGLONG at)
+{
+    struct itimerspec its;
+
+    /* CLOCK_MONOTONIC, like now_ms(); all zeroes disarms */
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = (time_t)(at / 1000);
+    its.it_value.tv_nsec = (long)(at % 1000) * 1000000;
+    timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void watchdog_arm(struct shield_dev *dev, ULONGLONG expires)
+{
+    timer_arm(dev->watchdog_fd, expires);
+}
+
+static void handle_watchdog(struct shield_dev *dev)
+{
+    uint64_t expirations;
+
+    if (read(dev->watchdog_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+
+    if (NvShieldRumbleExpire(&dev->state, now_ms())) {
+        if (dev->verbose)
+            fprintf(stderr, "rumble: stopped by the watchdog\n");
+        send_rumble(dev);
+    }
+
+    /* effects still playing may end later */
+    watchdog_arm(dev, NvShieldRumbleNextExpiry(&dev->state));
+}
+
+static int watchdog_create(struct shield_dev *dev)
+{
+    dev->watchdog_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (dev->watchdog_fd < 0) {
+        perror("timerfd_create");
+        return -1;
+    }
+    return 0;
+}
+
+static void handle_playback(struct shield_dev *dev)
+{
+    uint64_t expirations;
+
+    if (read(dev->playback_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+
+    if (NvShieldEffectTick(&dev->state, now_ms()))
+        send_rumble(dev);
+
+    timer_arm(dev->playback_fd, NvShieldEffectNextTick(&dev->state));
+}
+
+static int playback_create(struct shield_dev *dev)
+{
+    dev->playback_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (dev->playback_fd < 0) {
+        perror("timerfd_create");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Feeds a PID SET_REPORT through the core, the equivalent of the
+ * URB_FUNCTION_CLASS_INTERFACE path of HidFx2EvtInternalDeviceControl.
+ */
+static int pid_set_report(struct shield_dev *dev, int type,
+                          const UCHAR *buf, ULONG len)
+{
+    static UCHAR out[UHID_DATA_MAX];
+    unsigned long long arrived = now_ns();
+    NVSHIELD_PID_ACTION action;
+    USHORT value;
+
+    if (len == 0)
+        return -EINVAL;
+
+    value = (USHORT)((type << 8) | buf[0]);
+
+    action = NvShieldSetReport(&dev->state, value, buf, len);
+    if (action != NvShieldPidInvalid)
+        NvShieldReportCacheInvalidate(&dev->report_cache,
+                                      action == NvShieldPidForward ? 0 : value);
+
+    if (action == NvShieldPidComplete || action == NvShieldPidUpdateRumble) {
+        watchdog_arm(dev, NvShieldRumbleExpiry(&dev->state, now_ms(), dev->rumble_timeout));
+        timer_arm(dev->playback_fd, NvShieldEffectNextTick(&dev->state));
+    }
+
+    switch (action) {
+    case NvShieldPidUpdateRumble:
+        if (dev->rumble_arrived == 0)
+            dev->rumble_arrived = arrived;
+        send_rumble(dev);
+        return 0;
+
+    case NvShieldPidComplete:
+        return 0;
+
+    case NvShieldPidInvalid:
+        return -EINVAL;
+
+    default:
+        break;
+    }
+
+    if (dev->hidraw_fd < 0 || len > sizeof(out))
+        return 0;
+
+    /* under the controller's own report ID */
+    memcpy(out, buf, len);
+    out[0] = dev->device_ids[buf[0]];
+
+    if (type == HID_REPORT_TYPE_FEATURE) {
+        if (ioctl(dev->hidraw_fd, HIDIOCSFEATURE(len), out) < 0)
+            return -errno;
+    } else if (write(dev->hidraw_fd, out, len) < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+/*
+ * uhid side
+ */
+
+static int uhid_write(struct shield_dev *dev, const struct uhid_event *ev)
+{
+    if (write(dev->uhid_fd, ev, sizeof(*ev)) < 0) {
+        perror("uhid write");
+        return -errno;
+    }
+    return 0;
+}
+
+/*
+ * The Report Descriptor of the controller, or of the simulated one
+ */
+static int device_descriptor(struct shield_dev *dev,
+                             struct hidraw_report_descriptor *desc)
+{
+    int size;
+
+    if (dev->hidraw_fd < 0) {
+        memcpy(desc->value, sim_2017_descriptor, sizeof(sim_2017_descriptor));
+        desc->size = sizeof(sim_2017_descriptor);
+        return 0;
+    }
+
+    if (ioctl(dev->hidraw_fd, HIDIOCGRDESCSIZE, &size) < 0) {
+        perror("HIDIOCGRDESCSIZE");
+        return -1;
+    }
+    desc->size = (__u32)size;
+    if (ioctl(dev->hidraw_fd, HIDIOCGRDESC, desc) < 0) {
+        perror("HIDIOCGRDESC");
+        return -1;
+    }
+    return 0;
+}
+
+static int uhid_create(struct shield_dev *dev)
+{
+    static struct hidraw_report_descriptor desc;
+    const NVSHIELD_MODEL *model = dev->state.model;
+    struct uhid_event ev;
+    ULONG effects = NvShieldPidProfileEffects(dev->pid_profile);
+    UCHAR id_map[256];
+    ULONG len;
+
+    dev->uhid_fd = open("/dev/uhid", O_RDWR | O_CLOEXEC | O_NONBLOCK);
+    if (dev->uhid_fd < 0) {
+        perror("/dev/uhid");
+        return -1;
+    }
+
+    NvShieldSetPidEffects(&dev->state, effects);
+
+    memset(&ev, 0, sizeof(ev));
+
+    if (model->DeviceReportDescriptorLength != 0) {
+        len = NvShieldBuildReportDescriptor(effects, ev.u.create2.rd_data,
+                                            sizeof(ev.u.create2.rd_data));
+    } else {
+        if (device_descriptor(dev, &desc) < 0)
+            return -1;
+        len = NvShieldPatchReportDescriptor(model, effects, desc.value, desc.size,
+                                            ev.u.create2.rd_data,
+                                            sizeof(ev.u.create2.rd_data), id_map);
+        if (len == 0) {
+            fprintf(stderr, "no gamepad collection to add the PID reports to\n");
+            return -1;
+        }
+    }
+    if (len == 0 || len > sizeof(ev.u.create2.rd_data)) {
+        fprintf(stderr, "report descriptor too large for uhid\n");
+        return -1;
+    }
+
+    ev.type = UHID_CREATE2;
+    strcpy((char *)ev.u.create2.name, "NVIDIA Shield Controller");
+    strcpy((char *)ev.u.create2.phys, "nvshldctrld");
+    ev.u.create2.rd_size = (__u16)len;
+    ev.u.create2.bus = BUS_USB;
+    ev.u.create2.vendor = NVSHIELD_VENDOR_ID;
+    ev.u.create2.product = model->ProductId;
+
+    if (dev->verbose)
+        fprintf(stderr, "uhid: %lu byte report descriptor\n", (unsigned long)len);
+
+    NvShieldGetInputLayout(ev.u.create2.rd_data, len, model->GamepadReportId, &dev->layout);
+    dev->has_sizes = NvShieldGetInputReportSizes(ev.u.create2.rd_data, len,
+        model->DeviceReportDescriptorLength != 0 ? NULL : id_map, &dev->sizes);
+    NvShieldGetDeviceReportIds(model->DeviceReportDescriptorLength != 0 ? NULL : id_map,
+                               dev->device_ids);
+
+    dev->create_ns = now_ns();
+    return uhid_write(dev, &ev);
+}
+
+static void uhid_send_input(struct shield_dev *dev, const UCHAR *buf, ULONG len)
+{
+    struct uhid_event ev;
+
+    memset(&ev, 0, sizeof(ev.type) + sizeof(ev.u.input2.size));
+    ev.type = UHID_INPUT2;
+    ev.u.input2.size = (__u16)len;
+    memcpy(ev.u.input2.data, buf, len);
+
+    uhid_write(dev, &ev);
+}
+
+static void mouse_arm(struct shield_dev *dev, int arm)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    if (arm) {
+        its.it_interval.tv_nsec = NVSHIELD_MOUSE_PERIOD_MS * 1000000L;
+        its.it_value.tv_nsec = NVSHIELD_MOUSE_PERIOD_MS * 1000000L;
+    }
+    timerfd_settime(dev->mouse_fd, 0, &its, NULL);
+    dev->mouse_active = arm;
+}
+
+static USHORT stick_value(USHORT value, NVSHIELD_INPUT_FIELD field)
+{
+    if (field.BitSize == 0 || field.BitSize > 16)
+        return 0x8000;
+    return (USHORT)(value << (16 - field.BitSize));
+}
+
+static void mouse_input(struct shield_dev *dev, NVSHIELD_INPUT *input)
+{
+    const NVSHIELD_GAMEPAD_STATE *gamepad = NvShieldInputGamepad(input);
+
+    if (gamepad == NULL)
+        return;
+
+    dev->stick_x = stick_value(gamepad->Axes[NvShieldAxisZ],
+                               dev->layout.Axes[NvShieldAxisZ]);
+    dev->stick_y = stick_value(gamepad->Axes[NvShieldAxisRz],
+                               dev->layout.Axes[NvShieldAxisRz]);
+
+    if (!dev->mouse_active && NvShieldMouseStickActive(dev->stick_x, dev->stick_y))
+        mouse_arm(dev, 1);
+}
+
+static void handle_mouse(struct shield_dev *dev)
+{
+    UCHAR report[NVSHIELD_INPUT_REPORT_SIZE];
+    uint64_t expirations;
+    int pending = 0;
+
+    if (read(dev->mouse_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+
+    /* ticks missed while busy still move the pointer, in one report */
+    while (expirations--)
+        pending |= NvShieldMouseTick(&dev->state, dev->stick_x, dev->stick_y);
+
+    if (pending)
+        uhid_send_input(dev, report, NvShieldBuildMouseReport(&dev->state, report));
+
+    if (!NvShieldMouseStickActive(dev->stick_x, dev->stick_y)) {
+        dev->state.mouseX = dev->state.mouseY = 0;
+        mouse_arm(dev, 0);
+    }
+}
+
+static int mouse_create(struct shield_dev *dev)
+{
+    dev->mouse_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (dev->mouse_fd < 0) {
+        perror("timerfd_create");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Condition effects follow the left stick of every report, as the
+ * driver's completion routine does.
+ */
+static void condition_input(struct shield_dev *dev, NVSHIELD_INPUT *input)
+{
+    const NVSHIELD_GAMEPAD_STATE *gamepad = NvShieldInputGamepad(input);
+
+    if (gamepad == NULL)
+        return;
+
+    if (NvShieldConditionUpdate(&dev->state,
+            stick_value(gamepad->Axes[NvShieldAxisX], dev->layout.Axes[NvShieldAxisX]),
+            stick_value(gamepad->Axes[NvShieldAxisY], dev->layout.Axes[NvShieldAxisY]),
+            now_ns() / 1000))
+        send_rumble(dev);
+}
+
+/*
+ * The stages of NVSHIELD_INPUT_STAGES, as the driver runs them
+ */
+static inline void stage_Calibrate(struct shield_dev *dev, NVSHIELD_INPUT *input)
+{
+    if (NvShieldCalibrateInput(&dev->state, input))
+        dev->recalibrate = 1;
+}
+
+static inline void stage_Mouse(struct shield_dev *dev, NVSHIELD_INPUT *input)
+{
+    if (dev->mouse_fd >= 0)
+        mouse_input(dev, input);
+}
+
+static inline void stage_Publish(struct shield_dev *dev, NVSHIELD_INPUT *input)
+{
+    shared_publish(dev, input);
+}
+
+static inline void stage_Condition(struct shield_dev *dev, NVSHIELD_INPUT *input)
+{
+    if (NvShieldConditionPlaying(&dev->state))
+        condition_input(dev, input);
+}
+
+static inline void stage_Rewrite(struct shield_dev *dev, NVSHIELD_INPUT *input)
+{
+    input->Length = NvShieldTransformInputReport(&dev->state, input->Report,
+                                                 input->Length);
+}
+
+static ULONG input_pipeline(PVOID context, PUCHAR report, ULONG len)
+{
+    struct shield_dev *dev = context;
+    NVSHIELD_INPUT input;
+
+    NvShieldInputInit(&input, &dev->layout, report, len);
+
+#define RUN_STAGE(Name) \
+    NVSHIELD_RUN_STAGE(dev->stage_counters, NvShieldStage##Name, stage_##Name(dev, &input));
+    NVSHIELD_INPUT_STAGES(RUN_STAGE)
+#undef RUN_STAGE
+
+    return input.Length;
+}
+
+static void print_stage_stats(const struct shield_dev *dev)
+{
+    static const char *const names[] = {
+#define STAGE_NAME(Name) #Name,
+        NVSHIELD_INPUT_STAGES(STAGE_NAME)
+#undef STAGE_NAME
+    };
+    unsigned i;
+
+    if (!NVSHIELD_STAGE_TIMING)
+        return;
+
+    for (i = 0; i < NvShieldStageCount; i++) {
+        const NVSHIELD_STAGE_COUNTER *c = &dev->stage_counters[i];
+
+        fprintf(stderr, "stage %-10s %llu reports, %.1f cycles per report\n", names[i],
+                (unsigned long long)c->Reports,
+                c->Reports != 0 ? (double)c->Cycles / c->Reports : 0.0);
+    }
+}
+
+static void uhid_input(struct shield_dev *dev, UCHAR *buf, ULONG len)
+{
+    unsigned long long start = now_ns();
+
+    len = NvShieldTransformInputTransfer(&dev->state,
+                                         dev->has_sizes ? &dev->sizes : NULL, buf, len,
+                                         input_pipeline, dev);
+
+    /* nothing the readers don't have yet */
+    if (NvShieldInputUnchanged(&dev->state, buf, len, now_ms()))
+        return;
+
+    dev->input_sent++;
+    uhid_send_input(dev, buf, len);
+
+    NvShieldLatencyRecord(&dev->latencies[NvShieldLatencyInputFilter],
+                          (now_ns() - start) / 1000);
+}
+
+static void print_latency_stats(const struct shield_dev *dev)
+{
+    static const char *const names[] = {
+#define LATENCY_NAME(Name) #Name,
+        NVSHIELD_LATENCIES(LATENCY_NAME)
+#undef LATENCY_NAME
+    };
+    unsigned i;
+
+    for (i = 0; i < NvShieldLatencyCount; i++) {
+        const NVSHIELD_LATENCY_HISTOGRAM *histogram = &dev->latencies[i];
+        ULONG count = NvShieldLatencyCountOf(histogram);
+
+        if (count == 0)
+            continue;
+
+        fprintf(stderr, "latency %-12s %u samples, p50 %u us, p99 %u us, "
+                "p99.9 %u us, max %u us\n", names[i], count,
+                NvShieldLatencyPercentile(histogram, 500),
+                NvShieldLatencyPercentile(histogram, 990),
+                NvShieldLatencyPercentile(histogram, 999),
+                NvShieldLatencyPercentile(histogram, 1000));
+    }
+}
+
+static double timeval_s(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static void print_input_stats(const struct shield_dev *dev)
+{
+    double elapsed = (now_ns() - dev->start_ns) / 1e9;
+    double cpu;
+    struct rusage usage;
+
+    fprintf(stderr, "input: %lu reports sent, %u unchanged held back\n",
+            dev->input_sent, dev->state.inputSuppressed);
+
+    if (getrusage(RUSAGE_SELF, &usage) < 0 || elapsed <= 0)
+        return;
+
+    cpu = timeval_s(&usage.ru_utime) + timeval_s(&usage.ru_stime);
+    fprintf(stderr, "cpu: %.3f s in %.3f s, %.2f%%\n", cpu, elapsed, 100 * cpu / elapsed);
+}
+
+static void uhid_get_report(struct shield_dev *dev,
+                            const struct uhid_get_report_req *req)
+{
+    struct uhid_event ev;
+    USHORT value = (USHORT)((HID_REPORT_TYPE_FEATURE << 8) | req->rnum);
+    UCHAR *data = ev.u.get_report_reply.data;
+    ULONG size = sizeof(ev.u.get_report_reply.data);
+    int ret;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_GET_REPORT_REPLY;
+    ev.u.get_report_reply.id = req->id;
+
+    if (NvShieldGetReport(&dev->state, value, data, sizeof(ev.u.get_report_reply.data))) {
+        ev.u.get_report_reply.size = 5;
+    } else if (req->rtype != UHID_FEATURE_REPORT) {
+        ev.u.get_report_reply.err = EIO;
+    } else if (NvShieldReportCacheLookup(&dev->report_cache, value, data, &size,
+                                         now_ms())) {
+        ev.u.get_report_reply.size = (__u16)size;
+    } else if (dev->hidraw_fd >= 0) {
+        data[0] = dev->device_ids[req->rnum];
+        ret = ioctl(dev->hidraw_fd,
+                    HIDIOCGFEATURE(sizeof(ev.u.get_report_reply.data)), data);
+        if (ret < 0) {
+            ev.u.get_report_reply.err = EIO;
+        } else {
+            if (ret > 0 && data[0] == dev->device_ids[req->rnum])
+                data[0] = req->rnum;
+            ev.u.get_report_reply.size = (__u16)ret;
+            NvShieldReportCacheStore(&dev->report_cache, value, data,
+                                     (ULONG)ret, now_ms());
+        }
+    } else {
+        ev.u.get_report_reply.err = EIO;
+    }
+
+    uhid_write(dev, &ev);
+}
+
+static void uhid_set_report(struct shield_dev *dev,
+                            const struct uhid_set_report_req *req)
+{
+    struct uhid_event ev;
+    int type = req->rtype == UHID_FEATURE_REPORT ?
+               HID_REPORT_TYPE_FEATURE : HID_REPORT_TYPE_OUTPUT;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_SET_REPORT_REPLY;
+    ev.u.set_report_reply.id = req->id;
+    ev.u.set_report_reply.err =
+        pid_set_report(dev, type, req->data, req->size) < 0 ? EIO : 0;
+
+    uhid_write(dev, &ev);
+}
+
+static void handle_uhid(struct shield_dev *dev)
+{
+    struct uhid_event ev;
+    int type;
+
+    while (read(dev->uhid_fd, &ev, sizeof(ev)) > 0) {
+        switch (ev.type) {
+        case UHID_OUTPUT:
+            type = ev.u.output.rtype == UHID_FEATURE_REPORT ?
+                   HID_REPORT_TYPE_FEATURE : HID_REPORT_TYPE_OUTPUT;
+            pid_set_report(dev, type, ev.u.output.data, ev.u.output.size);
+            break;
+
+        case UHID_START:
+            fprintf(stderr, "uhid: started %.3f ms after create\n",
+                    (now_ns() - dev->create_ns) / 1e6);
+            break;
+
+        case UHID_GET_REPORT:
+            uhid_get_report(dev, &ev.u.get_report);
+            break;
+
+        case UHID_SET_REPORT:
+            uhid_set_report(dev, &ev.u.set_report);
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+/*
+ * uinput side: EV_FF effects are translated into the PID reports a
+ * DirectInput game would have sent, so that both paths share the same
+ * PID-to-motor translation.
+ */
+
+static int ff_create_block(struct shield_dev *dev, UCHAR *block)
+{
+    UCHAR report[NVSHIELD_PID_GET_REPORT_SIZE];
+
+    if (*block != 0)
+        return 0;
+
+    /* Create New Effect, then Block Load for the index it got */
+    report[0] = 0x09;
+    report[1] = NvShieldEffectConstant;
+    pid_set_report(dev, HID_REPORT_TYPE_FEATURE, report, 2);
+
+    if (!NvShieldGetReport(&dev->state, 0x0320, report, sizeof(report)) || report[2] != 1)
+        return -ENOSPC;
+
+    *block = report[1];
+    return 0;
+}
+
+static void ff_set_effect(struct shield_dev *dev, UCHAR block,
+                          const struct ff_effect *effect, UCHAR axes, int level)
+{
+    UCHAR report[13];
+
+    memset(report, 0, sizeof(report));
+    report[0] = 0x21;   /* Set Effect */
+    report[1] = block;
+    report[2] = NvShieldEffectConstant;
+    put_le16(&report[3], effect->replay.length < 0x7FFF ? effect->replay.length : 0x7FFF);
+    report[9] = 0xFF;   /* gain */
+    report[11] = axes;
+    /* uinput counts from south through west, PID from north through east */
+    report[12] = (UCHAR)((effect->direction >> 8) + 128);
+    pid_set_report(dev, HID_REPORT_TYPE_OUTPUT, report, sizeof(report));
+
+    report[0] = 0x05;   /* Set Constant Force */
+    report[1] = block;
+    report[2] = (UCHAR)(level & 0xFF);
+    report[3] = (UCHAR)((level >> 8) & 0xFF);
+    pid_set_report(dev, HID_REPORT_TYPE_OUTPUT, report, 4);
+}
+
+/*
+ * A rumble effect plays on a constant force block per motor, the strong
+ * magnitude on the X axis and the weak one on the Y axis; a constant
+ * effect on a single block pointing its way.
+ */
+static int ff_upload(struct shield_dev *dev, const struct ff_effect *effect)
+{
+    UCHAR *blocks;
+    int level;
+
+    if (effect->id < 0 || effect->id >= FF_EFFECTS_MAX)
+        return -EINVAL;
+    blocks = dev->effect_blocks[effect->id];
+
+    switch (effect->type) {
+    case FF_RUMBLE:
+        if (ff_create_block(dev, &blocks[0]) < 0 || ff_create_block(dev, &blocks[1]) < 0)
+            return -ENOSPC;
+        ff_set_effect(dev, blocks[0], effect, NVSHIELD_EFFECT_AXIS_X,
+                      effect->u.rumble.strong_magnitude >> 8);
+        ff_set_effect(dev, blocks[1], effect, NVSHIELD_EFFECT_AXIS_Y,
+                      effect->u.rumble.weak_magnitude >> 8);
+        return 0;
+
+    case FF_CONSTANT:
+        if (ff_create_block(dev, &blocks[0]) < 0)
+            return -ENOSPC;
+        level = effect->u.constant.level / 128;
+        if (level > 255)
+            level = 255;
+        else if (level < -255)
+            level = -255;
+        ff_set_effect(dev, blocks[0], effect,
+                      NVSHIELD_EFFECT_AXIS_X | NVSHIELD_EFFECT_AXIS_Y | NVSHIELD_EFFECT_POLAR,
+                      level);
+        return 0;
+
+    default:
+        return -EINVAL;
+    }
+}
+
+static void ff_erase(struct shield_dev *dev, int id)
+{
+    UCHAR report[2];
+    int i;
+
+    if (id < 0 || id >= FF_EFFECTS_MAX)
+        return;
+
+    for (i = 0; i < 2; i++) {
+        if (dev->effect_blocks[id][i] == 0)
+            continue;
+
+        report[0] = 0x0B;   /* Block Free */
+        report[1] = dev->effect_blocks[id][i];
+        pid_set_report(dev, HID_REPORT_TYPE_OUTPUT, report, sizeof(report));
+        dev->effect_blocks[id][i] = 0;
+    }
+}
+
+static void ff_play(struct shield_dev *dev, int id, int count)
+{
+    UCHAR report[4];
+    int i;
+
+    if (id < 0 || id >= FF_EFFECTS_MAX)
+        return;
+
+    for (i = 0; i < 2; i++) {
+        if (dev->effect_blocks[id][i] == 0)
+            continue;
+
+        report[0] = 0x0A;   /* Effect operation */
+        report[1] = dev->effect_blocks[id][i];
+        report[2] = count ? 1 : 3;
+        report[3] = (UCHAR)(count < 0xFF ? count : 0xFE);   /* 0xFF loops forever */
+        pid_set_report(dev, HID_REPORT_TYPE_OUTPUT, report, sizeof(report));
+    }
+}
+
+static void ff_gain(struct shield_dev *dev, int gain)
+{
+    UCHAR report[2];
+
+    report[0] = 0x0D;   /* Device gain */
+    report[1] = (UCHAR)(gain >> 8);
+    pid_set_report(dev, HID_REPORT_TYPE_OUTPUT, report, sizeof(report));
+}
+
+static int uinput_create(struct shield_dev *dev)
+{
+    struct uinput_setup setup;
+
+    dev->uinput_fd = open("/dev/uinput", O_RDWR | O_CLOEXEC | O_NONBLOCK);
+    if (dev->uinput_fd < 0) {
+        perror("/dev/uinput");
+        return -1;
+    }
+
+    if (ioctl(dev->uinput_fd, UI_SET_EVBIT, EV_FF) < 0 ||
+        ioctl(dev->uinput_fd, UI_SET_FFBIT, FF_RUMBLE) < 0 ||
+        ioctl(dev->uinput_fd, UI_SET_FFBIT, FF_CONSTANT) < 0 ||
+        ioctl(dev->uinput_fd, UI_SET_FFBIT, FF_GAIN) < 0) {
+        perror("uinput setup");
+        return -1;
+    }
+
+    memset(&setup, 0, sizeof(setup));
+    setup.id.bustype = BUS_VIRTUAL;
+    setup.id.vendor = NVSHIELD_VENDOR_ID;
+    setup.id.product = NVSHIELD_PRODUCT_ID;
+    setup.ff_effects_max = FF_EFFECTS_MAX;
+    strcpy(setup.name, "NVIDIA Shield Controller Force Feedback");
+
+    if (ioctl(dev->uinput_fd, UI_DEV_SETUP, &setup) < 0 ||
+        ioctl(dev->uinput_fd, UI_DEV_CREATE) < 0) {
+        perror("uinput create");
+        return -1;
+    }
+    return 0;
+}
+
+static void handle_uinput(struct shield_dev *dev)
+{
+    struct input_event ev;
+    struct uinput_ff_upload upload;
+    struct uinput_ff_erase erase;
+
+    while (read(dev->uinput_fd, &ev, sizeof(ev)) == sizeof(ev)) {
+        if (ev.type == EV_UINPUT && ev.code == UI_FF_UPLOAD) {
+            memset(&upload, 0, sizeof(upload));
+            upload.request_id = ev.value;
+            if (ioctl(dev->uinput_fd, UI_BEGIN_FF_UPLOAD, &upload) < 0)
+                continue;
+
+            upload.retval = ff_upload(dev, &upload.effect);
+            ioctl(dev->uinput_fd, UI_END_FF_UPLOAD, &upload);
+        } else if (ev.type == EV_UINPUT && ev.code == UI_FF_ERASE) {
+            memset(&erase, 0, sizeof(erase));
+            erase.request_id = ev.value;
+            if (ioctl(dev->uinput_fd, UI_BEGIN_FF_ERASE, &erase) < 0)
+                continue;
+
+            ff_erase(dev, erase.effect_id);
+            erase.retval = 0;
+            ioctl(dev->uinput_fd, UI_END_FF_ERASE, &erase);
+        } else if (ev.type == EV_FF) {
+            if (ev.code == FF_GAIN)
+                ff_gain(dev, ev.value);
+            else
+                ff_play(dev, ev.code, ev.value);
+        }
+    }
+}
+
+/*
+ * Report sources
+ */
+
+static void handle_hidraw(struct shield_dev *dev)
+{
+    UCHAR buf[64];
+    ssize_t len;
+    int n;
+
+    for (n = 0; n < MAX_BATCH; n++) {
+        len = read(dev->hidraw_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            if (len == 0 || errno != EAGAIN) {
+                fprintf(stderr, "controller disconnected\n");
+                running = 0;
+            }
+            return;
+        }
+        uhid_input(dev, buf, (ULONG)len);
+    }
+}
+
+/*
+ * The -C file: one setting per line, named like the driver's registry
+ * value, # for comments. Those absent or out of range keep their default.
+ */
+static const struct {
+    const char *name;
+    size_t offset;
+} setting_fields[] = {
+    { "TrackpadScaleX", offsetof(NVSHIELD_SETTINGS, TrackpadScaleX) },
+    { "TrackpadScaleY", offsetof(NVSHIELD_SETTINGS, TrackpadScaleY) },
+    { "VolumeButtons",  offsetof(NVSHIELD_SETTINGS, VolumeButtons) },
+    { "RumbleGain",     offsetof(NVSHIELD_SETTINGS, RumbleGain) },
+    { "RumbleFlags",    offsetof(NVSHIELD_SETTINGS, RumbleFlags) },
+    { "Calibrate",      offsetof(NVSHIELD_SETTINGS, Calibrate) },
+    { "InputKeepAlive", offsetof(NVSHIELD_SETTINGS, InputKeepAlive) },
+};
+
+static int settings_apply(struct shield_dev *dev)
+{
+    NVSHIELD_CONFIG *config;
+    const NVSHIELD_CONFIG *old;
+
+    config = malloc(sizeof(*config));
+    if (config == NULL)
+        return -1;
+
+    NvShieldCompileConfig(config, dev->state.model, &dev->settings,
+                          dev->state.calibration);
+
+    /* every reader runs on this thread, the old snapshot can go at once */
+    old = dev->state.config;
+    dev->state.config = config;
+    if (old != &dev->state.defaultConfig)
+        free((void *)old);
+    return 0;
+}
+
+static int settings_load(struct shield_dev *dev)
+{
+    NVSHIELD_SETTINGS settings;
+    char line[256], name[64];
+    unsigned long value;
+    size_t i;
+    FILE *f;
+
+    f = fopen(dev->settings_path, "r");
+    if (f == NULL) {
+        perror(dev->settings_path);
+        return -1;
+    }
+
+    NvShieldDefaultSettings(&settings);
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, " %63[A-Za-z] = %lu", name, &value) != 2)
+            continue;
+
+        for (i = 0; i < sizeof(setting_fields) / sizeof(setting_fields[0]); i++) {
+            if (strcasecmp(name, setting_fields[i].name) == 0)
+                break;
+        }
+        if (i == sizeof(setting_fields) / sizeof(setting_fields[0])) {
+            fprintf(stderr, "%s: no setting %s\n", dev->settings_path, name);
+            continue;
+        }
+
+        *(ULONG *)((char *)&settings + setting_fields[i].offset) = (ULONG)value;
+    }
+
+    fclose(f);
+
+    if (!NvShieldCheckSettings(&settings))
+        fprintf(stderr, "%s: values out of range left at their default\n",
+                dev->settings_path);
+
+    dev->settings = settings;
+    if (settings_apply(dev) < 0)
+        return -1;
+
+    fprintf(stderr, "settings:");
+    for (i = 0; i < sizeof(setting_fields) / sizeof(setting_fields[0]); i++)
+        fprintf(stderr, " %s=%u", setting_fields[i].name,
+                *(ULONG *)((char *)&settings + setting_fields[i].offset));
+    fprintf(stderr, "\n");
+    return 0;
+}
+
+/*
+ * The -K file: a line per stick axis, X, Y, Z then Rz, with its resting
+ * position, minimum and maximum, as NvShieldTakeCalibration() gives them.
+ */
+static void calibration_load(struct shield_dev *dev)
+{
+    NVSHIELD_AXIS_CALIBRATION calibration[NVSHIELD_CALIBRATION_AXES];
+    unsigned center, min, max;
+    char name[8];
+    int axis;
+    FILE *f;
+
+    f = fopen(dev->calibration_path, "r");
+    if (f == NULL)
+        return;             /* first run */
+
+    for (axis = 0; axis < NVSHIELD_CALIBRATION_AXES; axis++) {
+        if (fscanf(f, " %7s %u %u %u", name, &center, &min, &max) != 4 ||
+            center > 0xFFFF || min > 0xFFFF || max > 0xFFFF)
+            break;
+        calibration[axis].Center = (USHORT)center;
+        calibration[axis].Min = (USHORT)min;
+        calibration[axis].Max = (USHORT)max;
+    }
+
+    fclose(f);
+
+    if (axis < NVSHIELD_CALIBRATION_AXES ||
+        !NvShieldLoadCalibration(&dev->state, calibration))
+        fprintf(stderr, "%s: ignored, the sticks start uncalibrated\n",
+                dev->calibration_path);
+}
+
+/* Writes the estimate the tables were last built from to -K */
+static void calibration_save(struct shield_dev *dev)
+{
+    static const char *const names[NVSHIELD_CALIBRATION_AXES] = { "X", "Y", "Z", "Rz" };
+    const NVSHIELD_AXIS_CALIBRATION *calibration = dev->state.calibration;
+    int axis;
+    FILE *f;
+
+    dev->calibration_unsaved = 0;
+    dev->calibration_save_due = now_ms() + NVSHIELD_CALIBRATION_SAVE_MS;
+
+    f = fopen(dev->calibration_path, "w");
+    if (f == NULL) {
+        perror(dev->calibration_path);
+        return;
+    }
+    for (axis = 0; axis < NVSHIELD_CALIBRATION_AXES; axis++)
+        fprintf(f, "%s %u %u %u\n", names[axis], calibration[axis].Center,
+                calibration[axis].Min, calibration[axis].Max);
+    fclose(f);
+}
+
+/*
+ * Rebuilds the stick tables, unless they were rebuilt less than
+ * NVSHIELD_CALIBRATION_PERIOD_MS ago: the Calibrate stage asks again with
+ * the next report for as long as the estimate stays away from them.
+ */
+static void calibration_update(struct shield_dev *dev)
+{
+    NVSHIELD_AXIS_CALIBRATION calibration[NVSHIELD_CALIBRATION_AXES];
+    ULONGLONG now = now_ms();
+
+    dev->recalibrate = 0;
+    if (now < dev->recalibrate_due)
+        return;
+    dev->recalibrate_due = now + NVSHIELD_CALIBRATION_PERIOD_MS;
+
+    NvShieldTakeCalibration(&dev->state, calibration);
+    if (settings_apply(dev) < 0 || dev->calibration_path == NULL)
+        return;
+
+    dev->calibration_unsaved = 1;
+    if (now >= dev->calibration_save_due)
+        calibration_save(dev);
+}
+
+/*
+ * Synthesizes the reports of a controller whose left stick turns in
+ * circles, with a trackpad swipe, a volume key press and a right stick
+ * push every second, for the controls the simulated model has. The 2017
+ * model also answers a host command every second, on its vendor input
+ * report 3.
+ */
+static void simulate_report(struct shield_dev *dev)
+{
+    const NVSHIELD_MODEL *model = dev->state.model;
+    static const int circle[8][2] = {
+        { 0x8000, 0x0000 }, { 0xD000, 0x2F00 }, { 0xFFFF, 0x8000 },
+        { 0xD000, 0xD000 }, { 0x8000, 0xFFFF }, { 0x2F00, 0xD000 },
+        { 0x0000, 0x8000 }, { 0x2F00, 0x2F00 },
+    };
+    UCHAR buf[32];
+    ULONG len = NVSHIELD_INPUT_REPORT_SIZE;
+    unsigned long t = dev->sim_tick++;
+    unsigned phase = (unsigned)(t % 1000);
+
+    memset(buf, 0, sizeof(buf));
+
+    if (phase == 700 && model->ProductId == NVSHIELD_PRODUCT_ID_2017) {
+        buf[0] = 0x03;
+        buf[1] = 0x03;                  /* haptics */
+        len = 32;
+    } else if (phase >= 100 && phase < 200 && model->TrackpadReportId != 0) {
+        buf[0] = 0x02;
+        buf[1] = 0x08;                  /* finger down */
+        buf[2] = (UCHAR)(phase - 100);
+        buf[4] = (UCHAR)(phase - 100) / 2;
+    } else {
+        buf[0] = 0x01;
+        if (model->ConsumerReportId != 0)
+            buf[2] = phase >= 500 && phase < 600 ? 0x08 : 0x00; /* volume up */
+        buf[3] = 0x0F;                  /* hat centered */
+        put_le16(&buf[4], circle[(t / 64) % 8][0]);
+        put_le16(&buf[6], circle[(t / 64) % 8][1]);
+        put_le16(&buf[8], phase >= 300 && phase < 400 ? 0xC000 : 0x8000);
+        put_le16(&buf[10], phase >= 300 && phase < 400 ? 0x6000 : 0x8000);
+    }
+
+    uhid_input(dev, buf, len);
+}
+
+static void handle_sim(struct shield_dev *dev)
+{
+    uint64_t expirations;
+
+    if (read(dev->sim_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+
+    while (expirations--)
+        simulate_report(dev);
+}
+
+static int sim_create(struct shield_dev *dev, long interval_us)
+{
+    struct itimerspec its;
+
+    dev->sim_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (dev->sim_fd < 0) {
+        perror("timerfd_create");
+        return -1;
+    }
+
+    memset(&its, 0, sizeof(its));
+    its.it_interval.tv_nsec = interval_us * 1000;
+    its.it_value.tv_nsec = interval_us * 1000;
+    return timerfd_settime(dev->sim_fd, 0, &its, NULL);
+}
+
+static int signal_create(struct shield_dev *dev)
+{
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (dev->settings_path != NULL)
+        sigaddset(&mask, SIGHUP);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    dev->signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    return dev->signal_fd < 0 ? -1 : 0;
+}
+
+static void handle_signal(struct shield_dev *dev)
+{
+    struct signalfd_siginfo info;
+
+    while (read(dev->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        /* the motors may no longer run the way they did */
+        if (info.ssi_signo == SIGHUP) {
+            if (settings_load(dev) == 0)
+                send_rumble(dev);
+        } else
+            running = 0;
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-v] [-c] [-p profile] [-M curve] [-t ms] [-r ms] [-m name] [-C file]\n"
+            "          [-K file] /dev/hidrawN\n"
+            "       %s [-v] [-p profile] [-M curve] [-t ms] [-r ms] [-m name] [-C file]\n"
+            "          [-K file] -s [-i interval_us] [-P product]\n"
+            "       %s [-m name] -w\n"
+            "\n"
+            "  -c  send motor reports as SET_REPORT control transfers\n"
+            "  -p  PID reports to declare: full (default), rumble or constant\n"
+            "  -M  move the pointer with the right stick: precise, normal or fast\n"
+            "  -t  stop the motors after ms without force feedback updates,\n"
+            "      0 for never (default %d)\n"
+            "  -r  send at most one motor report every ms\n"
+            "  -m  shared memory object of the state (default " DEFAULT_SHM_NAME ")\n"
+            "  -C  settings file of Name=value lines, read again on SIGHUP\n"
+            "  -K  file keeping the stick calibration across runs\n"
+            "  -w  print the state published by a running daemon\n"
+            "  -s  simulate a controller instead of reading hidraw\n"
+            "  -i  simulated report interval in microseconds (default 1000)\n"
+            "  -P  USB product ID of the simulated model, in hex (default 7210)\n"
+            "  -v  log every motor report\n",
+            prog, prog, prog, DEFAULT_RUMBLE_TIMEOUT);
+}
+
+int main(int argc, char **argv)
+{
+    struct shield_dev dev;
+    struct epoll_event events[MAX_EVENTS];
+    struct uhid_event destroy;
+    long interval_us = 1000;
+    long product = 0;
+    struct hidraw_devinfo info;
+    int simulate = 0;
+    int watch = 0;
+    int opt, n, i;
+
+    memset(&dev, 0, sizeof(dev));
+    dev.hidraw_fd = dev.sim_fd = dev.mouse_fd = dev.watchdog_fd = dev.playback_fd = dev.rumble_fd = -1;
+    dev.uhid_fd = dev.uinput_fd = -1;
+    NvShieldInitState(&dev.state);
+    NvShieldDefaultSettings(&dev.settings);
+    NvShieldReportCacheInit(&dev.report_cache);
+    dev.shm_name = DEFAULT_SHM_NAME;
+    dev.rumble_timeout = DEFAULT_RUMBLE_TIMEOUT;
+
+    while ((opt = getopt(argc, argv, "cp:M:t:r:m:C:K:wsi:P:vh")) != -1) {
+        switch (opt) {
+        case 'c':
+            dev.rumble_control = 1;
+            break;
+        case 'p':
+            if (strcmp(optarg, "full") == 0)
+                dev.pid_profile = NvShieldPidProfileFull;
+            else if (strcmp(optarg, "rumble") == 0)
+                dev.pid_profile = NvShieldPidProfileRumble;
+            else if (strcmp(optarg, "constant") == 0)
+                dev.pid_profile = NvShieldPidProfileConstant;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'M':
+            if (strcmp(optarg, "precise") == 0)
+                dev.state.mouseCurve = NvShieldMousePrecise;
+            else if (strcmp(optarg, "normal") == 0)
+                dev.state.mouseCurve = NvShieldMouseNormal;
+            else if (strcmp(optarg, "fast") == 0)
+                dev.state.mouseCurve = NvShieldMouseFast;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 't':
+            dev.rumble_timeout = (ULONG)strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            dev.rumble_interval = (ULONG)strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            dev.shm_name = optarg;
+            break;
+        case 'C':
+            dev.settings_path = optarg;
+            break;
+        case 'K':
+            dev.calibration_path = optarg;
+            break;
+        case 'w':
+            watch = 1;
+            break;
+        case 's':
+            simulate = 1;
+            break;
+        case 'i':
+            interval_us = strtol(optarg, NULL, 0);
+            break;
+        case 'P':
+            product = strtol(optarg, NULL, 16);
+            break;
+        case 'v':
+            dev.verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (watch)
+        return watch_shared(dev.shm_name);
+
+    if ((!simulate && optind != argc - 1) || interval_us <= 0 ||
+        interval_us >= 1000000) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    dev.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (dev.epoll_fd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    if (simulate) {
+        if (sim_create(&dev, interval_us) < 0 || add_fd(&dev, dev.sim_fd) < 0)
+            return 1;
+    } else {
+        dev.hidraw_fd = open(argv[optind], O_RDWR | O_CLOEXEC | O_NONBLOCK);
+        if (dev.hidraw_fd < 0) {
+            perror(argv[optind]);
+            return 1;
+        }
+        if (add_fd(&dev, dev.hidraw_fd) < 0)
+            return 1;
+        if (ioctl(dev.hidraw_fd, HIDIOCGRAWINFO, &info) == 0)
+            product = info.product;
+    }
+
+    if (product != 0) {
+        const NVSHIELD_MODEL *model = NvShieldFindModel((USHORT)product);
+
+        if (model == NULL)
+            fprintf(stderr, "unknown product %04lx, handled as %04x\n",
+                    product, NVSHIELD_PRODUCT_ID);
+        else
+            NvShieldSetModel(&dev.state, model);
+    }
+
+    if (watchdog_create(&dev) < 0 || add_fd(&dev, dev.watchdog_fd) < 0 ||
+        playback_create(&dev) < 0 || add_fd(&dev, dev.playback_fd) < 0)
+        return 1;
+
+    if (dev.rumble_interval != 0 &&
+        (rumble_create(&dev) < 0 || add_fd(&dev, dev.rumble_fd) < 0))
+        return 1;
+
+    if (dev.state.mouseCurve != NvShieldMouseOff && dev.state.model->TrackpadReportId == 0) {
+        fprintf(stderr, "no trackpad on this model, mouse emulation off\n");
+        dev.state.mouseCurve = NvShieldMouseOff;
+    }
+
+    if (dev.state.mouseCurve != NvShieldMouseOff &&
+        (mouse_create(&dev) < 0 || add_fd(&dev, dev.mouse_fd) < 0))
+        return 1;
+
+    if (dev.calibration_path != NULL)
+        calibration_load(&dev);
+
+    /* compiled for the model, with the calibration */
+    if (dev.settings_path != NULL && settings_load(&dev) < 0)
+        return 1;
+
+    /* readers are optional, so is the shared state */
+    shared_create(&dev);
+
+    if (signal_create(&dev) < 0 || add_fd(&dev, dev.signal_fd) < 0 ||
+        uhid_create(&dev) < 0 || add_fd(&dev, dev.uhid_fd) < 0 ||
+        uinput_create(&dev) < 0 || add_fd(&dev, dev.uinput_fd) < 0) {
+        shared_destroy(&dev);
+        return 1;
+    }
+
+    dev.start_ns = now_ns();
+
+    while (running) {
+        n = epoll_wait(dev.epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == dev.hidraw_fd)
+                handle_hidraw(&dev);
+            else if (fd == dev.sim_fd)
+                handle_sim(&dev);
+            else if (fd == dev.mouse_fd)
+                handle_mouse(&dev);
+            else if (fd == dev.watchdog_fd)
+                handle_watchdog(&dev);
+            else if (fd == dev.playback_fd)
+                handle_playback(&dev);
+            else if (fd == dev.rumble_fd)
+                handle_rumble(&dev);
+            else if (fd == dev.uhid_fd)
+                handle_uhid(&dev);
+            else if (fd == dev.uinput_fd)
+                handle_uinput(&dev);
+            else if (fd == dev.signal_fd)
+                handle_signal(&dev);
+        }
+
+        /* off the report path, as the driver's work item */
+        if (dev.recalibrate)
+            calibration_update(&dev);
+    }
+
+    if (dev.calibration_unsaved)
+        calibration_save(&dev);
+
+    memset(&destroy, 0, sizeof(destroy));
+    destroy.type = UHID_DESTROY;
+    uhid_write(&dev, &destroy);
+    ioctl(dev.uinput_fd, UI_DEV_DESTROY);
+
+    shared_destroy(&dev);
+
+    print_input_stats(&dev);
+    print_rumble_stats(&dev);
+    print_latency_stats(&dev);
+    print_stage_stats(&dev);
+    fprintf(stderr, "GET_REPORT cache: %u hits, %u misses\n",
+            dev.report_cache.Hits, dev.report_cache.Misses);
+
+    return 0;
+}
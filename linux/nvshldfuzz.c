@@ -0,0 +1,431 @@
+/*
+ * nvshldfuzz.c - fuzz targets of the shared core.
+ *
+ * Everything the core parses comes from the controller or from whatever
+ * application opens the HID collection: SET_REPORT and GET_REPORT
+ * requests with any report ID and length, the configuration and Report
+ * Descriptors of the device, and interrupt transfers. Each target feeds
+ * one of those entry points arbitrary input:
+ *
+ *   pid          sequences of SET_REPORT and GET_REPORT requests of any
+ *                type, ID and length, interleaved with the effect timers,
+ *                the condition effects and the motor report
+ *   descriptor   the configuration, HID and Report Descriptor patching of
+ *                both models, then the parsing of what it produced
+ *   parse        NvShieldHidNextItem, NvShieldGetInputLayout and
+ *                NvShieldGetInputReportSizes over a Report Descriptor
+ *   input        interrupt transfers through the input pipeline of the
+ *                transports, with arbitrary settings
+ *
+ * The target is picked with -DFUZZ_TARGET=fuzz_<name>. Built with
+ * -fsanitize=fuzzer this is a libFuzzer target; otherwise main() mutates
+ * the inputs itself for the given number of seconds, which is enough to
+ * run it under the sanitizers of gcc. Every buffer handed to the core is
+ * allocated to the exact length it is told, so that AddressSanitizer
+ * catches a read or write past it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shield.h"
+#include "public.h"
+#include "sim2017.h"
+
+#ifndef FUZZ_TARGET
+#define FUZZ_TARGET fuzz_pid
+#endif
+
+struct fuzz_input {
+    const UCHAR *data;
+    size_t size;
+};
+
+static UCHAR take(struct fuzz_input *in)
+{
+    if (in->size == 0)
+        return 0;
+
+    in->size--;
+    return *in->data++;
+}
+
+static USHORT take16(struct fuzz_input *in)
+{
+    USHORT value = take(in);
+
+    return (USHORT)(value | take(in) << 8);
+}
+
+/* Exactly Length bytes, the next ones of the input as far as they go */
+static UCHAR *take_buffer(struct fuzz_input *in, ULONG Length)
+{
+    UCHAR *buffer = malloc(Length != 0 ? Length : 1);
+    ULONG n = Length < in->size ? Length : (ULONG)in->size;
+
+    if (buffer == NULL)
+        abort();
+
+    memcpy(buffer, in->data, n);
+    memset(buffer + n, 0, Length - n);
+    in->data += n;
+    in->size -= n;
+    return buffer;
+}
+
+static const NVSHIELD_MODEL *take_model(struct fuzz_input *in)
+{
+    return NvShieldFindModel(take(in) & 1 ? NVSHIELD_PRODUCT_ID_2017
+                                          : NVSHIELD_PRODUCT_ID);
+}
+
+static NVSHIELD_STATE state;
+
+/* Not static, only the one FUZZ_TARGET names is called */
+int fuzz_pid(const UCHAR *data, size_t size);
+int fuzz_descriptor(const UCHAR *data, size_t size);
+int fuzz_parse(const UCHAR *data, size_t size);
+int fuzz_input(const UCHAR *data, size_t size);
+
+int fuzz_pid(const UCHAR *data, size_t size)
+{
+    struct fuzz_input in = { data, size };
+    UCHAR rumble[NVSHIELD_RUMBLE_REPORT_MAX];
+    ULONGLONG now = 1;
+    USHORT left, right;
+
+    NvShieldInitState(&state);
+    NvShieldSetModel(&state, take_model(&in));
+    NvShieldSetPidEffects(&state, take(&in) & NVSHIELD_PID_EFFECT_ALL);
+
+    while (in.size != 0) {
+        UCHAR op = take(&in);
+        USHORT value = (USHORT)((op >> 4 & 3) << 8 | take(&in));
+        ULONG length = take(&in);
+        UCHAR *buffer;
+
+        now += take(&in);
+
+        switch (op & 7) {
+        case 0:
+        case 1:
+        case 2:
+            buffer = take_buffer(&in, length);
+            if (NvShieldSetReport(&state, value, buffer, length) == NvShieldPidUpdateRumble)
+                NvShieldBuildRumbleReport(&state, rumble);
+            free(buffer);
+            break;
+        case 3:
+            buffer = take_buffer(&in, length);
+            NvShieldGetReport(&state, value, buffer, length);
+            free(buffer);
+            break;
+        case 4:
+            NvShieldEffectTick(&state, now);
+            break;
+        case 5:
+            NvShieldRumbleExpiry(&state, now, length * 100);
+            NvShieldRumbleExpire(&state, now);
+            break;
+        case 6:
+            NvShieldConditionUpdate(&state, take16(&in), take16(&in), now);
+            break;
+        case 7:
+            NvShieldMixRumble(&state, &left, &right);
+            NvShieldBuildRumbleReport(&state, rumble);
+            break;
+        }
+
+        NvShieldRumbleNextExpiry(&state);
+        NvShieldEffectNextTick(&state);
+        NvShieldConditionPlaying(&state);
+    }
+
+    return 0;
+}
+
+static void parse_descriptor(const UCHAR *descriptor, ULONG length,
+                             const UCHAR *idMap, UCHAR reportId)
+{
+    static NVSHIELD_REPORT_SIZES sizes;
+    NVSHIELD_INPUT_LAYOUT layout;
+    NVSHIELD_HID_ITEM item;
+    ULONG offset = 0;
+
+    while (NvShieldHidNextItem(descriptor, length, &offset, &item))
+        ;
+
+    NvShieldGetInputLayout(descriptor, length, reportId, &layout);
+    NvShieldGetInputReportSizes(descriptor, length, idMap, &sizes);
+}
+
+int fuzz_descriptor(const UCHAR *data, size_t size)
+{
+    struct fuzz_input in = { data, size };
+    const NVSHIELD_MODEL *model = take_model(&in);
+    UCHAR op = take(&in);
+    ULONG effects = take(&in) & NVSHIELD_PID_EFFECT_ALL;
+    ULONG capacity = take16(&in) % 4096, length;
+    UCHAR idMap[256], deviceIds[256];
+    UCHAR *device, *buffer;
+    ULONG deviceLength = (ULONG)in.size, i;
+
+    switch (op & 3) {
+    case 0:
+        buffer = take_buffer(&in, deviceLength);
+        NvShieldPatchHidDescriptor(buffer, deviceLength, capacity);
+        free(buffer);
+        break;
+    case 1:
+        buffer = take_buffer(&in, deviceLength);
+        NvShieldPatchEndpointIntervals(buffer, deviceLength, (UCHAR)capacity);
+        free(buffer);
+        break;
+    case 2:
+        device = take_buffer(&in, deviceLength);
+        buffer = take_buffer(&in, capacity);
+        length = NvShieldPatchReportDescriptor(model, effects, device, deviceLength,
+                                               buffer, capacity, idMap);
+        /* only written if it fit */
+        if (length != 0 && length <= capacity)
+            parse_descriptor(buffer, length, idMap, model->GamepadReportId);
+        /* every report moved goes down under its own ID again */
+        if (length != 0) {
+            NvShieldGetDeviceReportIds(idMap, deviceIds);
+            for (i = 1; i < 256; i++) {
+                if (idMap[i] != i && deviceIds[idMap[i]] != i)
+                    abort();
+            }
+        }
+        free(device);
+        free(buffer);
+        break;
+    case 3:
+        buffer = take_buffer(&in, capacity);
+        length = NvShieldBuildReportDescriptor(effects, buffer, capacity);
+        if (length != 0 && length <= capacity)
+            parse_descriptor(buffer, length, NULL, 0x01);
+        free(buffer);
+        break;
+    }
+
+    return 0;
+}
+
+int fuzz_parse(const UCHAR *data, size_t size)
+{
+    struct fuzz_input in = { data, size };
+    UCHAR reportId = take(&in);
+    UCHAR *idMap = take(&in) & 1 ? take_buffer(&in, 256) : NULL;
+    ULONG length = (ULONG)in.size;
+    UCHAR *descriptor = take_buffer(&in, length);
+
+    parse_descriptor(descriptor, length, idMap, reportId);
+
+    free(descriptor);
+    free(idMap);
+    return 0;
+}
+
+static NVSHIELD_INPUT_LAYOUT input_layout;
+static NVSHIELD_REPORT_SIZES input_sizes[2];    /* by model, 2017 last */
+static ULONGLONG input_now;
+
+/* The stages of NVSHIELD_INPUT_STAGES, as the transports run them */
+static ULONG input_pipeline(PVOID context, PUCHAR report, ULONG length)
+{
+    const NVSHIELD_GAMEPAD_STATE *gamepad;
+    NVSHIELD_INPUT input;
+
+    (void)context;
+    NvShieldInputInit(&input, &input_layout, report, length);
+
+    NvShieldCalibrateInput(&state, &input);
+
+    gamepad = NvShieldInputGamepad(&input);
+    if (gamepad != NULL) {
+        NvShieldMouseTick(&state, gamepad->Axes[NvShieldAxisZ], gamepad->Axes[NvShieldAxisRz]);
+        if (NvShieldConditionPlaying(&state))
+            NvShieldConditionUpdate(&state, gamepad->Axes[NvShieldAxisX],
+                                    gamepad->Axes[NvShieldAxisY], input_now);
+    }
+
+    return NvShieldTransformInputReport(&state, input.Report, input.Length);
+}
+
+static void input_init(void)
+{
+    static int done;
+    static UCHAR descriptor[4096];
+    UCHAR idMap[256];
+    ULONG length;
+
+    if (done)
+        return;
+    done = 1;
+
+    NvShieldGetInputLayout(G_DefaultReportDescriptor,
+                           G_DefaultReportDescriptorLength, 0x01, &input_layout);
+    NvShieldGetInputReportSizes(G_DefaultReportDescriptor,
+                                G_DefaultReportDescriptorLength, NULL, &input_sizes[0]);
+
+    length = NvShieldPatchReportDescriptor(NvShieldFindModel(NVSHIELD_PRODUCT_ID_2017),
+                                           NVSHIELD_PID_EFFECT_ALL, sim_2017_descriptor,
+                                           sizeof(sim_2017_descriptor), descriptor,
+                                           sizeof(descriptor), idMap);
+    NvShieldGetInputReportSizes(descriptor, length, idMap, &input_sizes[1]);
+}
+
+int fuzz_input(const UCHAR *data, size_t size)
+{
+    struct fuzz_input in = { data, size };
+    static NVSHIELD_CONFIG config;
+    NVSHIELD_SETTINGS settings;
+    UCHAR mouse[NVSHIELD_INPUT_REPORT_SIZE];
+    UCHAR op = take(&in);
+    const NVSHIELD_MODEL *model = NvShieldFindModel(op & 1 ? NVSHIELD_PRODUCT_ID_2017
+                                                           : NVSHIELD_PRODUCT_ID);
+    const NVSHIELD_REPORT_SIZES *sizes = op & 2 ? NULL : &input_sizes[op & 1];
+
+    input_init();
+
+    NvShieldInitState(&state);
+    NvShieldSetModel(&state, model);
+    state.mouseCurve = (UCHAR)(op >> 2 & 3);
+
+    NvShieldDefaultSettings(&settings);
+    settings.TrackpadScaleX = take(&in);
+    settings.TrackpadScaleY = take(&in);
+    settings.VolumeButtons = take(&in);
+    settings.RumbleGain = take(&in);
+    settings.RumbleFlags = take(&in);
+    settings.Calibrate = take(&in);
+    settings.InputKeepAlive = take16(&in);
+    NvShieldCheckSettings(&settings);
+    NvShieldCompileConfig(&config, model, &settings, state.calibration);
+    state.config = &config;
+
+    input_now = 1;
+
+    while (in.size != 0) {
+        ULONG length = take(&in) % 128;
+        UCHAR *buffer = take_buffer(&in, length);
+
+        input_now += take(&in);
+
+        length = NvShieldTransformInputTransfer(&state, sizes, buffer, length,
+                                                input_pipeline, NULL);
+        NvShieldInputUnchanged(&state, buffer, length, input_now);
+        NvShieldBuildMouseReport(&state, mouse);
+        free(buffer);
+    }
+
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const UCHAR *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const UCHAR *data, size_t size)
+{
+    return FUZZ_TARGET(data, size);
+}
+
+#ifndef NVSHIELD_LIBFUZZER
+
+#define MAX_INPUT   4096
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Starts every input from one of the seeds or from random bytes and
+ * applies a few byte flips, overwrites, insertions and truncations, so
+ * that most of them get past the first checks of the core.
+ */
+static size_t mutate(UCHAR *buf, unsigned *seed)
+{
+    unsigned pick = rand_r(seed) % 4;
+    const UCHAR *from = G_DefaultReportDescriptor;
+    size_t size = G_DefaultReportDescriptorLength, i, n;
+
+    if (pick == 0) {
+        size = rand_r(seed) % 512;
+        for (i = 0; i < size; i++)
+            buf[i] = (UCHAR)rand_r(seed);
+        return size;
+    }
+
+    if (pick != 1) {
+        from = sim_2017_descriptor;
+        size = sizeof(sim_2017_descriptor);
+    }
+
+    /* a few bytes for the target to pick its operations from */
+    for (i = 0; i < 4; i++)
+        buf[i] = (UCHAR)rand_r(seed);
+    memcpy(buf + 4, from, size);
+    size += 4;
+
+    for (n = rand_r(seed) % 8 + 1; n > 0; n--) {
+        i = rand_r(seed) % size;
+
+        switch (rand_r(seed) % 4) {
+        case 0:
+            buf[i] ^= (UCHAR)(1 << rand_r(seed) % 8);
+            break;
+        case 1:
+            buf[i] = (UCHAR)rand_r(seed);
+            break;
+        case 2:
+            if (size < MAX_INPUT) {
+                memmove(buf + i + 1, buf + i, size - i);
+                buf[i] = (UCHAR)rand_r(seed);
+                size++;
+            }
+            break;
+        case 3:
+            size = i;
+            break;
+        }
+
+        if (size == 0)
+            break;
+    }
+
+    return size;
+}
+
+int main(int argc, char **argv)
+{
+    static UCHAR buf[MAX_INPUT + 1];
+    double seconds = argc > 1 ? atof(argv[1]) : 10;
+    unsigned seed = argc > 2 ? (unsigned)strtoul(argv[2], NULL, 0) : (unsigned)time(NULL);
+    unsigned long long start = now_ns(), elapsed;
+    unsigned long execs = 0;
+    size_t size;
+
+    printf("seed %u\n", seed);
+
+    do {
+        unsigned i;
+
+        for (i = 0; i < 1000; i++) {
+            size = mutate(buf, &seed);
+            LLVMFuzzerTestOneInput(buf, size);
+        }
+        execs += i;
+        elapsed = now_ns() - start;
+    } while (elapsed < seconds * 1e9);
+
+    printf("%lu execs in %.1f s, %.0f execs/sec\n",
+           execs, elapsed / 1e9, execs / (elapsed / 1e9));
+    return 0;
+}
+
+#endif /* NVSHIELD_LIBFUZZER */
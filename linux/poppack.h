@@ -0,0 +1,5 @@
+/*
+ * poppack.h - what the Windows SDK header of the same name does, see
+ * pshpack1.h.
+ */
+#pragma pack(pop)
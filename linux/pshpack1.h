@@ -0,0 +1,5 @@
+/*
+ * pshpack1.h - what the Windows SDK header of the same name does, so that
+ * ../sys/public.h can be shared with the Linux tools.
+ */
+#pragma pack(push, 1)
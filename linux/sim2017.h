@@ -0,0 +1,79 @@
+/*
+ * sim2017.h - stand-in for the Report Descriptor of the 2017 controller.
+ *
+ * Not a capture: it declares what the 2017 model support expects of the
+ * real one, so that the descriptor patching, the report ID renumbering
+ * and the motor reports can be exercised with nvshldctrld -s -P 7214 and
+ * nvshldbench without the hardware. A gamepad collection whose report 1
+ * is laid out like the 2015 controller's, with the triggers on the
+ * Simulation Controls page, and a vendor collection carrying the host
+ * command reports, input 3 and output 4, whose IDs the PID reports also
+ * use.
+ */
+#ifndef SIM2017_H
+#define SIM2017_H
+
+static const UCHAR sim_2017_descriptor[] = {
+    0x05, 0x01,             /*  Usage Page (Desktop),               */
+    0x09, 0x05,             /*  Usage (Gamepad),                    */
+    0xA1, 0x01,             /*  Collection (Application),           */
+    0x85, 0x01,             /*      Report ID (1),                  */
+    0x05, 0x09,             /*      Usage Page (Button),            */
+    0x15, 0x00,             /*      Logical Minimum (0),            */
+    0x25, 0x01,             /*      Logical Maximum (1),            */
+    0x75, 0x01,             /*      Report Size (1),                */
+    0x95, 0x0A,             /*      Report Count (10),              */
+    0x19, 0x01,             /*      Usage Minimum (01h),            */
+    0x29, 0x0A,             /*      Usage Maximum (0Ah),            */
+    0x81, 0x02,             /*      Input (Variable),               */
+    0x95, 0x06,             /*      Report Count (6),               */
+    0x81, 0x03,             /*      Input (Constant, Variable),     */
+    0x05, 0x01,             /*      Usage Page (Desktop),           */
+    0x09, 0x39,             /*      Usage (Hat Switch),             */
+    0x25, 0x07,             /*      Logical Maximum (7),            */
+    0x35, 0x00,             /*      Physical Minimum (0),           */
+    0x46, 0x0E, 0x01,       /*      Physical Maximum (270),         */
+    0x65, 0x14,             /*      Unit (Degrees),                 */
+    0x75, 0x04,             /*      Report Size (4),                */
+    0x95, 0x01,             /*      Report Count (1),               */
+    0x81, 0x42,             /*      Input (Variable, Null State),   */
+    0x81, 0x03,             /*      Input (Constant, Variable),     */
+    0x65, 0x00,             /*      Unit (None),                    */
+    0x09, 0x01,             /*      Usage (Pointer),                */
+    0xA1, 0x00,             /*      Collection (Physical),          */
+    0x75, 0x10,             /*          Report Size (16),           */
+    0x95, 0x04,             /*          Report Count (4),           */
+    0x15, 0x00,             /*          Logical Minimum (0),        */
+    0x27, 0xFF, 0xFF, 0x00, 0x00, /*    Logical Maximum (65535),    */
+    0x35, 0x00,             /*          Physical Minimum (0),       */
+    0x47, 0xFF, 0xFF, 0x00, 0x00, /*    Physical Maximum (65535),   */
+    0x09, 0x30,             /*          Usage (X),                  */
+    0x09, 0x31,             /*          Usage (Y),                  */
+    0x09, 0x32,             /*          Usage (Z),                  */
+    0x09, 0x35,             /*          Usage (Rz),                 */
+    0x81, 0x02,             /*          Input (Variable),           */
+    0x05, 0x02,             /*          Usage Page (Simulation),    */
+    0x95, 0x02,             /*          Report Count (2),           */
+    0x09, 0xC5,             /*          Usage (Brake),              */
+    0x09, 0xC4,             /*          Usage (Accelerator),        */
+    0x81, 0x02,             /*          Input (Variable),           */
+    0xC0,                   /*      End Collection,                 */
+    0xC0,                   /*  End Collection,                     */
+    0x06, 0x00, 0xFF,       /*  Usage Page (FF00h),                 */
+    0x09, 0x01,             /*  Usage (01h),                        */
+    0xA1, 0x01,             /*  Collection (Application),           */
+    0x85, 0x03,             /*      Report ID (3),                  */
+    0x15, 0x00,             /*      Logical Minimum (0),            */
+    0x26, 0xFF, 0x00,       /*      Logical Maximum (255),          */
+    0x75, 0x08,             /*      Report Size (8),                */
+    0x95, 0x1F,             /*      Report Count (31),              */
+    0x09, 0x01,             /*      Usage (01h),                    */
+    0x81, 0x02,             /*      Input (Variable),               */
+    0x85, 0x04,             /*      Report ID (4),                  */
+    0x95, 0x1F,             /*      Report Count (31),              */
+    0x09, 0x02,             /*      Usage (02h),                    */
+    0x91, 0x02,             /*      Output (Variable),              */
+    0xC0                    /*  End Collection                      */
+};
+
+#endif /* SIM2017_H */
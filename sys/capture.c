@@ -0,0 +1,409 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    capture.c
+
+Abstract:
+
+    USBPcap-format capture of the URBs going through the filter, written to
+    a preallocated ring that user mode maps and drains directly.
+
+Environment:
+
+    kernel mode only
+
+Revision History:
+
+--*/
+
+#include <hidusbfx2.h>
+
+#define NVSHIELD_CAPTURE_TAG    (ULONG)((((ULONG)'N') << 16) + (((ULONG)'V') << 8) + 'C')
+
+#define NVSHIELD_CAPTURE_MAPPING_SIZE \
+    (FIELD_OFFSET(NVSHIELD_CAPTURE_RING, Data) + NVSHIELD_CAPTURE_RING_SIZE)
+
+//
+// 100ns intervals between 1601-01-01 (KeQuerySystemTime) and 1970-01-01 (pcap)
+//
+#define EPOCH_DIFFERENCE_100NS  116444736000000000LL
+
+volatile LONG G_CaptureEnabled = 0;
+
+static struct {
+    KSPIN_LOCK Lock;
+
+    PNVSHIELD_CAPTURE_RING Ring;
+    PMDL Mdl;
+    ULONG Head;             // Ring->Head, which user mode can write, mirrors it
+
+    PVOID UserAddress;
+    WDFFILEOBJECT UserFile;
+} G_Capture;
+
+VOID
+NvShieldCaptureDriverInit(
+    VOID
+)
+{
+    KeInitializeSpinLock(&G_Capture.Lock);
+}
+
+NTSTATUS
+NvShieldCaptureInitialize(
+    VOID
+)
+/*++
+
+Routine Description:
+
+    Allocates the ring. Called when the control device is created.
+
+--*/
+{
+    PNVSHIELD_CAPTURE_RING ring;
+    PMDL mdl;
+
+    ring = (PNVSHIELD_CAPTURE_RING)ExAllocatePoolWithTag(NonPagedPool,
+        NVSHIELD_CAPTURE_MAPPING_SIZE, NVSHIELD_CAPTURE_TAG);
+    if (ring == NULL) {
+        NVSHIELD_COUNT(AllocationFailures);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    mdl = IoAllocateMdl(ring, NVSHIELD_CAPTURE_MAPPING_SIZE, FALSE, FALSE, NULL);
+    if (mdl == NULL) {
+        NVSHIELD_COUNT(AllocationFailures);
+        ExFreePool(ring);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    MmBuildMdlForNonPagedPool(mdl);
+
+    RtlZeroMemory(ring, FIELD_OFFSET(NVSHIELD_CAPTURE_RING, Data));
+    ring->Magic = NVSHIELD_CAPTURE_MAGIC;
+    ring->DataSize = NVSHIELD_CAPTURE_RING_SIZE;
+
+    G_Capture.Ring = ring;
+    G_Capture.Mdl = mdl;
+    G_Capture.Head = 0;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+NvShieldCaptureCleanup(
+    VOID
+)
+/*++
+
+Routine Description:
+
+    Frees the ring once the control device, and thus every handle that
+    could still have it mapped, is gone.
+
+--*/
+{
+    KIRQL irql;
+    PNVSHIELD_CAPTURE_RING ring;
+    PMDL mdl;
+
+    InterlockedExchange(&G_CaptureEnabled, 0);
+
+    KeAcquireSpinLock(&G_Capture.Lock, &irql);
+    ring = G_Capture.Ring;
+    mdl = G_Capture.Mdl;
+    G_Capture.Ring = NULL;
+    G_Capture.Mdl = NULL;
+    KeReleaseSpinLock(&G_Capture.Lock, irql);
+
+    ASSERT(G_Capture.UserAddress == NULL);
+
+    if (mdl != NULL)
+        IoFreeMdl(mdl);
+    if (ring != NULL)
+        ExFreePool(ring);
+}
+
+VOID
+NvShieldCaptureEnable(
+    BOOLEAN Enable
+)
+{
+    InterlockedExchange(&G_CaptureEnabled, (Enable && G_Capture.Ring != NULL) ? 1 : 0);
+}
+
+NTSTATUS
+NvShieldCaptureMap(
+    WDFFILEOBJECT File,
+    PNVSHIELD_CAPTURE_MAPPING Mapping
+)
+/*++
+
+Routine Description:
+
+    Maps the ring into the current process. Must run in the context of the
+    process that sent IOCTL_NVSHIELD_CAPTURE_MAP.
+
+--*/
+{
+    PVOID address = NULL;
+
+    PAGED_CODE();
+
+    if (G_Capture.Mdl == NULL)
+        return STATUS_DEVICE_NOT_READY;
+
+    if (InterlockedCompareExchangePointer((PVOID*)&G_Capture.UserFile, File, NULL) != NULL)
+        return STATUS_DEVICE_BUSY;
+
+    __try {
+        address = MmMapLockedPagesSpecifyCache(G_Capture.Mdl, UserMode, MmCached,
+            NULL, FALSE, NormalPagePriority | MdlMappingNoExecute);
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        address = NULL;
+    }
+
+    if (address == NULL) {
+        InterlockedExchangePointer((PVOID*)&G_Capture.UserFile, NULL);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    G_Capture.UserAddress = address;
+
+    Mapping->RingAddress = (ULONGLONG)(ULONG_PTR)address;
+    Mapping->RingSize = NVSHIELD_CAPTURE_MAPPING_SIZE;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+NvShieldCaptureUnmap(
+    WDFFILEOBJECT File
+)
+/*++
+
+Routine Description:
+
+    Called on handle cleanup, in the context of the process that owns it.
+
+--*/
+{
+    PAGED_CODE();
+
+    if (G_Capture.UserFile != File || G_Capture.UserAddress == NULL)
+        return;
+
+    MmUnmapLockedPages(G_Capture.UserAddress, G_Capture.Mdl);
+    G_Capture.UserAddress = NULL;
+
+    InterlockedExchangePointer((PVOID*)&G_Capture.UserFile, NULL);
+}
+
+static VOID
+captureBuildSetup(
+    PURB Urb,
+    PUCHAR Setup
+)
+{
+    switch (Urb->UrbHeader.Function)
+    {
+    case URB_FUNCTION_CONTROL_TRANSFER:
+        RtlCopyMemory(Setup, Urb->UrbControlTransfer.SetupPacket, 8);
+        break;
+
+    case URB_FUNCTION_CLASS_INTERFACE:
+    {
+        struct _URB_CONTROL_VENDOR_OR_CLASS_REQUEST *req = &Urb->UrbControlVendorClassRequest;
+
+        Setup[0] = ((req->TransferFlags & USBD_TRANSFER_DIRECTION_IN) ? 0x80 : 0x00) | 0x21; // class, interface
+        Setup[1] = req->Request;
+        Setup[2] = (UCHAR)(req->Value & 0xFF);
+        Setup[3] = (UCHAR)(req->Value >> 8);
+        Setup[4] = (UCHAR)(req->Index & 0xFF);
+        Setup[5] = (UCHAR)(req->Index >> 8);
+        Setup[6] = (UCHAR)(req->TransferBufferLength & 0xFF);
+        Setup[7] = (UCHAR)(req->TransferBufferLength >> 8);
+        break;
+    }
+
+    case URB_FUNCTION_GET_DESCRIPTOR_FROM_DEVICE:
+    case URB_FUNCTION_GET_DESCRIPTOR_FROM_INTERFACE:
+    {
+        struct _URB_CONTROL_DESCRIPTOR_REQUEST *req = &Urb->UrbControlDescriptorRequest;
+
+        Setup[0] = Urb->UrbHeader.Function == URB_FUNCTION_GET_DESCRIPTOR_FROM_DEVICE ? 0x80 : 0x81;
+        Setup[1] = 0x06; // GET_DESCRIPTOR
+        Setup[2] = req->Index;
+        Setup[3] = req->DescriptorType;
+        Setup[4] = (UCHAR)(req->LanguageId & 0xFF);
+        Setup[5] = (UCHAR)(req->LanguageId >> 8);
+        Setup[6] = (UCHAR)(req->TransferBufferLength & 0xFF);
+        Setup[7] = (UCHAR)(req->TransferBufferLength >> 8);
+        break;
+    }
+
+    default:
+        RtlZeroMemory(Setup, 8);
+        break;
+    }
+}
+
+VOID
+NvShieldCaptureUrb(
+    PDEVICE_EXTENSION devContext,
+    WDFREQUEST Request,
+    PURB Urb,
+    USHORT Bus,
+    BOOLEAN Completed
+)
+/*++
+
+Routine Description:
+
+    Appends one pcap record describing Urb to the ring. Only reached when
+    G_CaptureEnabled is set, see NVSHIELD_CAPTURE_URB.
+
+Arguments:
+
+    Bus - NVSHIELD_CAPTURE_BUS_DEVICE for the URB as exchanged with the
+          controller, NVSHIELD_CAPTURE_BUS_HIDUSB as exchanged with HidUsb
+
+    Completed - FALSE on submission, TRUE on completion
+
+--*/
+{
+    struct _URB_BULK_OR_INTERRUPT_TRANSFER *transfer = (struct _URB_BULK_OR_INTERRUPT_TRANSFER *)Urb;
+    NVSHIELD_PCAP_RECORD_HEADER record;
+    NVSHIELD_USBPCAP_HEADER usbpcap;
+    UCHAR setup[8];
+    LARGE_INTEGER now;
+    PUCHAR data, p;
+    ULONG dataLength, setupLength, headerLength, entryLength, offset, room;
+    ULONG head, used;
+    PNVSHIELD_CAPTURE_ENTRY entry;
+    PNVSHIELD_CAPTURE_RING ring;
+    BOOLEAN control, dataIn;
+    KIRQL irql;
+
+    switch (Urb->UrbHeader.Function)
+    {
+    case URB_FUNCTION_GET_DESCRIPTOR_FROM_DEVICE:
+    case URB_FUNCTION_GET_DESCRIPTOR_FROM_INTERFACE:
+        dataIn = TRUE; // no TransferFlags in descriptor requests
+        break;
+    case URB_FUNCTION_CLASS_INTERFACE:
+    case URB_FUNCTION_CONTROL_TRANSFER:
+    case URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER:
+        dataIn = (transfer->TransferFlags & USBD_TRANSFER_DIRECTION_IN) != 0;
+        break;
+    default:
+        return; // no transfer buffer, e.g. SELECT_CONFIGURATION
+    }
+
+    control = Urb->UrbHeader.Function != URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER;
+
+    // Like USBPcap, only record the data when it travels in this direction
+    dataLength = (dataIn == Completed) ? transfer->TransferBufferLength : 0;
+    data = dataLength != 0 ? (PUCHAR)USBPcapURBGetBufferPointer(dataLength,
+        transfer->TransferBuffer, transfer->TransferBufferMDL) : NULL;
+    if (data == NULL)
+        dataLength = 0;
+    dataLength = min(dataLength, NVSHIELD_CAPTURE_SNAPLEN);
+
+    setupLength = (control && !Completed) ? sizeof(setup) : 0;
+    if (setupLength != 0)
+        captureBuildSetup(Urb, setup);
+
+    headerLength = control ? sizeof(usbpcap) : FIELD_OFFSET(NVSHIELD_USBPCAP_HEADER, stage);
+
+    KeQuerySystemTime(&now);
+    now.QuadPart = (now.QuadPart - EPOCH_DIFFERENCE_100NS) / 10;
+
+    record.ts_sec = (ULONG)(now.QuadPart / 1000000);
+    record.ts_usec = (ULONG)(now.QuadPart % 1000000);
+    record.incl_len = headerLength + setupLength + dataLength;
+    record.orig_len = record.incl_len;
+
+    usbpcap.headerLen = (USHORT)headerLength;
+    usbpcap.irpId = (ULONGLONG)(ULONG_PTR)WdfRequestWdmGetIrp(Request);
+    usbpcap.status = Completed ? Urb->UrbHeader.Status : 0;
+    usbpcap.function = Urb->UrbHeader.Function;
+    usbpcap.info = Completed ? 1 : 0;
+    usbpcap.bus = Bus;
+    usbpcap.device = (USHORT)devContext->DeviceIndex;
+    usbpcap.endpoint = control ? (dataIn ? 0x80 : 0x00) : 0x81;
+    usbpcap.transfer = control ? 2 : 1;
+    usbpcap.dataLength = setupLength + dataLength;
+    usbpcap.stage = Completed ? 3 : 0;
+
+    entryLength = (sizeof(NVSHIELD_CAPTURE_ENTRY) + sizeof(record) + record.incl_len + 7) & ~7UL;
+
+    KeAcquireSpinLock(&G_Capture.Lock, &irql);
+
+    ring = G_Capture.Ring;
+    if (ring == NULL) {
+        KeReleaseSpinLock(&G_Capture.Lock, irql);
+        return;
+    }
+
+    // The ring is mapped writable into the consumer: only Tail is taken
+    // from it, once, and only to decide whether the entry fits
+    head = G_Capture.Head;
+    used = head - ring->Tail;
+
+    // Head is a multiple of 8 and so is room, which fits an entry header
+    offset = head & (NVSHIELD_CAPTURE_RING_SIZE - 1);
+    room = NVSHIELD_CAPTURE_RING_SIZE - offset;
+
+    if (used > NVSHIELD_CAPTURE_RING_SIZE
+        || (room < entryLength ? used + room : used) + entryLength > NVSHIELD_CAPTURE_RING_SIZE) {
+        ring->Dropped++;
+        KeReleaseSpinLock(&G_Capture.Lock, irql);
+        return;
+    }
+
+    if (room < entryLength) {
+        // Pad to the end of Data so that the record starts at offset 0
+        entry = (PNVSHIELD_CAPTURE_ENTRY)&ring->Data[offset];
+        entry->Length = room;
+        entry->Type = NVSHIELD_CAPTURE_ENTRY_PADDING;
+        KeMemoryBarrier();
+        head += room;
+        ring->Head = head;
+        offset = 0;
+    }
+
+    entry = (PNVSHIELD_CAPTURE_ENTRY)&ring->Data[offset];
+    entry->Length = entryLength;
+    entry->Type = NVSHIELD_CAPTURE_ENTRY_RECORD;
+
+    p = (PUCHAR)(entry + 1);
+
+    RtlCopyMemory(p, &record, sizeof(record));
+    p += sizeof(record);
+    RtlCopyMemory(p, &usbpcap, headerLength);
+    p += headerLength;
+    if (setupLength != 0) {
+        RtlCopyMemory(p, setup, setupLength);
+        p += setupLength;
+    }
+    if (dataLength != 0)
+        RtlCopyMemory(p, data, dataLength);
+
+    // Publish the entry only once its content is visible
+    KeMemoryBarrier();
+    head += entryLength;
+    G_Capture.Head = head;
+    ring->Head = head;
+
+    KeReleaseSpinLock(&G_Capture.Lock, irql);
+}
@@ -0,0 +1,419 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    config.c
+
+Abstract:
+
+    Settings of a controller, NVSHIELD_SETTINGS: read from its hardware
+    key as it is added, changed through IOCTL_NVSHIELD_SETTINGS_SET while
+    it runs.
+
+    Each change is compiled into a new snapshot, NVSHIELD_CONFIG, which
+    replaces the one in Shield.config with a single pointer exchange, so
+    that the next report already goes by it. The input rewrites and the
+    motor mix read the pointer once, without a lock, at DISPATCH_LEVEL
+    (NVSHIELD_CONFIG_READ). The snapshot replaced is freed once this thread
+    has run on every processor in turn: a processor it ran on was below
+    DISPATCH_LEVEL, so it had finished with whatever it read before the
+    exchange. Changes are rare, the wait is a few context switches.
+
+    The stick tables of the Calibrate setting are rebuilt the same way,
+    from a work item the Calibrate stage queues when its estimate has
+    moved, at most every NVSHIELD_CALIBRATION_PERIOD_MS. The estimate is
+    stored in the hardware key for the next time the controller starts,
+    by the work item every NVSHIELD_CALIBRATION_SAVE_MS and otherwise when
+    the device goes away. ConfigLock keeps it and the settings IOCTL from
+    publishing at the same time.
+
+Environment:
+
+    kernel mode only
+
+Revision History:
+
+--*/
+
+#include <hidusbfx2.h>
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text( PAGE, NvShieldConfigInitialize)
+#pragma alloc_text( PAGE, NvShieldConfigUpdate)
+#pragma alloc_text( PAGE, NvShieldConfigCleanup)
+#endif
+
+#define NVSHIELD_CONFIG_TAG     (ULONG)((((ULONG)'N') << 16) + (((ULONG)'V') << 8) + 'K')
+
+static const struct {
+    UNICODE_STRING Name;
+    ULONG Offset;
+} G_SettingValues[] = {
+    { RTL_CONSTANT_STRING(L"TrackpadScaleX"),   FIELD_OFFSET(NVSHIELD_SETTINGS, TrackpadScaleX) },
+    { RTL_CONSTANT_STRING(L"TrackpadScaleY"),   FIELD_OFFSET(NVSHIELD_SETTINGS, TrackpadScaleY) },
+    { RTL_CONSTANT_STRING(L"VolumeButtons"),    FIELD_OFFSET(NVSHIELD_SETTINGS, VolumeButtons) },
+    { RTL_CONSTANT_STRING(L"RumbleGain"),       FIELD_OFFSET(NVSHIELD_SETTINGS, RumbleGain) },
+    { RTL_CONSTANT_STRING(L"RumbleFlags"),      FIELD_OFFSET(NVSHIELD_SETTINGS, RumbleFlags) },
+    { RTL_CONSTANT_STRING(L"Calibrate"),        FIELD_OFFSET(NVSHIELD_SETTINGS, Calibrate) },
+    { RTL_CONSTANT_STRING(L"InputKeepAlive"),   FIELD_OFFSET(NVSHIELD_SETTINGS, InputKeepAlive) },
+};
+
+// NVSHIELD_CALIBRATION_AXES NVSHIELD_AXIS_CALIBRATION, REG_BINARY
+static const UNICODE_STRING G_CalibrationValue = RTL_CONSTANT_STRING(L"StickCalibration");
+
+static EVT_WDF_WORKITEM configRecalibrate;
+
+#define SETTING_VALUE(Settings, i) \
+    ((PULONG)((PUCHAR)(Settings) + G_SettingValues[i].Offset))
+
+static VOID
+configRead(
+    WDFDEVICE Device,
+    PNVSHIELD_SETTINGS Settings
+)
+{
+    WDFKEY key;
+    ULONG i, value;
+
+    PAGED_CODE();
+
+    NvShieldDefaultSettings(Settings);
+
+    if (!NT_SUCCESS(WdfDeviceOpenRegistryKey(Device, PLUGPLAY_REGKEY_DEVICE,
+            KEY_READ, WDF_NO_OBJECT_ATTRIBUTES, &key)))
+        return;
+
+    for (i = 0; i < ARRAYSIZE(G_SettingValues); i++) {
+        if (NT_SUCCESS(WdfRegistryQueryULong(key, &G_SettingValues[i].Name, &value)))
+            *SETTING_VALUE(Settings, i) = value;
+    }
+
+    WdfRegistryClose(key);
+
+    // Those out of range fall back to their defaults
+    NvShieldCheckSettings(Settings);
+}
+
+static NTSTATUS
+configWrite(
+    WDFDEVICE Device,
+    const NVSHIELD_SETTINGS* Settings
+)
+{
+    WDFKEY key;
+    ULONG i;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    status = WdfDeviceOpenRegistryKey(Device, PLUGPLAY_REGKEY_DEVICE,
+        KEY_WRITE, WDF_NO_OBJECT_ATTRIBUTES, &key);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    for (i = 0; i < ARRAYSIZE(G_SettingValues) && NT_SUCCESS(status); i++)
+        status = WdfRegistryAssignULong(key, &G_SettingValues[i].Name, *SETTING_VALUE(Settings, i));
+
+    WdfRegistryClose(key);
+
+    return status;
+}
+
+static VOID
+configReadCalibration(
+    WDFDEVICE Device
+)
+{
+    NVSHIELD_AXIS_CALIBRATION calibration[NVSHIELD_CALIBRATION_AXES];
+    ULONG length, type;
+    WDFKEY key;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    if (!NT_SUCCESS(WdfDeviceOpenRegistryKey(Device, PLUGPLAY_REGKEY_DEVICE,
+            KEY_READ, WDF_NO_OBJECT_ATTRIBUTES, &key)))
+        return;
+
+    status = WdfRegistryQueryValue(key, &G_CalibrationValue, sizeof(calibration),
+        calibration, &length, &type);
+
+    WdfRegistryClose(key);
+
+    // The sticks start from their defaults if it doesn't hold together
+    if (NT_SUCCESS(status) && type == REG_BINARY && length == sizeof(calibration))
+        NvShieldLoadCalibration(&GetDeviceContext(Device)->Shield, calibration);
+}
+
+static NTSTATUS
+configWriteCalibration(
+    WDFDEVICE Device,
+    const NVSHIELD_AXIS_CALIBRATION* Calibration
+)
+{
+    WDFKEY key;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    status = WdfDeviceOpenRegistryKey(Device, PLUGPLAY_REGKEY_DEVICE,
+        KEY_WRITE, WDF_NO_OBJECT_ATTRIBUTES, &key);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    status = WdfRegistryAssignValue(key, &G_CalibrationValue, REG_BINARY,
+        NVSHIELD_CALIBRATION_AXES * sizeof(NVSHIELD_AXIS_CALIBRATION), (PVOID)Calibration);
+
+    WdfRegistryClose(key);
+
+    return status;
+}
+
+static VOID
+configSynchronize(
+    VOID
+)
+/*++
+
+Routine Description:
+
+    Returns once every processor has been below DISPATCH_LEVEL since it
+    was called, by running the calling thread on each of them in turn.
+
+--*/
+{
+    ULONG count = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    GROUP_AFFINITY affinity, previous;
+    PROCESSOR_NUMBER number;
+    ULONG i;
+
+    PAGED_CODE();
+
+    for (i = 0; i < count; i++) {
+        if (!NT_SUCCESS(KeGetProcessorNumberFromIndex(i, &number)))
+            continue;
+
+        RtlZeroMemory(&affinity, sizeof(affinity));
+        affinity.Group = number.Group;
+        affinity.Mask = AFFINITY_MASK(number.Number);
+
+        // Only returns once the thread runs there
+        KeSetSystemGroupAffinityThread(&affinity, &previous);
+        KeRevertToUserGroupAffinityThread(&previous);
+    }
+}
+
+static NTSTATUS
+configPublish(
+    PDEVICE_EXTENSION devContext,
+    const NVSHIELD_SETTINGS* Settings
+)
+/*++
+
+Routine Description:
+
+    Compiles Settings, which NvShieldCheckSettings has passed, and the
+    stick calibration last taken into a new snapshot, publishes it and
+    frees the one it replaces. Called with ConfigLock held, or before
+    the device has seen any input.
+
+--*/
+{
+    PNVSHIELD_CONFIG config;
+    const NVSHIELD_CONFIG* old;
+
+    PAGED_CODE();
+
+    config = (PNVSHIELD_CONFIG)ExAllocatePoolWithTag(NonPagedPool, sizeof(NVSHIELD_CONFIG),
+        NVSHIELD_CONFIG_TAG);
+    if (config == NULL) {
+        NVSHIELD_COUNT(AllocationFailures);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    // Complete before it is published, the exchange is a full barrier
+    NvShieldCompileConfig(config, devContext->Shield.model, Settings,
+        devContext->Shield.calibration);
+
+    old = (const NVSHIELD_CONFIG*)InterlockedExchangePointer(
+        (PVOID volatile*)&devContext->Shield.config, config);
+
+    devContext->Settings = *Settings;
+
+    if (old != &devContext->Shield.defaultConfig) {
+        configSynchronize();
+        ExFreePool((PVOID)old);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+NvShieldConfigInitialize(
+    WDFDEVICE Device
+)
+/*++
+
+Routine Description:
+
+    Applies the settings and the stick calibration of the device's
+    hardware key, before it is added to the collection.
+
+--*/
+{
+    PDEVICE_EXTENSION devContext = GetDeviceContext(Device);
+    NVSHIELD_SETTINGS settings;
+    WDF_WORKITEM_CONFIG workItemConfig;
+    WDF_OBJECT_ATTRIBUTES attributes;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = Device;
+
+    status = WdfWaitLockCreate(&attributes, &devContext->ConfigLock);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    WDF_WORKITEM_CONFIG_INIT(&workItemConfig, configRecalibrate);
+    workItemConfig.AutomaticSerialization = FALSE;    // ConfigLock does
+
+    status = WdfWorkItemCreate(&workItemConfig, &attributes, &devContext->CalibrationWorkItem);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    configRead(Device, &settings);
+    settings.DeviceIndex = devContext->DeviceIndex;
+
+    configReadCalibration(Device);
+
+    return configPublish(devContext, &settings);
+}
+
+NTSTATUS
+NvShieldConfigUpdate(
+    WDFDEVICE Device,
+    const NVSHIELD_SETTINGS* Settings
+)
+/*++
+
+Routine Description:
+
+    Stores Settings in the device's hardware key and applies them. The
+    motors are updated right away rather than with the next force
+    feedback report, in case they no longer run the way they did.
+
+Return Value:
+
+    STATUS_INVALID_PARAMETER, and nothing changes, if a setting is out of
+    range; the status of the registry write, and nothing is applied, if
+    the settings couldn't be stored.
+
+--*/
+{
+    PDEVICE_EXTENSION devContext = GetDeviceContext(Device);
+    NVSHIELD_SETTINGS settings = *Settings;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    if (!NvShieldCheckSettings(&settings))
+        return STATUS_INVALID_PARAMETER;
+
+    settings.DeviceIndex = devContext->DeviceIndex;
+
+    // Stored first, so that a failure leaves the settings as they were;
+    // under the lock, so that the key ends up with the ones applied last
+    WdfWaitLockAcquire(devContext->ConfigLock, NULL);
+    status = configWrite(Device, &settings);
+    if (NT_SUCCESS(status)) {
+        status = configPublish(devContext, &settings);
+        if (!NT_SUCCESS(status))
+            configWrite(Device, &devContext->Settings);
+    }
+    WdfWaitLockRelease(devContext->ConfigLock);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    NvShieldRumbleOutSend(devContext);
+
+    return STATUS_SUCCESS;
+}
+
+static VOID
+configRecalibrate(
+    WDFWORKITEM WorkItem
+)
+/*++
+
+Routine Description:
+
+    Rebuilds the stick tables from the estimate the Calibrate stage has
+    moved on, and stores it for the next time the controller starts if
+    it wasn't for NVSHIELD_CALIBRATION_SAVE_MS; NvShieldConfigCleanup
+    stores it otherwise.
+
+--*/
+{
+    WDFDEVICE device = (WDFDEVICE)WdfWorkItemGetParentObject(WorkItem);
+    PDEVICE_EXTENSION devContext = GetDeviceContext(device);
+    NVSHIELD_AXIS_CALIBRATION calibration[NVSHIELD_CALIBRATION_AXES];
+    NVSHIELD_SETTINGS settings;
+    ULONGLONG now = KeQueryInterruptTime() / 10000; // 100ns to ms
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    // Taken under the lock, so that tables older than these can't be
+    // published after them, nor stored
+    WdfWaitLockAcquire(devContext->ConfigLock, NULL);
+
+    NvShieldTakeCalibration(&devContext->Shield, calibration);
+    settings = devContext->Settings;
+    status = configPublish(devContext, &settings);
+
+    if (NT_SUCCESS(status)) {
+        devContext->CalibrationUnsaved = TRUE;
+
+        if (now >= devContext->CalibrationSaveDue) {
+            devContext->CalibrationSaveDue = now + NVSHIELD_CALIBRATION_SAVE_MS;
+            if (NT_SUCCESS(configWriteCalibration(device, calibration)))
+                devContext->CalibrationUnsaved = FALSE;
+        }
+    }
+
+    WdfWaitLockRelease(devContext->ConfigLock);
+}
+
+VOID
+NvShieldConfigCleanup(
+    PDEVICE_EXTENSION devContext
+)
+{
+    PAGED_CODE();
+
+    // Input has stopped, the work item can't be queued again
+    if (devContext->CalibrationWorkItem != NULL)
+        WdfWorkItemFlush(devContext->CalibrationWorkItem);
+
+    // The tables last built, which the work item held back from the key
+    if (devContext->CalibrationUnsaved) {
+        configWriteCalibration((WDFDEVICE)WdfObjectContextGetObject(devContext),
+            devContext->Shield.calibration);
+        devContext->CalibrationUnsaved = FALSE;
+    }
+
+    // Nothing reads it anymore
+    if (devContext->Shield.config != &devContext->Shield.defaultConfig) {
+        ExFreePool((PVOID)devContext->Shield.config);
+        devContext->Shield.config = &devContext->Shield.defaultConfig;
+    }
+}
@@ -0,0 +1,640 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    control.c
+
+Abstract:
+
+    Control device through which user-mode tools talk to the filter. A
+    filter can't expose an interface on the HID stack it sits in, so, like
+    the toaster filter sample, we create a standalone control device with
+    the first filter device object and delete it with the last one.
+
+Environment:
+
+    kernel mode only
+
+Revision History:
+
+--*/
+
+#include <hidusbfx2.h>
+#include <wdmsec.h>
+
+WDFCOLLECTION   FilterDeviceCollection;
+WDFWAITLOCK     FilterDeviceCollectionLock;
+
+static WDFDEVICE ControlDevice = NULL;
+
+NVSHIELD_STATS_SLOT G_DriverStats[NVSHIELD_STATS_SLOTS];
+
+EVT_WDF_IO_IN_CALLER_CONTEXT NvShieldControlIoInCallerContext;
+EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL NvShieldControlEvtIoDeviceControl;
+EVT_WDF_FILE_CLEANUP NvShieldControlEvtFileCleanup;
+EVT_WDF_OBJECT_CONTEXT_CLEANUP NvShieldControlEvtCleanup;
+
+#ifdef ALLOC_PRAGMA
+    #pragma alloc_text( PAGE, NvShieldCreateControlDevice)
+    #pragma alloc_text( PAGE, NvShieldDeleteControlDevice)
+    #pragma alloc_text( PAGE, NvShieldControlIoInCallerContext)
+    #pragma alloc_text( PAGE, NvShieldControlEvtIoDeviceControl)
+    #pragma alloc_text( PAGE, NvShieldControlEvtFileCleanup)
+    #pragma alloc_text( PAGE, NvShieldControlEvtCleanup)
+#endif
+
+NTSTATUS
+NvShieldCreateControlDevice(
+    WDFDEVICE Device
+)
+/*++
+
+Routine Description:
+
+    Creates the control device if Device is the only filter device object.
+
+--*/
+{
+    PWDFDEVICE_INIT             pInit = NULL;
+    WDFDEVICE                   controlDevice = NULL;
+    WDF_OBJECT_ATTRIBUTES       attributes;
+    WDF_OBJECT_ATTRIBUTES       fileAttributes;
+    WDF_IO_QUEUE_CONFIG         queueConfig;
+    WDF_FILEOBJECT_CONFIG       fileConfig;
+    BOOLEAN                     bCreate = FALSE;
+    NTSTATUS                    status;
+    WDFQUEUE                    queue;
+    DECLARE_CONST_UNICODE_STRING(ntDeviceName, NVSHIELD_CONTROL_DEVICE_NAME);
+    DECLARE_CONST_UNICODE_STRING(symbolicLinkName, NVSHIELD_CONTROL_SYMBOLIC_NAME);
+
+    PAGED_CODE();
+
+    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+    if (WdfCollectionGetCount(FilterDeviceCollection) == 1) {
+        bCreate = TRUE;
+    }
+    WdfWaitLockRelease(FilterDeviceCollectionLock);
+
+    if (!bCreate) {
+        // Created when the first instance came up
+        return STATUS_SUCCESS;
+    }
+
+    pInit = WdfControlDeviceInitAllocate(WdfDeviceGetDriver(Device),
+        &SDDL_DEVOBJ_SYS_ALL_ADM_ALL);
+    if (pInit == NULL) {
+        status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Error;
+    }
+
+    WdfDeviceInitSetExclusive(pInit, FALSE);
+
+    status = WdfDeviceInitAssignName(pInit, &ntDeviceName);
+    if (!NT_SUCCESS(status)) {
+        goto Error;
+    }
+
+    // The ring and the shared state have to be mapped in the context of
+    // the requesting process
+    WdfDeviceInitSetIoInCallerContextCallback(pInit, NvShieldControlIoInCallerContext);
+
+    WDF_FILEOBJECT_CONFIG_INIT(&fileConfig, WDF_NO_EVENT_CALLBACK,
+        WDF_NO_EVENT_CALLBACK, NvShieldControlEvtFileCleanup);
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&fileAttributes, CONTROL_FILE_CONTEXT);
+    WdfDeviceInitSetFileObjectConfig(pInit, &fileConfig, &fileAttributes);
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.EvtCleanupCallback = NvShieldControlEvtCleanup;
+
+    status = WdfDeviceCreate(&pInit, &attributes, &controlDevice);
+    if (!NT_SUCCESS(status)) {
+        goto Error;
+    }
+
+    status = WdfDeviceCreateSymbolicLink(controlDevice, &symbolicLinkName);
+    if (!NT_SUCCESS(status)) {
+        goto Error;
+    }
+
+    WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(&queueConfig, WdfIoQueueDispatchSequential);
+    queueConfig.EvtIoDeviceControl = NvShieldControlEvtIoDeviceControl;
+
+    status = WdfIoQueueCreate(controlDevice, &queueConfig, WDF_NO_OBJECT_ATTRIBUTES, &queue);
+    if (!NT_SUCCESS(status)) {
+        goto Error;
+    }
+
+    status = NvShieldCaptureInitialize();
+    if (!NT_SUCCESS(status)) {
+        goto Error;
+    }
+
+    status = NvShieldSharedStateInitialize();
+    if (!NT_SUCCESS(status)) {
+        goto Error;
+    }
+
+    WdfControlFinishInitializing(controlDevice);
+
+    ControlDevice = controlDevice;
+
+    return STATUS_SUCCESS;
+
+Error:
+
+    if (pInit != NULL) {
+        WdfDeviceInitFree(pInit);
+    }
+
+    if (controlDevice != NULL) {
+        // Runs NvShieldControlEvtCleanup, which frees whatever got allocated
+        WdfObjectDelete(controlDevice);
+    }
+
+    return status;
+}
+
+VOID
+NvShieldDeleteControlDevice(
+    WDFDEVICE Device
+)
+/*++
+
+Routine Description:
+
+    Deletes the control device when Device is the last filter device object.
+
+--*/
+{
+    UNREFERENCED_PARAMETER(Device);
+
+    PAGED_CODE();
+
+    if (ControlDevice) {
+        WdfObjectDelete(ControlDevice);
+        ControlDevice = NULL;
+    }
+}
+
+VOID
+NvShieldControlEvtCleanup(
+    IN WDFOBJECT Object
+)
+{
+    UNREFERENCED_PARAMETER(Object);
+
+    PAGED_CODE();
+
+    NvShieldCaptureCleanup();
+    NvShieldSharedStateCleanup();
+}
+
+VOID
+NvShieldControlEvtFileCleanup(
+    IN WDFFILEOBJECT FileObject
+)
+{
+    PAGED_CODE();
+
+    // Still in the context of the process that owns the handle
+    NvShieldCaptureUnmap(FileObject);
+    NvShieldSharedStateUnmap(FileObject);
+}
+
+VOID
+NvShieldControlIoInCallerContext(
+    IN WDFDEVICE  Device,
+    IN WDFREQUEST Request
+)
+/*++
+
+Routine Description:
+
+    Handles IOCTL_NVSHIELD_CAPTURE_MAP and IOCTL_NVSHIELD_STATE_MAP before
+    the request is queued, while we still run in the context of the calling
+    thread. Everything else goes to the queue.
+
+--*/
+{
+    WDF_REQUEST_PARAMETERS params;
+    PNVSHIELD_CAPTURE_MAPPING mapping;
+    PNVSHIELD_STATE_MAPPING stateMapping;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(Request, &params);
+
+    if (params.Type == WdfRequestTypeDeviceControl &&
+        params.Parameters.DeviceIoControl.IoControlCode == IOCTL_NVSHIELD_CAPTURE_MAP) {
+
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(NVSHIELD_CAPTURE_MAPPING),
+            (PVOID*)&mapping, NULL);
+        if (!NT_SUCCESS(status)) {
+            WdfRequestComplete(Request, status);
+            return;
+        }
+
+        status = NvShieldCaptureMap(WdfRequestGetFileObject(Request), mapping);
+
+        WdfRequestCompleteWithInformation(Request, status,
+            NT_SUCCESS(status) ? sizeof(NVSHIELD_CAPTURE_MAPPING) : 0);
+        return;
+    }
+
+    if (params.Type == WdfRequestTypeDeviceControl &&
+        params.Parameters.DeviceIoControl.IoControlCode == IOCTL_NVSHIELD_STATE_MAP) {
+
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(NVSHIELD_STATE_MAPPING),
+            (PVOID*)&stateMapping, NULL);
+        if (!NT_SUCCESS(status)) {
+            WdfRequestComplete(Request, status);
+            return;
+        }
+
+        status = NvShieldSharedStateMap(WdfRequestGetFileObject(Request), stateMapping);
+
+        WdfRequestCompleteWithInformation(Request, status,
+            NT_SUCCESS(status) ? sizeof(NVSHIELD_STATE_MAPPING) : 0);
+        return;
+    }
+
+    status = WdfDeviceEnqueueRequest(Device, Request);
+    if (!NT_SUCCESS(status)) {
+        WdfRequestComplete(Request, status);
+    }
+}
+
+static VOID
+rateEnable(
+    BOOLEAN Enable
+)
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+    if (Enable && !G_MeasureReportRate) {
+        for (i = 0; i < WdfCollectionGetCount(FilterDeviceCollection); i++) {
+            WDFDEVICE device = (WDFDEVICE)WdfCollectionGetItem(FilterDeviceCollection, i);
+            NvShieldResetReportRate(GetDeviceContext(device));
+        }
+    }
+
+    InterlockedExchange(&G_MeasureReportRate, Enable ? 1 : 0);
+
+    WdfWaitLockRelease(FilterDeviceCollectionLock);
+}
+
+static NTSTATUS
+rateQuery(
+    PNVSHIELD_REPORT_RATE Rates,
+    size_t Count,
+    size_t* Returned
+)
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+    for (i = 0; i < WdfCollectionGetCount(FilterDeviceCollection) && i < Count; i++) {
+        WDFDEVICE device = (WDFDEVICE)WdfCollectionGetItem(FilterDeviceCollection, i);
+        PDEVICE_EXTENSION devContext = GetDeviceContext(device);
+
+        Rates[i].DeviceIndex = devContext->DeviceIndex;
+        Rates[i].PollingInterval = devContext->PollingInterval;
+        Rates[i].ReportsPerSecond = (ULONG)devContext->ReportRate;
+    }
+
+    WdfWaitLockRelease(FilterDeviceCollectionLock);
+
+    *Returned = i * sizeof(NVSHIELD_REPORT_RATE);
+
+    return STATUS_SUCCESS;
+}
+
+static VOID
+latencyEnable(
+    BOOLEAN Enable
+)
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+    // Nothing records while it is off
+    if (Enable && !G_MeasureLatency) {
+        for (i = 0; i < WdfCollectionGetCount(FilterDeviceCollection); i++) {
+            WDFDEVICE device = (WDFDEVICE)WdfCollectionGetItem(FilterDeviceCollection, i);
+            NvShieldLatencyReset(GetDeviceContext(device));
+        }
+    }
+
+    InterlockedExchange(&G_MeasureLatency, Enable ? 1 : 0);
+
+    WdfWaitLockRelease(FilterDeviceCollectionLock);
+}
+
+static NTSTATUS
+latencyQuery(
+    PNVSHIELD_LATENCY_STATS Latencies,
+    size_t Count,
+    size_t* Returned
+)
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+    for (i = 0; i < WdfCollectionGetCount(FilterDeviceCollection) && i < Count; i++) {
+        WDFDEVICE device = (WDFDEVICE)WdfCollectionGetItem(FilterDeviceCollection, i);
+        PDEVICE_EXTENSION devContext = GetDeviceContext(device);
+
+        Latencies[i].DeviceIndex = devContext->DeviceIndex;
+        Latencies[i].Reserved = 0;
+        RtlCopyMemory(Latencies[i].Latencies, devContext->Latencies, sizeof(Latencies[i].Latencies));
+    }
+
+    WdfWaitLockRelease(FilterDeviceCollectionLock);
+
+    *Returned = i * sizeof(NVSHIELD_LATENCY_STATS);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+statsQuery(
+    PNVSHIELD_DEVICE_STATS Stats,
+    size_t Count,
+    size_t* Returned
+)
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+    for (i = 0; i < WdfCollectionGetCount(FilterDeviceCollection) && i < Count; i++) {
+        WDFDEVICE device = (WDFDEVICE)WdfCollectionGetItem(FilterDeviceCollection, i);
+        PDEVICE_EXTENSION devContext = GetDeviceContext(device);
+
+        Stats[i].DeviceIndex = devContext->DeviceIndex;
+        Stats[i].ReportCacheHits = devContext->ReportCache.Hits;
+        Stats[i].ReportCacheMisses = devContext->ReportCache.Misses;
+        Stats[i].RumbleReportsSent = devContext->Shield.rumbleSent;
+        Stats[i].RumbleReportsSuppressed = devContext->Shield.rumbleSuppressed
+            + devContext->RumbleOutMerged;
+        Stats[i].InputReportsShort = devContext->Shield.inputShort;
+        Stats[i].InputReportsMismatched = devContext->Shield.inputMismatched;
+        Stats[i].InputReportsSuppressed = devContext->Shield.inputSuppressed;
+    }
+
+    WdfWaitLockRelease(FilterDeviceCollectionLock);
+
+    *Returned = i * sizeof(NVSHIELD_DEVICE_STATS);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+stageStatsQuery(
+    PNVSHIELD_STAGE_STATS Stats,
+    size_t Count,
+    size_t* Returned
+)
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    if (!NVSHIELD_STAGE_TIMING)
+        return STATUS_NOT_SUPPORTED;
+
+    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+    for (i = 0; i < WdfCollectionGetCount(FilterDeviceCollection) && i < Count; i++) {
+        WDFDEVICE device = (WDFDEVICE)WdfCollectionGetItem(FilterDeviceCollection, i);
+        PDEVICE_EXTENSION devContext = GetDeviceContext(device);
+
+        Stats[i].DeviceIndex = devContext->DeviceIndex;
+        Stats[i].Reserved = 0;
+        RtlCopyMemory(Stats[i].Stages, devContext->StageCounters, sizeof(Stats[i].Stages));
+    }
+
+    WdfWaitLockRelease(FilterDeviceCollectionLock);
+
+    *Returned = i * sizeof(NVSHIELD_STAGE_STATS);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+settingsQuery(
+    PNVSHIELD_SETTINGS Settings,
+    size_t Count,
+    size_t* Returned
+)
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+    for (i = 0; i < WdfCollectionGetCount(FilterDeviceCollection) && i < Count; i++) {
+        WDFDEVICE device = (WDFDEVICE)WdfCollectionGetItem(FilterDeviceCollection, i);
+
+        Settings[i] = GetDeviceContext(device)->Settings;
+    }
+
+    WdfWaitLockRelease(FilterDeviceCollectionLock);
+
+    *Returned = i * sizeof(NVSHIELD_SETTINGS);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+settingsSet(
+    const NVSHIELD_SETTINGS* Settings
+)
+{
+    NTSTATUS status = STATUS_NO_SUCH_DEVICE;
+    ULONG i;
+
+    PAGED_CODE();
+
+    // Held throughout, so that the device can't go away meanwhile
+    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+    for (i = 0; i < WdfCollectionGetCount(FilterDeviceCollection); i++) {
+        WDFDEVICE device = (WDFDEVICE)WdfCollectionGetItem(FilterDeviceCollection, i);
+
+        if (GetDeviceContext(device)->DeviceIndex == Settings->DeviceIndex) {
+            status = NvShieldConfigUpdate(device, Settings);
+            break;
+        }
+    }
+
+    WdfWaitLockRelease(FilterDeviceCollectionLock);
+
+    return status;
+}
+
+static VOID
+driverStatsQuery(
+    PNVSHIELD_DRIVER_STATS Stats
+)
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    RtlZeroMemory(Stats, sizeof(*Stats));
+
+    // Each slot may move on while it is read; the totals are a snapshot
+    // only as far as every counter is
+    for (i = 0; i < NVSHIELD_STATS_SLOTS; i++) {
+        const NVSHIELD_STATS_SLOT* slot = &G_DriverStats[i];
+
+        if (slot->ReportsProcessed == 0 && slot->RumbleReportsSent == 0
+            && slot->AllocationFailures == 0)
+            continue;
+
+        Stats->ReportsProcessed += slot->ReportsProcessed;
+        Stats->ReportsRewritten += slot->ReportsRewritten;
+        Stats->RumbleReportsSent += slot->RumbleReportsSent;
+        Stats->AllocationFailures += slot->AllocationFailures;
+        Stats->Processors++;
+    }
+}
+
+VOID
+NvShieldControlEvtIoDeviceControl(
+    IN WDFQUEUE     Queue,
+    IN WDFREQUEST   Request,
+    IN size_t       OutputBufferLength,
+    IN size_t       InputBufferLength,
+    IN ULONG        IoControlCode
+)
+{
+    NTSTATUS status;
+    PULONG enable;
+    PNVSHIELD_REPORT_RATE rates;
+    PNVSHIELD_DEVICE_STATS stats;
+    PNVSHIELD_DRIVER_STATS driverStats;
+    PNVSHIELD_STAGE_STATS stageStats;
+    PNVSHIELD_SETTINGS settings;
+    PNVSHIELD_LATENCY_STATS latencies;
+    size_t length, information = 0;
+
+    UNREFERENCED_PARAMETER(Queue);
+    UNREFERENCED_PARAMETER(OutputBufferLength);
+    UNREFERENCED_PARAMETER(InputBufferLength);
+
+    PAGED_CODE();
+
+    switch (IoControlCode)
+    {
+    case IOCTL_NVSHIELD_CAPTURE_ENABLE:
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(ULONG), (PVOID*)&enable, NULL);
+        if (NT_SUCCESS(status)) {
+            NvShieldCaptureEnable(*enable != 0);
+        }
+        break;
+
+    case IOCTL_NVSHIELD_RATE_ENABLE:
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(ULONG), (PVOID*)&enable, NULL);
+        if (NT_SUCCESS(status)) {
+            rateEnable(*enable != 0);
+        }
+        break;
+
+    case IOCTL_NVSHIELD_RATE_QUERY:
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(NVSHIELD_REPORT_RATE),
+            (PVOID*)&rates, &length);
+        if (NT_SUCCESS(status)) {
+            status = rateQuery(rates, length / sizeof(NVSHIELD_REPORT_RATE), &information);
+        }
+        break;
+
+    case IOCTL_NVSHIELD_STATS_QUERY:
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(NVSHIELD_DEVICE_STATS),
+            (PVOID*)&stats, &length);
+        if (NT_SUCCESS(status)) {
+            status = statsQuery(stats, length / sizeof(NVSHIELD_DEVICE_STATS), &information);
+        }
+        break;
+
+    case IOCTL_NVSHIELD_STAGE_STATS_QUERY:
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(NVSHIELD_STAGE_STATS),
+            (PVOID*)&stageStats, &length);
+        if (NT_SUCCESS(status)) {
+            status = stageStatsQuery(stageStats, length / sizeof(NVSHIELD_STAGE_STATS), &information);
+        }
+        break;
+
+    case IOCTL_NVSHIELD_SETTINGS_QUERY:
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(NVSHIELD_SETTINGS),
+            (PVOID*)&settings, &length);
+        if (NT_SUCCESS(status)) {
+            status = settingsQuery(settings, length / sizeof(NVSHIELD_SETTINGS), &information);
+        }
+        break;
+
+    case IOCTL_NVSHIELD_SETTINGS_SET:
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(NVSHIELD_SETTINGS),
+            (PVOID*)&settings, NULL);
+        if (NT_SUCCESS(status)) {
+            status = settingsSet(settings);
+        }
+        break;
+
+    case IOCTL_NVSHIELD_LATENCY_ENABLE:
+        status = WdfRequestRetrieveInputBuffer(Request, sizeof(ULONG), (PVOID*)&enable, NULL);
+        if (NT_SUCCESS(status)) {
+            latencyEnable(*enable != 0);
+        }
+        break;
+
+    case IOCTL_NVSHIELD_LATENCY_QUERY:
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(NVSHIELD_LATENCY_STATS),
+            (PVOID*)&latencies, &length);
+        if (NT_SUCCESS(status)) {
+            status = latencyQuery(latencies, length / sizeof(NVSHIELD_LATENCY_STATS), &information);
+        }
+        break;
+
+    case IOCTL_NVSHIELD_DRIVER_STATS_QUERY:
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(NVSHIELD_DRIVER_STATS),
+            (PVOID*)&driverStats, NULL);
+        if (NT_SUCCESS(status)) {
+            driverStatsQuery(driverStats);
+            information = sizeof(NVSHIELD_DRIVER_STATS);
+        }
+        break;
+
+    default:
+        status = STATUS_INVALID_DEVICE_REQUEST;
+        break;
+    }
+
+    WdfRequestCompleteWithInformation(Request, status, information);
+}
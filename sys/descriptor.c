@@ -0,0 +1,1587 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    descriptor.c
+
+Abstract:
+
+    HID Report Descriptor presented to HidUsb in place of the one reported
+    by the controller, the builder of its trimmed PID variants, and the
+    patcher of the Report Descriptors of the models that keep their own.
+    Shared with the user-mode Linux daemon.
+
+Author:
+
+
+Environment:
+
+    kernel mode and user mode
+
+Revision History:
+
+--*/
+
+#include "shield.h"
+
+HID_REPORT_DESCRIPTOR       G_DefaultReportDescriptor[] = {
+    0x05, 0x01,         /*  Usage Page (Desktop),               */
+    0x15, 0x00,         /*  Logical Minimum (0),                */
+    0x09, 0x05,         /*  Usage (Gamepad),                    */
+    0xA1, 0x01,         /*  Collection (Application),           */
+    0x85, 0x01,         /*      Report ID (1),                  */
+    0x05, 0x09,         /*      Usage Page (Button),            */
+    0x15, 0x00,         /*      Logical Minimum (0),            */
+    0x25, 0x01,         /*      Logical Maximum (1),            */
+    0x75, 0x01,         /*      Report Size (1),                */
+    0x95, 0x0A,         /*      Report Count (10),              */
+    0x09, 0x01,         /*      Usage (01h),                    */
+    0x09, 0x02,         /*      Usage (02h),                    */
+    0x09, 0x04,         /*      Usage (04h),                    */
+    0x09, 0x05,         /*      Usage (05h),                    */
+    0x09, 0x07,         /*      Usage (07h),                    */
+    0x09, 0x08,         /*      Usage (08h),                    */
+    0x09, 0x0E,         /*      Usage (0Eh),                    */
+    0x09, 0x0F,         /*      Usage (0Fh),                    */
+    0x09, 0x09,         /*      Usage (09h),                    */
+    0x09, 0x0C,         /*      Usage (0Ch),                    */
+    0x81, 0x02,         /*      Input (Variable),               */
+    0x05, 0x0C,         /*      Usage Page (Consumer),          */
+    0x95, 0x06,         /*      Report Count (6),               */
+    0x09, 0xE2,         /*      Usage (Mute),                   */
+    0x09, 0xE9,         /*      Usage (Volume Inc),             */
+    0x09, 0xEA,         /*      Usage (Volume Dec),             */
+    0x09, 0x30,         /*      Usage (Power),                  */
+    0x0A, 0x24, 0x02,   /*      Usage (AC Back),                */
+    0x0A, 0x23, 0x02,   /*      Usage (AC Home),                */
+    0x81, 0x02,         /*      Input (Variable),               */
+    0x05, 0x01,         /*      Usage Page (Desktop),           */
+    0x09, 0x39,         /*      Usage (Hat Switch),             */
+    0x25, 0x07,         /*      Logical Maximum (7),            */
+    0x35, 0x00,         /*      Physical Minimum (0),           */
+    0x46, 0x0E, 0x01,   /*      Physical Maximum (270),         */
+    0x65, 0x14,         /*      Unit (Degrees),                 */
+    0x75, 0x04,         /*      Report Size (4),                */
+    0x95, 0x01,         /*      Report Count (1),               */
+    0x81, 0x02,         /*      Input (Variable),               */
+    0x81, 0x03,         /*      Input (Constant, Variable),     */
+    0x09, 0x01,         /*      Usage (Pointer),                */
+    0xA1, 0x00,         /*      Collection (Physical),          */
+    0x75, 0x10,         /*          Report Size (16),           */
+    //0x95, 0x04,         /*          Report Count (4),           */
+    0x95, 0x06,         /*          Report Count (6),           */
+    0x15, 0x00,         /*          Logical Minimum (0),        */
+    0x26, 0xFF, 0xFF,   /*          Logical Maximum (65536),       */
+    0x35, 0x00,         /*          Physical Minimum (0),       */
+    0x46, 0xFF, 0xFF,   /*          Physical Maximum (65536),      */
+    0x09, 0x30,         /*          Usage (X),                  */
+    0x09, 0x31,         /*          Usage (Y),                  */
+    0x09, 0x32,         /*          Usage (Z),                  */
+    0x09, 0x35,         /*          Usage (Rz),                 */
+    //0x81, 0x02,         /*          Input (Variable),           */
+    //0x05, 0x02,         /*          Usage Page (Simulation),    */
+    //0x95, 0x02,         /*          Report Count (2),           */
+    //0x09, 0xC5,         /*          Usage (C5h),                */
+    //0x09, 0xC4,         /*          Usage (C4h),                */ // Brake and accelerators turned to Rx and Ry below
+    0x09, 0x33,         /*          Usage (Rx),                */ 
+    0x09, 0x34,         /*          Usage (Ry),                */
+    0x81, 0x02,         /*          Input (Variable),           */
+    0xC0,               /*      End Collection,                 */
+    0xA1, 0x01,         /*      Collection (Application),       */
+    //0x19, 0x01,         /*          Usage Minimum (01h),        */ // Using "Usage Minimum" and "Maximum" prevents the gamepad from being recognized as one by DirectInput, go figure..
+    //0x29, 0x03,         /*          Usage Maximum (03h),        */
+    0x09, 0x01,         /*          Usage (01h),                 */   // left rumble
+    0x09, 0x02,          /*          Usage (02h),                 */   // right rumble
+    0x09, 0x03,         /*          Usage (03h),                 */
+    0x15, 0x00,         /*          Logical Minimum (0),        */
+    0x26, 0xFF, 0xFF,   /*          Logical Maximum (65536),       */
+    0x95, 0x03,         /*          Report Count (3),           */
+    0x75, 0x10,         /*          Report Size (16),           */
+    0x91, 0x02,         /*          Output (Variable),          */
+    0xC0,               /*      End Collection,                 */
+
+        // ====== Virtual PID force feedback ======= //
+
+    0x05,0x0F,        //    Usage Page Physical Interface
+    0x09,0x92,        //    Usage ES Playing
+    0xA1,0x02,        //    Collection Datalink
+    0x85,0x20,    //    Report ID 20h
+    0x09,0x9F,    //    Usage (Device Paused)
+    0x09,0xA0,    //    Usage (Actuators Enabled)
+    0x09,0xA4,    //    Usage (Safety Switch)
+    0x09,0xA5,    //    Usage (Actuator Override Switch)
+    0x09,0xA6,    //    Usage (Actuator Power)
+    0x15,0x00,    //    Logical Minimum 0
+    0x25,0x01,    //    Logical Maximum 1
+    0x35,0x00,    //    Physical Minimum 0
+    0x45,0x01,    //    Physical Maximum 1
+    0x75,0x01,    //    Report Size 1
+    0x95,0x05,    //    Report Count 5
+    0x81,0x02,    //    Input (Variable)
+    0x95,0x03,    //    Report Count 3
+    0x75,0x01,    //    Report Size 1
+    0x81,0x03,    //    Input (Constant, Variable)
+    0x09,0x94,    //    Usage (Effect Playing)
+    0x15,0x00,    //    Logical Minimum 0
+    0x25,0x01,    //    Logical Maximum 1
+    0x35,0x00,    //    Physical Minimum 0
+    0x45,0x01,    //    Physical Maximum 1
+    0x75,0x01,    //    Report Size 1
+    0x95,0x01,    //    Report Count 1
+    0x81,0x02,    //    Input (Variable)
+    0x09,0x22,    //    Usage Effect Block Index
+    0x15,0x01,    //    Logical Minimum 1
+    0x25,0x28,    //    Logical Maximum 28h (40d)
+    0x35,0x01,    //    Physical Minimum 1
+    0x45,0x28,    //    Physical Maximum 28h (40d)
+    0x75,0x07,    //    Report Size 7
+    0x95,0x01,    //    Report Count 1
+    0x81,0x02,    //    Input (Variable)
+    0xC0    ,    // End Collection
+
+
+    0x09,0x21,    //    Usage Set Effect Report
+    0xA1,0x02,    //    Collection Datalink
+    0x85,0x21,    //    Report ID 21h
+    0x09,0x22,    //    Usage Effect Block Index
+    0x15,0x01,    //    Logical Minimum 1
+    0x25,0x28,    //    Logical Maximum 28h (40d)
+    0x35,0x01,    //    Physical Minimum 1
+    0x45,0x28,    //    Physical Maximum 28h (40d)
+    0x75,0x08,    //    Report Size 8
+    0x95,0x01,    //    Report Count 1
+    0x91,0x02,    //    Output (Variable)
+    0x09,0x25,    //    Usage Effect Type
+    0xA1,0x02,    //    Collection Datalink
+    0x09,0x26,    //    Usage ET Constant Force
+    0x09,0x27,    //    Usage ET Ramp
+    0x09,0x30,    //    Usage ET Square
+    0x09,0x31,    //    Usage ET Sine
+    0x09,0x32,    //    Usage ET Triangle
+    0x09,0x33,    //    Usage ET Sawtooth Up
+    0x09,0x34,    //    Usage ET Sawtooth Down
+    0x09,0x40,    //    Usage ET Spring
+    0x09,0x41,    //    Usage ET Damper
+    0x09,0x42,    //    Usage ET Inertia
+    0x09,0x43,    //    Usage ET Friction
+    0x09,0x28,    //    Usage ET Custom Force Data
+    0x25,0x0C,    //    Logical Maximum Ch (12d)
+    0x15,0x01,    //    Logical Minimum 1
+    0x35,0x01,    //    Physical Minimum 1
+    0x45,0x0C,    //    Physical Maximum Ch (12d)
+    0x75,0x08,    //    Report Size 8
+    0x95,0x01,    //    Report Count 1
+    0x91,0x00,    //    Output
+    0xC0    ,          //    End Collection
+
+    0x09,0x50,         //    Usage Duration
+    0x09,0x54,         //    Usage Trigger Repeat Interval
+    0x09,0x51,         //    Usage Sample Period
+    0x15,0x00,         //    Logical Minimum 0
+    0x26,0xFF,0x7F,    //    Logical Maximum 7FFFh (32767d)
+    0x35,0x00,         //    Physical Minimum 0
+    0x46,0xFF,0x7F,    //    Physical Maximum 7FFFh (32767d)
+    0x66,0x03,0x10,    //    Unit 1003h (4099d)
+    0x55,0xFD,         //    Unit Exponent FDh (253d)
+    0x75,0x10,         //    Report Size 10h (16d)
+    0x95,0x03,         //    Report Count 3
+    0x91,0x02,         //    Output (Variable)
+    0x55,0x00,         //    Unit Exponent 0
+    0x66,0x00,0x00,    //    Unit 0
+    0x09,0x52,         //    Usage Gain
+    0x15,0x00,         //    Logical Minimum 0
+    0x26,0xFF,0x00,    //    Logical Maximum FFh (255d)
+    0x35,0x00,         //    Physical Minimum 0
+    0x46,0x10,0x27,    //    Physical Maximum 2710h (10000d)
+    0x75,0x08,         //    Report Size 8
+    0x95,0x01,         //    Report Count 1
+    0x91,0x02,         //    Output (Variable)
+    0x09,0x53,         //    Usage Trigger Button
+    0x15,0x01,         //    Logical Minimum 1
+    0x25,0x08,         //    Logical Maximum 8
+    0x35,0x01,         //    Physical Minimum 1
+    0x45,0x08,         //    Physical Maximum 8
+    0x75,0x08,         //    Report Size 8
+    0x95,0x01,         //    Report Count 1
+    0x91,0x02,         //    Output (Variable)
+    0x09,0x55,         //    Usage Axes Enable
+    0xA1,0x02,         //    Collection Datalink
+    0x05,0x01,    //    Usage Page Generic Desktop
+    0x09,0x30,    //    Usage X
+    0x09,0x31,    //    Usage Y
+    0x15,0x00,    //    Logical Minimum 0
+    0x25,0x01,    //    Logical Maximum 1
+    0x75,0x01,    //    Report Size 1
+    0x95,0x02,    //    Report Count 2
+    0x91,0x02,    //    Output (Variable)
+    0xC0     ,    // End Collection
+    0x05,0x0F,    //    Usage Page Physical Interface
+    0x09,0x56,    //    Usage Direction Enable
+    0x95,0x01,    //    Report Count 1
+    0x91,0x02,    //    Output (Variable)
+    0x95,0x05,    //    Report Count 5
+    0x91,0x03,    //    Output (Constant, Variable)
+    0x09,0x57,    //    Usage Direction
+    0xA1,0x02,    //    Collection Datalink
+    0x0B,0x01,0x00,0x0A,0x00,    //    Usage Ordinals: Instance 1
+    0x0B,0x02,0x00,0x0A,0x00,    //    Usage Ordinals: Instance 2
+    0x66,0x14,0x00,              //    Unit 14h (20d)
+    0x55,0xFE,                   //    Unit Exponent FEh (254d)
+    0x15,0x00,                   //    Logical Minimum 0
+    0x26,0xFF,0x00,              //    Logical Maximum FFh (255d)
+    0x35,0x00,                   //    Physical Minimum 0
+    0x47,0xA0,0x8C,0x00,0x00,    //    Physical Maximum 8CA0h (36000d)
+    0x66,0x00,0x00,              //    Unit 0
+    0x75,0x08,                   //    Report Size 8
+    0x95,0x02,                   //    Report Count 2
+    0x91,0x02,                   //    Output (Variable)
+    0x55,0x00,                   //    Unit Exponent 0
+    0x66,0x00,0x00,              //    Unit 0
+    0xC0     ,         //    End Collection
+    0x05,0x0F,         //    Usage Page Physical Interface
+    0x09,0xA7,         //    Usage Undefined
+    0x66,0x03,0x10,    //    Unit 1003h (4099d)
+    0x55,0xFD,         //    Unit Exponent FDh (253d)
+    0x15,0x00,         //    Logical Minimum 0
+    0x26,0xFF,0x7F,    //    Logical Maximum 7FFFh (32767d)
+    0x35,0x00,         //    Physical Minimum 0
+    0x46,0xFF,0x7F,    //    Physical Maximum 7FFFh (32767d)
+    0x75,0x10,         //    Report Size 10h (16d)
+    0x95,0x01,         //    Report Count 1
+    0x91,0x02,         //    Output (Variable)
+    0x66,0x00,0x00,    //    Unit 0
+    0x55,0x00,         //    Unit Exponent 0
+    0xC0     ,    //    End Collection
+    0x05,0x0F,    //    Usage Page Physical Interface
+    0x09,0x5A,    //    Usage Set Envelope Report
+    0xA1,0x02,    //    Collection Datalink
+    0x85, 0x20,    //    Report ID 20h
+    0x09,0x22,         //    Usage Effect Block Index
+    0x15,0x01,         //    Logical Minimum 1
+    0x25,0x28,         //    Logical Maximum 28h (40d)
+    0x35,0x01,         //    Physical Minimum 1
+    0x45,0x28,         //    Physical Maximum 28h (40d)
+    0x75,0x08,         //    Report Size 8
+    0x95,0x01,         //    Report Count 1
+    0x91,0x02,         //    Output (Variable)
+    0x09,0x5B,         //    Usage Attack Level
+    0x09,0x5D,         //    Usage Fade Level
+    0x15,0x00,         //    Logical Minimum 0
+    0x26,0xFF,0x00,    //    Logical Maximum FFh (255d)
+    0x35,0x00,         //    Physical Minimum 0
+    0x46,0x10,0x27,    //    Physical Maximum 2710h (10000d)
+    0x95,0x02,         //    Report Count 2
+    0x91,0x02,         //    Output (Variable)
+    0x09,0x5C,         //    Usage Attack Time
+    0x09,0x5E,         //    Usage Fade Time
+    0x66,0x03,0x10,    //    Unit 1003h (4099d)
+    0x55,0xFD,         //    Unit Exponent FDh (253d)
+    0x26,0xFF,0x7F,    //    Logical Maximum 7FFFh (32767d)
+    0x46,0xFF,0x7F,    //    Physical Maximum 7FFFh (32767d)
+    0x75,0x10,         //    Report Size 10h (16d)
+    0x91,0x02,         //    Output (Variable)
+    0x45,0x00,         //    Physical Maximum 0
+    0x66,0x00,0x00,    //    Unit 0
+    0x55,0x00,         //    Unit Exponent 0
+    0xC0     ,            //    End Collection
+    0x09,0x5F,    //    Usage Set Condition Report
+    0xA1,0x02,    //    Collection Datalink
+    0x85,0x03,    //    Report ID 3
+    0x09,0x22,    //    Usage Effect Block Index
+    0x15,0x01,    //    Logical Minimum 1
+    0x25,0x28,    //    Logical Maximum 28h (40d)
+    0x35,0x01,    //    Physical Minimum 1
+    0x45,0x28,    //    Physical Maximum 28h (40d)
+    0x75,0x08,    //    Report Size 8
+    0x95,0x01,    //    Report Count 1
+    0x91,0x02,    //    Output (Variable)
+    0x09,0x23,    //    Usage Parameter Block Offset
+    0x15,0x00,    //    Logical Minimum 0
+    0x25,0x01,    //    Logical Maximum 1
+    0x35,0x00,    //    Physical Minimum 0
+    0x45,0x01,    //    Physical Maximum 1
+    0x75,0x04,    //    Report Size 4
+    0x95,0x01,    //    Report Count 1
+    0x91,0x02,    //    Output (Variable)
+    0x09,0x58,    //    Usage Type Specific Block Off...
+    0xA1,0x02,    //    Collection Datalink
+    0x0B,0x01,0x00,0x0A,0x00,    //    Usage Ordinals: Instance 1
+    0x0B,0x02,0x00,0x0A,0x00,    //    Usage Ordinals: Instance 2
+    0x75,0x02,                   //    Report Size 2
+    0x95,0x02,                   //    Report Count 2
+    0x91,0x02,                   //    Output (Variable)
+    0xC0     ,         //    End Collection
+    0x15,0x80,         //    Logical Minimum 80h (-128d)
+    0x25,0x7F,         //    Logical Maximum 7Fh (127d)
+    0x36,0xF0,0xD8,    //    Physical Minimum D8F0h (-10000d)
+    0x46,0x10,0x27,    //    Physical Maximum 2710h (10000d)
+    0x09,0x60,         //    Usage CP Offset
+    0x75,0x08,         //    Report Size 8
+    0x95,0x01,         //    Report Count 1
+    0x91,0x02,         //    Output (Variable)
+    0x36,0xF0,0xD8,    //    Physical Minimum D8F0h (-10000d)
+    0x46,0x10,0x27,    //    Physical Maximum 2710h (10000d)
+    0x09,0x61,         //    Usage Positive Coefficient
+    0x09,0x62,         //    Usage Negative Coefficient
+    0x95,0x02,         //    Report Count 2
+    0x91,0x02,         //    Output (Variable)
+    0x15,0x00,         //    Logical Minimum 0
+    0x26,0xFF,0x00,    //    Logical Maximum FFh (255d)
+    0x35,0x00,         //    Physical Minimum 0
+    0x46,0x10,0x27,    //    Physical Maximum 2710h (10000d)
+    0x09,0x63,         //    Usage Positive Saturation
+    0x09,0x64,         //    Usage Negative Saturation
+    0x75,0x08,         //    Report Size 8
+    0x95,0x02,         //    Report Count 2
+    0x91,0x02,         //    Output (Variable)
+    0x09,0x65,         //    Usage Dead Band
+    0x46,0x10,0x27,    //    Physical Maximum 2710h (10000d)
+    0x95,0x01,         //    Report Count 1
+    0x91,0x02,         //    Output (Variable)
+    0xC0     ,    //    End Collection
+    0x09,0x6E,    //    Usage Set Periodic Report
+    0xA1,0x02,    //    Collection Datalink
+    0x85,0x04,                   //    Report ID 4
+    0x09,0x22,                   //    Usage Effect Block Index
+    0x15,0x01,                   //    Logical Minimum 1
+    0x25,0x28,                   //    Logical Maximum 28h (40d)
+    0x35,0x01,                   //    Physical Minimum 1
+    0x45,0x28,                   //    Physical Maximum 28h (40d)
+    0x75,0x08,                   //    Report Size 8
+    0x95,0x01,                   //    Report Count 1
+    0x91,0x02,                   //    Output (Variable)
+    0x09,0x70,                   //   Usage Magnitude
+    0x15,0x00,                   //    Logical Minimum 0
+    0x26,0xFF,0x00,              //    Logical Maximum FFh (255d)
+    0x35,0x00,                   //    Physical Minimum 0
+    0x46,0x10,0x27,              //    Physical Maximum 2710h (10000d)
+    0x75,0x08,                   //    Report Size 8
+    0x95,0x01,                   //    Report Count 1
+    0x91,0x02,                   //    Output (Variable)
+    0x09,0x6F,                   //   Usage Offset
+    0x15,0x80,                   //    Logical Minimum 80h (-128d)
+    0x25,0x7F,                   //    Logical Maximum 7Fh (127d)
+    0x36,0xF0,0xD8,              //    Physical Minimum D8F0h (-10000d)
+    0x46,0x10,0x27,              //    Physical Maximum 2710h (10000d)
+    0x95,0x01,                   //    Report Count 1
+    0x91,0x02,                   //    Output (Variable)
+    0x09,0x71,                   //   Usage Phase
+    0x66,0x14,0x00,              //    Unit 14h (20d)
+    0x55,0xFE,                   //    Unit Exponent FEh (254d)
+    0x15,0x00,                   //    Logical Minimum 0
+    0x26,0xFF,0x00,              //    Logical Maximum FFh (255d)
+    0x35,0x00,                   //    Physical Minimum 0
+    0x47,0xA0,0x8C,0x00,0x00,    //    Physical Maximum 8CA0h (36000d)
+    0x91,0x02,                   //    Output (Variable)
+    0x09,0x72,                   //   Usage Period
+    0x26,0xFF,0x7F,              //    Logical Maximum 7FFFh (32767d)
+    0x46,0xFF,0x7F,              //    Physical Maximum 7FFFh (32767d)
+    0x66,0x03,0x10,              //    Unit 1003h (4099d)
+    0x55,0xFD,                   //    Unit Exponent FDh (253d)
+    0x75,0x10,                   //    Report Size 10h (16d)
+    0x95,0x01,                   //    Report Count 1
+    0x91,0x02,                   //    Output (Variable)
+    0x66,0x00,0x00,              //    Unit 0
+    0x55,0x00,                   //    Unit Exponent 0
+    0xC0     ,    // End Collection
+    0x09,0x73,    //    Usage Set Constant Force Rep...
+    0xA1,0x02,    //    Collection Datalink
+    0x85,0x05,         //    Report ID 5
+    0x09,0x22,         //    Usage Effect Block Index
+    0x15,0x01,         //    Logical Minimum 1
+    0x25,0x28,         //    Logical Maximum 28h (40d)
+    0x35,0x01,         //    Physical Minimum 1
+    0x45,0x28,         //    Physical Maximum 28h (40d)
+    0x75,0x08,         //    Report Size 8
+    0x95,0x01,         //    Report Count 1
+    0x91,0x02,         //    Output (Variable)
+    0x09,0x70,         //    Usage Magnitude
+    0x16,0x01,0xFF,    //    Logical Minimum FF01h (-255d)
+    0x26,0xFF,0x00,    //    Logical Maximum FFh (255d)
+    0x36,0xF0,0xD8,    //    Physical Minimum D8F0h (-10000d)
+    0x46,0x10,0x27,    //    Physical Maximum 2710h (10000d)
+    0x75,0x10,         //    Report Size 10h (16d)
+    0x95,0x01,         //    Report Count 1
+    0x91,0x02,         //    Output (Variable)
+    0xC0     ,    //    End Collection
+    0x09,0x74,    //    Usage Set Ramp Force Report
+    0xA1,0x02,    //    Collection Datalink
+    0x85,0x06,         //    Report ID 6
+    0x09,0x22,         //    Usage Effect Block Index
+    0x15,0x01,         //    Logical Minimum 1
+    0x25,0x28,         //    Logical Maximum 28h (40d)
+    0x35,0x01,         //    Physical Minimum 1
+    0x45,0x28,         //    Physical Maximum 28h (40d)
+    0x75,0x08,         //    Report Size 8
+    0x95,0x01,         //    Report Count 1
+    0x91,0x02,         //    Output (Variable)
+    0x09,0x75,         //    Usage Ramp Start
+    0x09,0x76,         //    Usage Ramp End
+    0x15,0x80,         //    Logical Minimum 80h (-128d)
+    0x25,0x7F,         //    Logical Maximum 7Fh (127d)
+    0x36,0xF0,0xD8,    //    Physical Minimum D8F0h (-10000d)
+    0x46,0x10,0x27,    //    Physical Maximum 2710h (10000d)
+    0x75,0x08,         //    Report Size 8
+    0x95,0x02,         //    Report Count 2
+    0x91,0x02,         //    Output (Variable)
+    0xC0     ,    //    End Collection
+    0x09,0x68,    //    Usage Custom Force Data Rep...
+    0xA1,0x02,    //    Collection Datalink
+    0x85,0x07,         //    Report ID 7
+    0x09,0x22,         //    Usage Effect Block Index
+    0x15,0x01,         //    Logical Minimum 1
+    0x25,0x28,         //    Logical Maximum 28h (40d)
+    0x35,0x01,         //    Physical Minimum 1
+    0x45,0x28,         //    Physical Maximum 28h (40d)
+    0x75,0x08,         //    Report Size 8
+    0x95,0x01,         //    Report Count 1
+    0x91,0x02,         //    Output (Variable)
+    0x09,0x6C,         //    Usage Custom Force Data Offset
+    0x15,0x00,         //    Logical Minimum 0
+    0x26,0x10,0x27,    //    Logical Maximum 2710h (10000d)
+    0x35,0x00,         //    Physical Minimum 0
+    0x46,0x10,0x27,    //    Physical Maximum 2710h (10000d)
+    0x75,0x10,         //    Report Size 10h (16d)
+    0x95,0x01,         //    Report Count 1
+    0x91,0x02,         //    Output (Variable)
+    0x09,0x69,         //    Usage Custom Force Data
+    0x15,0x81,         //    Logical Minimum 81h (-127d)
+    0x25,0x7F,         //    Logical Maximum 7Fh (127d)
+    0x35,0x00,         //    Physical Minimum 0
+    0x46,0xFF,0x00,    //    Physical Maximum FFh (255d)
+    0x75,0x08,         //    Report Size 8
+    0x95,0x0C,         //    Report Count Ch (12d)
+    0x92,0x02,0x01,    //       Output (Variable, Buffered)
+    0xC0     ,    //    End Collection
+    0x09,0x66,    //    Usage Download Force Sample
+    0xA1,0x02,    //    Collection Datalink
+    0x85,0x08,         //    Report ID 8
+    0x05,0x01,         //    Usage Page Generic Desktop
+    0x09,0x30,         //    Usage X
+    0x09,0x31,         //    Usage Y
+    0x15,0x81,         //    Logical Minimum 81h (-127d)
+    0x25,0x7F,         //    Logical Maximum 7Fh (127d)
+    0x35,0x00,         //    Physical Minimum 0
+    0x46,0xFF,0x00,    //    Physical Maximum FFh (255d)
+    0x75,0x08,         //    Report Size 8
+    0x95,0x02,         //    Report Count 2
+    0x91,0x02,         //    Output (Variable)
+    0xC0     ,   //    End Collection
+    0x05,0x0F,   //    Usage Page Physical Interface
+    0x09,0x77,   //    Usage Effect Operation Report
+    0xA1,0x02,   //    Collection Datalink
+    0x85,0x0A,    //    Report ID Ah (10d)
+    0x09,0x22,    //    Usage Effect Block Index
+    0x15,0x01,    //    Logical Minimum 1
+    0x25,0x28,    //    Logical Maximum 28h (40d)
+    0x35,0x01,    //    Physical Minimum 1
+    0x45,0x28,    //    Physical Maximum 28h (40d)
+    0x75,0x08,    //    Report Size 8
+    0x95,0x01,    //    Report Count 1
+    0x91,0x02,    //    Output (Variable)
+    0x09,0x78,    //    Usage Operation
+    0xA1,0x02,    //    Collection Datalink
+    0x09,0x79,    //    Usage Op Effect Start
+    0x09,0x7A,    //    Usage Op Effect Start Solo
+    0x09,0x7B,    //    Usage Op Effect Stop
+    0x15,0x01,    //    Logical Minimum 1
+    0x25,0x03,    //    Logical Maximum 3
+    0x75,0x08,    //    Report Size 8
+    0x95,0x01,    //    Report Count 1
+    0x91,0x00,    //    Output
+    0xC0     ,         //    End Collection
+    0x09,0x7C,         //    Usage Loop Count
+    0x15,0x00,         //    Logical Minimum 0
+    0x26,0xFF,0x00,    //    Logical Maximum FFh (255d)
+    0x35,0x00,         //    Physical Minimum 0
+    0x46,0xFF,0x00,    //    Physical Maximum FFh (255d)
+    0x91,0x02,         //    Output (Variable)
+    0xC0     ,    //    End Collection
+    0x09,0x90,    //    Usage PID State Report (PID Block Free Report)
+    0xA1,0x02,    //    Collection Datalink
+    0x85,0x0B,    //    Report ID Bh (11d)
+    0x09,0x22,    //    Usage Effect Block Index
+    0x25,0x28,    //    Logical Maximum 28h (40d)
+    0x15,0x01,    //    Logical Minimum 1
+    0x35,0x01,    //    Physical Minimum 1
+    0x45,0x28,    //    Physical Maximum 28h (40d)
+    0x75,0x08,    //    Report Size 8
+    0x95,0x01,    //    Report Count 1
+    0x91,0x02,    //    Output (Variable)
+    0xC0     ,    //    End Collection
+    0x09,0x96,    //    Usage DC Disable Actuators (PID Device Control)
+    0xA1,0x02,    //    Collection Datalink
+    0x85,0x0C,    //    Report ID Ch (12d)
+    0x09,0x97,    //    Usage DC Stop All Effects (DC Enable Actuators)
+    0x09,0x98,    //    Usage DC Device Reset (DC Disable Actuators)
+    0x09,0x99,    //    Usage DC Device Pause (DC Stop All Effects)
+    0x09,0x9A,    //    Usage DC Device Continue (DC Device Reset?)
+    0x09,0x9B,    //    Usage PID Device State (DC Device Pause)
+    0x09,0x9C,    //    Usage DS Actuators Enabled
+    0x15,0x01,    //    Logical Minimum 1
+    0x25,0x06,    //    Logical Maximum 6
+    0x75,0x08,    //    Report Size 8
+    0x95,0x01,    //    Report Count 1
+    0x91,0x00,    //    Output
+    0xC0     ,    //    End Collection
+    0x09,0x7D,    //    Usage PID Pool Report (Device Gain Report)
+    0xA1,0x02,    //    Collection Datalink
+    0x85,0x0D,         //    Report ID Dh (13d)
+    0x09,0x7E,         //    Usage RAM Pool Size (Device Gain)
+    0x15,0x00,         //    Logical Minimum 0
+    0x26,0xFF,0x00,    //    Logical Maximum FFh (255d)
+    0x35,0x00,         //    Physical Minimum 0
+    0x46,0x10,0x27,    //    Physical Maximum 2710h (10000d)
+    0x75,0x08,         //    Report Size 8
+    0x95,0x01,         //    Report Count 1
+    0x91,0x02,         //    Output (Variable)
+    0xC0     ,            //    End Collection
+    0x09,0x6B,    //    Usage Set Custom Force Report
+    0xA1,0x02,    //    Collection Datalink
+    0x85,0x0E,         //    Report ID Eh (14d)
+    0x09,0x22,         //    Usage Effect Block Index
+    0x15,0x01,         //    Logical Minimum 1
+    0x25,0x28,         //    Logical Maximum 28h (40d)
+    0x35,0x01,         //    Physical Minimum 1
+    0x45,0x28,         //    Physical Maximum 28h (40d)
+    0x75,0x08,         //    Report Size 8
+    0x95,0x01,         //    Report Count 1
+    0x91,0x02,         //    Output (Variable)
+    0x09,0x6D,         //    Usage Sample Count
+    0x15,0x00,         //    Logical Minimum 0
+    0x26,0xFF,0x00,    //    Logical Maximum FFh (255d)
+    0x35,0x00,         //    Physical Minimum 0
+    0x46,0xFF,0x00,    //    Physical Maximum FFh (255d)
+    0x75,0x08,         //    Report Size 8
+    0x95,0x01,         //    Report Count 1
+    0x91,0x02,         //    Output (Variable)
+    0x09,0x51,         //    Usage Sample Period
+    0x66,0x03,0x10,    //    Unit 1003h (4099d)
+    0x55,0xFD,         //    Unit Exponent FDh (253d)
+    0x15,0x00,         //    Logical Minimum 0
+    0x26,0xFF,0x7F,    //    Logical Maximum 7FFFh (32767d)
+    0x35,0x00,         //    Physical Minimum 0
+    0x46,0xFF,0x7F,    //    Physical Maximum 7FFFh (32767d)
+    0x75,0x10,         //    Report Size 10h (16d)
+    0x95,0x01,         //    Report Count 1
+    0x91,0x02,         //    Output (Variable)
+    0x55,0x00,         //    Unit Exponent 0
+    0x66,0x00,0x00,    //    Unit 0
+    0xC0     ,    //    End Collection
+    0x09,0xAB,    //    Usage Undefined << Create New Effect Report
+    0xA1,0x02,    //    Collection Datalink
+    0x85,0x09,    //    Report ID 9
+    0x09,0x25,    //    Usage Effect Type
+    0xA1,0x02,    //    Collection Datalink
+    0x09,0x26,    //    Usage ET Constant Force
+    0x09,0x27,    //    Usage ET Ramp
+    0x09,0x30,    //    Usage ET Square
+    0x09,0x31,    //    Usage ET Sine
+    0x09,0x32,    //    Usage ET Triangle
+    0x09,0x33,    //    Usage ET Sawtooth Up
+    0x09,0x34,    //    Usage ET Sawtooth Down
+    0x09,0x40,    //    Usage ET Spring
+    0x09,0x41,    //    Usage ET Damper
+    0x09,0x42,    //    Usage ET Inertia
+    0x09,0x43,    //    Usage ET Friction
+    0x09,0x28,    //    Usage ET Custom Force Data
+    0x25,0x0C,    //    Logical Maximum Ch (12d)
+    0x15,0x01,    //    Logical Minimum 1
+    0x35,0x01,    //    Physical Minimum 1
+    0x45,0x0C,    //    Physical Maximum Ch (12d)
+    0x75,0x08,    //    Report Size 8
+    0x95,0x01,    //    Report Count 1
+    0xB1,0x00,    //    Feature
+    0xC0     ,    // End Collection
+    0x05,0x01,         //    Usage Page Generic Desktop
+    0x09,0x3B,         //    Usage Byte Count
+    0x15,0x00,         //    Logical Minimum 0
+    0x26,0xFF,0x01,    //    Logical Maximum 1FFh (511d)
+    0x35,0x00,         //    Physical Minimum 0
+    0x46,0xFF,0x01,    //    Physical Maximum 1FFh (511d)
+    0x75,0x0A,         //    Report Size Ah (10d)
+    0x95,0x01,         //    Report Count 1
+    0xB1,0x02,         //    Feature (Variable)
+    0x75,0x06,         //    Report Size 6
+    0xB1,0x01,         //    Feature (Constant)
+    0xC0     ,    //    End Collection
+    0x05,0x0F,    //    Usage Page Physical Interface
+    0x09,0x89,    //    Usage Block Load Status (PID Block Load Report)
+    0xA1,0x02,    //    Collection Datalink
+    0x85, 0x20,    //    Report ID 20h (32d)
+    0x09,0x22,    //    Usage Effect Block Index
+    0x25,0x28,    //    Logical Maximum 28h (40d)
+    0x15,0x01,    //    Logical Minimum 1
+    0x35,0x01,    //    Physical Minimum 1
+    0x45,0x28,    //    Physical Maximum 28h (40d)
+    0x75,0x08,    //    Report Size 8
+    0x95,0x01,    //    Report Count 1
+    0xB1,0x02,    //    Feature (Variable)
+    0x09,0x8B,    //    Usage Block Load Full (Block Load Status)
+    0xA1,0x02,    //    Collection Datalink
+    0x09,0x8C,    //    Usage Block Load Error
+    0x09,0x8D,    //    Usage Block Handle
+    0x09,0x8E,    //    Usage PID Block Free Report
+    0x25,0x03,    //    Logical Maximum 3
+    0x15,0x01,    //    Logical Minimum 1
+    0x35,0x01,    //    Physical Minimum 1
+    0x45,0x03,    //    Physical Maximum 3
+    0x75,0x08,    //    Report Size 8
+    0x95,0x01,    //    Report Count 1
+    0xB1,0x00,    //    Feature
+    0xC0     ,                   // End Collection
+    0x09,0xAC,                   //    Usage Undefined
+    0x15,0x00,                   //    Logical Minimum 0
+    0x27,0xFF,0xFF,0x00,0x00,    //    Logical Maximum FFFFh (65535d)
+    0x35,0x00,                   //    Physical Minimum 0
+    0x47,0xFF,0xFF,0x00,0x00,    //    Physical Maximum FFFFh (65535d)
+    0x75,0x10,                   //    Report Size 10h (16d)
+    0x95,0x01,                   //    Report Count 1
+    0xB1,0x00,                   //    Feature
+    0xC0     ,    //    End Collection
+    0x09,0x7F,    //    Usage ROM Pool Size (PID Pool Report?)
+    0xA1,0x02,    //    Collection Datalink
+    0x85,0x03,                   //    Report ID 3
+    0x09,0x80,                   //    Usage ROM Effect Block Count (RAM Pool Size?)
+    0x75,0x10,                   //    Report Size 10h (16d)
+    0x95,0x01,                   //    Report Count 1
+    0x15,0x00,                   //    Logical Minimum 0
+    0x35,0x00,                   //    Physical Minimum 0
+    0x27,0xFF,0xFF,0x00,0x00,    //    Logical Maximum FFFFh (65535d)
+    0x47,0xFF,0xFF,0x00,0x00,    //    Physical Maximum FFFFh (65535d)
+    0xB1,0x02,                   //    Feature (Variable)
+    0x09,0x83,                   //    Usage PID Pool Move Report (Simultaneous Effects Max?)
+    0x26,0xFF,0x00,              //    Logical Maximum FFh (255d)
+    0x46,0xFF,0x00,              //    Physical Maximum FFh (255d)
+    0x75,0x08,                   //    Report Size 8
+    0x95,0x01,                   //    Report Count 1
+    0xB1,0x02,                   //    Feature (Variable)
+    0x09,0xA9,                   //    Usage Undefined (Device Managed Pool?)
+    0x09,0xAA,                   //    Usage Undefined (Shared Parameter Blocks?)
+    0x75,0x01,                   //    Report Size 1
+    0x95,0x02,                   //    Report Count 2
+    0x15,0x00,                   //    Logical Minimum 0
+    0x25,0x01,                   //    Logical Maximum 1
+    0x35,0x00,                   //    Physical Minimum 0
+    0x45,0x01,                   //    Physical Maximum 1
+    0xB1,0x02,                   //    Feature (Variable)
+    0x75,0x06,                   //    Report Size 6
+    0x95,0x01,                   //    Report Count 1
+    0xB1,0x03,                   //    Feature (Constant, Variable)
+    0xC0,    //    End Collection
+
+        // ====== End of virtual PID force feedback ======= //
+
+    0xC0,               /*  End Collection,                     */
+
+    0x05, 0x0C,         /*  Usage Page (Consumer),              */
+    0x09, 0x01,         /*  Usage (Consumer Control),           */  // Virtual consumer control device
+    0xA1, 0x01,         /*  Collection (Application),           */
+    0x85, 0x1E,         /*      Report ID (30),                 */
+    0x15, 0x00,         /*      Logical Minimum (0),            */
+    0x25, 0x01,         /*      Logical Maximum (1),            */
+    0x75, 0x03,         /*      Report Size (3),                */
+    0x95, 0x01,         /*      Report Count (1),               */
+    0x81, 0x03,         /*      Input (Constant, Variable),     */
+    0x75, 0x01,         /*      Report Size (1),                */
+    0x95, 0x02,         /*      Report Count (2),               */
+    //0x09, 0xE2,         /*      Usage (Mute),                   */
+    0x09, 0xE9,         /*      Usage (Volume Inc),             */
+    0x09, 0xEA,         /*      Usage (Volume Dec),             */
+    //0x09, 0x30,         /*      Usage (Power),                  */
+    //0x0A, 0x24, 0x02,   /*      Usage (AC Back),                */
+    //0x0A, 0x23, 0x02,   /*      Usage (AC Home),                */
+    0x81, 0x02,         /*      Input (Variable),               */
+    0x75, 0x03,         /*      Report Size (3),                */
+    0x95, 0x01,         /*      Report Count (1),               */
+    0x81, 0x03,         /*      Input (Constant, Variable),     */
+    0xA1, 0x01,         /*      Collection (Application),       */
+        0x19, 0x01,         /*          Usage Minimum (01h),        */ // HACK: Without this deliberately DirectInput-incompatible collection the customer control device would get detected as a gamepad, go figure..
+        0x29, 0x03,         /*          Usage Maximum (03h),        */
+        0x15, 0x00,         /*          Logical Minimum (0),        */
+        0x26, 0xFF, 0xFF,   /*          Logical Maximum (65536),       */
+        0x95, 0x03,         /*          Report Count (3),           */
+        0x75, 0x10,         /*          Report Size (16),           */
+        0x91, 0x02,         /*          Output (Variable),          */
+        0xC0,               /*      End Collection,                 */
+    0xC0,               /*  End Collection,                     */
+
+    0x05, 0x01,         /*  Usage Page (Desktop),               */
+    0x09, 0x02,         /*  Usage (Mouse),                      */
+    0xA1, 0x01,         /*  Collection (Application),           */
+    0x85, 0x02,         /*      Report ID (2),                  */
+    0x09, 0x01,         /*      Usage (Pointer),                */
+    0xA1, 0x00,         /*      Collection (Physical),          */
+    0x05, 0x09,         /*          Usage Page (Button),        */
+    0x19, 0x01,         /*          Usage Minimum (01h),        */
+    0x29, 0x03,         /*          Usage Maximum (03h),        */
+    0x25, 0x01,         /*          Logical Maximum (1),        */
+    0x75, 0x01,         /*          Report Size (1),            */
+    0x95, 0x03,         /*          Report Count (3),           */
+    0x81, 0x02,         /*          Input (Variable),           */
+    0x05, 0x09,         /*          Usage Page (Button),        */
+    0x09, 0x05,         /*          Usage (05h),                */
+    0x95, 0x01,         /*          Report Count (1),           */
+    0x81, 0x02,         /*          Input (Variable),           */
+    0x75, 0x04,         /*          Report Size (4),            */
+    0x81, 0x01,         /*          Input (Constant),           */
+    0x05, 0x01,         /*          Usage Page (Desktop),       */
+    0x09, 0x30,         /*          Usage (X),                  */
+    0x09, 0x31,         /*          Usage (Y),                  */
+    0x15, 0x81,         /*          Logical Minimum (-127),     */
+    0x25, 0x7F,         /*          Logical Maximum (127),      */
+    0x35, 0x81,                   //    Physical Minimum -127
+    0x45, 0x7F,                   //    Physical Maximum 127
+    0x75, 0x10,         /*          Report Size (16),           */
+    0x95, 0x02,         /*          Report Count (2),           */
+    0x81, 0x06,         /*          Input (Variable, Relative), */
+    0xC0,               /*      End Collection,                 */
+    0xC0,               /*  End Collection,                     */
+    0x06, 0xDE, 0xFF,   /*  Usage Page (FFDEh),                 */
+    0x09, 0x01,         /*  Usage (01h),                        */
+    0xA1, 0x01,         /*  Collection (Application),           */
+    0x05, 0xFF,         /*      Usage Page (FFh),               */
+    0x19, 0x01,         /*      Usage Minimum (01h),            */
+    0x29, 0x40,         /*      Usage Maximum (40h),            */
+    0x85, 0xFD,         /*      Report ID (253),                */
+    0x15, 0x00,         /*      Logical Minimum (0),            */
+    0x25, 0xFF,         /*      Logical Maximum (-1),           */
+    0x95, 0x40,         /*      Report Count (64),              */
+    0x75, 0x08,         /*      Report Size (8),                */
+    0x81, 0x02,         /*      Input (Variable),               */
+    0xC0,               /*  End Collection,                     */
+    0x06, 0xDE, 0xFF,   /*  Usage Page (FFDEh),                 */
+    0x09, 0x03,         /*  Usage (03h),                        */
+    0xA1, 0x01,         /*  Collection (Application),           */
+    0x19, 0x01,         /*      Usage Minimum (01h),            */
+    0x29, 0x40,         /*      Usage Maximum (40h),            */
+    0x85, 0xFC,         /*      Report ID (252),                */
+    0x95, 0x40,         /*      Report Count (64),              */
+    0x75, 0x08,         /*      Report Size (8),                */
+    0xB1, 0x02,         /*      Feature (Variable),             */
+    0xC0                /*  End Collection                      */
+
+};
+
+const ULONG G_DefaultReportDescriptorLength = sizeof(G_DefaultReportDescriptor);
+
+BOOLEAN
+NvShieldHidNextItem(
+    const UCHAR* Descriptor,
+    ULONG Length,
+    PULONG Offset,
+    PNVSHIELD_HID_ITEM Item
+)
+/*++
+
+Routine Description:
+
+    Decodes the item at *Offset and advances *Offset past it.
+
+Return Value:
+
+    FALSE at the end of the descriptor or on a truncated item.
+
+--*/
+{
+    ULONG offset = *Offset;
+    ULONG size, i;
+    UCHAR prefix;
+
+    if (Descriptor == NULL || offset >= Length)
+        return FALSE;
+
+    prefix = Descriptor[offset];
+
+    if (prefix == 0xFE) { // long item, data not decoded
+        if (offset + 3 > Length || offset + 3 + Descriptor[offset + 1] > Length)
+            return FALSE;
+
+        Item->Prefix = prefix;
+        Item->Type = NVSHIELD_HID_ITEM_RESERVED;
+        Item->Tag = Descriptor[offset + 2];
+        Item->Size = Descriptor[offset + 1];
+        Item->Data = 0;
+        Item->Raw = Descriptor + offset;
+        Item->RawLength = 3 + Item->Size;
+
+        *Offset = offset + Item->RawLength;
+        return TRUE;
+    }
+
+    size = prefix & 0x03;
+    if (size == 3)
+        size = 4;
+
+    if (offset + 1 + size > Length)
+        return FALSE;
+
+    Item->Prefix = prefix;
+    Item->Type = (prefix >> 2) & 0x03;
+    Item->Tag = prefix >> 4;
+    Item->Size = (UCHAR)size;
+    Item->Data = 0;
+    for (i = 0; i < size; i++)
+        Item->Data |= (ULONG)Descriptor[offset + 1 + i] << (8 * i);
+    Item->Raw = Descriptor + offset;
+    Item->RawLength = 1 + size;
+
+    *Offset = offset + 1 + size;
+    return TRUE;
+}
+
+static VOID
+layoutAssign(
+    PNVSHIELD_INPUT_LAYOUT Layout,
+    ULONG Usage,
+    ULONG BitOffset,
+    ULONG BitSize
+)
+{
+    PNVSHIELD_INPUT_FIELD field = NULL;
+    ULONG page = Usage >> 16;
+
+    Usage &= 0xFFFF;
+
+    if (page == 0x09) {                             // Button
+        field = &Layout->Buttons;
+    }
+    else if (page == 0x0C) {                        // Consumer
+        field = &Layout->Consumer;
+    }
+    else if (page == 0x01) {                        // Generic Desktop
+        switch (Usage)
+        {
+        case 0x30: field = &Layout->Axes[NvShieldAxisX]; break;
+        case 0x31: field = &Layout->Axes[NvShieldAxisY]; break;
+        case 0x32: field = &Layout->Axes[NvShieldAxisZ]; break;
+        case 0x33: field = &Layout->Axes[NvShieldAxisRx]; break;
+        case 0x34: field = &Layout->Axes[NvShieldAxisRy]; break;
+        case 0x35: field = &Layout->Axes[NvShieldAxisRz]; break;
+        case 0x39: field = &Layout->Hat; break;
+        default: break;
+        }
+    }
+
+    if (field == NULL || BitSize > 16)
+        return;
+
+    if (field == &Layout->Buttons || field == &Layout->Consumer) {
+        // Bit arrays, grown while their bits are contiguous
+        if (field->BitSize == 0)
+            field->BitOffset = (USHORT)BitOffset;
+        if (field->BitOffset + field->BitSize == BitOffset && field->BitSize + BitSize <= 16)
+            field->BitSize = (USHORT)(field->BitSize + BitSize);
+    }
+    else if (field->BitSize == 0) {
+        field->BitOffset = (USHORT)BitOffset;
+        field->BitSize = (USHORT)BitSize;
+    }
+}
+
+BOOLEAN
+NvShieldGetInputLayout(
+    const UCHAR* Descriptor,
+    ULONG Length,
+    UCHAR ReportId,
+    PNVSHIELD_INPUT_LAYOUT Layout
+)
+/*++
+
+Routine Description:
+
+    Finds the gamepad controls in input report ReportId of a Report
+    Descriptor, so that the reports can be decoded without hardcoding
+    their layout.
+
+Return Value:
+
+    FALSE if the descriptor has no such input report or it is too large
+    to be described.
+
+--*/
+{
+    NVSHIELD_HID_ITEM item;
+    ULONG usages[16];
+    ULONG usageCount = 0, usageMinimum = 0, usageMaximum = 0;
+    ULONG usagePage = 0, reportSize = 0, reportCount = 0, reportId = 0;
+    ULONG offset = 0, bitOffset = 8, i;
+
+    RtlZeroMemory(Layout, sizeof(*Layout));
+    Layout->ReportId = ReportId;
+
+    while (NvShieldHidNextItem(Descriptor, Length, &offset, &item)) {
+
+        if (item.Type == NVSHIELD_HID_ITEM_GLOBAL) {
+            switch (item.Tag)
+            {
+            case NVSHIELD_HID_TAG_USAGE_PAGE:   usagePage = item.Data; break;
+            case NVSHIELD_HID_TAG_REPORT_SIZE:  reportSize = item.Data; break;
+            case NVSHIELD_HID_TAG_REPORT_COUNT: reportCount = item.Data; break;
+            case NVSHIELD_HID_TAG_REPORT_ID:    reportId = item.Data; break;
+            default: break;
+            }
+        }
+        else if (item.Type == NVSHIELD_HID_ITEM_LOCAL) {
+            // Usages without a page take the current one
+            ULONG usage = item.Size == 4 ? item.Data : (usagePage << 16) | item.Data;
+
+            if (item.Tag == NVSHIELD_HID_TAG_USAGE && usageCount < ARRAYSIZE(usages))
+                usages[usageCount++] = usage;
+            else if (item.Tag == NVSHIELD_HID_TAG_USAGE_MINIMUM)
+                usageMinimum = usage;
+            else if (item.Tag == NVSHIELD_HID_TAG_USAGE_MAXIMUM)
+                usageMaximum = usage;
+        }
+        else if (item.Type == NVSHIELD_HID_ITEM_MAIN) {
+            if (item.Tag == NVSHIELD_HID_TAG_INPUT && reportId == ReportId) {
+                // Checked before the fields are walked, both come from the
+                // device and a Report Count of billions would take seconds;
+                // fields of no bits aren't walked at all, for the same reason
+                if ((ULONGLONG)reportSize * reportCount > 0xFFFF - bitOffset)
+                    return FALSE;
+
+                for (i = 0; i < reportCount && reportSize != 0 && !(item.Data & 0x01); i++) { // not Constant
+                    ULONG usage = 0;
+
+                    if (usageCount != 0)
+                        usage = usages[i < usageCount ? i : usageCount - 1];
+                    else if (usageMinimum != 0 && usageMinimum + i <= usageMaximum)
+                        usage = usageMinimum + i;
+
+                    layoutAssign(Layout, usage, bitOffset + i * reportSize, reportSize);
+                }
+
+                bitOffset += reportSize * reportCount;
+            }
+
+            usageCount = 0;
+            usageMinimum = usageMaximum = 0;
+        }
+    }
+
+    if (bitOffset == 8)
+        return FALSE;
+
+    Layout->ReportSize = (bitOffset + 7) / 8;
+    return TRUE;
+}
+
+BOOLEAN
+NvShieldGetInputReportSizes(
+    const UCHAR* Descriptor,
+    ULONG Length,
+    const UCHAR* IdMap,
+    PNVSHIELD_REPORT_SIZES Sizes
+)
+/*++
+
+Routine Description:
+
+    Adds up the Input items of every report ID of a Report Descriptor.
+    All of them must have a report ID, as ours do.
+
+    IdMap, if not NULL, is the report ID each report of the controller is
+    presented with, see NvShieldPatchReportDescriptor: the report sizes are
+    then also recorded under the IDs the controller sends.
+
+Return Value:
+
+    FALSE if the descriptor declares no input report, or one without a
+    report ID or too large to be described.
+
+--*/
+{
+    NVSHIELD_HID_ITEM item;
+    ULONG bits[256];
+    ULONG reportSize = 0, reportCount = 0, reportId = 0;
+    ULONG offset = 0, i;
+    BOOLEAN found = FALSE;
+
+    RtlZeroMemory(bits, sizeof(bits));
+    RtlZeroMemory(Sizes, sizeof(*Sizes));
+
+    while (NvShieldHidNextItem(Descriptor, Length, &offset, &item)) {
+
+        if (item.Type == NVSHIELD_HID_ITEM_GLOBAL) {
+            switch (item.Tag)
+            {
+            case NVSHIELD_HID_TAG_REPORT_SIZE:  reportSize = item.Data; break;
+            case NVSHIELD_HID_TAG_REPORT_COUNT: reportCount = item.Data; break;
+            case NVSHIELD_HID_TAG_REPORT_ID:    reportId = item.Data; break;
+            default: break;
+            }
+        }
+        else if (item.Type == NVSHIELD_HID_ITEM_MAIN && item.Tag == NVSHIELD_HID_TAG_INPUT) {
+            if (reportId == 0 || reportId > 0xFF)
+                return FALSE;
+
+            // In 64 bits, the product of the two can't wrap, and the
+            // report ID byte must still fit in a USHORT length
+            if ((ULONGLONG)reportSize * reportCount > 0xFFFE * 8 - bits[reportId])
+                return FALSE;
+
+            bits[reportId] += reportSize * reportCount;
+
+            found = TRUE;
+        }
+    }
+
+    for (i = 0; i < 256; i++) {
+        if (bits[i] != 0)
+            Sizes->Input[i] = (USHORT)(1 + (bits[i] + 7) / 8);
+        Sizes->InputId[i] = (UCHAR)i;
+    }
+
+    if (IdMap != NULL) {
+        for (i = 1; i < 256; i++) {
+            if (IdMap[i] != i) {
+                Sizes->Input[i] = Sizes->Input[IdMap[i]];
+                Sizes->InputId[i] = IdMap[i];
+            }
+        }
+    }
+
+    return found;
+}
+
+//
+// PID variants
+//
+// The PID block of G_DefaultReportDescriptor declares a report for every
+// effect parameter block of the specification, most of which the emulation
+// ignores, and HID class and DirectInput parse and allocate for all of them.
+// A variant keeps only the parameter block reports and effect types of the
+// effect classes it is built for.
+//
+// Globals are inherited across reports, so wherever items were dropped or
+// rewritten, the ones that now differ from the original descriptor's state
+// are emitted again before the next item that depends on them. Within an
+// Effect Type collection the expected state carries the rewritten maximums
+// instead.
+//
+
+#define PID_USAGE_PAGE              0x0F
+#define PID_USAGE_EFFECT_TYPE       0x25
+
+#define GLOBAL_STATE_TAGS           10 // Usage Page to Report Count, no Push/Pop
+
+typedef struct _GLOBAL_ITEM {
+    UCHAR Raw[5];
+    UCHAR Length;
+} GLOBAL_ITEM;
+
+typedef struct _DESCRIPTOR_WRITER {
+    PUCHAR Buffer;
+    ULONG Capacity;
+    ULONG Length;           // keeps counting past Capacity
+    GLOBAL_ITEM Emitted[GLOBAL_STATE_TAGS];
+    BOOLEAN Muted;          // drops what is emitted
+} DESCRIPTOR_WRITER;
+
+static ULONG
+pidSegmentEffects(
+    ULONG Usage
+)
+{
+    switch (Usage)
+    {
+    case 0x5A: return NVSHIELD_PID_EFFECT_ENVELOPE;     // Set Envelope Report
+    case 0x5F: return NVSHIELD_PID_EFFECT_CONDITION;    // Set Condition Report
+    case 0x6E: return NVSHIELD_PID_EFFECT_PERIODIC;     // Set Periodic Report
+    case 0x73: return NVSHIELD_PID_EFFECT_CONSTANT;     // Set Constant Force Report
+    case 0x74: return NVSHIELD_PID_EFFECT_RAMP;         // Set Ramp Force Report
+    case 0x66:                                          // Download Force Sample
+    case 0x68:                                          // Custom Force Data Report
+    case 0x6B: return NVSHIELD_PID_EFFECT_CUSTOM;       // Set Custom Force Report
+    default:   return 0;                                // needed by every effect
+    }
+}
+
+static ULONG
+pidEffectTypeEffects(
+    ULONG Usage
+)
+{
+    if (Usage == 0x26)
+        return NVSHIELD_PID_EFFECT_CONSTANT;
+    if (Usage == 0x27)
+        return NVSHIELD_PID_EFFECT_RAMP;
+    if (Usage >= 0x30 && Usage <= 0x34) // Square to Sawtooth Down
+        return NVSHIELD_PID_EFFECT_PERIODIC;
+    if (Usage >= 0x40 && Usage <= 0x43) // Spring to Friction
+        return NVSHIELD_PID_EFFECT_CONDITION;
+    if (Usage == 0x28)
+        return NVSHIELD_PID_EFFECT_CUSTOM;
+    return 0;
+}
+
+static VOID
+writerEmit(
+    DESCRIPTOR_WRITER* Writer,
+    const UCHAR* Raw,
+    ULONG Length
+)
+{
+    if (Writer->Muted)
+        return;
+
+    if (Writer->Buffer != NULL && Writer->Length + Length <= Writer->Capacity)
+        RtlCopyMemory(Writer->Buffer + Writer->Length, Raw, Length);
+
+    Writer->Length += Length;
+}
+
+static VOID
+writerEmitGlobal(
+    DESCRIPTOR_WRITER* Writer,
+    UCHAR Tag,
+    const UCHAR* Raw,
+    ULONG Length
+)
+{
+    writerEmit(Writer, Raw, Length);
+
+    if (!Writer->Muted && Tag < GLOBAL_STATE_TAGS && Length <= sizeof(Writer->Emitted[Tag].Raw)) {
+        RtlCopyMemory(Writer->Emitted[Tag].Raw, Raw, Length);
+        Writer->Emitted[Tag].Length = (UCHAR)Length;
+    }
+}
+
+static VOID
+writerSyncGlobals(
+    DESCRIPTOR_WRITER* Writer,
+    const GLOBAL_ITEM* Expected,
+    UCHAR FirstTag,
+    UCHAR LastTag
+)
+{
+    UCHAR tag;
+
+    for (tag = FirstTag; tag <= LastTag; tag++) {
+        const GLOBAL_ITEM* expected = &Expected[tag];
+        GLOBAL_ITEM* emitted = &Writer->Emitted[tag];
+
+        if (expected->Length != 0 && (expected->Length != emitted->Length
+            || !RtlEqualMemory(expected->Raw, emitted->Raw, expected->Length)))
+            writerEmitGlobal(Writer, tag, expected->Raw, expected->Length);
+    }
+}
+
+static VOID
+writeVariant(
+    DESCRIPTOR_WRITER* Writer,
+    ULONG Effects,
+    ULONG First,
+    ULONG End
+)
+/*++
+
+Routine Description:
+
+    Emits the items of the variant of G_DefaultReportDescriptor declaring
+    the PID reports of the effect classes in Effects, of those starting
+    from offset First up to End of G_DefaultReportDescriptor. The items
+    before First still set the global state the others are emitted
+    against.
+
+--*/
+{
+    const UCHAR* desc = G_DefaultReportDescriptor;
+    GLOBAL_ITEM original[GLOBAL_STATE_TAGS];
+    GLOBAL_ITEM expected[GLOBAL_STATE_TAGS];
+    NVSHIELD_HID_ITEM item, next;
+    ULONG offset = 0, start, peek, depth = 0;
+    ULONG skipDepth = 0, effectTypeDepth = 0, effectTypeCount = 0;
+
+    RtlZeroMemory(original, sizeof(original));
+    RtlZeroMemory(expected, sizeof(expected));
+
+    for (start = offset; NvShieldHidNextItem(desc, G_DefaultReportDescriptorLength, &offset, &item);
+        start = offset) {
+
+        Writer->Muted = start < First || start >= End;
+
+        if (item.Type == NVSHIELD_HID_ITEM_GLOBAL && item.Tag < GLOBAL_STATE_TAGS) {
+            RtlCopyMemory(original[item.Tag].Raw, item.Raw, item.RawLength);
+            original[item.Tag].Length = (UCHAR)item.RawLength;
+            expected[item.Tag] = original[item.Tag];
+        }
+
+        if (skipDepth != 0) {
+            // Dropping a parameter block report, up to its End Collection
+            if (item.Type == NVSHIELD_HID_ITEM_MAIN && item.Tag == NVSHIELD_HID_TAG_COLLECTION)
+                depth++;
+            else if (item.Type == NVSHIELD_HID_ITEM_MAIN && item.Tag == NVSHIELD_HID_TAG_END_COLLECTION
+                && --depth < skipDepth)
+                skipDepth = 0;
+            continue;
+        }
+
+        if (item.Type == NVSHIELD_HID_ITEM_LOCAL && item.Tag == NVSHIELD_HID_TAG_USAGE
+            && original[NVSHIELD_HID_TAG_USAGE_PAGE].Raw[1] == PID_USAGE_PAGE) {
+
+            peek = offset;
+            if (NvShieldHidNextItem(desc, G_DefaultReportDescriptorLength, &peek, &next)
+                && next.Type == NVSHIELD_HID_ITEM_MAIN && next.Tag == NVSHIELD_HID_TAG_COLLECTION) {
+
+                ULONG needs = pidSegmentEffects(item.Data);
+
+                if (needs != 0 && (needs & Effects) == 0) {
+                    skipDepth = depth + 1;
+                    continue;
+                }
+
+                if (item.Data == PID_USAGE_EFFECT_TYPE) {
+                    effectTypeDepth = depth + 1;
+                    effectTypeCount = 0;
+                }
+            }
+            else if (effectTypeDepth != 0 && depth == effectTypeDepth) {
+                if ((pidEffectTypeEffects(item.Data) & Effects) == 0)
+                    continue;
+                effectTypeCount++;
+            }
+        }
+
+        if (item.Type == NVSHIELD_HID_ITEM_GLOBAL) {
+            if (effectTypeDepth != 0 && depth == effectTypeDepth && item.RawLength == 2
+                && (item.Tag == NVSHIELD_HID_TAG_LOGICAL_MAXIMUM
+                    || item.Tag == NVSHIELD_HID_TAG_PHYSICAL_MAXIMUM)) {
+                // The effect type is an index into the usages kept above
+                UCHAR raw[2];
+
+                raw[0] = item.Prefix;
+                raw[1] = (UCHAR)effectTypeCount;
+                writerEmitGlobal(Writer, item.Tag, raw, sizeof(raw));
+                expected[item.Tag] = Writer->Emitted[item.Tag];
+            }
+            else {
+                writerEmitGlobal(Writer, item.Tag, item.Raw, item.RawLength);
+            }
+            continue;
+        }
+
+        // Usages take the current page, only data items use the rest
+        if (item.Type == NVSHIELD_HID_ITEM_MAIN && (item.Tag == NVSHIELD_HID_TAG_INPUT
+            || item.Tag == NVSHIELD_HID_TAG_OUTPUT || item.Tag == NVSHIELD_HID_TAG_FEATURE))
+            writerSyncGlobals(Writer, expected, 0, GLOBAL_STATE_TAGS - 1);
+        else
+            writerSyncGlobals(Writer, expected, NVSHIELD_HID_TAG_USAGE_PAGE, NVSHIELD_HID_TAG_USAGE_PAGE);
+
+        writerEmit(Writer, item.Raw, item.RawLength);
+
+        if (item.Type == NVSHIELD_HID_ITEM_MAIN && item.Tag == NVSHIELD_HID_TAG_COLLECTION) {
+            depth++;
+        }
+        else if (item.Type == NVSHIELD_HID_ITEM_MAIN && item.Tag == NVSHIELD_HID_TAG_END_COLLECTION) {
+            if (depth == effectTypeDepth) {
+                effectTypeDepth = 0;
+                RtlCopyMemory(expected, original, sizeof(expected));
+            }
+            depth--;
+        }
+    }
+
+    Writer->Muted = FALSE;
+}
+
+ULONG
+NvShieldBuildReportDescriptor(
+    ULONG Effects,
+    PUCHAR Buffer,
+    ULONG Length
+)
+/*++
+
+Routine Description:
+
+    Builds the variant of G_DefaultReportDescriptor declaring the PID
+    reports of the NVSHIELD_PID_EFFECT_* classes in Effects. With all of
+    them, the result is G_DefaultReportDescriptor itself.
+
+Arguments:
+
+    Buffer - receives the variant, may be NULL to get the length needed
+
+Return Value:
+
+    Length of the variant, which was only written if it fits in Length.
+    0 if Effects has no effect class.
+
+--*/
+{
+    DESCRIPTOR_WRITER writer;
+
+    if ((Effects & NVSHIELD_PID_EFFECT_TYPES) == 0)
+        return 0;
+
+    RtlZeroMemory(&writer, sizeof(writer));
+    writer.Buffer = Buffer;
+    writer.Capacity = Buffer != NULL ? Length : 0;
+
+    writeVariant(&writer, Effects, 0, G_DefaultReportDescriptorLength);
+
+    return writer.Length;
+}
+
+//
+// Patched Report Descriptors
+//
+// A model keeping the controller's own Report Descriptor gets the PID
+// block of G_DefaultReportDescriptor (its variant for the PID profile)
+// inserted before the End Collection of its gamepad collection, between a
+// Push and a Pop so that the global state the controller's items rely on
+// comes back after it. The PID reports must keep their report IDs, which
+// the emulation answers to, so the controller's reports using one of them
+// are moved to a free one, from 0xFF down, and moved back on their way to
+// the controller, see NvShieldGetDeviceReportIds.
+//
+
+#define HID_ITEM_PUSH               0xA4
+#define HID_ITEM_POP                0xB4
+#define HID_ITEM_USAGE_EXTENDED     0x0B    // Usage, 4 bytes, page included
+
+#define ID_BIT(Map, Id)             ((Map)[(Id) >> 3] & (1 << ((Id) & 7)))
+#define ID_SET(Map, Id)             ((Map)[(Id) >> 3] |= (UCHAR)(1 << ((Id) & 7)))
+
+static BOOLEAN
+pidBlock(
+    PULONG First,
+    PULONG End
+)
+{
+    const UCHAR* desc = G_DefaultReportDescriptor;
+    NVSHIELD_HID_ITEM item;
+    ULONG offset = 0, start, depth = 0;
+
+    *First = 0;
+
+    for (start = offset; NvShieldHidNextItem(desc, G_DefaultReportDescriptorLength, &offset, &item);
+        start = offset) {
+
+        if (*First == 0 && item.Type == NVSHIELD_HID_ITEM_GLOBAL
+            && item.Tag == NVSHIELD_HID_TAG_USAGE_PAGE && item.Data == PID_USAGE_PAGE)
+            *First = start;
+
+        if (item.Type == NVSHIELD_HID_ITEM_MAIN && item.Tag == NVSHIELD_HID_TAG_COLLECTION) {
+            depth++;
+        }
+        else if (item.Type == NVSHIELD_HID_ITEM_MAIN && item.Tag == NVSHIELD_HID_TAG_END_COLLECTION
+            && depth != 0 && --depth == 0 && *First != 0) {
+            *End = start;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static VOID
+reportIds(
+    const UCHAR* Descriptor,
+    ULONG First,
+    ULONG End,
+    PUCHAR Ids
+)
+{
+    NVSHIELD_HID_ITEM item;
+    ULONG offset = First;
+
+    while (offset < End && NvShieldHidNextItem(Descriptor, End, &offset, &item)) {
+        if (item.Type == NVSHIELD_HID_ITEM_GLOBAL && item.Tag == NVSHIELD_HID_TAG_REPORT_ID
+            && item.Data != 0 && item.Data <= 0xFF)
+            ID_SET(Ids, item.Data);
+    }
+}
+
+ULONG
+NvShieldPatchReportDescriptor(
+    const NVSHIELD_MODEL* Model,
+    ULONG Effects,
+    const UCHAR* Device,
+    ULONG DeviceLength,
+    PUCHAR Buffer,
+    ULONG Length,
+    PUCHAR IdMap
+)
+/*++
+
+Routine Description:
+
+    Builds the Report Descriptor presented for a model that patches the
+    controller's own, see NVSHIELD_MODEL.
+
+Arguments:
+
+    Device - the controller's Report Descriptor
+
+    Buffer - receives the result, may be NULL to get the length needed
+
+    IdMap - receives the report ID each report of the controller is
+        presented with, 256 entries; see NvShieldGetDeviceReportIds for
+        the way back
+
+Return Value:
+
+    Length of the result, which was only written if it fits in Length.
+    0 if Effects has no effect class, the controller has no gamepad
+    collection, or no report ID is left for one that has to move.
+
+--*/
+{
+    DESCRIPTOR_WRITER writer;
+    NVSHIELD_HID_ITEM item;
+    UCHAR deviceIds[32], pidIds[32];
+    UCHAR raw[5];
+    ULONG first, end, offset, i, j;
+    ULONG usagePage = 0, usage = 0, depth = 0;
+    BOOLEAN gamepad = FALSE, inserted = FALSE;
+    UCHAR next = 0xFF;
+
+    if ((Effects & NVSHIELD_PID_EFFECT_TYPES) == 0 || !pidBlock(&first, &end))
+        return 0;
+
+    RtlZeroMemory(deviceIds, sizeof(deviceIds));
+    RtlZeroMemory(pidIds, sizeof(pidIds));
+    reportIds(Device, 0, DeviceLength, deviceIds);
+    reportIds(G_DefaultReportDescriptor, first, end, pidIds);
+
+    for (i = 0; i < 256; i++)
+        IdMap[i] = (UCHAR)i;
+
+    for (i = 1; i < 256; i++) {
+        if (!ID_BIT(deviceIds, i) || !ID_BIT(pidIds, i))
+            continue;
+
+        while (next != 0 && (ID_BIT(deviceIds, next) || ID_BIT(pidIds, next)))
+            next--;
+        if (next == 0)
+            return 0;
+
+        IdMap[i] = next--;
+    }
+
+    RtlZeroMemory(&writer, sizeof(writer));
+    writer.Buffer = Buffer;
+    writer.Capacity = Buffer != NULL ? Length : 0;
+
+    offset = 0;
+    while (NvShieldHidNextItem(Device, DeviceLength, &offset, &item)) {
+
+        if (item.Type == NVSHIELD_HID_ITEM_GLOBAL && item.Tag == NVSHIELD_HID_TAG_USAGE_PAGE)
+            usagePage = item.Data;
+
+        if (item.Type == NVSHIELD_HID_ITEM_GLOBAL && item.Tag == NVSHIELD_HID_TAG_REPORT_ID
+            && item.Size == 1 && IdMap[item.Data] != item.Data) {
+            raw[0] = item.Prefix;
+            raw[1] = IdMap[item.Data];
+            writerEmit(&writer, raw, 2);
+            continue;
+        }
+
+        if (item.Type == NVSHIELD_HID_ITEM_LOCAL && item.Tag == NVSHIELD_HID_TAG_USAGE) {
+            usage = item.Size == 4 ? item.Data : (usagePage << 16) | item.Data;
+
+            for (j = 0; j < Model->UsagePatchCount; j++) {
+                if (Model->UsagePatches[j].Usage == usage)
+                    break;
+            }
+
+            if (j < Model->UsagePatchCount) {
+                usage = Model->UsagePatches[j].NewUsage;
+                raw[0] = HID_ITEM_USAGE_EXTENDED;
+                raw[1] = (UCHAR)usage;
+                raw[2] = (UCHAR)(usage >> 8);
+                raw[3] = (UCHAR)(usage >> 16);
+                raw[4] = (UCHAR)(usage >> 24);
+                writerEmit(&writer, raw, 5);
+                continue;
+            }
+        }
+
+        if (item.Type == NVSHIELD_HID_ITEM_MAIN && item.Tag == NVSHIELD_HID_TAG_COLLECTION) {
+            // Application collection of a Joystick or Gamepad usage
+            if (depth == 0 && item.Data == 0x01 && !inserted)
+                gamepad = usage == 0x00010004 || usage == 0x00010005;
+            depth++;
+        }
+        else if (item.Type == NVSHIELD_HID_ITEM_MAIN && item.Tag == NVSHIELD_HID_TAG_END_COLLECTION
+            && depth != 0 && --depth == 0 && gamepad) {
+            raw[0] = HID_ITEM_PUSH;
+            writerEmit(&writer, raw, 1);
+
+            // Every global the PID block relies on is emitted again
+            RtlZeroMemory(writer.Emitted, sizeof(writer.Emitted));
+            writeVariant(&writer, Effects, first, end);
+
+            raw[0] = HID_ITEM_POP;
+            writerEmit(&writer, raw, 1);
+
+            gamepad = FALSE;
+            inserted = TRUE;
+        }
+
+        if (item.Type == NVSHIELD_HID_ITEM_MAIN)
+            usage = 0;
+
+        writerEmit(&writer, item.Raw, item.RawLength);
+    }
+
+    return inserted ? writer.Length : 0;
+}
+
+VOID
+NvShieldGetDeviceReportIds(
+    const UCHAR* IdMap,
+    PUCHAR DeviceIds
+)
+/*++
+
+Routine Description:
+
+    Inverts the IdMap of NvShieldPatchReportDescriptor for the reports
+    that go down: DeviceIds, 256 entries, receives the report ID the
+    controller knows each report presented by. IDs nothing moved to or
+    away from, the PID reports' among them, stay as they are. IdMap may be
+    NULL when the descriptor presented keeps the controller's IDs.
+
+--*/
+{
+    ULONG i;
+
+    for (i = 0; i < 256; i++)
+        DeviceIds[i] = (UCHAR)i;
+
+    if (IdMap == NULL)
+        return;
+
+    for (i = 1; i < 256; i++) {
+        if (IdMap[i] != i)
+            DeviceIds[IdMap[i]] = (UCHAR)i;
+    }
+}
+
+ULONG
+NvShieldPidProfileEffects(
+    NVSHIELD_PID_PROFILE Profile
+)
+{
+    switch (Profile)
+    {
+    case NvShieldPidProfileRumble:
+        return NVSHIELD_PID_EFFECT_CONSTANT | NVSHIELD_PID_EFFECT_PERIODIC;
+    case NvShieldPidProfileConstant:
+        return NVSHIELD_PID_EFFECT_CONSTANT;
+    case NvShieldPidProfileFull:
+    default:
+        return NVSHIELD_PID_EFFECT_ALL;
+    }
+}
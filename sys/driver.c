@@ -1,216 +1,658 @@
-/*++
-
-Copyright (c) Microsoft Corporation.  All rights reserved.
-
-    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
-    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
-    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
-    PURPOSE.
-
-Module Name:
-
-    driver.c
-
-Abstract:
-
-    Code for main entry point of KMDF driver
-
-Author:
-
-
-Environment:
-
-    kernel mode only
-
-Revision History:
-
---*/
-
-#include <hidusbfx2.h>
-
-#ifdef ALLOC_PRAGMA
-    #pragma alloc_text( INIT, DriverEntry )
-    #pragma alloc_text( PAGE, HidFx2EvtDeviceAdd)
-    #pragma alloc_text( PAGE, HidFx2EvtDriverContextCleanup)
-#endif
-
-NTSTATUS
-DriverEntry (
-    _In_ PDRIVER_OBJECT  DriverObject,
-    _In_ PUNICODE_STRING RegistryPath
-    )
-/*++
-
-Routine Description:
-
-    Installable driver initialization entry point.
-    This entry point is called directly by the I/O system.
-
-Arguments:
-
-    DriverObject - pointer to the driver object
-
-    RegistryPath - pointer to a unicode string representing the path,
-                   to driver-specific key in the registry.
-
-Return Value:
-
-    STATUS_SUCCESS if successful,
-    STATUS_UNSUCCESSFUL otherwise.
-
---*/
-{
-    NTSTATUS               status = STATUS_SUCCESS;
-    WDF_DRIVER_CONFIG      config;
-    WDF_OBJECT_ATTRIBUTES  attributes;
-
-    //
-    // Initialize WPP Tracing
-    //
-    //WPP_INIT_TRACING( DriverObject, RegistryPath );
-
-    WDF_DRIVER_CONFIG_INIT(&config, HidFx2EvtDeviceAdd);
-
-    //
-    // Register a cleanup callback so that we can call WPP_CLEANUP when
-    // the framework driver object is deleted during driver unload.
-    //
-    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
-    //attributes.EvtCleanupCallback = HidFx2EvtDriverContextCleanup;
-
-    //
-    // Create a framework driver object to represent our driver.
-    //
-    status = WdfDriverCreate(DriverObject,
-                             RegistryPath,
-                             &attributes,      // Driver Attributes
-                             &config,          // Driver Config Info
-                             WDF_NO_HANDLE
-                             );
-
-    //if (!NT_SUCCESS(status)) {
-    //    WPP_CLEANUP(DriverObject);
-    //}
-
-    return status;
-}
-
-
-NTSTATUS
-HidFx2EvtDeviceAdd(
-    IN WDFDRIVER       Driver,
-    IN PWDFDEVICE_INIT DeviceInit
-    )
-/*++
-Routine Description:
-
-    HidFx2EvtDeviceAdd is called by the framework in response to AddDevice
-    call from the PnP manager. We create and initialize a WDF device object to
-    represent a new instance of toaster device.
-
-Arguments:
-
-    Driver - Handle to a framework driver object created in DriverEntry
-
-    DeviceInit - Pointer to a framework-allocated WDFDEVICE_INIT structure.
-
-Return Value:
-
-    NTSTATUS
-
---*/
-{
-    NTSTATUS                      status = STATUS_SUCCESS;
-    WDF_IO_QUEUE_CONFIG           queueConfig;
-    WDF_OBJECT_ATTRIBUTES         attributes;
-    WDFDEVICE                     hDevice;
-    PDEVICE_EXTENSION             devContext = NULL;
-    WDFQUEUE                      queue;
-
-    UNREFERENCED_PARAMETER(Driver);
-
-    PAGED_CODE();
-
-    //
-    // Tell framework this is a filter driver. Filter drivers by default are  
-    // not power policy owners. This works well for this driver because
-    // HIDclass driver is the power policy owner for HID minidrivers.
-    //
-    WdfFdoInitSetFilter(DeviceInit);
-
-    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, DEVICE_EXTENSION);
-
-    //
-    // Create a framework device object.This call will in turn create
-    // a WDM device object, attach to the lower stack, and set the
-    // appropriate flags and attributes.
-    //
-    status = WdfDeviceCreate(&DeviceInit, &attributes, &hDevice);
-    if (!NT_SUCCESS(status)) {
-        return status;
-    }
-
-    devContext = GetDeviceContext(hDevice);
-
-    // Figure out where we'll be sending all our requests
-    //  once we're done with them
-    devContext->TargetToSendRequestsTo = WdfDeviceGetIoTarget(hDevice);
-
-    // Init rumble values
-    devContext->isRumbling = FALSE;
-    devContext->isZeroRumble = FALSE;
-    devContext->leftRumbleStrength = 0;
-    devContext->rightRumbleStrength = 0;
-    devContext->rumbleGain = 255;
-    devContext->actuatorSel = 1;
-
-    // Init trackpad values
-    devContext->origX = 0;
-    devContext->origY = 0;
-    devContext->isTrackpadPressed = FALSE;
-    devContext->firstTrackpadPress.QuadPart = 0;
-
-    // Init consumer control
-    devContext->lastCCState = 0;
-    
-    WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(&queueConfig, WdfIoQueueDispatchParallel);
-    queueConfig.EvtIoInternalDeviceControl = HidFx2EvtInternalDeviceControl;
-
-    status = WdfIoQueueCreate(hDevice,
-                              &queueConfig,
-                              WDF_NO_OBJECT_ATTRIBUTES,
-                              &queue
-                              );
-    if (!NT_SUCCESS (status)) {
-        return status;
-    }
-
-    return status;
-}
-
-
-VOID
-HidFx2EvtDriverContextCleanup(
-    IN WDFOBJECT Object
-    )
-/*++
-Routine Description:
-
-    Free resources allocated in DriverEntry that are not automatically
-    cleaned up framework.
-
-Arguments:
-
-    Driver - handle to a WDF Driver object.
-
-Return Value:
-
-    VOID.
-
---*/
-{
-    PAGED_CODE ();
-    UNREFERENCED_PARAMETER(Object);
-
-    //WPP_CLEANUP(WdfDriverWdmGetDriverObject((WDFDRIVER) Object));
-}
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    driver.c
+
+Abstract:
+
+    Code for main entry point of KMDF driver
+
+Author:
+
+
+Environment:
+
+    kernel mode only
+
+Revision History:
+
+--*/
+
+#include <hidusbfx2.h>
+
+#ifdef ALLOC_PRAGMA
+    #pragma alloc_text( INIT, DriverEntry )
+    #pragma alloc_text( PAGE, HidFx2EvtDeviceAdd)
+    #pragma alloc_text( PAGE, HidFx2EvtDriverContextCleanup)
+    #pragma alloc_text( PAGE, HidFx2EvtDeviceContextCleanup)
+    #pragma alloc_text( PAGE, HidFx2EvtDevicePrepareHardware)
+#endif
+
+#define NVSHIELD_DEVICE_DESCRIPTOR_MAX  4096
+
+static volatile LONG G_NextDeviceIndex = 0;
+
+NTSTATUS
+DriverEntry (
+    _In_ PDRIVER_OBJECT  DriverObject,
+    _In_ PUNICODE_STRING RegistryPath
+    )
+/*++
+
+Routine Description:
+
+    Installable driver initialization entry point.
+    This entry point is called directly by the I/O system.
+
+Arguments:
+
+    DriverObject - pointer to the driver object
+
+    RegistryPath - pointer to a unicode string representing the path,
+                   to driver-specific key in the registry.
+
+Return Value:
+
+    STATUS_SUCCESS if successful,
+    STATUS_UNSUCCESSFUL otherwise.
+
+--*/
+{
+    NTSTATUS               status = STATUS_SUCCESS;
+    WDF_DRIVER_CONFIG      config;
+    WDF_OBJECT_ATTRIBUTES  attributes;
+
+    //
+    // Initialize WPP Tracing
+    //
+    //WPP_INIT_TRACING( DriverObject, RegistryPath );
+
+    WDF_DRIVER_CONFIG_INIT(&config, HidFx2EvtDeviceAdd);
+
+    //
+    // Register a cleanup callback so that we can call WPP_CLEANUP when
+    // the framework driver object is deleted during driver unload.
+    //
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    //attributes.EvtCleanupCallback = HidFx2EvtDriverContextCleanup;
+
+    //
+    // Create a framework driver object to represent our driver.
+    //
+    status = WdfDriverCreate(DriverObject,
+                             RegistryPath,
+                             &attributes,      // Driver Attributes
+                             &config,          // Driver Config Info
+                             WDF_NO_HANDLE
+                             );
+
+    //if (!NT_SUCCESS(status)) {
+    //    WPP_CLEANUP(DriverObject);
+    //}
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    //
+    // Since there is only one control device for all the filter device
+    // objects, keep track of them in a collection.
+    //
+    status = WdfCollectionCreate(WDF_NO_OBJECT_ATTRIBUTES,
+                                 &FilterDeviceCollection);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    status = WdfWaitLockCreate(WDF_NO_OBJECT_ATTRIBUTES,
+                               &FilterDeviceCollectionLock);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    NvShieldCaptureDriverInit();
+    NvShieldWatchdogDriverInit();
+    NvShieldLatencyDriverInit();
+
+    return status;
+}
+
+
+static ULONG
+readParameter(
+    IN WDFDEVICE Device,
+    IN PCUNICODE_STRING ValueName,
+    IN ULONG Maximum
+    )
+/*++
+Routine Description:
+
+    Reads a DWORD value of the device's hardware key. The settings are:
+
+    PollingInterval - the bInterval to force on the interrupt endpoints,
+    0 to keep the one the controller advertises.
+
+    PidProfile - the NVSHIELD_PID_PROFILE of the Report Descriptor
+    presented to HidUsb.
+
+    MouseEmulation - the NVSHIELD_MOUSE_CURVE with which the right stick
+    moves the pointer, 0 to leave it alone.
+
+    RumbleTimeout - ms without PID reports after which the motors are
+    stopped, 0 to let them run until the game stops them.
+
+    RumbleInterval - least ms between two motor reports, 0 to send each
+    one as it comes.
+
+Return Value:
+
+    The value, 0 if it is absent or above Maximum.
+
+--*/
+{
+    WDFKEY      key;
+    ULONG       value = 0;
+    NTSTATUS    status;
+
+    PAGED_CODE();
+
+    status = WdfDeviceOpenRegistryKey(Device,
+                                      PLUGPLAY_REGKEY_DEVICE,
+                                      KEY_READ,
+                                      WDF_NO_OBJECT_ATTRIBUTES,
+                                      &key);
+    if (!NT_SUCCESS(status)) {
+        return 0;
+    }
+
+    status = WdfRegistryQueryULong(key, ValueName, &value);
+    WdfRegistryClose(key);
+
+    if (!NT_SUCCESS(status) || value > Maximum) {
+        return 0;
+    }
+
+    return value;
+}
+
+
+static const NVSHIELD_MODEL*
+deviceModel(
+    IN PWDFDEVICE_INIT DeviceInit
+    )
+/*++
+Routine Description:
+
+    Finds the model of the controller from the PID_xxxx of its first
+    hardware ID, the 2015 controller if it is unknown.
+
+--*/
+{
+    WCHAR       hardwareId[128];
+    ULONG       length, i, j;
+    USHORT      productId = 0;
+    NTSTATUS    status;
+    const NVSHIELD_MODEL* model;
+
+    PAGED_CODE();
+
+    status = WdfFdoInitQueryProperty(DeviceInit, DevicePropertyHardwareID,
+                                     sizeof(hardwareId) - sizeof(WCHAR), hardwareId, &length);
+    if (!NT_SUCCESS(status)) {
+        return &G_NvShieldModel2015;
+    }
+
+    hardwareId[ARRAYSIZE(hardwareId) - 1] = L'\0';
+
+    for (i = 0; hardwareId[i] != L'\0'; i++) {
+        if (hardwareId[i] != L'P' || hardwareId[i + 1] != L'I'
+            || hardwareId[i + 2] != L'D' || hardwareId[i + 3] != L'_') {
+            continue;
+        }
+
+        for (j = i + 4; j < i + 8; j++) {
+            WCHAR c = hardwareId[j];
+
+            if (c >= L'0' && c <= L'9')
+                productId = (USHORT)((productId << 4) | (c - L'0'));
+            else if (c >= L'A' && c <= L'F')
+                productId = (USHORT)((productId << 4) | (c - L'A' + 10));
+            else if (c >= L'a' && c <= L'f')
+                productId = (USHORT)((productId << 4) | (c - L'a' + 10));
+            else
+                break;
+        }
+        break;
+    }
+
+    model = NvShieldFindModel(productId);
+
+    return model != NULL ? model : &G_NvShieldModel2015;
+}
+
+
+static NTSTATUS
+buildReportDescriptor(
+    IN WDFDEVICE Device,
+    IN NVSHIELD_PID_PROFILE Profile
+    )
+/*++
+Routine Description:
+
+    Points the device at the Report Descriptor of its PID profile. The
+    full one is G_DefaultReportDescriptor, the others are built once here.
+    Models that keep their own have it patched later, by
+    HidFx2EvtDevicePrepareHardware.
+
+--*/
+{
+    PDEVICE_EXTENSION       devContext = GetDeviceContext(Device);
+    const NVSHIELD_MODEL*   model = devContext->Shield.model;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    ULONG                   effects, length;
+    PVOID                   buffer;
+    NTSTATUS                status;
+
+    PAGED_CODE();
+
+    effects = NvShieldPidProfileEffects(Profile);
+    devContext->PidEffects = effects;
+    NvShieldSetPidEffects(&devContext->Shield, effects);
+    devContext->DeviceReportDescriptorLength = model->DeviceReportDescriptorLength;
+
+    if (model->DeviceReportDescriptorLength == 0) {
+        devContext->ReportDescriptor = NULL;
+        devContext->ReportDescriptorLength = 0;
+        return STATUS_SUCCESS;
+    }
+
+    devContext->ReportDescriptor = G_DefaultReportDescriptor;
+    devContext->ReportDescriptorLength = G_DefaultReportDescriptorLength;
+
+    if (effects == NVSHIELD_PID_EFFECT_ALL) {
+        return STATUS_SUCCESS;
+    }
+
+    length = NvShieldBuildReportDescriptor(effects, NULL, 0);
+    if (length == 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = Device;
+
+    status = WdfMemoryCreate(&attributes, NonPagedPool,
+                             (ULONG)((((ULONG)'N') << 16) + (((ULONG)'V') << 8) + 'D'),
+                             length, &devContext->ReportDescriptorMemory, &buffer);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    NvShieldBuildReportDescriptor(effects, (PUCHAR)buffer, length);
+
+    devContext->ReportDescriptor = (PUCHAR)buffer;
+    devContext->ReportDescriptorLength = length;
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+HidFx2EvtDevicePrepareHardware(
+    IN WDFDEVICE    Device,
+    IN WDFCMRESLIST ResourcesRaw,
+    IN WDFCMRESLIST ResourcesTranslated
+    )
+/*++
+Routine Description:
+
+    Reads the controller's own Report Descriptor and builds the one
+    presented to HidUsb from it, for the models that patch it. Runs as the
+    start request comes back from the bus driver, before HidUsb reads the
+    descriptors. The controller keeps its own descriptor, without force
+    feedback, if it can't be read or patched.
+
+--*/
+{
+    PDEVICE_EXTENSION       devContext = GetDeviceContext(Device);
+    const NVSHIELD_MODEL*   model = devContext->Shield.model;
+    struct _URB_CONTROL_DESCRIPTOR_REQUEST urb;
+    WDF_MEMORY_DESCRIPTOR   urbDescriptor;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    UCHAR                   idMap[256];
+    PUCHAR                  device;
+    PVOID                   buffer;
+    ULONG                   length = 0;
+    NTSTATUS                status;
+
+    UNREFERENCED_PARAMETER(ResourcesRaw);
+    UNREFERENCED_PARAMETER(ResourcesTranslated);
+
+    PAGED_CODE();
+
+    // The controller's descriptor doesn't change from one start to the next
+    if (devContext->ReportDescriptor != NULL) {
+        return STATUS_SUCCESS;
+    }
+
+    device = (PUCHAR)ExAllocatePoolWithTag(NonPagedPool, NVSHIELD_DEVICE_DESCRIPTOR_MAX,
+        (ULONG)((((ULONG)'N') << 16) + (((ULONG)'V') << 8) + 'R'));
+    if (device == NULL) {
+        NVSHIELD_COUNT(AllocationFailures);
+        return STATUS_SUCCESS;
+    }
+
+    // wIndex is the HID interface
+    UsbBuildGetDescriptorRequest((PURB)&urb,
+        sizeof(struct _URB_CONTROL_DESCRIPTOR_REQUEST),
+        0x22 /* Report */,
+        0,
+        0,
+        device,
+        NULL,
+        NVSHIELD_DEVICE_DESCRIPTOR_MAX,
+        NULL);
+    urb.Hdr.Function = URB_FUNCTION_GET_DESCRIPTOR_FROM_INTERFACE;
+
+    WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(&urbDescriptor, &urb, sizeof(urb));
+
+    status = WdfIoTargetSendInternalIoctlOthersSynchronously(devContext->TargetToSendRequestsTo,
+        NULL, IOCTL_INTERNAL_USB_SUBMIT_URB, &urbDescriptor, NULL, NULL, NULL, NULL);
+
+    if (NT_SUCCESS(status) && USBD_SUCCESS(urb.Hdr.Status)) {
+        length = NvShieldPatchReportDescriptor(model, devContext->PidEffects,
+            device, urb.TransferBufferLength, NULL, 0, idMap);
+    }
+
+    if (length != 0) {
+        WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+        attributes.ParentObject = Device;
+
+        status = WdfMemoryCreate(&attributes, NonPagedPool,
+                                 (ULONG)((((ULONG)'N') << 16) + (((ULONG)'V') << 8) + 'D'),
+                                 length, &devContext->ReportDescriptorMemory, &buffer);
+        if (NT_SUCCESS(status)) {
+            NvShieldPatchReportDescriptor(model, devContext->PidEffects,
+                device, urb.TransferBufferLength, (PUCHAR)buffer, length, idMap);
+
+            devContext->DeviceReportDescriptorLength = urb.TransferBufferLength;
+            devContext->HasInputSizes = NvShieldGetInputReportSizes((PUCHAR)buffer, length,
+                idMap, &devContext->InputSizes);
+            NvShieldGetDeviceReportIds(idMap, devContext->DeviceReportIds);
+
+            // Published last, hid.c patches nothing before
+            devContext->ReportDescriptorLength = length;
+            devContext->ReportDescriptor = (PUCHAR)buffer;
+
+            NvShieldSharedStateAcquireSlot(devContext);
+        }
+        else {
+            NVSHIELD_COUNT(AllocationFailures);
+        }
+    }
+
+    ExFreePool(device);
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+HidFx2EvtDeviceAdd(
+    IN WDFDRIVER       Driver,
+    IN PWDFDEVICE_INIT DeviceInit
+    )
+/*++
+Routine Description:
+
+    HidFx2EvtDeviceAdd is called by the framework in response to AddDevice
+    call from the PnP manager. We create and initialize a WDF device object to
+    represent a new instance of toaster device.
+
+Arguments:
+
+    Driver - Handle to a framework driver object created in DriverEntry
+
+    DeviceInit - Pointer to a framework-allocated WDFDEVICE_INIT structure.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    NTSTATUS                      status = STATUS_SUCCESS;
+    WDF_IO_QUEUE_CONFIG           queueConfig;
+    WDF_OBJECT_ATTRIBUTES         attributes;
+    WDF_PNPPOWER_EVENT_CALLBACKS  pnpPowerCallbacks;
+    const NVSHIELD_MODEL*         model;
+    WDFDEVICE                     hDevice;
+    PDEVICE_EXTENSION             devContext = NULL;
+    WDFQUEUE                      queue;
+    DECLARE_CONST_UNICODE_STRING(pollingInterval, L"PollingInterval");
+    DECLARE_CONST_UNICODE_STRING(pidProfile, L"PidProfile");
+    DECLARE_CONST_UNICODE_STRING(mouseEmulation, L"MouseEmulation");
+    DECLARE_CONST_UNICODE_STRING(rumbleTimeout, L"RumbleTimeout");
+    DECLARE_CONST_UNICODE_STRING(rumbleInterval, L"RumbleInterval");
+
+    UNREFERENCED_PARAMETER(Driver);
+
+    PAGED_CODE();
+
+    //
+    // Tell framework this is a filter driver. Filter drivers by default are  
+    // not power policy owners. This works well for this driver because
+    // HIDclass driver is the power policy owner for HID minidrivers.
+    //
+    WdfFdoInitSetFilter(DeviceInit);
+
+    model = deviceModel(DeviceInit);
+
+    if (model->DeviceReportDescriptorLength == 0) {
+        WDF_PNPPOWER_EVENT_CALLBACKS_INIT(&pnpPowerCallbacks);
+        pnpPowerCallbacks.EvtDevicePrepareHardware = HidFx2EvtDevicePrepareHardware;
+        WdfDeviceInitSetPnpPowerEventCallbacks(DeviceInit, &pnpPowerCallbacks);
+    }
+
+    // Every request HidUsb sends comes with room for its latency stamp
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, REQUEST_CONTEXT);
+    WdfDeviceInitSetRequestAttributes(DeviceInit, &attributes);
+
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, DEVICE_EXTENSION);
+    attributes.EvtCleanupCallback = HidFx2EvtDeviceContextCleanup;
+
+    //
+    // Create a framework device object.This call will in turn create
+    // a WDM device object, attach to the lower stack, and set the
+    // appropriate flags and attributes.
+    //
+    status = WdfDeviceCreate(&DeviceInit, &attributes, &hDevice);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    devContext = GetDeviceContext(hDevice);
+
+    // HidFx2EvtDeviceContextCleanup runs from here on, however far this
+    // gets: what it undoes must look not done yet in the zeroed context
+    InitializeListHead(&devContext->WatchdogLink);
+    devContext->SharedStateSlot = NVSHIELD_SHARED_STATE_SLOTS;
+
+    NvShieldGetDeviceReportIds(NULL, devContext->DeviceReportIds);
+
+    // Figure out where we'll be sending all our requests
+    //  once we're done with them
+    devContext->TargetToSendRequestsTo = WdfDeviceGetIoTarget(hDevice);
+
+    NvShieldInitState(&devContext->Shield);
+    NvShieldSetModel(&devContext->Shield, model);
+    KeInitializeSpinLock(&devContext->RumbleLock);
+
+    // Sized after the model's motor report
+    status = NvShieldRumbleOutInitialize(hDevice, readParameter(hDevice, &rumbleInterval, 1000));
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    NvShieldReportCacheInit(&devContext->ReportCache);
+    KeInitializeSpinLock(&devContext->ReportCacheLock);
+
+    NvShieldLatencyReset(devContext);
+
+    // Init trackpad values
+    devContext->firstTrackpadPress.QuadPart = 0;
+
+    devContext->DeviceIndex = (ULONG)InterlockedIncrement(&G_NextDeviceIndex);
+
+    // Compiled for the model
+    status = NvShieldConfigInitialize(hDevice);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    devContext->PollingInterval = (UCHAR)readParameter(hDevice, &pollingInterval, 255);
+
+    // Off unless set, as the INF installs it: games may play an endless
+    // effect without sending anything more
+    NvShieldWatchdogInitialize(devContext, readParameter(hDevice, &rumbleTimeout, 600000));
+
+    status = buildReportDescriptor(hDevice,
+        (NVSHIELD_PID_PROFILE)readParameter(hDevice, &pidProfile, NvShieldPidProfileCount - 1));
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    devContext->HasInputSizes = NvShieldGetInputReportSizes(devContext->ReportDescriptor,
+        devContext->ReportDescriptorLength, NULL, &devContext->InputSizes);
+
+    NvShieldSharedStateAcquireSlot(devContext);
+
+    // Needs the input layout the slot came with
+    status = NvShieldMouseInitialize(hDevice,
+        (NVSHIELD_MOUSE_CURVE)readParameter(hDevice, &mouseEmulation, NvShieldMouseCurveCount - 1));
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+    
+    WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(&queueConfig, WdfIoQueueDispatchParallel);
+    queueConfig.EvtIoInternalDeviceControl = HidFx2EvtInternalDeviceControl;
+
+    status = WdfIoQueueCreate(hDevice,
+                              &queueConfig,
+                              WDF_NO_OBJECT_ATTRIBUTES,
+                              &queue
+                              );
+    if (!NT_SUCCESS (status)) {
+        return status;
+    }
+
+    //
+    // Add this device to the filter device collection and create the
+    // control device if it's the first one.
+    //
+    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+    status = WdfCollectionAdd(FilterDeviceCollection, hDevice);
+    devContext->InFilterCollection = NT_SUCCESS(status);
+    WdfWaitLockRelease(FilterDeviceCollectionLock);
+    if (!NT_SUCCESS(status)) {
+        return status;
+    }
+
+    //
+    // The filter keeps working without the control device, it only loses
+    // the capture feature.
+    //
+    NvShieldCreateControlDevice(hDevice);
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+HidFx2EvtDeviceContextCleanup(
+    IN WDFOBJECT Device
+    )
+/*++
+Routine Description:
+
+    Stops mouse emulation, the rumble watchdog and the rumble interval
+    timer, frees the snapshot of the device's settings after storing the
+    stick calibration it held back, releases its
+    shared state slot, removes it from the collection, and deletes the
+    control device along with the last one. Also called when
+    HidFx2EvtDeviceAdd fails, for what it got done.
+
+Arguments:
+
+    Device - handle to a WDF Device object.
+
+Return Value:
+
+    VOID.
+
+--*/
+{
+    ULONG   count;
+
+    PAGED_CODE();
+
+    NvShieldMouseCleanup(GetDeviceContext((WDFDEVICE)Device));
+    NvShieldWatchdogCleanup(GetDeviceContext((WDFDEVICE)Device));
+    NvShieldRumbleOutCleanup(GetDeviceContext((WDFDEVICE)Device));
+    NvShieldConfigCleanup(GetDeviceContext((WDFDEVICE)Device));
+
+    // While the control device, and the area with it, is still there
+    NvShieldSharedStateReleaseSlot(GetDeviceContext((WDFDEVICE)Device));
+
+    // HidFx2EvtDeviceAdd failed before adding it
+    if (!GetDeviceContext((WDFDEVICE)Device)->InFilterCollection)
+        return;
+
+    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+    count = WdfCollectionGetCount(FilterDeviceCollection);
+
+    if (count == 1) {
+        NvShieldDeleteControlDevice((WDFDEVICE)Device);
+    }
+
+    WdfCollectionRemove(FilterDeviceCollection, Device);
+
+    WdfWaitLockRelease(FilterDeviceCollectionLock);
+}
+
+
+VOID
+HidFx2EvtDriverContextCleanup(
+    IN WDFOBJECT Object
+    )
+/*++
+Routine Description:
+
+    Free resources allocated in DriverEntry that are not automatically
+    cleaned up framework.
+
+Arguments:
+
+    Driver - handle to a WDF Driver object.
+
+Return Value:
+
+    VOID.
+
+--*/
+{
+    PAGED_CODE ();
+    UNREFERENCED_PARAMETER(Object);
+
+    NvShieldWatchdogDriverCleanup();
+
+    //WPP_CLEANUP(WdfDriverWdmGetDriverObject((WDFDRIVER) Object));
+}
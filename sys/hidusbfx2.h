@@ -1,114 +1,589 @@
-/*++
-
-Copyright (c) Microsoft Corporation.  All rights reserved.
-
-    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
-    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
-    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
-    PURPOSE.
-
-Module Name:
-
-    hidusbfx2.h
-    
-Abstract:
-
-    common header file
-
-Author:
-
-
-Environment:
-
-    kernel mode only
-
-Notes:
-
-
-Revision History:
-
-
---*/
-#ifndef _HIDUSBFX2_H_
-
-#define _HIDUSBFX2_H_
-
-#pragma warning(disable:4200)  // suppress nameless struct/union warning
-#pragma warning(disable:4201)  // suppress nameless struct/union warning
-#pragma warning(disable:4214)  // suppress bit field types other than int warning
-#include <initguid.h>
-#include <wdm.h>
-#include "usbdi.h"
-#include "usbdlib.h"
-
-#pragma warning(default:4200)
-#pragma warning(default:4201)
-#pragma warning(default:4214)
-#include <wdf.h>
-#include "wdfusb.h"
-
-#pragma warning(disable:4201)  // suppress nameless struct/union warning
-#pragma warning(disable:4214)  // suppress bit field types other than int warning
-#include <hidport.h>
-
-#define NTSTRSAFE_LIB
-#include <ntstrsafe.h>
-
-typedef UCHAR HID_REPORT_DESCRIPTOR, *PHID_REPORT_DESCRIPTOR;
-
-typedef struct _DEVICE_EXTENSION{
-
-    //
-    //WDF handles for USB Target 
-    //
-    WDFUSBDEVICE      UsbDevice;
-
-    WDFIOTARGET TargetToSendRequestsTo; 
-    
-    // Rumble state
-    int isRumbling;
-    int isZeroRumble;
-
-    unsigned short leftRumbleStrength;
-    unsigned short rightRumbleStrength;
-
-    unsigned short rumbleGain;
-
-    LONG actuatorSel; // 1 = left, 2 = right
-
-    // Trackpad state
-    UCHAR origX;
-    UCHAR origY;
-
-    int isTrackpadPressed;
-    LARGE_INTEGER firstTrackpadPress;
-
-    // Consumer control
-    UCHAR lastCCState;
-} DEVICE_EXTENSION, * PDEVICE_EXTENSION;
-
-WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_EXTENSION, GetDeviceContext)
-
-//
-// driver routine declarations
-//
-// This type of function declaration is for Prefast for drivers. 
-// Because this declaration specifies the function type, PREfast for Drivers
-// does not need to infer the type or to report an inference. The declaration
-// also prevents PREfast for Drivers from misinterpreting the function type 
-// and applying inappropriate rules to the function. For example, PREfast for
-// Drivers would not apply rules for completion routines to functions of type
-// DRIVER_CANCEL. The preferred way to avoid Warning 28101 is to declare the
-// function type explicitly. In the following example, the DriverEntry function
-// is declared to be of type DRIVER_INITIALIZE.
-//
-DRIVER_INITIALIZE DriverEntry;
-
-EVT_WDF_DRIVER_DEVICE_ADD HidFx2EvtDeviceAdd;
-
-EVT_WDF_IO_QUEUE_IO_INTERNAL_DEVICE_CONTROL HidFx2EvtInternalDeviceControl;
-
-EVT_WDF_OBJECT_CONTEXT_CLEANUP HidFx2EvtDriverContextCleanup;
-
-#endif   //_HIDUSBFX2_H_
-
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    hidusbfx2.h
+    
+Abstract:
+
+    common header file
+
+Author:
+
+
+Environment:
+
+    kernel mode only
+
+Notes:
+
+
+Revision History:
+
+
+--*/
+#ifndef _HIDUSBFX2_H_
+
+#define _HIDUSBFX2_H_
+
+#pragma warning(disable:4200)  // suppress nameless struct/union warning
+#pragma warning(disable:4201)  // suppress nameless struct/union warning
+#pragma warning(disable:4214)  // suppress bit field types other than int warning
+#include <initguid.h>
+#include <wdm.h>
+#include "usbdi.h"
+#include "usbdlib.h"
+
+#pragma warning(default:4200)
+#pragma warning(default:4201)
+#pragma warning(default:4214)
+#include <wdf.h>
+#include "wdfusb.h"
+
+#pragma warning(disable:4201)  // suppress nameless struct/union warning
+#pragma warning(disable:4214)  // suppress bit field types other than int warning
+#include <hidport.h>
+
+#define NTSTRSAFE_LIB
+#include <ntstrsafe.h>
+
+#include "shield.h"
+#include "public.h"
+
+//
+// Driver-owned interrupt OUT transfer carrying the motor report, built once
+// and resubmitted for every update. Motor reports the driver originates
+// itself go out as a SET_REPORT on ControlUrb when there is no interrupt
+// OUT pipe.
+//
+typedef struct _RUMBLE_OUT {
+    struct _URB_BULK_OR_INTERRUPT_TRANSFER Urb;
+    struct _URB_CONTROL_VENDOR_OR_CLASS_REQUEST ControlUrb;
+    UCHAR Report[NVSHIELD_RUMBLE_REPORT_MAX];
+} RUMBLE_OUT, *PRUMBLE_OUT;
+
+typedef struct _DEVICE_EXTENSION{
+
+    //
+    //WDF handles for USB Target 
+    //
+    WDFUSBDEVICE      UsbDevice;
+
+    WDFIOTARGET TargetToSendRequestsTo; 
+    
+    // Rumble, trackpad and consumer control state
+    NVSHIELD_STATE Shield;
+
+    // Settings Shield.config was compiled from, see config.c
+    NVSHIELD_SETTINGS Settings;
+    WDFWAITLOCK ConfigLock;             // held while a snapshot is published
+    WDFWORKITEM CalibrationWorkItem;    // rebuilds the stick tables
+    LONGLONG CalibrationDue;            // KeQueryInterruptTime ms before which it isn't queued
+    ULONGLONG CalibrationSaveDue;       // before which the estimate isn't stored, under ConfigLock
+    BOOLEAN CalibrationUnsaved;         // tables newer than the stored estimate, under ConfigLock
+
+    LARGE_INTEGER firstTrackpadPress;
+
+    // Device address in capture records
+    ULONG DeviceIndex;
+
+    // In FilterDeviceCollection, which HidFx2EvtDeviceAdd may fail before
+    BOOLEAN InFilterCollection;
+
+    // bInterval forced on the interrupt endpoints, 0 to leave them alone
+    UCHAR PollingInterval;
+
+    // Report Descriptor presented to HidUsb, per the PidProfile setting
+    // and the model. NULL while the controller's own goes up unchanged,
+    // which is the case until HidFx2EvtDevicePrepareHardware has patched
+    // it for the models that need that.
+    const UCHAR* ReportDescriptor;
+    ULONG ReportDescriptorLength;
+    WDFMEMORY ReportDescriptorMemory;   // NULL for G_DefaultReportDescriptor
+    ULONG DeviceReportDescriptorLength; // of the controller's own
+    ULONG PidEffects;                   // NVSHIELD_PID_EFFECT_* of the PidProfile setting
+
+    // Report ID the controller knows each report presented by, for the
+    // output and feature reports and the GET_REPORTs forwarded to it,
+    // see NvShieldGetDeviceReportIds
+    UCHAR DeviceReportIds[256];
+
+    // Input report lengths of ReportDescriptor, for splitting the
+    // interrupt transfers, unless HasInputSizes is FALSE
+    NVSHIELD_REPORT_SIZES InputSizes;
+    BOOLEAN HasInputSizes;
+
+    // Time spent in each stage of the input pipeline, see hid.c; only
+    // counted when built with NVSHIELD_STAGE_TIMING
+    NVSHIELD_STAGE_COUNTER StageCounters[NvShieldStageCount];
+
+    // Shared state slot, NVSHIELD_SHARED_STATE_SLOTS if none was free
+    ULONG SharedStateSlot;
+    KSPIN_LOCK SharedStateLock;
+    NVSHIELD_INPUT_LAYOUT InputLayout;
+
+    // Report rate measurement, see NvShieldMeasureReportRate
+    volatile LONG ReportCount;
+    volatile LONG64 RateWindowStart;
+    volatile LONG ReportRate;
+
+    // Answers to GET_REPORTs that went to the device
+    NVSHIELD_REPORT_CACHE ReportCache;
+    KSPIN_LOCK ReportCacheLock;
+
+    // Interrupt OUT rumble path, unused while RumbleOutPipe is NULL
+    USBD_PIPE_HANDLE RumbleOutPipe;
+    WDFREQUEST RumbleOutRequest;
+    WDFMEMORY RumbleOutMemory;
+    PRUMBLE_OUT RumbleOut;
+    volatile LONG RumbleOutBusy;
+    volatile LONG RumbleOutPending;
+    volatile LONG RumbleOutMerged;  // updates superseded before they went out
+    ULONG RumbleInterval;           // RumbleInterval setting, ms
+    WDFTIMER RumbleOutTimer;        // sends what RumbleInterval held back, NULL while it is 0
+    ULONGLONG RumbleOutLast;        // when the last motor report went out, ms
+
+    // Held around the core calls that touch the effects and the motor
+    // report of Shield, see NVSHIELD_RUMBLE_LOCKED
+    KSPIN_LOCK RumbleLock;
+
+    // Custom force playback, see NvShieldPlaybackArm
+    WDFTIMER PlaybackTimer;
+    ULONGLONG PlaybackDue;          // when PlaybackTimer fires, ms, 0 while stopped
+
+    // Rumble watchdog, see watchdog.c
+    ULONG RumbleTimeout;            // RumbleTimeout setting, ms
+    LIST_ENTRY WatchdogLink;        // in a slot of the wheel, or empty
+    ULONGLONG WatchdogTick;         // wheel tick it expires on
+
+    // Mouse emulation, see mouse.c; MouseTimer is NULL while it is off
+    WDFTIMER MouseTimer;
+    WDFQUEUE MouseQueue;            // the interrupt IN request held for the timer
+    volatile LONG MouseStick;       // right stick, X in the low word, Y in the high word
+    volatile LONG MouseActive;      // MouseTimer is running
+    volatile LONG MouseParked;      // a request is in MouseQueue
+    volatile LONG MouseInFlight;    // interrupt IN requests at the device
+    WDFWORKITEM MouseResolutionWorkItem;    // follows MouseActive with the timer resolution
+    WDFWAITLOCK MouseResolutionLock;
+    BOOLEAN MouseResolution;        // raised, under MouseResolutionLock
+
+    // Latency measurement, see latency.c
+    NVSHIELD_LATENCY_HISTOGRAM Latencies[NvShieldLatencyCount];
+    volatile LONG64 RumbleArrived;  // first update the next motor report carries, 0 if none
+    LONGLONG RumbleOutSent;         // when RumbleOutRequest went down
+} DEVICE_EXTENSION, * PDEVICE_EXTENSION;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_EXTENSION, GetDeviceContext)
+
+//
+// Request of HidUsb going through the filter
+//
+typedef struct _REQUEST_CONTEXT {
+    LONGLONG Sent;          // latency stamp of when it went down, see latency.c
+} REQUEST_CONTEXT, *PREQUEST_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(REQUEST_CONTEXT, GetRequestContext)
+
+//
+// Handle on the control device
+//
+typedef struct _CONTROL_FILE_CONTEXT {
+    PVOID SharedStateAddress;   // where NvShieldSharedStateMap mapped the area
+} CONTROL_FILE_CONTEXT, *PCONTROL_FILE_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(CONTROL_FILE_CONTEXT, GetControlFileContext)
+
+//
+// driver routine declarations
+//
+// This type of function declaration is for Prefast for drivers. 
+// Because this declaration specifies the function type, PREfast for Drivers
+// does not need to infer the type or to report an inference. The declaration
+// also prevents PREfast for Drivers from misinterpreting the function type 
+// and applying inappropriate rules to the function. For example, PREfast for
+// Drivers would not apply rules for completion routines to functions of type
+// DRIVER_CANCEL. The preferred way to avoid Warning 28101 is to declare the
+// function type explicitly. In the following example, the DriverEntry function
+// is declared to be of type DRIVER_INITIALIZE.
+//
+DRIVER_INITIALIZE DriverEntry;
+
+EVT_WDF_DRIVER_DEVICE_ADD HidFx2EvtDeviceAdd;
+
+EVT_WDF_IO_QUEUE_IO_INTERNAL_DEVICE_CONTROL HidFx2EvtInternalDeviceControl;
+
+EVT_WDF_OBJECT_CONTEXT_CLEANUP HidFx2EvtDriverContextCleanup;
+
+EVT_WDF_DEVICE_CONTEXT_CLEANUP HidFx2EvtDeviceContextCleanup;
+
+EVT_WDF_DEVICE_PREPARE_HARDWARE HidFx2EvtDevicePrepareHardware;
+
+PVOID
+USBPcapURBGetBufferPointer(
+    ULONG length,
+    PVOID buffer,
+    PMDL  bufferMDL
+);
+
+//
+// Control device (control.c)
+//
+extern WDFCOLLECTION   FilterDeviceCollection;
+extern WDFWAITLOCK     FilterDeviceCollectionLock;
+
+NTSTATUS
+NvShieldCreateControlDevice(
+    WDFDEVICE Device
+);
+
+VOID
+NvShieldDeleteControlDevice(
+    WDFDEVICE Device
+);
+
+//
+// Sends a URB of HidUsb down with the completion routine that rewrites the
+// answers (hid.c). Returns FALSE if it couldn't be sent, the caller then
+// completes it.
+//
+BOOLEAN
+NvShieldSendUrb(
+    PDEVICE_EXTENSION devContext,
+    WDFREQUEST Request,
+    PURB Urb,
+    ULONG Length
+);
+
+//
+// Interrupt OUT rumble (hid.c)
+//
+// The effects and the last motor report in Shield are changed from the
+// SET_REPORT dispatch, the input completion running the condition
+// effects, the playback timer, the watchdog DPC and whichever of those
+// sends the motor report, on as many processors. The core doesn't lock
+// them, so every call into it that touches them is made through
+// NVSHIELD_RUMBLE_LOCKED, or between an acquire and release of RumbleLock
+// of its own. Being at DISPATCH_LEVEL under the lock, such a call may read
+// the settings snapshot as under NVSHIELD_CONFIG_READ. Nothing is sent
+// down, and no other lock taken, while it is held; the watchdog DPC takes
+// it under the lock of the wheel.
+//
+#define NVSHIELD_RUMBLE_LOCKED(devContext, Call) \
+    do { \
+        KIRQL rumbleIrql_; \
+        KeAcquireSpinLock(&(devContext)->RumbleLock, &rumbleIrql_); \
+        Call; \
+        KeReleaseSpinLock(&(devContext)->RumbleLock, rumbleIrql_); \
+    } while (0)
+
+NTSTATUS
+NvShieldRumbleOutInitialize(
+    WDFDEVICE Device,
+    ULONG RumbleInterval
+);
+
+VOID
+NvShieldRumbleOutCleanup(
+    PDEVICE_EXTENSION devContext
+);
+
+VOID
+NvShieldRumbleOutSend(
+    PDEVICE_EXTENSION devContext
+);
+
+VOID
+NvShieldPlaybackArm(
+    PDEVICE_EXTENSION devContext,
+    ULONGLONG Due
+);
+
+//
+// Rumble watchdog (watchdog.c)
+//
+VOID
+NvShieldWatchdogDriverInit(
+    VOID
+);
+
+VOID
+NvShieldWatchdogDriverCleanup(
+    VOID
+);
+
+VOID
+NvShieldWatchdogInitialize(
+    PDEVICE_EXTENSION devContext,
+    ULONG RumbleTimeout
+);
+
+VOID
+NvShieldWatchdogArm(
+    PDEVICE_EXTENSION devContext,
+    ULONGLONG Expires
+);
+
+VOID
+NvShieldWatchdogCleanup(
+    PDEVICE_EXTENSION devContext
+);
+
+//
+// Settings (config.c)
+//
+// The core reads the snapshot of the settings, Shield.config, with a
+// single load and no lock. Every call into it that may read the snapshot
+// runs at DISPATCH_LEVEL, through NVSHIELD_CONFIG_READ where it could
+// come in below: a snapshot replaced is freed once every processor has
+// been below DISPATCH_LEVEL since, when none of those calls can still be
+// looking at it. New snapshots come from the settings IOCTL and from the
+// work item rebuilding the stick tables, one at a time under ConfigLock.
+//
+#define NVSHIELD_CONFIG_READ(Call) \
+    do { \
+        KIRQL configIrql_; \
+        KeRaiseIrql(DISPATCH_LEVEL, &configIrql_); \
+        Call; \
+        KeLowerIrql(configIrql_); \
+    } while (0)
+
+NTSTATUS
+NvShieldConfigInitialize(
+    WDFDEVICE Device
+);
+
+NTSTATUS
+NvShieldConfigUpdate(
+    WDFDEVICE Device,
+    const NVSHIELD_SETTINGS* Settings
+);
+
+VOID
+NvShieldConfigCleanup(
+    PDEVICE_EXTENSION devContext
+);
+
+//
+// Driver-wide counters (control.c)
+//
+// One cache line per processor, so that controllers completing on
+// different processors never write to the same line and no lock is
+// taken; IOCTL_NVSHIELD_DRIVER_STATS_QUERY adds them up.
+//
+#define NVSHIELD_STATS_SLOTS    64
+
+typedef struct DECLSPEC_CACHEALIGN _NVSHIELD_STATS_SLOT {
+    volatile LONG64 ReportsProcessed;
+    volatile LONG64 ReportsRewritten;
+    volatile LONG64 RumbleReportsSent;
+    volatile LONG64 AllocationFailures;
+} NVSHIELD_STATS_SLOT;
+
+extern NVSHIELD_STATS_SLOT G_DriverStats[NVSHIELD_STATS_SLOTS];
+
+#define NVSHIELD_COUNT(Counter) \
+    InterlockedIncrement64(&G_DriverStats[KeGetCurrentProcessorNumber() % NVSHIELD_STATS_SLOTS].Counter)
+
+//
+// Report rate measurement (hid.c)
+//
+extern volatile LONG G_MeasureReportRate;
+
+VOID
+NvShieldResetReportRate(
+    PDEVICE_EXTENSION devContext
+);
+
+//
+// Latency measurement (latency.c)
+//
+// Stamps are performance counter values, 0 while nothing is measured;
+// the call sites only pay for the test of G_MeasureLatency then.
+//
+extern volatile LONG G_MeasureLatency;
+
+VOID
+NvShieldLatencyDriverInit(
+    VOID
+);
+
+VOID
+NvShieldLatencyReset(
+    PDEVICE_EXTENSION devContext
+);
+
+LONGLONG
+NvShieldLatencyStart(
+    VOID
+);
+
+LONGLONG
+NvShieldLatencyStop(
+    PDEVICE_EXTENSION devContext,
+    NVSHIELD_LATENCY Latency,
+    LONGLONG Start
+);
+
+VOID
+NvShieldLatencyRumbleArrived(
+    PDEVICE_EXTENSION devContext,
+    LONGLONG Arrived
+);
+
+//
+// URB capture (capture.c)
+//
+// The call sites only pay for the test of G_CaptureEnabled while capture
+// is off.
+//
+extern volatile LONG G_CaptureEnabled;
+
+#define NVSHIELD_CAPTURE_URB(devContext, Request, Urb, Bus, Completed) \
+    do { \
+        if (G_CaptureEnabled) \
+            NvShieldCaptureUrb((devContext), (Request), (Urb), (Bus), (Completed)); \
+    } while (0)
+
+VOID
+NvShieldCaptureDriverInit(
+    VOID
+);
+
+NTSTATUS
+NvShieldCaptureInitialize(
+    VOID
+);
+
+VOID
+NvShieldCaptureCleanup(
+    VOID
+);
+
+VOID
+NvShieldCaptureEnable(
+    BOOLEAN Enable
+);
+
+NTSTATUS
+NvShieldCaptureMap(
+    WDFFILEOBJECT File,
+    PNVSHIELD_CAPTURE_MAPPING Mapping
+);
+
+VOID
+NvShieldCaptureUnmap(
+    WDFFILEOBJECT File
+);
+
+VOID
+NvShieldCaptureUrb(
+    PDEVICE_EXTENSION devContext,
+    WDFREQUEST Request,
+    PURB Urb,
+    USHORT Bus,
+    BOOLEAN Completed
+);
+
+//
+// Shared state area (sharedstate.c)
+//
+// Nothing is decoded while no process has the area mapped.
+//
+extern volatile LONG G_SharedStateReaders;
+
+#define NVSHIELD_PUBLISH_STATE(devContext, Input) \
+    do { \
+        if (G_SharedStateReaders) \
+            NvShieldSharedStatePublish((devContext), (Input)); \
+    } while (0)
+
+NTSTATUS
+NvShieldSharedStateInitialize(
+    VOID
+);
+
+VOID
+NvShieldSharedStateCleanup(
+    VOID
+);
+
+NTSTATUS
+NvShieldSharedStateMap(
+    WDFFILEOBJECT File,
+    PNVSHIELD_STATE_MAPPING Mapping
+);
+
+VOID
+NvShieldSharedStateUnmap(
+    WDFFILEOBJECT File
+);
+
+VOID
+NvShieldSharedStateAcquireSlot(
+    PDEVICE_EXTENSION devContext
+);
+
+VOID
+NvShieldSharedStateReleaseSlot(
+    PDEVICE_EXTENSION devContext
+);
+
+VOID
+NvShieldSharedStatePublish(
+    PDEVICE_EXTENSION devContext,
+    PNVSHIELD_INPUT Input
+);
+
+//
+// Mouse emulation (mouse.c)
+//
+// The interrupt IN paths only pay for the test of MouseTimer while it is
+// off.
+//
+#define NVSHIELD_MOUSE_ENABLED(devContext)  ((devContext)->MouseTimer != NULL)
+
+NTSTATUS
+NvShieldMouseInitialize(
+    WDFDEVICE Device,
+    NVSHIELD_MOUSE_CURVE Curve
+);
+
+VOID
+NvShieldMouseCleanup(
+    PDEVICE_EXTENSION devContext
+);
+
+VOID
+NvShieldMouseSubmitInput(
+    PDEVICE_EXTENSION devContext,
+    WDFREQUEST Request,
+    PURB Urb
+);
+
+VOID
+NvShieldMouseInputComplete(
+    PDEVICE_EXTENSION devContext,
+    PURB Urb
+);
+
+VOID
+NvShieldMouseInput(
+    PDEVICE_EXTENSION devContext,
+    PNVSHIELD_INPUT Input
+);
+
+USHORT
+NvShieldStickValue(
+    USHORT Value,
+    NVSHIELD_INPUT_FIELD Field
+);
+
+#endif   //_HIDUSBFX2_H_
+
@@ -0,0 +1,130 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    latency.c
+
+Abstract:
+
+    Latency measurement: while IOCTL_NVSHIELD_LATENCY_ENABLE has it on,
+    the interrupt IN requests of HidUsb and the motor reports are stamped
+    with the performance counter on their way through the filter, and the
+    time between two stamps goes to a histogram of the device per
+    NVSHIELD_LATENCIES. The interrupt time the other timers of the driver
+    read moves on with the clock tick only, too coarse for this.
+
+    A latency starts from a stamp taken by NvShieldLatencyStart and ends
+    in NvShieldLatencyStop, which gives the stamp the next one starts
+    from. Stamps are 0 while it is off, and latencies starting from 0
+    aren't counted, so a request sent down before it was turned on isn't.
+
+Environment:
+
+    kernel mode only
+
+Revision History:
+
+--*/
+
+#include <hidusbfx2.h>
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text( INIT, NvShieldLatencyDriverInit)
+#endif
+
+volatile LONG G_MeasureLatency = 0;
+
+static ULONGLONG G_LatencyFrequency;    // performance counter ticks per second
+
+VOID
+NvShieldLatencyDriverInit(
+    VOID
+)
+{
+    LARGE_INTEGER frequency;
+
+    KeQueryPerformanceCounter(&frequency);
+    G_LatencyFrequency = (ULONGLONG)frequency.QuadPart;
+}
+
+VOID
+NvShieldLatencyReset(
+    PDEVICE_EXTENSION devContext
+)
+{
+    RtlZeroMemory(devContext->Latencies, sizeof(devContext->Latencies));
+    devContext->RumbleArrived = 0;
+}
+
+LONGLONG
+NvShieldLatencyStart(
+    VOID
+)
+{
+    if (!G_MeasureLatency)
+        return 0;
+
+    return KeQueryPerformanceCounter(NULL).QuadPart;
+}
+
+LONGLONG
+NvShieldLatencyStop(
+    PDEVICE_EXTENSION devContext,
+    NVSHIELD_LATENCY Latency,
+    LONGLONG Start
+)
+/*++
+
+Routine Description:
+
+    Counts the time since Start in the Latency histogram of the device,
+    unless Start is 0.
+
+Return Value:
+
+    The stamp of now, as NvShieldLatencyStart gives it.
+
+--*/
+{
+    LONGLONG now = NvShieldLatencyStart();
+    ULONGLONG ticks;
+
+    if (Start == 0 || now < Start)
+        return now;
+
+    // In two steps, so that a request that stayed down for hours can't
+    // overflow it
+    ticks = (ULONGLONG)(now - Start);
+    NvShieldLatencyRecord(&devContext->Latencies[Latency],
+        ticks / G_LatencyFrequency * 1000000
+        + ticks % G_LatencyFrequency * 1000000 / G_LatencyFrequency);
+
+    return now;
+}
+
+VOID
+NvShieldLatencyRumbleArrived(
+    PDEVICE_EXTENSION devContext,
+    LONGLONG Arrived
+)
+/*++
+
+Routine Description:
+
+    Called for a SET_REPORT that changes the motors and leaves the motor
+    report to RumbleOutRequest, stamped Arrived. The motor report carries
+    every update that came since the last one went out, so its
+    RumbleFilter latency starts from the first of them.
+
+--*/
+{
+    if (Arrived != 0)
+        InterlockedCompareExchange64(&devContext->RumbleArrived, Arrived, 0);
+}
@@ -0,0 +1,89 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    model.c
+
+Abstract:
+
+    The controller models the driver binds to, see NVSHIELD_MODEL. Shared
+    with the user-mode Linux daemon.
+
+    The 2015 controller (PID 7210) is what the rest of the driver was
+    written against. The 2017 controller (PID 7214) keeps its own Report
+    Descriptor, with the PID reports inserted; its triggers are declared as
+    Brake and Accelerator on the Simulation Controls page, which DirectInput
+    doesn't map, and are presented as Rx and Ry like those of the 2015
+    controller. Its motors are driven with the haptics host command of its
+    vendor output report 4, update flag set, levels 0 to 32, as the
+    hid-nvidia-shield Linux driver does. Neither has been checked against
+    the hardware yet.
+
+Environment:
+
+    kernel mode and user mode
+
+Revision History:
+
+--*/
+
+#include "shield.h"
+
+const NVSHIELD_MODEL G_NvShieldModel2015 = {
+    NVSHIELD_PRODUCT_ID,
+    241,                        // G_DefaultReportDescriptor replaces it
+    NULL, 0,
+    0x01,                       // gamepad
+    0x1E, 2, 0x18,              // volume up/down to the consumer control report
+    0x02,                       // trackpad
+    { 0x01, 7, 0, 0, 1, 3, 0 }, // output report 1, 16 bit levels
+};
+
+static const NVSHIELD_USAGE_PATCH G_Model2017UsagePatches[] = {
+    { 0x000200C5, 0x00010033 }, // Brake to Rx, left trigger
+    { 0x000200C4, 0x00010034 }, // Accelerator to Ry, right trigger
+};
+
+static const NVSHIELD_MODEL G_NvShieldModel2017 = {
+    NVSHIELD_PRODUCT_ID_2017,
+    0,                          // patched
+    G_Model2017UsagePatches, ARRAYSIZE(G_Model2017UsagePatches),
+    0x01,                       // gamepad
+    0, 0, 0,                    // no volume buttons
+    0,                          // no trackpad
+    { 0x04, 32, 0x03, 3, 4, 5, 32 }, // host command report 4, haptics, update, levels 0-32
+};
+
+static const NVSHIELD_MODEL* const G_NvShieldModels[] = {
+    &G_NvShieldModel2015,
+    &G_NvShieldModel2017,
+};
+
+const NVSHIELD_MODEL*
+NvShieldFindModel(
+    USHORT ProductId
+)
+/*++
+
+Return Value:
+
+    The model with USB product ID ProductId, NULL if there is none.
+
+--*/
+{
+    ULONG i;
+
+    for (i = 0; i < ARRAYSIZE(G_NvShieldModels); i++) {
+        if (G_NvShieldModels[i]->ProductId == ProductId)
+            return G_NvShieldModels[i];
+    }
+
+    return NULL;
+}
@@ -0,0 +1,410 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    mouse.c
+
+Abstract:
+
+    Mouse emulation: the right stick moves the pointer of the trackpad
+    collection.
+
+    The motion comes out of a periodic timer rather than out of the input
+    reports, so that the pointer keeps moving at a steady pace while the
+    stick is held still and the controller has nothing to send. The
+    synthesized reports need an interrupt IN request of HidUsb to travel
+    in: one of the requests HidUsb keeps pending is held back in a manual
+    queue while the stick is out of its dead zone and completed with the
+    next report, then comes back to be held again. Another one always
+    stays at the device, so the gamepad reports keep flowing.
+
+    The default clock tick would stretch the period to 15.6ms, so the
+    timer resolution is raised while the timer runs, and only then: it
+    costs the whole system power. ExSetTimerResolution can't be called
+    from where the timer starts and stops, a work item follows it.
+
+Environment:
+
+    kernel mode only
+
+Revision History:
+
+--*/
+
+#include <hidusbfx2.h>
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text( PAGE, NvShieldMouseInitialize)
+#pragma alloc_text( PAGE, NvShieldMouseCleanup)
+#endif
+
+#define MOUSE_TIMER_RESOLUTION  10000   // 1ms in 100ns units
+
+static EVT_WDF_TIMER mouseTimer;
+static EVT_WDF_WORKITEM mouseResolution;
+static EVT_WDF_IO_QUEUE_IO_CANCELED_ON_QUEUE mouseCanceledOnQueue;
+
+NTSTATUS
+NvShieldMouseInitialize(
+    WDFDEVICE Device,
+    NVSHIELD_MOUSE_CURVE Curve
+)
+/*++
+
+Routine Description:
+
+    Sets up the timer and the queue of the device if the MouseEmulation
+    setting asks for it and the model has a trackpad collection for the
+    pointer. Leaves MouseTimer NULL otherwise.
+
+--*/
+{
+    PDEVICE_EXTENSION devContext = GetDeviceContext(Device);
+    WDF_IO_QUEUE_CONFIG queueConfig;
+    WDF_TIMER_CONFIG timerConfig;
+    WDF_WORKITEM_CONFIG workItemConfig;
+    WDF_OBJECT_ATTRIBUTES attributes;
+    WDFTIMER timer;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    devContext->MouseTimer = NULL;
+
+    if (Curve == NvShieldMouseOff || devContext->Shield.model->TrackpadReportId == 0)
+        return STATUS_SUCCESS;
+
+    WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchManual);
+    queueConfig.PowerManaged = WdfFalse;
+    queueConfig.EvtIoCanceledOnQueue = mouseCanceledOnQueue;
+
+    status = WdfIoQueueCreate(Device, &queueConfig, WDF_NO_OBJECT_ATTRIBUTES,
+        &devContext->MouseQueue);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    WDF_TIMER_CONFIG_INIT_PERIODIC(&timerConfig, mouseTimer, NVSHIELD_MOUSE_PERIOD_MS);
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = Device;
+
+    status = WdfWaitLockCreate(&attributes, &devContext->MouseResolutionLock);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    WDF_WORKITEM_CONFIG_INIT(&workItemConfig, mouseResolution);
+    workItemConfig.AutomaticSerialization = FALSE;    // MouseResolutionLock does
+
+    status = WdfWorkItemCreate(&workItemConfig, &attributes, &devContext->MouseResolutionWorkItem);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    status = WdfTimerCreate(&timerConfig, &attributes, &timer);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    devContext->MouseStick = 0x80008000;
+    devContext->MouseActive = 0;
+    devContext->MouseParked = 0;
+    devContext->MouseInFlight = 0;
+    devContext->MouseResolution = FALSE;
+    devContext->Shield.mouseCurve = (UCHAR)Curve;
+
+    devContext->MouseTimer = timer;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+NvShieldMouseCleanup(
+    PDEVICE_EXTENSION devContext
+)
+{
+    PAGED_CODE();
+
+    if (devContext->MouseTimer == NULL)
+        return;
+
+    // Input has stopped, nothing queues the work item once the timer has
+    WdfTimerStop(devContext->MouseTimer, TRUE);
+    WdfWorkItemFlush(devContext->MouseResolutionWorkItem);
+
+    if (devContext->MouseResolution) {
+        ExSetTimerResolution(0, FALSE);
+        devContext->MouseResolution = FALSE;
+    }
+}
+
+static VOID
+mouseResolution(
+    WDFWORKITEM WorkItem
+)
+/*++
+
+Routine Description:
+
+    Raises the timer resolution while MouseTimer runs and drops it once
+    it has stopped, whichever it did last by the time this runs.
+
+--*/
+{
+    PDEVICE_EXTENSION devContext = GetDeviceContext((WDFDEVICE)WdfWorkItemGetParentObject(WorkItem));
+    BOOLEAN active;
+
+    PAGED_CODE();
+
+    // The work item may run again while it runs
+    WdfWaitLockAcquire(devContext->MouseResolutionLock, NULL);
+
+    active = devContext->MouseActive != 0;
+    if (active != devContext->MouseResolution) {
+        ExSetTimerResolution(MOUSE_TIMER_RESOLUTION, active);
+        devContext->MouseResolution = active;
+    }
+
+    WdfWaitLockRelease(devContext->MouseResolutionLock);
+}
+
+USHORT
+NvShieldStickValue(
+    USHORT Value,
+    NVSHIELD_INPUT_FIELD Field
+)
+{
+    // To the 16 bits centered on 0x8000 the core expects
+    if (Field.BitSize == 0 || Field.BitSize > 16)
+        return 0x8000;
+
+    return (USHORT)(Value << (16 - Field.BitSize));
+}
+
+static VOID
+mouseSend(
+    PDEVICE_EXTENSION devContext,
+    WDFREQUEST Request,
+    PURB Urb
+)
+{
+    InterlockedIncrement(&devContext->MouseInFlight);
+
+    if (!NvShieldSendUrb(devContext, Request, Urb,
+            ((struct _URB_BULK_OR_INTERRUPT_TRANSFER*)Urb)->TransferBufferLength)) {
+        InterlockedDecrement(&devContext->MouseInFlight);
+        WdfRequestComplete(Request, WdfRequestGetStatus(Request));
+    }
+}
+
+VOID
+NvShieldMouseSubmitInput(
+    PDEVICE_EXTENSION devContext,
+    WDFREQUEST Request,
+    PURB Urb
+)
+/*++
+
+Routine Description:
+
+    Takes an interrupt IN request of HidUsb. Holds it back for the timer
+    if the pointer is moving, none is held yet and another one is at the
+    device, sends it down otherwise.
+
+--*/
+{
+    if (devContext->MouseActive && devContext->MouseInFlight > 0
+        && InterlockedCompareExchange(&devContext->MouseParked, 1, 0) == 0) {
+
+        if (NT_SUCCESS(WdfRequestForwardToIoQueue(Request, devContext->MouseQueue)))
+            return;
+
+        InterlockedExchange(&devContext->MouseParked, 0);
+    }
+
+    mouseSend(devContext, Request, Urb);
+}
+
+VOID
+NvShieldMouseInputComplete(
+    PDEVICE_EXTENSION devContext,
+    PURB Urb
+)
+/*++
+
+Routine Description:
+
+    Called as an interrupt IN transfer comes back from the device,
+    successful or not.
+
+--*/
+{
+    struct _URB_BULK_OR_INTERRUPT_TRANSFER* req = (struct _URB_BULK_OR_INTERRUPT_TRANSFER*)Urb;
+
+    if (req->TransferFlags & USBD_TRANSFER_DIRECTION_IN)
+        InterlockedDecrement(&devContext->MouseInFlight);
+}
+
+VOID
+NvShieldMouseInput(
+    PDEVICE_EXTENSION devContext,
+    PNVSHIELD_INPUT Input
+)
+/*++
+
+Routine Description:
+
+    The Mouse stage of the input pipeline, before the report is
+    rewritten. Keeps the stick position for the timer and starts it when
+    the stick leaves the dead zone.
+
+--*/
+{
+    const NVSHIELD_GAMEPAD_STATE* gamepad = NvShieldInputGamepad(Input);
+    USHORT x, y;
+
+    if (gamepad == NULL)
+        return;
+
+    x = NvShieldStickValue(gamepad->Axes[NvShieldAxisZ], devContext->InputLayout.Axes[NvShieldAxisZ]);
+    y = NvShieldStickValue(gamepad->Axes[NvShieldAxisRz], devContext->InputLayout.Axes[NvShieldAxisRz]);
+
+    // Before MouseActive, which the timer checks the stick again after clearing
+    InterlockedExchange(&devContext->MouseStick, (LONG)(((ULONG)y << 16) | x));
+
+    if (NvShieldMouseStickActive(x, y)
+        && InterlockedCompareExchange(&devContext->MouseActive, 1, 0) == 0) {
+        WdfTimerStart(devContext->MouseTimer, WDF_REL_TIMEOUT_IN_MS(NVSHIELD_MOUSE_PERIOD_MS));
+        WdfWorkItemEnqueue(devContext->MouseResolutionWorkItem);
+    }
+}
+
+static VOID
+mouseInject(
+    PDEVICE_EXTENSION devContext
+)
+/*++
+
+Routine Description:
+
+    Completes the held request, if there is one, with a report carrying
+    the pending motion. Nothing is allocated: the report is built straight
+    into HidUsb's buffer.
+
+--*/
+{
+    struct _URB_BULK_OR_INTERRUPT_TRANSFER* req;
+    WDFREQUEST request;
+    PURB urb;
+    PUCHAR buf;
+
+    if (!devContext->MouseParked
+        || !NT_SUCCESS(WdfIoQueueRetrieveNextRequest(devContext->MouseQueue, &request)))
+        return;
+
+    urb = (PURB)IoGetCurrentIrpStackLocation(WdfRequestWdmGetIrp(request))->Parameters.Others.Argument1;
+    req = (struct _URB_BULK_OR_INTERRUPT_TRANSFER*)urb;
+
+    // Lets the request be held again once HidUsb sends it back
+    InterlockedExchange(&devContext->MouseParked, 0);
+
+    buf = (PUCHAR)USBPcapURBGetBufferPointer(req->TransferBufferLength,
+        req->TransferBuffer, req->TransferBufferMDL);
+
+    if (buf == NULL || req->TransferBufferLength < NVSHIELD_INPUT_REPORT_SIZE) {
+        mouseSend(devContext, request, urb);
+        return;
+    }
+
+    req->TransferBufferLength = NvShieldBuildMouseReport(&devContext->Shield, buf);
+    urb->UrbHeader.Status = USBD_STATUS_SUCCESS;
+
+    NVSHIELD_CAPTURE_URB(devContext, request, urb, NVSHIELD_CAPTURE_BUS_HIDUSB, TRUE);
+
+    NVSHIELD_COUNT(ReportsProcessed);
+    NVSHIELD_COUNT(ReportsRewritten);
+
+    WdfRequestComplete(request, STATUS_SUCCESS);
+}
+
+static VOID
+mouseRelease(
+    PDEVICE_EXTENSION devContext
+)
+{
+    WDFREQUEST request;
+
+    if (!devContext->MouseParked
+        || !NT_SUCCESS(WdfIoQueueRetrieveNextRequest(devContext->MouseQueue, &request)))
+        return;
+
+    InterlockedExchange(&devContext->MouseParked, 0);
+
+    mouseSend(devContext, request,
+        (PURB)IoGetCurrentIrpStackLocation(WdfRequestWdmGetIrp(request))->Parameters.Others.Argument1);
+}
+
+static VOID
+mouseTimer(
+    WDFTIMER Timer
+)
+/*++
+
+Routine Description:
+
+    Runs every NVSHIELD_MOUSE_PERIOD_MS while the stick is out of the dead
+    zone. Stops itself and gives the held request back to the device once
+    it is centered again.
+
+--*/
+{
+    PDEVICE_EXTENSION devContext = GetDeviceContext((WDFDEVICE)WdfTimerGetParentObject(Timer));
+    LONG stick = devContext->MouseStick;
+    USHORT x = (USHORT)(stick & 0xFFFF);
+    USHORT y = (USHORT)((ULONG)stick >> 16);
+
+    if (NvShieldMouseTick(&devContext->Shield, x, y))
+        mouseInject(devContext);
+
+    if (NvShieldMouseStickActive(x, y))
+        return;
+
+    // Whatever didn't make a whole pixel is dropped
+    devContext->Shield.mouseX = 0;
+    devContext->Shield.mouseY = 0;
+
+    // Stopped before MouseActive is cleared, so that a start racing with
+    // this can't be undone
+    WdfTimerStop(Timer, FALSE);
+    InterlockedExchange(&devContext->MouseActive, 0);
+
+    stick = devContext->MouseStick;
+    x = (USHORT)(stick & 0xFFFF);
+    y = (USHORT)((ULONG)stick >> 16);
+
+    if (NvShieldMouseStickActive(x, y)
+        && InterlockedCompareExchange(&devContext->MouseActive, 1, 0) == 0) {
+        WdfTimerStart(Timer, WDF_REL_TIMEOUT_IN_MS(NVSHIELD_MOUSE_PERIOD_MS));
+        return;
+    }
+
+    WdfWorkItemEnqueue(devContext->MouseResolutionWorkItem);
+
+    mouseRelease(devContext);
+}
+
+static VOID
+mouseCanceledOnQueue(
+    WDFQUEUE Queue,
+    WDFREQUEST Request
+)
+{
+    PDEVICE_EXTENSION devContext = GetDeviceContext(WdfIoQueueGetDevice(Queue));
+
+    InterlockedExchange(&devContext->MouseParked, 0);
+    WdfRequestComplete(Request, STATUS_CANCELLED);
+}
@@ -0,0 +1,448 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    public.h
+
+Abstract:
+
+    Interface between the filter's control device and user-mode tools.
+    User-mode callers include <windows.h> and <winioctl.h> first.
+
+Environment:
+
+    kernel mode and user mode
+
+--*/
+#ifndef _NVSHIELD_PUBLIC_H_
+
+#define _NVSHIELD_PUBLIC_H_
+
+#define NVSHIELD_CONTROL_DEVICE_NAME    L"\\Device\\NvShieldCtrl"
+#define NVSHIELD_CONTROL_SYMBOLIC_NAME  L"\\DosDevices\\NvShieldCtrl"
+#define NVSHIELD_CONTROL_USER_PATH      L"\\\\.\\NvShieldCtrl"
+
+#define FILE_DEVICE_NVSHIELD            0x8A53
+
+//
+// Input: ULONG, non-zero to start copying intercepted URBs to the capture
+// ring, zero to stop.
+//
+#define IOCTL_NVSHIELD_CAPTURE_ENABLE \
+    CTL_CODE(FILE_DEVICE_NVSHIELD, 0x800, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+//
+// Output: NVSHIELD_CAPTURE_MAPPING. Maps the capture ring read/write into
+// the calling process until its handle is closed. Only one handle may
+// hold the mapping at a time.
+//
+#define IOCTL_NVSHIELD_CAPTURE_MAP \
+    CTL_CODE(FILE_DEVICE_NVSHIELD, 0x801, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+//
+// Input: ULONG, non-zero to start measuring the rate of input reports of
+// every controller, zero to stop.
+//
+#define IOCTL_NVSHIELD_RATE_ENABLE \
+    CTL_CODE(FILE_DEVICE_NVSHIELD, 0x802, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+//
+// Output: array of NVSHIELD_REPORT_RATE, one per controller, as many as
+// fit in the buffer.
+//
+#define IOCTL_NVSHIELD_RATE_QUERY \
+    CTL_CODE(FILE_DEVICE_NVSHIELD, 0x803, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+typedef struct _NVSHIELD_REPORT_RATE {
+    ULONG DeviceIndex;
+    ULONG PollingInterval;  // bInterval override, 0 if the device's own is used
+    ULONG ReportsPerSecond; // over the last full second, 0 until there is one
+} NVSHIELD_REPORT_RATE, *PNVSHIELD_REPORT_RATE;
+
+//
+// Output: array of NVSHIELD_DEVICE_STATS, one per controller, as many as
+// fit in the buffer.
+//
+#define IOCTL_NVSHIELD_STATS_QUERY \
+    CTL_CODE(FILE_DEVICE_NVSHIELD, 0x804, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+typedef struct _NVSHIELD_DEVICE_STATS {
+    ULONG DeviceIndex;
+    ULONG ReportCacheHits;      // GET_REPORTs answered from the cache
+    ULONG ReportCacheMisses;    // GET_REPORTs sent to the device
+    ULONG RumbleReportsSent;    // motor reports sent to the device
+    ULONG RumbleReportsSuppressed; // motor updates that changed nothing or were superseded
+    ULONG InputReportsShort;    // interrupt transfers ending in a cut off report
+    ULONG InputReportsMismatched; // interrupt transfers with a report ID the descriptor lacks
+    ULONG InputReportsSuppressed; // unchanged gamepad reports held back, see InputKeepAlive
+} NVSHIELD_DEVICE_STATS, *PNVSHIELD_DEVICE_STATS;
+
+//
+// Output: NVSHIELD_DRIVER_STATS, totals over every controller since the
+// driver loaded.
+//
+#define IOCTL_NVSHIELD_DRIVER_STATS_QUERY \
+    CTL_CODE(FILE_DEVICE_NVSHIELD, 0x806, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+typedef struct _NVSHIELD_DRIVER_STATS {
+    ULONGLONG ReportsProcessed;     // input reports handed to HidUsb
+    ULONGLONG ReportsRewritten;     // of which the filter rewrote or synthesized
+    ULONGLONG RumbleReportsSent;    // motor reports sent to the devices
+    ULONGLONG AllocationFailures;
+    ULONG Processors;               // that added to the counters
+    ULONG Reserved;
+} NVSHIELD_DRIVER_STATS, *PNVSHIELD_DRIVER_STATS;
+
+//
+// Output: array of NVSHIELD_STAGE_STATS, one per controller, as many as
+// fit in the buffer. Fails with STATUS_NOT_SUPPORTED unless the driver
+// was built with NVSHIELD_STAGE_TIMING, as checked builds are.
+//
+#define IOCTL_NVSHIELD_STAGE_STATS_QUERY \
+    CTL_CODE(FILE_DEVICE_NVSHIELD, 0x807, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+//
+// Stages of the input pipeline, in the order every input report goes
+// through them. Calibrate comes first, since it corrects the sticks the
+// others read, and Rewrite last, since it may replace the report.
+//
+#define NVSHIELD_INPUT_STAGES(STAGE) \
+    STAGE(Calibrate)    /* stick drift and reach correction */ \
+    STAGE(Mouse)        /* right stick to the mouse emulation */ \
+    STAGE(Publish)      /* shared state slot */ \
+    STAGE(Condition)    /* left stick to the condition effects */ \
+    STAGE(Rewrite)      /* consumer control and trackpad rewrites of the model */
+
+typedef enum _NVSHIELD_INPUT_STAGE {
+#define NVSHIELD_STAGE_ID(Name) NvShieldStage##Name,
+    NVSHIELD_INPUT_STAGES(NVSHIELD_STAGE_ID)
+#undef NVSHIELD_STAGE_ID
+    NvShieldStageCount
+} NVSHIELD_INPUT_STAGE;
+
+typedef struct _NVSHIELD_STAGE_COUNTER {
+    ULONGLONG Reports;          // that went through the stage
+    ULONGLONG Cycles;           // spent in it, in time stamp counter ticks
+} NVSHIELD_STAGE_COUNTER, *PNVSHIELD_STAGE_COUNTER;
+
+typedef struct _NVSHIELD_STAGE_STATS {
+    ULONG DeviceIndex;
+    ULONG Reserved;
+    NVSHIELD_STAGE_COUNTER Stages[NvShieldStageCount]; // in NVSHIELD_INPUT_STAGES order
+} NVSHIELD_STAGE_STATS, *PNVSHIELD_STAGE_STATS;
+
+//
+// Output: array of NVSHIELD_SETTINGS, one per controller, as many as fit
+// in the buffer.
+//
+#define IOCTL_NVSHIELD_SETTINGS_QUERY \
+    CTL_CODE(FILE_DEVICE_NVSHIELD, 0x808, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+//
+// Input: NVSHIELD_SETTINGS of the controller DeviceIndex. They apply to
+// the next report, without reconnecting it, and are stored in its
+// hardware key for the next time it starts. Fails with
+// STATUS_INVALID_PARAMETER if a value is out of range, and with the
+// registry's status if they can't be stored; nothing changes either way.
+//
+#define IOCTL_NVSHIELD_SETTINGS_SET \
+    CTL_CODE(FILE_DEVICE_NVSHIELD, 0x809, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+//
+// Tunables of a controller, each stored in the registry value named after
+// its field; a value that is absent or out of range stands for its
+// default, given last.
+//
+#define NVSHIELD_TRACKPAD_SCALE_MAX     8
+
+#define NVSHIELD_VOLUME_UP              0x01
+#define NVSHIELD_VOLUME_DOWN            0x02
+#define NVSHIELD_VOLUME_ALL             0x03
+
+#define NVSHIELD_RUMBLE_OFF             0x01    // the motors never run
+#define NVSHIELD_RUMBLE_SWAP            0x02    // each motor plays what the other one would
+#define NVSHIELD_RUMBLE_FLAGS           0x03
+
+#define NVSHIELD_INPUT_KEEPALIVE_MAX    10000   // ms
+
+typedef struct _NVSHIELD_SETTINGS {
+    ULONG DeviceIndex;
+    ULONG TrackpadScaleX;   // trackpad motion multiplier, before it is squared, 1 to NVSHIELD_TRACKPAD_SCALE_MAX; 1
+    ULONG TrackpadScaleY;   // 2
+    ULONG VolumeButtons;    // NVSHIELD_VOLUME_* mirrored to the consumer control collection; NVSHIELD_VOLUME_ALL
+    ULONG RumbleGain;       // 0-255, on top of the game's device gain; 255
+    ULONG RumbleFlags;      // NVSHIELD_RUMBLE_*; 0
+    ULONG Calibrate;        // 1 to correct stick drift and reach as the controller is used; 0
+    ULONG InputKeepAlive;   // ms an unchanged gamepad report is held back for, up to NVSHIELD_INPUT_KEEPALIVE_MAX; 0, every report goes up
+} NVSHIELD_SETTINGS, *PNVSHIELD_SETTINGS;
+
+//
+// Input: ULONG, non-zero to start measuring the latencies of every
+// controller into new histograms, zero to stop.
+//
+#define IOCTL_NVSHIELD_LATENCY_ENABLE \
+    CTL_CODE(FILE_DEVICE_NVSHIELD, 0x80A, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+
+//
+// Output: array of NVSHIELD_LATENCY_STATS, one per controller, as many as
+// fit in the buffer.
+//
+#define IOCTL_NVSHIELD_LATENCY_QUERY \
+    CTL_CODE(FILE_DEVICE_NVSHIELD, 0x80B, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+//
+// Latencies measured for every controller, each from one point a request
+// or a motor report goes through to a later one.
+//
+#define NVSHIELD_LATENCIES(LATENCY) \
+    LATENCY(InputDevice)    /* interrupt IN request sent down to its completion */ \
+    LATENCY(InputFilter)    /* that completion to the request handed back up */ \
+    LATENCY(RumbleFilter)   /* SET_REPORT changing the motors to the motor report sent */ \
+    LATENCY(RumbleDevice)   /* motor report sent to its completion */
+
+typedef enum _NVSHIELD_LATENCY {
+#define NVSHIELD_LATENCY_ID(Name) NvShieldLatency##Name,
+    NVSHIELD_LATENCIES(NVSHIELD_LATENCY_ID)
+#undef NVSHIELD_LATENCY_ID
+    NvShieldLatencyCount
+} NVSHIELD_LATENCY;
+
+//
+// Log-linear histogram of latencies in microseconds, as HDR histograms
+// keep them: values below 2 * NVSHIELD_LATENCY_SUB_BUCKETS have a bucket
+// each, and every power of two above that is split into
+// NVSHIELD_LATENCY_SUB_BUCKETS buckets, so that any percentile read from
+// it is within 1/NVSHIELD_LATENCY_SUB_BUCKETS of the true value. Values of
+// NVSHIELD_LATENCY_BITS bits and more count as the largest one.
+//
+#define NVSHIELD_LATENCY_SUB_BITS       5
+#define NVSHIELD_LATENCY_SUB_BUCKETS    (1 << NVSHIELD_LATENCY_SUB_BITS)
+#define NVSHIELD_LATENCY_BITS           24      // 16.7s
+#define NVSHIELD_LATENCY_BUCKETS \
+    ((NVSHIELD_LATENCY_BITS - NVSHIELD_LATENCY_SUB_BITS + 1) * NVSHIELD_LATENCY_SUB_BUCKETS)
+
+typedef struct _NVSHIELD_LATENCY_HISTOGRAM {
+    ULONG Buckets[NVSHIELD_LATENCY_BUCKETS];
+} NVSHIELD_LATENCY_HISTOGRAM, *PNVSHIELD_LATENCY_HISTOGRAM;
+
+typedef struct _NVSHIELD_LATENCY_STATS {
+    ULONG DeviceIndex;
+    ULONG Reserved;
+    NVSHIELD_LATENCY_HISTOGRAM Latencies[NvShieldLatencyCount]; // in NVSHIELD_LATENCIES order
+} NVSHIELD_LATENCY_STATS, *PNVSHIELD_LATENCY_STATS;
+
+//
+// Output: NVSHIELD_STATE_MAPPING. Maps the shared state area, one
+// NVSHIELD_SHARED_STATE slot per controller, read-only into the calling
+// process until its handle is closed. Any number of handles may map it.
+//
+#define IOCTL_NVSHIELD_STATE_MAP \
+    CTL_CODE(FILE_DEVICE_NVSHIELD, 0x805, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+typedef struct _NVSHIELD_STATE_MAPPING {
+    ULONGLONG AreaAddress;  // first NVSHIELD_SHARED_STATE in the caller's address space
+    ULONG AreaSize;
+    ULONG SlotCount;        // slots, NVSHIELD_SHARED_STATE_SLOT_SIZE bytes apart
+} NVSHIELD_STATE_MAPPING, *PNVSHIELD_STATE_MAPPING;
+
+typedef struct _NVSHIELD_CAPTURE_MAPPING {
+    ULONGLONG RingAddress;  // PNVSHIELD_CAPTURE_RING in the caller's address space
+    ULONG RingSize;         // size of the whole mapping
+} NVSHIELD_CAPTURE_MAPPING, *PNVSHIELD_CAPTURE_MAPPING;
+
+//
+// Capture ring
+//
+// The driver appends entries at Head and the consumer releases them by
+// advancing Tail; both are free running byte counters, taken modulo
+// DataSize (a power of two) to index Data. An entry never wraps: when the
+// space left before the end of Data is too small, the driver writes a
+// padding entry and starts over at offset 0. Entries that don't fit in
+// the free space are dropped and counted.
+//
+// Head and DataSize in the ring only tell the consumer; the driver goes by
+// its own copies, whatever the mapping holds. A Tail more than DataSize
+// behind Head has every entry dropped until the consumer puts it back.
+//
+// Each record entry carries a complete pcap record (pcaprec_hdr_t followed
+// by a USBPcap packet header and the transfer data), so that writing the
+// records after a pcap file header with LINKTYPE_USBPCAP yields a file
+// Wireshark can open. Bus 1 holds the traffic as exchanged with the
+// controller, bus 2 as exchanged with HidUsb; the device address is the
+// filter's device index.
+//
+
+#define NVSHIELD_CAPTURE_MAGIC          'pCvN'
+#define NVSHIELD_CAPTURE_RING_SIZE      (1024 * 1024)    // DataSize
+#define NVSHIELD_CAPTURE_SNAPLEN        2048
+
+#define NVSHIELD_CAPTURE_BUS_DEVICE     1
+#define NVSHIELD_CAPTURE_BUS_HIDUSB     2
+
+#define NVSHIELD_CAPTURE_ENTRY_RECORD   0
+#define NVSHIELD_CAPTURE_ENTRY_PADDING  1
+
+#define LINKTYPE_USBPCAP                249
+
+typedef struct _NVSHIELD_CAPTURE_ENTRY {
+    ULONG Length;           // whole entry, multiple of 8
+    ULONG Type;             // NVSHIELD_CAPTURE_ENTRY_*
+    // pcap record follows
+} NVSHIELD_CAPTURE_ENTRY, *PNVSHIELD_CAPTURE_ENTRY;
+
+typedef struct _NVSHIELD_CAPTURE_RING {
+    ULONG Magic;
+    ULONG DataSize;
+    volatile ULONG Head;    // written by the driver
+    volatile ULONG Tail;    // written by the consumer
+    volatile ULONG Dropped;
+    ULONG Reserved[3];
+    UCHAR Data[1];
+} NVSHIELD_CAPTURE_RING, *PNVSHIELD_CAPTURE_RING;
+
+//
+// Shared state area
+//
+// The latest state of every controller, updated as its input reports
+// complete, for readers that want to poll it rather than queue HID reads.
+// Each slot is guarded by Sequence: the driver makes it odd before
+// updating the slot and even again after, so a copy taken between two
+// reads of the same even Sequence is consistent, see
+// NvShieldReadSharedState. Timestamp is on the QueryPerformanceCounter
+// clock. Slots are only updated while some handle has the area mapped.
+//
+
+#define NVSHIELD_SHARED_STATE_MAGIC     0x7353764E  // 'sSvN'
+#define NVSHIELD_SHARED_STATE_SLOTS     16
+#define NVSHIELD_SHARED_STATE_SLOT_SIZE 4096
+
+typedef struct _NVSHIELD_SHARED_STATE {
+    ULONG Magic;
+    ULONG DeviceIndex;          // 0 while no controller has the slot
+    volatile LONG Sequence;
+    ULONG Reserved;
+    LONGLONG Frequency;         // Timestamp ticks per second
+    LONGLONG Timestamp;         // when the last report completed
+
+    // Gamepad, from the last report 0x01
+    USHORT Buttons;
+    UCHAR Hat;                  // 0 = up, clockwise, above 7 when released
+    UCHAR Consumer;
+    USHORT Axes[6];             // X, Y, Z, Rz, Rx (left trigger), Ry (right trigger)
+
+    // Trackpad, from the last report 0x02
+    UCHAR TrackpadButtons;      // bit 3 while touched
+    UCHAR TrackpadX;
+    UCHAR TrackpadY;
+    UCHAR Reserved2;
+} NVSHIELD_SHARED_STATE, *PNVSHIELD_SHARED_STATE;
+
+#ifndef _KERNEL_MODE
+
+//
+// Copies a slot of the shared state area. Returns FALSE if no controller
+// has the slot.
+//
+static __inline BOOLEAN
+NvShieldReadSharedState(
+    const NVSHIELD_SHARED_STATE* Slot,
+    NVSHIELD_SHARED_STATE* Copy
+)
+{
+    LONG sequence;
+
+    for (;;) {
+        sequence = Slot->Sequence;
+        MemoryBarrier();
+        *Copy = *Slot;
+        MemoryBarrier();
+        if (!(sequence & 1) && sequence == Slot->Sequence)
+            break;
+    }
+
+    return Copy->Magic == NVSHIELD_SHARED_STATE_MAGIC && Copy->DeviceIndex != 0;
+}
+
+//
+// Number of latencies in a histogram.
+//
+static __inline ULONG
+NvShieldLatencyCountOf(
+    const NVSHIELD_LATENCY_HISTOGRAM* Histogram
+)
+{
+    ULONG count = 0;
+    ULONG i;
+
+    for (i = 0; i < NVSHIELD_LATENCY_BUCKETS; i++)
+        count += Histogram->Buckets[i];
+
+    return count;
+}
+
+//
+// Latency in microseconds that PerMille thousandths of those in a
+// histogram don't exceed, the highest of its bucket: 500 for the median,
+// 999 for p99.9, 1000 for the largest. 0 if the histogram is empty.
+//
+static __inline ULONG
+NvShieldLatencyPercentile(
+    const NVSHIELD_LATENCY_HISTOGRAM* Histogram,
+    ULONG PerMille
+)
+{
+    ULONGLONG rank = ((ULONGLONG)NvShieldLatencyCountOf(Histogram) * PerMille + 999) / 1000;
+    ULONGLONG seen = 0;
+    ULONG i, shift;
+
+    if (rank == 0)
+        return 0;
+
+    for (i = 0; i < NVSHIELD_LATENCY_BUCKETS - 1; i++) {
+        seen += Histogram->Buckets[i];
+        if (seen >= rank)
+            break;
+    }
+
+    if (i < 2 * NVSHIELD_LATENCY_SUB_BUCKETS)
+        return i;
+
+    shift = i / NVSHIELD_LATENCY_SUB_BUCKETS - 1;
+    return (((i % NVSHIELD_LATENCY_SUB_BUCKETS + NVSHIELD_LATENCY_SUB_BUCKETS + 1) << shift) - 1);
+}
+
+#endif
+
+#include <pshpack1.h>
+
+typedef struct _NVSHIELD_PCAP_RECORD_HEADER {
+    ULONG ts_sec;
+    ULONG ts_usec;
+    ULONG incl_len;
+    ULONG orig_len;
+} NVSHIELD_PCAP_RECORD_HEADER;
+
+typedef struct _NVSHIELD_USBPCAP_HEADER {
+    USHORT headerLen;
+    ULONGLONG irpId;
+    LONG status;
+    USHORT function;
+    UCHAR info;             // bit 0: from the device
+    USHORT bus;
+    USHORT device;
+    UCHAR endpoint;
+    UCHAR transfer;         // 1 = interrupt, 2 = control
+    ULONG dataLength;
+    UCHAR stage;            // control transfers only: 0 = setup, 3 = complete
+} NVSHIELD_USBPCAP_HEADER;
+
+#include <poppack.h>
+
+#endif   //_NVSHIELD_PUBLIC_H_
@@ -0,0 +1,325 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    sharedstate.c
+
+Abstract:
+
+    Latest decoded state of every controller, published in an area that
+    user mode maps read-only, so that readers poll it instead of going
+    through HID reads.
+
+Environment:
+
+    kernel mode only
+
+Revision History:
+
+--*/
+
+#include <hidusbfx2.h>
+
+#define NVSHIELD_STATE_TAG      (ULONG)((((ULONG)'N') << 16) + (((ULONG)'V') << 8) + 'S')
+
+#define NVSHIELD_STATE_AREA_SIZE \
+    (NVSHIELD_SHARED_STATE_SLOTS * NVSHIELD_SHARED_STATE_SLOT_SIZE)
+
+#define TRACKPAD_REPORT_SIZE    5
+
+volatile LONG G_SharedStateReaders = 0;
+
+static struct {
+    PUCHAR Area;
+    PMDL Mdl;
+
+    volatile LONG SlotsUsed;
+} G_SharedState;
+
+C_ASSERT(sizeof(NVSHIELD_SHARED_STATE) <= NVSHIELD_SHARED_STATE_SLOT_SIZE);
+C_ASSERT(NVSHIELD_SHARED_STATE_SLOTS <= 32);
+
+static PNVSHIELD_SHARED_STATE
+sharedStateSlot(
+    PUCHAR Area,
+    ULONG Slot
+)
+{
+    return (PNVSHIELD_SHARED_STATE)(Area + Slot * NVSHIELD_SHARED_STATE_SLOT_SIZE);
+}
+
+NTSTATUS
+NvShieldSharedStateInitialize(
+    VOID
+)
+/*++
+
+Routine Description:
+
+    Allocates the area. Called when the control device is created.
+
+--*/
+{
+    LARGE_INTEGER frequency;
+    PUCHAR area;
+    PMDL mdl;
+    ULONG i;
+
+    // Page aligned, being at least a page
+    area = (PUCHAR)ExAllocatePoolWithTag(NonPagedPool, NVSHIELD_STATE_AREA_SIZE,
+        NVSHIELD_STATE_TAG);
+    if (area == NULL) {
+        NVSHIELD_COUNT(AllocationFailures);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    mdl = IoAllocateMdl(area, NVSHIELD_STATE_AREA_SIZE, FALSE, FALSE, NULL);
+    if (mdl == NULL) {
+        NVSHIELD_COUNT(AllocationFailures);
+        ExFreePool(area);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    MmBuildMdlForNonPagedPool(mdl);
+
+    RtlZeroMemory(area, NVSHIELD_STATE_AREA_SIZE);
+
+    KeQueryPerformanceCounter(&frequency);
+
+    for (i = 0; i < NVSHIELD_SHARED_STATE_SLOTS; i++) {
+        PNVSHIELD_SHARED_STATE slot = sharedStateSlot(area, i);
+
+        slot->Magic = NVSHIELD_SHARED_STATE_MAGIC;
+        slot->Frequency = frequency.QuadPart;
+    }
+
+    G_SharedState.Mdl = mdl;
+    InterlockedExchangePointer((PVOID*)&G_SharedState.Area, area);
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+NvShieldSharedStateCleanup(
+    VOID
+)
+/*++
+
+Routine Description:
+
+    Frees the area once the control device, and thus every handle that
+    could still have it mapped, is gone.
+
+--*/
+{
+    PUCHAR area;
+
+    ASSERT(G_SharedStateReaders == 0);
+
+    area = (PUCHAR)InterlockedExchangePointer((PVOID*)&G_SharedState.Area, NULL);
+
+    if (G_SharedState.Mdl != NULL) {
+        IoFreeMdl(G_SharedState.Mdl);
+        G_SharedState.Mdl = NULL;
+    }
+    if (area != NULL)
+        ExFreePool(area);
+}
+
+NTSTATUS
+NvShieldSharedStateMap(
+    WDFFILEOBJECT File,
+    PNVSHIELD_STATE_MAPPING Mapping
+)
+/*++
+
+Routine Description:
+
+    Maps the area read-only into the current process, once per handle.
+    Must run in the context of the process that sent
+    IOCTL_NVSHIELD_STATE_MAP.
+
+--*/
+{
+    PCONTROL_FILE_CONTEXT fileContext = GetControlFileContext(File);
+    PVOID address = NULL;
+
+    PAGED_CODE();
+
+    if (G_SharedState.Mdl == NULL)
+        return STATUS_DEVICE_NOT_READY;
+
+    if (fileContext->SharedStateAddress == NULL) {
+        __try {
+            address = MmMapLockedPagesSpecifyCache(G_SharedState.Mdl, UserMode, MmCached,
+                NULL, FALSE, NormalPagePriority | MdlMappingNoExecute | MdlMappingNoWrite);
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER) {
+            address = NULL;
+        }
+
+        if (address == NULL)
+            return STATUS_INSUFFICIENT_RESOURCES;
+
+        fileContext->SharedStateAddress = address;
+        InterlockedIncrement(&G_SharedStateReaders);
+    }
+
+    Mapping->AreaAddress = (ULONGLONG)(ULONG_PTR)fileContext->SharedStateAddress;
+    Mapping->AreaSize = NVSHIELD_STATE_AREA_SIZE;
+    Mapping->SlotCount = NVSHIELD_SHARED_STATE_SLOTS;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+NvShieldSharedStateUnmap(
+    WDFFILEOBJECT File
+)
+/*++
+
+Routine Description:
+
+    Called on handle cleanup, in the context of the process that owns it.
+
+--*/
+{
+    PCONTROL_FILE_CONTEXT fileContext = GetControlFileContext(File);
+
+    PAGED_CODE();
+
+    if (fileContext->SharedStateAddress == NULL)
+        return;
+
+    MmUnmapLockedPages(fileContext->SharedStateAddress, G_SharedState.Mdl);
+    fileContext->SharedStateAddress = NULL;
+
+    InterlockedDecrement(&G_SharedStateReaders);
+}
+
+VOID
+NvShieldSharedStateAcquireSlot(
+    PDEVICE_EXTENSION devContext
+)
+/*++
+
+Routine Description:
+
+    Gives the device a slot, if one is free, and finds its gamepad report
+    in the Report Descriptor it presents. Gives none while there is no
+    such descriptor yet; HidFx2EvtDevicePrepareHardware tries again once
+    it has built one.
+
+--*/
+{
+    ULONG i;
+
+    KeInitializeSpinLock(&devContext->SharedStateLock);
+    devContext->SharedStateSlot = NVSHIELD_SHARED_STATE_SLOTS;
+
+    if (!NvShieldGetInputLayout(devContext->ReportDescriptor, devContext->ReportDescriptorLength,
+            devContext->Shield.model->GamepadReportId, &devContext->InputLayout))
+        return;
+
+    for (i = 0; i < NVSHIELD_SHARED_STATE_SLOTS; i++) {
+        if (!InterlockedBitTestAndSet(&G_SharedState.SlotsUsed, (LONG)i)) {
+            devContext->SharedStateSlot = i;
+            return;
+        }
+    }
+}
+
+VOID
+NvShieldSharedStateReleaseSlot(
+    PDEVICE_EXTENSION devContext
+)
+{
+    ULONG slotIndex = devContext->SharedStateSlot;
+    PUCHAR area = G_SharedState.Area;
+    PNVSHIELD_SHARED_STATE slot;
+    KIRQL irql;
+
+    if (slotIndex >= NVSHIELD_SHARED_STATE_SLOTS)
+        return;
+
+    if (area != NULL) {
+        slot = sharedStateSlot(area, slotIndex);
+
+        KeAcquireSpinLock(&devContext->SharedStateLock, &irql);
+        InterlockedIncrement(&slot->Sequence);
+        slot->DeviceIndex = 0;
+        InterlockedIncrement(&slot->Sequence);
+        KeReleaseSpinLock(&devContext->SharedStateLock, irql);
+    }
+
+    devContext->SharedStateSlot = NVSHIELD_SHARED_STATE_SLOTS;
+    InterlockedBitTestAndReset(&G_SharedState.SlotsUsed, (LONG)slotIndex);
+}
+
+VOID
+NvShieldSharedStatePublish(
+    PDEVICE_EXTENSION devContext,
+    PNVSHIELD_INPUT Input
+)
+/*++
+
+Routine Description:
+
+    Updates the device's slot from an input report as received from the
+    controller, the Publish stage of the input pipeline. Only reached
+    while the area is mapped, see NVSHIELD_PUBLISH_STATE.
+
+--*/
+{
+    PUCHAR area = G_SharedState.Area;
+    const NVSHIELD_GAMEPAD_STATE* gamepad;
+    const UCHAR* Report = Input->Report;
+    PNVSHIELD_SHARED_STATE slot;
+    LARGE_INTEGER now;
+    KIRQL irql;
+
+    if (area == NULL || devContext->SharedStateSlot >= NVSHIELD_SHARED_STATE_SLOTS
+        || Input->Length == 0)
+        return;
+
+    // The trackpad report of the model, which has none with ID 0
+    gamepad = NvShieldInputGamepad(Input);
+    if (gamepad == NULL && (Report[0] == 0 || Report[0] != devContext->Shield.model->TrackpadReportId
+            || Input->Length < TRACKPAD_REPORT_SIZE))
+        return;
+
+    now = KeQueryPerformanceCounter(NULL);
+    slot = sharedStateSlot(area, devContext->SharedStateSlot);
+
+    // Completions of the same device may run on several processors
+    KeAcquireSpinLock(&devContext->SharedStateLock, &irql);
+
+    InterlockedIncrement(&slot->Sequence);
+
+    slot->DeviceIndex = devContext->DeviceIndex;
+    slot->Timestamp = now.QuadPart;
+
+    if (gamepad != NULL) {
+        C_ASSERT(sizeof(slot->Axes) == sizeof(gamepad->Axes));
+
+        slot->Buttons = gamepad->Buttons;
+        slot->Hat = gamepad->Hat;
+        slot->Consumer = gamepad->Consumer;
+        RtlCopyMemory(slot->Axes, gamepad->Axes, sizeof(slot->Axes));
+    }
+    else {
+        slot->TrackpadButtons = Report[1];
+        slot->TrackpadX = Report[2];
+        slot->TrackpadY = Report[4];
+    }
+
+    InterlockedIncrement(&slot->Sequence);
+
+    KeReleaseSpinLock(&devContext->SharedStateLock, irql);
+}
@@ -0,0 +1,2324 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    shield.c
+
+Abstract:
+
+    Input report rewriting and PID force feedback emulation, independent
+    of the transport the reports travel on.
+
+Author:
+
+
+Environment:
+
+    kernel mode and user mode
+
+Revision History:
+
+--*/
+
+#include "shield.h"
+#include "public.h"
+
+static VOID
+calibrationInit(
+    PNVSHIELD_STATE State
+)
+{
+    ULONG axis;
+
+    // Whatever the sticks do, until they are seen doing it
+    for (axis = 0; axis < NVSHIELD_CALIBRATION_AXES; axis++) {
+        State->calibration[axis].Center = 0x8000;
+        State->calibration[axis].Min = 0x8000 - NVSHIELD_CALIBRATION_REACH;
+        State->calibration[axis].Max = 0x8000 + NVSHIELD_CALIBRATION_REACH;
+
+        State->calibrationCenter[axis] = 0x8000 << 8;
+        State->calibrationMin[axis] = State->calibration[axis].Min;
+        State->calibrationMax[axis] = State->calibration[axis].Max;
+        State->calibrationLast[axis] = 0x8000;
+    }
+
+    RtlZeroMemory(State->calibrationStill, sizeof(State->calibrationStill));
+}
+
+VOID
+NvShieldInitState(
+    PNVSHIELD_STATE State
+)
+{
+    NvShieldSetModel(State, &G_NvShieldModel2015);
+
+    // Init rumble values
+    NvShieldSetPidEffects(State, NVSHIELD_PID_EFFECT_ALL);
+    RtlZeroMemory(State->effects, sizeof(State->effects));
+    State->loadedBlock = 0;
+    State->customBlock = 0;
+    State->isActuatorEnabled = TRUE;
+    State->isPaused = FALSE;
+    State->rumbleGain = 255;
+    State->rumbleSent = 0;
+    State->rumbleSuppressed = 0;
+
+    State->inputShort = 0;
+    State->inputMismatched = 0;
+
+    RtlZeroMemory(State->lastInput, sizeof(State->lastInput));
+    State->lastInputTime = 0;
+    State->inputSuppressed = 0;
+
+    State->idleExpires = 0;
+
+    State->conditionTime = 0;
+
+    calibrationInit(State);
+
+    // Init trackpad values
+    State->origX = 0;
+    State->origY = 0;
+    State->isTrackpadPressed = FALSE;
+
+    // Init consumer control
+    State->lastCCState = 0;
+
+    // Init mouse emulation
+    State->mouseCurve = NvShieldMouseOff;
+    State->trackpadButtons = 0;
+    State->mouseX = 0;
+    State->mouseY = 0;
+}
+
+static ULONG
+gamepadInput(
+    PNVSHIELD_STATE State,
+    PUCHAR Report,
+    ULONG Length
+)
+{
+    const NVSHIELD_MODEL* model = State->model;
+    UCHAR ccState;
+
+    if (Length <= model->ConsumerByte)
+        return Length;
+
+    // Mirror consumer control buttons in the consumer control virtual device, because the HID game controller client driver
+    // doesn't know how to handle them (while Linux has no problem picking them up).
+    ccState = Report[model->ConsumerByte] & State->config->ConsumerMask;
+
+    if (State->lastCCState != ccState) {
+        Report[0] = model->ConsumerReportId;
+        Report[1] = State->lastCCState = ccState;
+        return 2;
+    }
+
+    return Length;
+}
+
+static ULONG
+trackpadInput(
+    PNVSHIELD_STATE State,
+    PUCHAR Report,
+    ULONG Length
+)
+{
+    PUCHAR buf = Report;
+    SHORT diffX = 0, diffY = 0;
+    UCHAR x, y;
+
+    if (Length < 6)
+        return Length;
+
+    // Tweak trackpad interrupts
+    x = buf[2];
+    y = buf[4];
+
+    State->trackpadButtons = buf[1] & 0x0F;
+
+    if (buf[1] & 0x08) {
+        if (State->isTrackpadPressed) {
+            const NVSHIELD_CONFIG* config = State->config;
+
+            diffX = config->TrackpadX[255 + x - State->origX];
+            diffY = config->TrackpadY[255 + y - State->origY];
+        }
+        else {
+            State->isTrackpadPressed = TRUE;
+        }
+        State->origX = x;
+        State->origY = y;
+    }
+    else {
+        State->isTrackpadPressed = FALSE;
+    }
+
+    // A byte at a time, the report needn't be aligned in a transfer
+    // carrying several
+    buf[2] = (UCHAR)(diffX & 0xFF);
+    buf[3] = (UCHAR)((diffX >> 8) & 0xFF);
+    buf[4] = (UCHAR)(diffY & 0xFF);
+    buf[5] = (UCHAR)((diffY >> 8) & 0xFF);
+
+    return Length;
+}
+
+VOID
+NvShieldSetModel(
+    PNVSHIELD_STATE State,
+    const NVSHIELD_MODEL* Model
+)
+/*++
+
+Routine Description:
+
+    Switches the input rewrites and the motor report to those of Model,
+    before any report went through State, and goes back to the default
+    settings, compiled for it.
+
+--*/
+{
+    NVSHIELD_SETTINGS settings;
+
+    State->model = Model;
+    RtlZeroMemory(State->lastRumbleReport, sizeof(State->lastRumbleReport));
+
+    // Report ID 0 stays NULL, it is padding
+    RtlZeroMemory(State->inputHandlers, sizeof(State->inputHandlers));
+
+    if (Model->GamepadReportId != 0 && Model->ConsumerReportId != 0)
+        State->inputHandlers[Model->GamepadReportId] = gamepadInput;
+    if (Model->TrackpadReportId != 0)
+        State->inputHandlers[Model->TrackpadReportId] = trackpadInput;
+
+    NvShieldDefaultSettings(&settings);
+    NvShieldCompileConfig(&State->defaultConfig, Model, &settings, State->calibration);
+    State->config = &State->defaultConfig;
+}
+
+static ULONG
+effectTypeClass(
+    UCHAR Type
+)
+{
+    switch (Type)
+    {
+    case NvShieldEffectConstant:        return NVSHIELD_PID_EFFECT_CONSTANT;
+    case NvShieldEffectRamp:            return NVSHIELD_PID_EFFECT_RAMP;
+    case NvShieldEffectSquare:
+    case NvShieldEffectSine:
+    case NvShieldEffectTriangle:
+    case NvShieldEffectSawtoothUp:
+    case NvShieldEffectSawtoothDown:    return NVSHIELD_PID_EFFECT_PERIODIC;
+    case NvShieldEffectSpring:
+    case NvShieldEffectDamper:
+    case NvShieldEffectInertia:
+    case NvShieldEffectFriction:        return NVSHIELD_PID_EFFECT_CONDITION;
+    case NvShieldEffectCustom:          return NVSHIELD_PID_EFFECT_CUSTOM;
+    default:                            return 0;
+    }
+}
+
+VOID
+NvShieldSetPidEffects(
+    PNVSHIELD_STATE State,
+    ULONG Effects
+)
+/*++
+
+Routine Description:
+
+    Tells the emulation which effect classes, NVSHIELD_PID_EFFECT_*, the
+    Report Descriptor presented declares, before any SET_REPORT went
+    through State. NvShieldInitState assumes all of them. A variant
+    declaring fewer numbers the effect types it keeps from 1 on, in the
+    order of NVSHIELD_EFFECT_TYPE, and Create New Effect and Set Effect
+    are mapped back through effectTypes.
+
+--*/
+{
+    UCHAR type, index = 0;
+
+    RtlZeroMemory(State->effectTypes, sizeof(State->effectTypes));
+
+    for (type = NvShieldEffectNone + 1; type < NvShieldEffectTypeCount; type++) {
+        if (effectTypeClass(type) & Effects)
+            State->effectTypes[++index] = type;
+    }
+}
+
+VOID
+NvShieldDefaultSettings(
+    PNVSHIELD_SETTINGS Settings
+)
+/*++
+
+Routine Description:
+
+    Fills in the default of every setting, which is how the driver behaved
+    before they could be changed. DeviceIndex is left alone.
+
+--*/
+{
+    Settings->TrackpadScaleX = 1;
+    Settings->TrackpadScaleY = 2;
+    Settings->VolumeButtons = NVSHIELD_VOLUME_ALL;
+    Settings->RumbleGain = 255;
+    Settings->RumbleFlags = 0;
+    Settings->Calibrate = 0;
+    Settings->InputKeepAlive = 0;
+}
+
+BOOLEAN
+NvShieldCheckSettings(
+    PNVSHIELD_SETTINGS Settings
+)
+/*++
+
+Routine Description:
+
+    Replaces the settings that are out of range with their defaults.
+
+Return Value:
+
+    FALSE if any was.
+
+--*/
+{
+    NVSHIELD_SETTINGS defaults;
+    BOOLEAN valid = TRUE;
+
+    NvShieldDefaultSettings(&defaults);
+
+    if (Settings->TrackpadScaleX < 1 || Settings->TrackpadScaleX > NVSHIELD_TRACKPAD_SCALE_MAX) {
+        Settings->TrackpadScaleX = defaults.TrackpadScaleX;
+        valid = FALSE;
+    }
+    if (Settings->TrackpadScaleY < 1 || Settings->TrackpadScaleY > NVSHIELD_TRACKPAD_SCALE_MAX) {
+        Settings->TrackpadScaleY = defaults.TrackpadScaleY;
+        valid = FALSE;
+    }
+    if (Settings->VolumeButtons & ~NVSHIELD_VOLUME_ALL) {
+        Settings->VolumeButtons = defaults.VolumeButtons;
+        valid = FALSE;
+    }
+    if (Settings->RumbleGain > 255) {
+        Settings->RumbleGain = defaults.RumbleGain;
+        valid = FALSE;
+    }
+    if (Settings->RumbleFlags & ~NVSHIELD_RUMBLE_FLAGS) {
+        Settings->RumbleFlags = defaults.RumbleFlags;
+        valid = FALSE;
+    }
+    if (Settings->Calibrate > 1) {
+        Settings->Calibrate = defaults.Calibrate;
+        valid = FALSE;
+    }
+    if (Settings->InputKeepAlive > NVSHIELD_INPUT_KEEPALIVE_MAX) {
+        Settings->InputKeepAlive = defaults.InputKeepAlive;
+        valid = FALSE;
+    }
+
+    return valid;
+}
+
+static VOID
+trackpadCurve(
+    SHORT* Curve,
+    LONG Scale
+)
+{
+    LONG delta;
+
+    // Scaled, then squared keeping the sign, so that slow strokes stay
+    // precise; saturates where the square no longer fits
+    for (delta = -255; delta <= 255; delta++) {
+        LONG motion = delta * Scale;
+        LONG square = (motion > 0 ? motion : -motion) * motion;
+
+        if (square > 32767)
+            square = 32767;
+        else if (square < -32767)
+            square = -32767;
+
+        Curve[delta + 255] = (SHORT)square;
+    }
+}
+
+static VOID
+calibrationTable(
+    PUSHORT Table,
+    const NVSHIELD_AXIS_CALIBRATION* Axis
+)
+{
+    ULONG knot, x, y;
+
+    // Min to Center onto 0 to 0x8000, Center to Max onto 0x8000 to 0xFFFF,
+    // and flat past them
+    for (knot = 0; knot < NVSHIELD_CALIBRATION_KNOTS; knot++) {
+        x = knot << 8;
+
+        if (x <= Axis->Min)
+            y = 0;
+        else if (x <= Axis->Center)
+            y = 0x8000 - (Axis->Center - x) * 0x8000 / (Axis->Center - Axis->Min);
+        else if (x < Axis->Max)
+            y = 0x8000 + (x - Axis->Center) * 0x7FFF / (Axis->Max - Axis->Center);
+        else
+            y = 0xFFFF;
+
+        Table[knot] = (USHORT)y;
+    }
+}
+
+VOID
+NvShieldCompileConfig(
+    PNVSHIELD_CONFIG Config,
+    const NVSHIELD_MODEL* Model,
+    const NVSHIELD_SETTINGS* Settings,
+    const NVSHIELD_AXIS_CALIBRATION* Calibration
+)
+/*++
+
+Routine Description:
+
+    Builds the snapshot of Settings, which NvShieldCheckSettings has
+    passed, for a controller of model Model.
+
+Arguments:
+
+    Calibration - NVSHIELD_CALIBRATION_AXES entries the tables of the
+        sticks are built from, as NvShieldTakeCalibration gave them; only
+        read with the Calibrate setting on.
+
+--*/
+{
+    ULONG bit, button = NVSHIELD_VOLUME_UP;
+    ULONG axis;
+
+    trackpadCurve(Config->TrackpadX, (LONG)Settings->TrackpadScaleX);
+    trackpadCurve(Config->TrackpadY, (LONG)Settings->TrackpadScaleY);
+
+    // The volume buttons of the model, lowest bit first, are up then down
+    Config->ConsumerMask = 0;
+    for (bit = 0x01; bit <= 0x80; bit <<= 1) {
+        if (!(Model->ConsumerMask & bit))
+            continue;
+        if (Settings->VolumeButtons & button)
+            Config->ConsumerMask |= (UCHAR)bit;
+        button <<= 1;
+    }
+
+    Config->RumbleGain = (UCHAR)Settings->RumbleGain;
+    Config->RumbleFlags = (UCHAR)Settings->RumbleFlags;
+
+    Config->InputKeepAlive = (USHORT)Settings->InputKeepAlive;
+
+    Config->Calibrate = (UCHAR)Settings->Calibrate;
+    if (Config->Calibrate) {
+        for (axis = 0; axis < NVSHIELD_CALIBRATION_AXES; axis++)
+            calibrationTable(Config->Sticks[axis], &Calibration[axis]);
+    }
+}
+
+BOOLEAN
+NvShieldLoadCalibration(
+    PNVSHIELD_STATE State,
+    const NVSHIELD_AXIS_CALIBRATION* Calibration
+)
+/*++
+
+Routine Description:
+
+    Starts the estimate of the sticks from Calibration, which
+    NvShieldTakeCalibration gave, typically in an earlier session, and
+    takes it as the one the tables come from.
+
+Return Value:
+
+    FALSE, and nothing changes, if an axis of Calibration doesn't hold
+    together.
+
+--*/
+{
+    ULONG axis;
+
+    for (axis = 0; axis < NVSHIELD_CALIBRATION_AXES; axis++) {
+        const NVSHIELD_AXIS_CALIBRATION* entry = &Calibration[axis];
+
+        if (entry->Center < 0x8000 - NVSHIELD_CALIBRATION_REST
+            || entry->Center > 0x8000 + NVSHIELD_CALIBRATION_REST
+            || entry->Min > 0x8000 - NVSHIELD_CALIBRATION_REACH
+            || entry->Max < 0x8000 + NVSHIELD_CALIBRATION_REACH)
+            return FALSE;
+    }
+
+    for (axis = 0; axis < NVSHIELD_CALIBRATION_AXES; axis++) {
+        State->calibration[axis] = Calibration[axis];
+        State->calibrationCenter[axis] = (ULONG)Calibration[axis].Center << 8;
+        State->calibrationMin[axis] = Calibration[axis].Min;
+        State->calibrationMax[axis] = Calibration[axis].Max;
+    }
+
+    return TRUE;
+}
+
+VOID
+NvShieldTakeCalibration(
+    PNVSHIELD_STATE State,
+    PNVSHIELD_AXIS_CALIBRATION Calibration
+)
+/*++
+
+Routine Description:
+
+    Copies the current estimate of the sticks to Calibration,
+    NVSHIELD_CALIBRATION_AXES entries, for new tables to be built from,
+    and takes it as the one they come from. The Calibrate stage may run
+    meanwhile: an axis it moves on in between is only rebuilt later.
+
+--*/
+{
+    ULONG axis;
+
+    for (axis = 0; axis < NVSHIELD_CALIBRATION_AXES; axis++) {
+        Calibration[axis].Center = (USHORT)((State->calibrationCenter[axis] + 0x80) >> 8);
+        Calibration[axis].Min = State->calibrationMin[axis];
+        Calibration[axis].Max = State->calibrationMax[axis];
+
+        State->calibration[axis] = Calibration[axis];
+    }
+}
+
+ULONG
+NvShieldTransformInputReport(
+    PNVSHIELD_STATE State,
+    PUCHAR Buffer,
+    ULONG Length
+)
+/*++
+
+Routine Description:
+
+    Rewrites an input report in place. Length may run past the end of the
+    report, as in a transfer padded to the endpoint's packet size.
+
+    The rewrite is looked up by report ID in State->inputHandlers, so
+    reports nothing is done to cost one load and one test whatever the
+    number of rewrites.
+
+Return Value:
+
+    The new length of the report.
+
+--*/
+{
+    PNVSHIELD_INPUT_HANDLER handler;
+
+    if (Buffer == NULL || Length < 2)
+        return Length;
+
+    handler = State->inputHandlers[Buffer[0]];
+    if (handler == NULL)
+        return Length;
+
+    return handler(State, Buffer, Length);
+}
+
+ULONG
+NvShieldTransformInputTransfer(
+    PNVSHIELD_STATE State,
+    const NVSHIELD_REPORT_SIZES* Sizes,
+    PUCHAR Buffer,
+    ULONG Length,
+    PNVSHIELD_INPUT_PIPELINE Pipeline,
+    PVOID Context
+)
+/*++
+
+Routine Description:
+
+    Rewrites every input report of an interrupt IN transfer in place,
+    walking it by the report lengths of NvShieldGetInputReportSizes, and
+    closes the gap a report that got shorter leaves behind. A zero where
+    the next report ID would be is padding and ends the walk.
+
+    A report ID Sizes doesn't have, or a report cut off by the end of the
+    transfer, also ends it and is counted: the rest of the transfer goes
+    up untouched, since there is no telling where its reports start.
+    Reports the controller sends with another ID than they are presented
+    with get it replaced.
+
+    Without Sizes, the whole transfer is taken as one report.
+
+Arguments:
+
+    Pipeline - runs each report through the stages of the transport, the
+        last of which rewrites it, see NVSHIELD_INPUT_STAGES. Without
+        one, the reports are only rewritten.
+
+Return Value:
+
+    The new length of the transfer.
+
+--*/
+{
+    PNVSHIELD_INPUT_HANDLER handler;
+    ULONG offset = 0, size, newSize;
+
+    if (Buffer == NULL)
+        return Length;
+
+    if (Sizes == NULL) {
+        return Pipeline != NULL ? Pipeline(Context, Buffer, Length)
+            : NvShieldTransformInputReport(State, Buffer, Length);
+    }
+
+    while (offset < Length) {
+        UCHAR id = Buffer[offset];
+
+        if (id == 0 && offset != 0)
+            break;
+
+        size = Sizes->Input[id];
+        if (size == 0) {
+            State->inputMismatched++;
+            break;
+        }
+        if (size > Length - offset) {
+            State->inputShort++;
+            break;
+        }
+
+        id = Sizes->InputId[id];
+        Buffer[offset] = id;
+
+        if (Pipeline != NULL) {
+            newSize = Pipeline(Context, Buffer + offset, size);
+        }
+        else {
+            handler = State->inputHandlers[id];
+            if (handler == NULL) {
+                offset += size;
+                continue;
+            }
+
+            newSize = handler(State, Buffer + offset, size);
+        }
+        if (newSize < size) {
+            RtlMoveMemory(Buffer + offset + newSize, Buffer + offset + size,
+                Length - offset - size);
+            Length -= size - newSize;
+        }
+
+        offset += newSize;
+    }
+
+    return Length;
+}
+
+BOOLEAN
+NvShieldInputUnchanged(
+    PNVSHIELD_STATE State,
+    const UCHAR* Buffer,
+    ULONG Length,
+    ULONGLONG Now
+)
+/*++
+
+Routine Description:
+
+    Tells whether an interrupt IN transfer, as rewritten, can be held back
+    rather than go up: with the InputKeepAlive setting on, when it is one
+    gamepad report of NVSHIELD_INPUT_REPORT_SIZE bytes identical to the
+    last one let through, and that one went up less than InputKeepAlive
+    ms before Now. Every change goes up with the transfer carrying it.
+    Otherwise the report, if it is a gamepad one, becomes the last one let
+    through, setting or not, so that turning it on compares against what
+    the readers really saw last.
+
+    The transfers of the interrupt IN pipe complete in order, one at a
+    time, so this isn't locked.
+
+--*/
+{
+    const NVSHIELD_CONFIG* config = State->config;
+    ULONGLONG low, high;
+
+    if (Buffer == NULL || Length != NVSHIELD_INPUT_REPORT_SIZE
+        || Buffer[0] != State->model->GamepadReportId)
+        return FALSE;
+
+    // Two 64 bit compares, the buffer may not be aligned
+    RtlCopyMemory(&low, Buffer, sizeof(low));
+    RtlCopyMemory(&high, Buffer + sizeof(low), sizeof(high));
+
+    if (config->InputKeepAlive != 0
+        && ((low ^ State->lastInput[0]) | (high ^ State->lastInput[1])) == 0
+        && Now - State->lastInputTime < config->InputKeepAlive) {
+        State->inputSuppressed++;
+        return TRUE;
+    }
+
+    State->lastInput[0] = low;
+    State->lastInput[1] = high;
+    State->lastInputTime = Now;
+
+    return FALSE;
+}
+
+BOOLEAN
+NvShieldGetReport(
+    PNVSHIELD_STATE State,
+    USHORT Value,
+    PUCHAR Buffer,
+    ULONG Length
+)
+/*++
+
+Routine Description:
+
+    Answers the GET_REPORT requests of the emulated PID device.
+
+Return Value:
+
+    TRUE if Buffer was filled in, FALSE if the request is for the device.
+
+--*/
+{
+    PUCHAR buf = Buffer;
+
+    if (buf == NULL || Length < NVSHIELD_PID_GET_REPORT_SIZE)
+        return FALSE;
+
+    if (Value == 0x0303)
+    {
+        buf[0] = 0x03; // Report ID
+        buf[1] = 1;
+        buf[2] = 1; // doesn't seem rational to me, but that's what gc_n64_usb does
+        buf[3] = NVSHIELD_MAX_EFFECTS; // simultaneous effects
+        buf[4] = 1;
+        return TRUE;
+    }
+    else if (Value == 0x0320) // Block Load Status
+    {
+        buf[0] = 0x20; // Report ID
+        buf[1] = State->loadedBlock;
+        buf[2] = State->loadedBlock != 0 ? 1 /* success */ : 2 /* full */;
+        buf[3] = 10;
+        buf[4] = 10;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+//
+// Smallest SET_REPORT payload, report ID included, that the emulation
+// reads from. Anything shorter never reaches the decoder below.
+//
+static ULONG
+pidReportMinLength(
+    USHORT Value
+)
+{
+    switch (Value)
+    {
+    case 0x020C: // Device control
+    case 0x020D: // Device gain
+        return 2;
+    case 0x020A: // Effect operation
+    case 0x020B: // Block free
+    case 0x0309: // Create new effect
+        return 2;
+    case 0x0204: // Set periodic
+    case 0x0206: // Set ramp force
+    case 0x0208: // Download force sample
+    case 0x020E: // Set custom force
+    case 0x0221: // Set effect
+        return 3;
+    case 0x0205: // Set constant force
+    case 0x0207: // Set custom force data
+        return 4;
+    case 0x0203: // Set condition
+        return 9;
+    default:
+        return 1;
+    }
+}
+
+static PNVSHIELD_EFFECT
+effectBlock(
+    PNVSHIELD_STATE State,
+    ULONG BlockIndex
+)
+{
+    // Only the blocks Create New Effect handed out
+    if (BlockIndex == 0 || BlockIndex > NVSHIELD_MAX_EFFECTS
+        || State->effects[BlockIndex - 1].type == NvShieldEffectNone)
+        return NULL;
+
+    return &State->effects[BlockIndex - 1];
+}
+
+static VOID
+stopEffects(
+    PNVSHIELD_STATE State,
+    PNVSHIELD_EFFECT Except
+)
+{
+    ULONG i;
+
+    for (i = 0; i < NVSHIELD_MAX_EFFECTS; i++) {
+        if (&State->effects[i] != Except)
+            State->effects[i].isPlaying = FALSE;
+    }
+}
+
+static NVSHIELD_PID_ACTION
+effectMagnitude(
+    PNVSHIELD_STATE State,
+    ULONG BlockIndex,
+    LONG Magnitude
+)
+{
+    PNVSHIELD_EFFECT effect = effectBlock(State, BlockIndex);
+
+    if (effect == NULL)
+        return NvShieldPidComplete;
+
+    // The fields are wider than the logical range games are told about
+    if (Magnitude > NVSHIELD_EFFECT_MAGNITUDE_MAX)
+        Magnitude = NVSHIELD_EFFECT_MAGNITUDE_MAX;
+    else if (Magnitude < -NVSHIELD_EFFECT_MAGNITUDE_MAX)
+        Magnitude = -NVSHIELD_EFFECT_MAGNITUDE_MAX;
+
+    effect->magnitude = (SHORT)Magnitude;
+
+    // Those of an effect not playing are for its next start
+    return effect->isPlaying ? NvShieldPidUpdateRumble : NvShieldPidComplete;
+}
+
+static SHORT
+customSample(
+    const NVSHIELD_STATE* State,
+    const NVSHIELD_EFFECT* Effect,
+    ULONG Step
+)
+{
+    // Samples are -127 to 127, played like the ends of a ramp
+    if (Effect->sampleCount == 0)
+        return 0;
+
+    return (SHORT)(State->customSamples[Effect - State->effects][Step % Effect->sampleCount] * 2);
+}
+
+NVSHIELD_PID_ACTION
+NvShieldSetReport(
+    PNVSHIELD_STATE State,
+    USHORT Value,
+    const UCHAR* Buffer,
+    ULONG Length
+)
+{
+    const UCHAR* buf = Buffer;
+
+    if (buf == NULL || Length < pidReportMinLength(Value))
+        return NvShieldPidInvalid;
+
+    if (Value == 0x020C) // Device control
+    {
+        switch (buf[1]) {
+            case 0x01: // Enable actuators
+            case 0x02: // Disable actuators
+                State->isActuatorEnabled = (buf[1] == 0x01);
+                return NvShieldPidUpdateRumble;
+            case 0x03: // Stop all effects
+                stopEffects(State, NULL);
+                return NvShieldPidUpdateRumble;
+            case 0x04: // Device reset
+                RtlZeroMemory(State->effects, sizeof(State->effects));
+                State->customBlock = 0;
+                State->isActuatorEnabled = TRUE;
+                State->isPaused = FALSE;
+                return NvShieldPidUpdateRumble;
+            case 0x05: // Pause
+            case 0x06: // Continue
+                State->isPaused = (buf[1] == 0x05);
+                return NvShieldPidUpdateRumble;
+            default:
+                break;
+        }
+    }
+    else if (Value == 0x020D) // Device gain
+    {
+        State->rumbleGain = (USHORT)buf[1];
+        return NvShieldPidUpdateRumble;
+    }
+    else if (Value == 0x0309) // Create new effect
+    {
+        /* Byte 0 : report ID
+        * Byte 1 : effect type, as numbered by the descriptor presented */
+        UCHAR type = buf[1] < NvShieldEffectTypeCount ? State->effectTypes[buf[1]] : NvShieldEffectNone;
+        ULONG i;
+
+        State->loadedBlock = 0;
+
+        if (type == NvShieldEffectNone)
+            return NvShieldPidComplete;
+
+        for (i = 0; i < NVSHIELD_MAX_EFFECTS; i++) {
+            if (State->effects[i].type == NvShieldEffectNone) {
+                RtlZeroMemory(&State->effects[i], sizeof(State->effects[i]));
+                State->effects[i].type = type;
+                State->effects[i].gain = 255;
+                State->loadedBlock = (UCHAR)(i + 1);
+
+                // Set Effect may turn any of them into a custom force
+                RtlZeroMemory(State->customSamples[i], sizeof(State->customSamples[i]));
+                if (type == NvShieldEffectCustom)
+                    State->customBlock = State->loadedBlock;
+                break;
+            }
+        }
+        return NvShieldPidComplete;
+    }
+    else if (Value == 0x020B) // Block free
+    {
+        PNVSHIELD_EFFECT effect = effectBlock(State, buf[1]);
+        BOOLEAN wasPlaying;
+
+        if (effect == NULL)
+            return NvShieldPidComplete;
+
+        wasPlaying = effect->isPlaying;
+        RtlZeroMemory(effect, sizeof(*effect));
+        if (State->customBlock == buf[1])
+            State->customBlock = 0;
+
+        return wasPlaying ? NvShieldPidUpdateRumble : NvShieldPidComplete;
+    }
+    else if (Value == 0x0203) // Set condition
+    {
+        /* Byte 0 : report ID
+        * Byte 1 : effect block index
+        * Byte 2 : bits 0-3 parameter block offset, the axis; bits 4-7
+        * type specific block offsets
+        * Byte 3 : center point offset, -127 to 127
+        * Byte 4-5 : positive and negative coefficients, -127 to 127
+        * Byte 6-7 : positive and negative saturations, 0 to 255
+        * Byte 8 : dead band, 0 to 255 */
+        PNVSHIELD_EFFECT effect = effectBlock(State, buf[1]);
+        PNVSHIELD_CONDITION condition;
+
+        if (effect == NULL || (buf[2] & 0x0F) >= NVSHIELD_CONDITION_AXES)
+            return NvShieldPidComplete;
+
+        condition = &effect->conditions[buf[2] & 0x0F];
+        condition->centerOffset = (signed char)buf[3];
+        condition->positiveCoefficient = (signed char)buf[4];
+        condition->negativeCoefficient = (signed char)buf[5];
+        condition->positiveSaturation = buf[6];
+        condition->negativeSaturation = buf[7];
+        condition->deadBand = buf[8];
+
+        // Played from the next input report on
+        return NvShieldPidComplete;
+    }
+    else if (Value == 0x0205) // Set constant force
+    {
+        /* Byte 0 : report ID
+        * Byte 1 : effect block index
+        * Byte 2-3 : magnitude, -255 to 255 */
+        return effectMagnitude(State, buf[1], (SHORT)(buf[2] | (buf[3] << 8)));
+    }
+    else if (Value == 0x0204) // Set periodic
+    {
+        /* Byte 0 : report ID
+        * Byte 1 : effect block index
+        * Byte 2 : magnitude, 0 to 255
+        * Byte 3-6 : offset, phase and period, which the motors can't play */
+        return effectMagnitude(State, buf[1], buf[2]);
+    }
+    else if (Value == 0x0206) // Set ramp force
+    {
+        /* Byte 0 : report ID
+        * Byte 1 : effect block index
+        * Byte 2 : ramp start, byte 3 : ramp end, -128 to 127; played at
+        * the stronger end */
+        LONG start = (signed char)buf[2];
+        LONG end = Length >= 4 ? (signed char)buf[3] : 0;
+        LONG level = (start < 0 ? -start : start) > (end < 0 ? -end : end) ? start : end;
+
+        return effectMagnitude(State, buf[1], level * 2);
+    }
+    else if (Value == 0x0207) // Set custom force data
+    {
+        /* Byte 0 : report ID
+        * Byte 1 : effect block index
+        * Byte 2-3 : offset of the first sample in the effect's data
+        * Byte 4-15 : samples, -127 to 127; those past the slice of the
+        * block are dropped */
+        PNVSHIELD_EFFECT effect = effectBlock(State, buf[1]);
+        ULONG offset = buf[2] | (buf[3] << 8);
+        ULONG i;
+
+        if (effect == NULL)
+            return NvShieldPidComplete;
+
+        State->customBlock = buf[1];
+
+        for (i = 4; i < Length && offset < NVSHIELD_CUSTOM_SAMPLES; i++, offset++)
+            State->customSamples[buf[1] - 1][offset] = (signed char)buf[i];
+
+        // Set custom force may still cut the effect shorter
+        if (offset > effect->sampleCount)
+            effect->sampleCount = (USHORT)offset;
+
+        return NvShieldPidComplete;
+    }
+    else if (Value == 0x0208) // Download force sample
+    {
+        /* Byte 0 : report ID
+        * Byte 1 : X, byte 2 : Y, -127 to 127; appended to the effect the
+        * last custom force report was for, as a single channel played
+        * through its direction */
+        PNVSHIELD_EFFECT effect = effectBlock(State, State->customBlock);
+        LONG x = (signed char)buf[1];
+        LONG y = (signed char)buf[2];
+
+        if (effect == NULL || effect->sampleCount >= NVSHIELD_CUSTOM_SAMPLES)
+            return NvShieldPidComplete;
+
+        State->customSamples[State->customBlock - 1][effect->sampleCount++] =
+            (signed char)((x < 0 ? -x : x) > (y < 0 ? -y : y) ? x : y);
+
+        return NvShieldPidComplete;
+    }
+    else if (Value == 0x020E) // Set custom force
+    {
+        /* Byte 0 : report ID
+        * Byte 1 : effect block index
+        * Byte 2 : sample count
+        * Byte 3-4 : sample period in ms */
+        PNVSHIELD_EFFECT effect = effectBlock(State, buf[1]);
+
+        if (effect == NULL)
+            return NvShieldPidComplete;
+
+        State->customBlock = buf[1];
+        effect->sampleCount = buf[2];
+        if (Length >= 5)
+            effect->samplePeriod = (USHORT)(buf[3] | (buf[4] << 8));
+
+        return NvShieldPidComplete;
+    }
+    else if (Value == 0x0221) // Set effect
+    {
+        /* Byte 0 : report ID
+        * Byte 1 : effect block index
+        * Byte 2 : effect type
+        * Byte 3-4 : duration in ms, the logical maximum or above for infinite
+        * Byte 5-8 : trigger repeat interval and sample period
+        * Byte 9 : gain
+        * Byte 10 : trigger button
+        * Byte 11 : bits 0-1 axes enable, bit 2 direction enable
+        * Byte 12 : direction, 0-255 for a full turn */
+        PNVSHIELD_EFFECT effect = effectBlock(State, buf[1]);
+
+        if (effect == NULL)
+            return NvShieldPidComplete;
+
+        if (buf[2] < NvShieldEffectTypeCount && State->effectTypes[buf[2]] != NvShieldEffectNone)
+            effect->type = State->effectTypes[buf[2]];
+
+        if (Length >= 5) {
+            USHORT duration = (USHORT)(buf[3] | (buf[4] << 8));
+
+            effect->duration = duration < 0x7FFF ? duration : 0;
+        }
+        if (Length >= 9 && (buf[7] | buf[8]) != 0)
+            effect->samplePeriod = (USHORT)(buf[7] | (buf[8] << 8));
+        if (Length >= 10)
+            effect->gain = buf[9];
+        if (Length >= 12)
+            effect->axes = buf[11] & (NVSHIELD_EFFECT_AXIS_X | NVSHIELD_EFFECT_AXIS_Y | NVSHIELD_EFFECT_POLAR);
+        if (Length >= 13)
+            effect->direction = buf[12];
+
+        return effect->isPlaying ? NvShieldPidUpdateRumble : NvShieldPidComplete;
+    }
+    else if (Value == 0x020A) // Effect operation
+    {
+        /* Byte 0 : report ID
+        * Byte 1 : bit 7=rom flag, bits 6-0=effect block index
+        * Byte 2 : Effect operation
+        * Byte 3 : Loop count */
+
+#define EFFECT_OP_START			1
+#define EFFECT_OP_START_SOLO	2
+#define EFFECT_OP_STOP			3
+
+        PNVSHIELD_EFFECT effect = effectBlock(State, buf[1] & 0x7F);
+
+        if (effect == NULL)
+            return NvShieldPidComplete;
+
+        switch (buf[2]) // effect operation
+        {
+        case EFFECT_OP_START_SOLO:
+            stopEffects(State, effect);
+            // fall through
+        case EFFECT_OP_START:
+            {
+                UCHAR loops = Length >= 4 && buf[3] != 0 ? buf[3] : 1;
+
+                effect->isPlaying = TRUE;
+                effect->isStarted = TRUE;
+                effect->playDuration = loops == 0xFF ? 0 : effect->duration * loops;
+
+                // From its first sample, NvShieldEffectTick plays the rest
+                if (effect->type == NvShieldEffectCustom) {
+                    effect->startTime = 0;
+                    effect->sampleStep = 0;
+                    effect->magnitude = customSample(State, effect, 0);
+                }
+
+                // Silent until the next input report
+                if (effect->type >= NvShieldEffectSpring && effect->type <= NvShieldEffectFriction)
+                    effect->magnitude = 0;
+            }
+            return NvShieldPidUpdateRumble;
+
+        case EFFECT_OP_STOP:
+            effect->isPlaying = FALSE;
+            return NvShieldPidUpdateRumble;
+        }
+
+        return NvShieldPidComplete;
+    }
+
+    return NvShieldPidForward;
+}
+
+BOOLEAN
+NvShieldPatchHidDescriptor(
+    PUCHAR Buffer,
+    ULONG Length,
+    ULONG ReportDescriptorLength
+)
+/*++
+
+Routine Description:
+
+    Makes the first HID descriptor embedded in the configuration
+    descriptor announce ReportDescriptorLength bytes of Report Descriptor.
+    On the 2015 controller it sits at NVSHIELD_HID_DESCRIPTOR_OFFSET.
+
+Return Value:
+
+    FALSE if Buffer doesn't hold a HID descriptor.
+
+--*/
+{
+    PUCHAR hid;
+    ULONG offset = 0;
+
+    if (Buffer == NULL || ReportDescriptorLength > 0xFFFF)
+        return FALSE;
+
+    // Descriptors running past Length are left alone
+    while (offset + 2 <= Length && Buffer[offset] >= 2) {
+        hid = Buffer + offset;
+
+        if (hid[1] == 0x21 /* HID */) {
+            if (hid[0] < 9 || offset + 9 > Length || hid[6] != 0x22 /* Report */)
+                return FALSE;
+
+            hid[8] = (UCHAR)(ReportDescriptorLength >> 8); // already translated to big endian by the bus driver (FIXME little endian)
+            hid[7] = (UCHAR)(ReportDescriptorLength & 0xFF);
+            return TRUE;
+        }
+
+        offset += hid[0];
+    }
+
+    return FALSE;
+}
+
+//
+// How long a GET_REPORT answer stays valid, per report. Input reports are
+// live state and never cached.
+//
+static const struct {
+    USHORT Value;
+    ULONG TtlMs;
+} reportCachePolicy[] = {
+    { 0x03FC, 1000 },   // vendor feature report, static while connected
+};
+
+#define REPORT_CACHE_DEFAULT_FEATURE_TTL_MS     100
+
+static ULONG
+reportCacheTtl(
+    USHORT Value
+)
+{
+    ULONG i;
+
+    for (i = 0; i < sizeof(reportCachePolicy) / sizeof(reportCachePolicy[0]); i++)
+        if (reportCachePolicy[i].Value == Value)
+            return reportCachePolicy[i].TtlMs;
+
+    return (Value >> 8) == 0x03 /* Feature */ ? REPORT_CACHE_DEFAULT_FEATURE_TTL_MS : 0;
+}
+
+VOID
+NvShieldReportCacheInit(
+    PNVSHIELD_REPORT_CACHE Cache
+)
+{
+    RtlZeroMemory(Cache, sizeof(*Cache));
+}
+
+BOOLEAN
+NvShieldReportCacheLookup(
+    PNVSHIELD_REPORT_CACHE Cache,
+    USHORT Value,
+    PUCHAR Buffer,
+    PULONG Length,
+    ULONGLONG Now
+)
+/*++
+
+Routine Description:
+
+    Copies the cached answer to GET_REPORT Value into Buffer, which holds
+    *Length bytes.
+
+Return Value:
+
+    TRUE and the answer's length in *Length on a hit.
+
+--*/
+{
+    ULONG i;
+
+    if (Buffer == NULL || Value == 0)
+        return FALSE;
+
+    for (i = 0; i < NVSHIELD_REPORT_CACHE_ENTRIES; i++) {
+        PNVSHIELD_REPORT_CACHE_ENTRY entry = &Cache->Entries[i];
+
+        if (entry->Value != Value)
+            continue;
+
+        if (Now >= entry->Expires) {
+            entry->Value = 0;
+            break;
+        }
+
+        if (*Length < entry->Length)
+            break;
+
+        RtlCopyMemory(Buffer, entry->Data, entry->Length);
+        *Length = entry->Length;
+        Cache->Hits++;
+        return TRUE;
+    }
+
+    Cache->Misses++;
+    return FALSE;
+}
+
+VOID
+NvShieldReportCacheStore(
+    PNVSHIELD_REPORT_CACHE Cache,
+    USHORT Value,
+    const UCHAR* Buffer,
+    ULONG Length,
+    ULONGLONG Now
+)
+/*++
+
+Routine Description:
+
+    Remembers the device's answer to GET_REPORT Value, if its policy allows
+    caching it. Replaces the entry of the same report, else the free one
+    or the one that expires first.
+
+--*/
+{
+    PNVSHIELD_REPORT_CACHE_ENTRY victim = NULL;
+    ULONGLONG victimExpires = 0;
+    ULONG ttl = reportCacheTtl(Value);
+    ULONG i;
+
+    if (ttl == 0 || Buffer == NULL || Length == 0 || Length > NVSHIELD_REPORT_CACHE_DATA_SIZE)
+        return;
+
+    for (i = 0; i < NVSHIELD_REPORT_CACHE_ENTRIES; i++) {
+        PNVSHIELD_REPORT_CACHE_ENTRY entry = &Cache->Entries[i];
+        ULONGLONG expires = entry->Value == 0 ? 0 : entry->Expires;
+
+        if (entry->Value == Value) {
+            victim = entry;
+            break;
+        }
+
+        if (victim == NULL || expires < victimExpires) {
+            victim = entry;
+            victimExpires = expires;
+        }
+    }
+
+    victim->Value = Value;
+    victim->Length = (USHORT)Length;
+    victim->Expires = Now + ttl;
+    RtlCopyMemory(victim->Data, Buffer, Length);
+}
+
+VOID
+NvShieldReportCacheInvalidate(
+    PNVSHIELD_REPORT_CACHE Cache,
+    USHORT Value
+)
+/*++
+
+Routine Description:
+
+    Called for every SET_REPORT Value. Setting a report drops the cached
+    answers for the same report ID, and a PID device reset drops them all.
+    Value 0 drops them all too: the transport passes it for SET_REPORTs
+    that reach the device, whose side effects are unknown.
+
+--*/
+{
+    ULONG i;
+
+    for (i = 0; i < NVSHIELD_REPORT_CACHE_ENTRIES; i++) {
+        PNVSHIELD_REPORT_CACHE_ENTRY entry = &Cache->Entries[i];
+
+        if (Value == 0 || Value == 0x020C
+            || (entry->Value & 0xFF) == (Value & 0xFF))
+            entry->Value = 0;
+    }
+}
+
+VOID
+NvShieldLatencyRecord(
+    PNVSHIELD_LATENCY_HISTOGRAM Histogram,
+    ULONGLONG Microseconds
+)
+/*++
+
+Routine Description:
+
+    Counts a latency in its bucket, see NVSHIELD_LATENCY_HISTOGRAM. Safe
+    against other processors recording in the same histogram.
+
+--*/
+{
+    ULONG shift = 0;
+
+    if (Microseconds >= (1ULL << NVSHIELD_LATENCY_BITS))
+        Microseconds = (1ULL << NVSHIELD_LATENCY_BITS) - 1;
+
+    // Down to the NVSHIELD_LATENCY_SUB_BITS + 1 bits kept, the top one set
+    while ((Microseconds >> shift) >= 2 * NVSHIELD_LATENCY_SUB_BUCKETS)
+        shift++;
+
+    InterlockedIncrement((volatile LONG*)&Histogram->Buckets[
+        shift * NVSHIELD_LATENCY_SUB_BUCKETS + (ULONG)(Microseconds >> shift)]);
+}
+
+static USHORT
+readField(
+    const UCHAR* Report,
+    ULONG Length,
+    NVSHIELD_INPUT_FIELD Field
+)
+{
+    ULONG byte = Field.BitOffset >> 3;
+    ULONG shift = Field.BitOffset & 7;
+    ULONG value = 0, i;
+
+    if (Field.BitSize == 0)
+        return 0;
+
+    // At most 16 bits, spread over up to 3 bytes
+    for (i = 0; i < 3 && byte + i < Length && i * 8 < shift + Field.BitSize; i++)
+        value |= (ULONG)Report[byte + i] << (8 * i);
+
+    return (USHORT)((value >> shift) & ((1UL << Field.BitSize) - 1));
+}
+
+BOOLEAN
+NvShieldDecodeInputReport(
+    const NVSHIELD_INPUT_LAYOUT* Layout,
+    const UCHAR* Report,
+    ULONG Length,
+    PNVSHIELD_GAMEPAD_STATE State
+)
+/*++
+
+Routine Description:
+
+    Decodes a gamepad input report as laid out by NvShieldGetInputLayout.
+
+Return Value:
+
+    FALSE if the report isn't the one the layout describes.
+
+--*/
+{
+    ULONG i;
+
+    if (Report == NULL || Length < Layout->ReportSize || Report[0] != Layout->ReportId)
+        return FALSE;
+
+    State->Buttons = readField(Report, Length, Layout->Buttons);
+    State->Hat = (UCHAR)readField(Report, Length, Layout->Hat);
+    State->Consumer = (UCHAR)readField(Report, Length, Layout->Consumer);
+    for (i = 0; i < NvShieldAxisCount; i++)
+        State->Axes[i] = readField(Report, Length, Layout->Axes[i]);
+
+    return TRUE;
+}
+
+static VOID
+writeField(
+    PUCHAR Report,
+    ULONG Length,
+    NVSHIELD_INPUT_FIELD Field,
+    USHORT Value
+)
+{
+    ULONG byte = Field.BitOffset >> 3;
+    ULONG shift = Field.BitOffset & 7;
+    ULONG mask = ((1UL << Field.BitSize) - 1) << shift;
+    ULONG value = ((ULONG)Value << shift) & mask;
+    ULONG i;
+
+    // The bits of the field only, as readField finds them
+    for (i = 0; i < 3 && byte + i < Length && i * 8 < shift + Field.BitSize; i++) {
+        Report[byte + i] = (UCHAR)((Report[byte + i] & ~(mask >> (8 * i)))
+            | (value >> (8 * i)));
+    }
+}
+
+static __inline USHORT
+calibrationDistance(
+    USHORT A,
+    USHORT B
+)
+{
+    return A > B ? A - B : B - A;
+}
+
+BOOLEAN
+NvShieldCalibrateInput(
+    PNVSHIELD_STATE State,
+    PNVSHIELD_INPUT Input
+)
+/*++
+
+Routine Description:
+
+    The Calibrate stage of the input pipeline. Moves the estimate of each
+    stick axis on with the report: the resting position once the stick
+    has moved less than NVSHIELD_CALIBRATION_STILL between
+    NVSHIELD_CALIBRATION_SETTLE reports in a row within
+    NVSHIELD_CALIBRATION_REST of the center, by a 32nd of the way each
+    report, and the furthest positions every report. Then corrects the
+    axes through the tables of the snapshot, in the report and in its
+    decoded controls alike, so that the later stages read them corrected.
+
+    Does nothing unless the Calibrate setting is on.
+
+Return Value:
+
+    TRUE if the estimate of an axis moved NVSHIELD_CALIBRATION_THRESHOLD
+    away from the one the tables come from, for the transport to rebuild
+    them, see NvShieldTakeCalibration.
+
+--*/
+{
+    const NVSHIELD_CONFIG* config = State->config;
+    const NVSHIELD_INPUT_FIELD* fields = Input->Layout->Axes;
+    USHORT values[NVSHIELD_CALIBRATION_AXES];
+    const USHORT* table;
+    USHORT corrected;
+    BOOLEAN rebuild = FALSE;
+    ULONG axis, stick, knot;
+
+    if (!config->Calibrate || NvShieldInputGamepad(Input) == NULL)
+        return FALSE;
+
+    for (axis = 0; axis < NVSHIELD_CALIBRATION_AXES; axis++) {
+        values[axis] = fields[axis].BitSize != 0
+            ? (USHORT)(Input->Gamepad.Axes[axis] << (16 - fields[axis].BitSize)) : 0x8000;
+    }
+
+    // Both axes of a stick have to be still and near the center
+    for (stick = 0; stick < NVSHIELD_CALIBRATION_AXES / 2; stick++) {
+        ULONG x = 2 * stick, y = 2 * stick + 1;
+
+        if (calibrationDistance(values[x], State->calibrationLast[x]) < NVSHIELD_CALIBRATION_STILL
+            && calibrationDistance(values[y], State->calibrationLast[y]) < NVSHIELD_CALIBRATION_STILL
+            && calibrationDistance(values[x], 0x8000) <= NVSHIELD_CALIBRATION_REST
+            && calibrationDistance(values[y], 0x8000) <= NVSHIELD_CALIBRATION_REST) {
+            if (State->calibrationStill[stick] < NVSHIELD_CALIBRATION_SETTLE)
+                State->calibrationStill[stick]++;
+        }
+        else {
+            State->calibrationStill[stick] = 0;
+        }
+    }
+
+    for (axis = 0; axis < NVSHIELD_CALIBRATION_AXES; axis++) {
+        const NVSHIELD_AXIS_CALIBRATION* built = &State->calibration[axis];
+        USHORT value = values[axis], center;
+
+        State->calibrationLast[axis] = value;
+
+        if (State->calibrationStill[axis / 2] >= NVSHIELD_CALIBRATION_SETTLE) {
+            LONG delta = ((LONG)value << 8) - (LONG)State->calibrationCenter[axis];
+
+            State->calibrationCenter[axis] += delta / 32;
+        }
+        if (value < State->calibrationMin[axis])
+            State->calibrationMin[axis] = value;
+        if (value > State->calibrationMax[axis])
+            State->calibrationMax[axis] = value;
+
+        center = (USHORT)((State->calibrationCenter[axis] + 0x80) >> 8);
+        if (calibrationDistance(center, built->Center) >= NVSHIELD_CALIBRATION_THRESHOLD
+            || built->Min - State->calibrationMin[axis] >= NVSHIELD_CALIBRATION_THRESHOLD
+            || State->calibrationMax[axis] - built->Max >= NVSHIELD_CALIBRATION_THRESHOLD)
+            rebuild = TRUE;
+
+        if (fields[axis].BitSize == 0)
+            continue;
+
+        // Interpolated between the two knots around the value
+        table = config->Sticks[axis];
+        knot = value >> 8;
+        corrected = (USHORT)(table[knot]
+            + ((ULONG)(table[knot + 1] - table[knot]) * (value & 0xFF) >> 8));
+
+        Input->Gamepad.Axes[axis] = (USHORT)(corrected >> (16 - fields[axis].BitSize));
+        writeField(Input->Report, Input->Length, fields[axis], Input->Gamepad.Axes[axis]);
+    }
+
+    return rebuild;
+}
+
+ULONG
+NvShieldPatchEndpointIntervals(
+    PUCHAR Buffer,
+    ULONG Length,
+    UCHAR Interval
+)
+/*++
+
+Routine Description:
+
+    Lowers the bInterval of the interrupt endpoints of a configuration
+    descriptor to Interval, so that the host polls them faster than the
+    device advertises. The value is in frames at full speed and in
+    2^(Interval-1) microframes at high speed, so 1 means 1 ms or 125 us.
+
+    Length may be shorter than wTotalLength, descriptors running past it
+    are left alone.
+
+Return Value:
+
+    Number of endpoints patched.
+
+--*/
+{
+    ULONG offset = 0, patched = 0;
+
+    if (Buffer == NULL || Interval == 0)
+        return 0;
+
+    while (offset + 2 <= Length) {
+        PUCHAR desc = Buffer + offset;
+        ULONG bLength = desc[0];
+
+        if (bLength < 2 || offset + bLength > Length)
+            break;
+
+        if (desc[1] == 0x05 /* Endpoint */ && bLength >= 7
+            && (desc[3] & 0x03) == 0x03 /* Interrupt */
+            && desc[6] > Interval) {
+            desc[6] = Interval;
+            patched++;
+        }
+
+        offset += bLength;
+    }
+
+    return patched;
+}
+
+//
+// Share of an effect pointing at a polar direction that goes to the left
+// motor, in 1/32768, for the directions from north to south through east:
+// 1 - sin(direction). Those from south to north through west go wholly to
+// the left motor, and the right motor mirrors the left one.
+//
+#define RUMBLE_PAN_ONE      32768
+
+C_ASSERT(NVSHIELD_MAX_EFFECTS * 255ULL * 255 * 255 <= 0xFFFFFFFF);
+
+static const USHORT G_RumblePan[65] = {
+    32768, 31964, 31160, 30357, 29556, 28757, 27960, 27166,
+    26375, 25588, 24806, 24028, 23256, 22489, 21729, 20975,
+    20228, 19489, 18758, 18035, 17321, 16617, 15922, 15237,
+    14563, 13900, 13248, 12608, 11980, 11365, 10762, 10173,
+     9598,  9036,  8489,  7956,  7438,  6935,  6448,  5977,
+     5522,  5084,  4662,  4257,  3869,  3499,  3146,  2811,
+     2494,  2196,  1915,  1654,  1411,  1187,   982,   796,
+      630,   482,   355,   246,   158,    89,    39,    10,
+        0,
+};
+
+static ULONG
+rumblePan(
+    UCHAR Direction
+)
+{
+    if (Direction >= 128)
+        return RUMBLE_PAN_ONE;
+
+    return G_RumblePan[Direction <= 64 ? Direction : 128 - Direction];
+}
+
+VOID
+NvShieldMixRumble(
+    const NVSHIELD_STATE* State,
+    PUSHORT Left,
+    PUSHORT Right
+)
+/*++
+
+Routine Description:
+
+    Sums the effects playing into the strength of each motor, 0-65535.
+
+    Each effect contributes |magnitude| * effect gain, up to 255 * 255, in
+    the share its direction gives each motor. With Direction Enable, the
+    polar direction pans between the motors, east being the right one and
+    a negative magnitude pointing the opposite way; without it, an effect
+    on the X axis drives the left motor and one on the Y axis the right
+    one, as on the gamepads games map axes to motors for. An effect with
+    neither, as Create New Effect leaves it, drives both. The sums are
+    scaled by the device gain, then by the RumbleGain setting, and
+    saturate at the motor's maximum, so that a full strength effect at
+    full gain plays at 65025. The RumbleFlags setting then applies.
+
+    Everything stays in 32 bits: an effect adds at most 255 * 255 to a
+    motor, NVSHIELD_MAX_EFFECTS of them times either gain fit.
+
+--*/
+{
+    const NVSHIELD_CONFIG* config = State->config;
+    ULONG left = 0, right = 0;
+    ULONG i;
+
+    if (State->isActuatorEnabled && !State->isPaused) {
+        for (i = 0; i < NVSHIELD_MAX_EFFECTS; i++) {
+            const NVSHIELD_EFFECT* effect = &State->effects[i];
+            LONG magnitude = effect->magnitude;
+            UCHAR direction = effect->direction;
+            ULONG level, panLeft, panRight;
+
+            if (!effect->isPlaying || magnitude == 0)
+                continue;
+
+            if (magnitude < 0) {
+                magnitude = -magnitude;
+                direction += 128;
+            }
+
+            level = (ULONG)magnitude * effect->gain;
+
+            if (effect->axes & NVSHIELD_EFFECT_POLAR) {
+                panLeft = rumblePan(direction);
+                panRight = rumblePan((UCHAR)(256 - direction));
+            } else if ((effect->axes & (NVSHIELD_EFFECT_AXIS_X | NVSHIELD_EFFECT_AXIS_Y)) == 0) {
+                panLeft = RUMBLE_PAN_ONE;
+                panRight = RUMBLE_PAN_ONE;
+            } else {
+                panLeft = effect->axes & NVSHIELD_EFFECT_AXIS_X ? RUMBLE_PAN_ONE : 0;
+                panRight = effect->axes & NVSHIELD_EFFECT_AXIS_Y ? RUMBLE_PAN_ONE : 0;
+            }
+
+            left += (level * panLeft) >> 15;
+            right += (level * panRight) >> 15;
+        }
+    }
+
+    left = left * State->rumbleGain / 255;
+    right = right * State->rumbleGain / 255;
+
+    left = left * config->RumbleGain / 255;
+    right = right * config->RumbleGain / 255;
+
+    if (config->RumbleFlags & NVSHIELD_RUMBLE_OFF) {
+        left = 0;
+        right = 0;
+    }
+    else if (config->RumbleFlags & NVSHIELD_RUMBLE_SWAP) {
+        ULONG swap = left;
+
+        left = right;
+        right = swap;
+    }
+
+    *Left = (USHORT)(left < 0xFFFF ? left : 0xFFFF);
+    *Right = (USHORT)(right < 0xFFFF ? right : 0xFFFF);
+}
+
+static VOID
+rumbleReport(
+    const NVSHIELD_STATE* State,
+    PUCHAR Report
+)
+{
+    const NVSHIELD_RUMBLE_FORMAT* format = &State->model->Rumble;
+    USHORT leftRumble, rightRumble;
+
+    NvShieldMixRumble(State, &leftRumble, &rightRumble);
+
+    RtlZeroMemory(Report, format->Size);
+    Report[0] = format->ReportId;
+    if (format->Command != 0)
+        Report[1] = format->Command;
+    if (format->UpdateOffset != 0)
+        Report[format->UpdateOffset] = 1;
+
+    if (format->MotorMax == 0) {
+        Report[format->LeftOffset] = leftRumble & 0xFF;
+        Report[format->LeftOffset + 1] = (leftRumble >> 8) & 0xFF;
+        Report[format->RightOffset] = rightRumble & 0xFF;
+        Report[format->RightOffset + 1] = (rightRumble >> 8) & 0xFF;
+    } else {
+        Report[format->LeftOffset] = (UCHAR)((ULONG)leftRumble * format->MotorMax / 0xFFFF);
+        Report[format->RightOffset] = (UCHAR)((ULONG)rightRumble * format->MotorMax / 0xFFFF);
+    }
+}
+
+static BOOLEAN
+rumbleChanged(
+    const NVSHIELD_STATE* State
+)
+{
+    UCHAR report[NVSHIELD_RUMBLE_REPORT_MAX];
+
+    rumbleReport(State, report);
+
+    return !RtlEqualMemory(report, State->lastRumbleReport, State->model->Rumble.Size);
+}
+
+BOOLEAN
+NvShieldBuildRumbleReport(
+    PNVSHIELD_STATE State,
+    PUCHAR Report
+)
+/*++
+
+Routine Description:
+
+    Translates the emulated motor state into the controller's own output
+    report, as laid out by the Rumble format of its model (Size bytes, up
+    to NVSHIELD_RUMBLE_REPORT_MAX). A report identical to the
+    last one let through is held back: the motors already run that way,
+    and some games send the same constant force every frame.
+
+Return Value:
+
+    FALSE if nothing needs to be sent to the device.
+
+--*/
+{
+    rumbleReport(State, Report);
+
+    if (RtlEqualMemory(Report, State->lastRumbleReport, State->model->Rumble.Size)) {
+        State->rumbleSuppressed++;
+        return FALSE;
+    }
+
+    RtlCopyMemory(State->lastRumbleReport, Report, State->model->Rumble.Size);
+    State->rumbleSent++;
+
+    return TRUE;
+}
+
+VOID
+NvShieldRumbleReportLost(
+    PNVSHIELD_STATE State
+)
+/*++
+
+Routine Description:
+
+    Called by the transport when a report NvShieldBuildRumbleReport let
+    through didn't reach the controller. Forgets it, so that the next
+    one is sent whatever it holds: the motors may still run the way an
+    earlier report had them, and the stop NvShieldRumbleExpire asks for
+    must not be held back as unchanged.
+
+--*/
+{
+    RtlZeroMemory(State->lastRumbleReport, sizeof(State->lastRumbleReport));
+    if (State->rumbleSent != 0)
+        State->rumbleSent--;
+}
+
+static BOOLEAN
+customPlaying(
+    const NVSHIELD_EFFECT* Effect
+)
+{
+    // Stamped by NvShieldRumbleExpiry, which runs after the start
+    return Effect->type == NvShieldEffectCustom && Effect->isPlaying
+        && Effect->sampleCount != 0 && Effect->startTime != 0;
+}
+
+static ULONG
+customPeriod(
+    const NVSHIELD_EFFECT* Effect
+)
+{
+    return Effect->samplePeriod != 0 ? Effect->samplePeriod : NVSHIELD_CUSTOM_PERIOD_MS;
+}
+
+static BOOLEAN
+conditionPlaying(
+    const NVSHIELD_EFFECT* Effect
+)
+{
+    return Effect->type >= NvShieldEffectSpring && Effect->type <= NvShieldEffectFriction
+        && Effect->isPlaying;
+}
+
+ULONGLONG
+NvShieldRumbleExpiry(
+    PNVSHIELD_STATE State,
+    ULONGLONG Now,
+    ULONG InactivityTimeout
+)
+/*++
+
+Routine Description:
+
+    Tells the transport when to stop the motors, or some of the effects,
+    if no PID report comes in meanwhile: when an effect has played for its
+    duration, or InactivityTimeout ms from Now, so that a game that crashed
+    or lost focus mid-effect doesn't leave them running. Called after
+    every PID report the core handled, with Now in ms on whatever
+    monotonic clock the caller uses; 0 for InactivityTimeout means no
+    timeout.
+
+Return Value:
+
+    The time to call NvShieldRumbleExpire at, see NvShieldRumbleNextExpiry.
+
+--*/
+{
+    ULONG i;
+
+    for (i = 0; i < NVSHIELD_MAX_EFFECTS; i++) {
+        PNVSHIELD_EFFECT effect = &State->effects[i];
+
+        if (effect->isStarted) {
+            effect->isStarted = FALSE;
+            effect->expires = effect->playDuration != 0 ? Now + effect->playDuration : 0;
+            effect->startTime = Now;
+        }
+    }
+
+    State->idleExpires = InactivityTimeout != 0 ? Now + InactivityTimeout : 0;
+
+    return NvShieldRumbleNextExpiry(State);
+}
+
+ULONGLONG
+NvShieldRumbleNextExpiry(
+    const NVSHIELD_STATE* State
+)
+/*++
+
+Routine Description:
+
+    Tells when NvShieldRumbleExpire has something to stop next, for the
+    transport to call it again after it did.
+
+Return Value:
+
+    The time, 0 if the motors are off.
+
+--*/
+{
+    ULONGLONG expires = State->idleExpires;
+    USHORT left, right;
+    BOOLEAN live;
+    ULONG i;
+
+    NvShieldMixRumble(State, &left, &right);
+    live = left != 0 || right != 0;
+
+    for (i = 0; i < NVSHIELD_MAX_EFFECTS; i++) {
+        const NVSHIELD_EFFECT* effect = &State->effects[i];
+
+        // Silent for now, but a sample or the stick may wake them up
+        if (customPlaying(effect) || conditionPlaying(effect))
+            live = TRUE;
+
+        if (effect->isPlaying && effect->expires != 0
+            && (expires == 0 || effect->expires < expires))
+            expires = effect->expires;
+    }
+
+    return live ? expires : 0;
+}
+
+BOOLEAN
+NvShieldRumbleExpire(
+    PNVSHIELD_STATE State,
+    ULONGLONG Now
+)
+/*++
+
+Routine Description:
+
+    Stops the effects whose duration has passed by Now, or all of them
+    once the inactivity timeout has.
+
+Return Value:
+
+    TRUE if NvShieldBuildRumbleReport has a report to send.
+
+--*/
+{
+    ULONG i;
+
+    if (State->idleExpires != 0 && State->idleExpires <= Now) {
+        State->idleExpires = 0;
+        stopEffects(State, NULL);
+    }
+
+    for (i = 0; i < NVSHIELD_MAX_EFFECTS; i++) {
+        PNVSHIELD_EFFECT effect = &State->effects[i];
+
+        if (effect->expires != 0 && effect->expires <= Now) {
+            effect->expires = 0;
+            effect->isPlaying = FALSE;
+        }
+    }
+
+    return rumbleChanged(State);
+}
+
+BOOLEAN
+NvShieldEffectTick(
+    PNVSHIELD_STATE State,
+    ULONGLONG Now
+)
+/*++
+
+Routine Description:
+
+    Moves every custom force effect that plays on to its sample for Now.
+    The sample follows from the time the effect has played, so that a
+    late or missed tick skips samples rather than stretching the effect.
+
+Return Value:
+
+    TRUE if NvShieldBuildRumbleReport has a report to send.
+
+--*/
+{
+    ULONG i;
+
+    for (i = 0; i < NVSHIELD_MAX_EFFECTS; i++) {
+        PNVSHIELD_EFFECT effect = &State->effects[i];
+        ULONG step;
+
+        if (!customPlaying(effect) || Now < effect->startTime)
+            continue;
+
+        step = (ULONG)((Now - effect->startTime) / customPeriod(effect));
+        if (step == effect->sampleStep)
+            continue;
+
+        effect->sampleStep = step;
+        effect->magnitude = customSample(State, effect, step);
+    }
+
+    return rumbleChanged(State);
+}
+
+ULONGLONG
+NvShieldEffectNextTick(
+    const NVSHIELD_STATE* State
+)
+/*++
+
+Routine Description:
+
+    Tells when a custom force effect moves on to its next sample, for the
+    transport to call NvShieldEffectTick then. Called after every PID
+    report the core handled, following NvShieldRumbleExpiry, and after
+    every tick.
+
+Return Value:
+
+    The time, 0 if no custom force plays or the motors are paused.
+
+--*/
+{
+    ULONGLONG next = 0;
+    ULONG i;
+
+    if (!State->isActuatorEnabled || State->isPaused)
+        return 0;
+
+    for (i = 0; i < NVSHIELD_MAX_EFFECTS; i++) {
+        const NVSHIELD_EFFECT* effect = &State->effects[i];
+        ULONGLONG tick;
+
+        if (!customPlaying(effect))
+            continue;
+
+        tick = effect->startTime + (ULONGLONG)(effect->sampleStep + 1) * customPeriod(effect);
+        if (next == 0 || tick < next)
+            next = tick;
+    }
+
+    return next;
+}
+
+BOOLEAN
+NvShieldConditionPlaying(
+    const NVSHIELD_STATE* State
+)
+/*++
+
+Routine Description:
+
+    Tells the transport whether input reports need to go through
+    NvShieldConditionUpdate.
+
+--*/
+{
+    ULONG i;
+
+    for (i = 0; i < NVSHIELD_MAX_EFFECTS; i++) {
+        if (conditionPlaying(&State->effects[i]))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static LONG
+conditionRate(
+    LONG Delta,
+    ULONGLONG Elapsed
+)
+{
+    // Per NVSHIELD_CONDITION_FULL_SCALE_US, saturated to the stick's range
+    LONGLONG rate = (LONGLONG)Delta * NVSHIELD_CONDITION_FULL_SCALE_US / (LONGLONG)Elapsed;
+
+    return (LONG)(rate > 32767 ? 32767 : rate < -32768 ? -32768 : rate);
+}
+
+static LONG
+conditionForce(
+    const NVSHIELD_CONDITION* Condition,
+    UCHAR Type,
+    LONG Metric
+)
+/*++
+
+Routine Description:
+
+    Applies the parameters of an axis to the stick's position, velocity
+    or acceleration on it, -32768 to 32767.
+
+Return Value:
+
+    The force, -255 to 255.
+
+--*/
+{
+    LONG offset = Metric - Condition->centerOffset * 256;
+    LONG deadBand = Condition->deadBand * 128;
+    LONG coefficient, saturation, force;
+
+    if (offset > deadBand) {
+        offset -= deadBand;
+        coefficient = Condition->positiveCoefficient;
+        saturation = Condition->positiveSaturation;
+    }
+    else if (offset < -deadBand) {
+        offset += deadBand;
+        coefficient = Condition->negativeCoefficient;
+        saturation = Condition->negativeSaturation;
+    }
+    else
+        return 0;
+
+    // Friction only cares which way the stick moves; the others grow
+    // with the metric, full scale giving full strength
+    if (Type == NvShieldEffectFriction)
+        force = offset > 0 ? coefficient * 2 : -coefficient * 2;
+    else
+        force = offset * coefficient / 127 / 128;
+
+    if (force > saturation)
+        force = saturation;
+    else if (force < -saturation)
+        force = -saturation;
+
+    return force;
+}
+
+BOOLEAN
+NvShieldConditionUpdate(
+    PNVSHIELD_STATE State,
+    USHORT X,
+    USHORT Y,
+    ULONGLONG Now
+)
+/*++
+
+Routine Description:
+
+    Plays the condition effects for the left stick at X and Y, 16 bits
+    centered on 0x8000, read at Now in microseconds on whatever monotonic
+    clock the caller uses. Called with every input report while
+    NvShieldConditionPlaying; the first report after a pause of more than
+    NVSHIELD_CONDITION_FULL_SCALE_US only sets the stick's position. An
+    effect with both axes plays the stronger of their forces.
+
+Return Value:
+
+    TRUE if NvShieldBuildRumbleReport has a report to send.
+
+--*/
+{
+    ULONGLONG elapsed = Now - State->conditionTime;
+    BOOLEAN fresh = State->conditionTime != 0 && Now > State->conditionTime
+        && elapsed <= NVSHIELD_CONDITION_FULL_SCALE_US;
+    LONG position[NVSHIELD_CONDITION_AXES];
+    LONG velocity[NVSHIELD_CONDITION_AXES];
+    LONG acceleration[NVSHIELD_CONDITION_AXES];
+    ULONG i, axis;
+
+    // Reports stamped alike carry nothing new to derive from
+    if (State->conditionTime != 0 && Now == State->conditionTime)
+        return FALSE;
+
+    position[0] = (LONG)X - 0x8000;
+    position[1] = (LONG)Y - 0x8000;
+
+    for (axis = 0; axis < NVSHIELD_CONDITION_AXES; axis++) {
+        velocity[axis] = fresh
+            ? conditionRate(position[axis] - State->conditionPosition[axis], elapsed) : 0;
+        acceleration[axis] = fresh
+            ? conditionRate(velocity[axis] - State->conditionVelocity[axis], elapsed) : 0;
+
+        State->conditionPosition[axis] = position[axis];
+        State->conditionVelocity[axis] = velocity[axis];
+    }
+
+    State->conditionTime = Now;
+
+    for (i = 0; i < NVSHIELD_MAX_EFFECTS; i++) {
+        PNVSHIELD_EFFECT effect = &State->effects[i];
+        const LONG* metric;
+        LONG strongest = 0;
+
+        if (!conditionPlaying(effect))
+            continue;
+
+        metric = effect->type == NvShieldEffectSpring ? position
+               : effect->type == NvShieldEffectInertia ? acceleration
+               : velocity;
+
+        for (axis = 0; axis < NVSHIELD_CONDITION_AXES; axis++) {
+            LONG force = conditionForce(&effect->conditions[axis], effect->type, metric[axis]);
+
+            if ((force < 0 ? -force : force) > (strongest < 0 ? -strongest : strongest))
+                strongest = force;
+        }
+
+        effect->magnitude = (SHORT)strongest;
+    }
+
+    return rumbleChanged(State);
+}
+
+//
+// Pointer speed by stick deflection, in 1/256 pixel per
+// NVSHIELD_MOUSE_PERIOD_MS, one entry per 0x400 of travel from the center
+// and linearly interpolated in between. The first two entries make the
+// dead zone.
+//
+#define MOUSE_LUT_SHIFT     10
+#define MOUSE_LUT_ENTRIES   ((0x8000 >> MOUSE_LUT_SHIFT) + 1)
+
+C_ASSERT(NVSHIELD_MOUSE_DEADZONE == 2 << MOUSE_LUT_SHIFT);
+
+static const USHORT G_MouseSpeed[NvShieldMouseCurveCount - 1][MOUSE_LUT_ENTRIES] = {
+    // Precise
+    { 0, 0, 0, 0, 0, 2, 4, 7, 12, 20, 29, 41, 57, 76, 98, 125, 156, 192, 233,
+      279, 332, 390, 455, 527, 606, 692, 786, 889, 1000, 1120, 1249, 1387, 1536 },
+    // Normal
+    { 0, 0, 0, 3, 11, 26, 46, 71, 102, 139, 182, 230, 284, 344, 410, 481, 558,
+      640, 728, 822, 922, 1027, 1138, 1254, 1377, 1505, 1638, 1778, 1923, 2074,
+      2230, 2392, 2560 },
+    // Fast
+    { 0, 0, 0, 6, 23, 51, 91, 142, 205, 279, 364, 461, 569, 688, 819, 961,
+      1115, 1280, 1456, 1644, 1843, 2054, 2276, 2509, 2753, 3009, 3277, 3556,
+      3846, 4147, 4460, 4784, 5120 },
+};
+
+// Largest motion a report carries, from the Logical Maximum of report 0x02
+#define MOUSE_REPORT_MAXIMUM    127
+
+static LONG
+mouseSpeed(
+    const USHORT* Lut,
+    USHORT Value
+)
+{
+    LONG deflection = (LONG)Value - 0x8000;
+    LONG travel = deflection < 0 ? -deflection : deflection;
+    LONG i, speed;
+
+    if (travel > 0x7FFF)
+        travel = 0x7FFF;
+
+    i = travel >> MOUSE_LUT_SHIFT;
+    speed = Lut[i] + (((Lut[i + 1] - Lut[i]) * (travel & ((1 << MOUSE_LUT_SHIFT) - 1)))
+        >> MOUSE_LUT_SHIFT);
+
+    return deflection < 0 ? -speed : speed;
+}
+
+static LONG
+mouseClamp(
+    LONG Value,
+    LONG Maximum
+)
+{
+    return Value > Maximum ? Maximum : Value < -Maximum ? -Maximum : Value;
+}
+
+BOOLEAN
+NvShieldMouseStickActive(
+    USHORT X,
+    USHORT Y
+)
+/*++
+
+Routine Description:
+
+    Tells whether the stick is out of the dead zone, that is whether
+    NvShieldMouseTick would move the pointer.
+
+--*/
+{
+    return X < 0x8000 - NVSHIELD_MOUSE_DEADZONE || X > 0x8000 + NVSHIELD_MOUSE_DEADZONE
+        || Y < 0x8000 - NVSHIELD_MOUSE_DEADZONE || Y > 0x8000 + NVSHIELD_MOUSE_DEADZONE;
+}
+
+BOOLEAN
+NvShieldMouseTick(
+    PNVSHIELD_STATE State,
+    USHORT X,
+    USHORT Y
+)
+/*++
+
+Routine Description:
+
+    Adds one period of pointer motion for a stick position (16 bits,
+    centered on 0x8000, increasing right and down) to the motion not
+    reported yet. Whatever the transport can't deliver piles up to at most
+    one report's worth.
+
+Return Value:
+
+    TRUE if at least a whole pixel is waiting to be reported.
+
+--*/
+{
+    const USHORT* lut;
+    LONG maximum = MOUSE_REPORT_MAXIMUM << 8;
+
+    if (State->mouseCurve == NvShieldMouseOff || State->mouseCurve >= NvShieldMouseCurveCount)
+        return FALSE;
+
+    lut = G_MouseSpeed[State->mouseCurve - 1];
+
+    State->mouseX = mouseClamp(State->mouseX + mouseSpeed(lut, X), maximum);
+    State->mouseY = mouseClamp(State->mouseY + mouseSpeed(lut, Y), maximum);
+
+    return State->mouseX >= 256 || State->mouseX <= -256
+        || State->mouseY >= 256 || State->mouseY <= -256;
+}
+
+ULONG
+NvShieldBuildMouseReport(
+    PNVSHIELD_STATE State,
+    PUCHAR Report
+)
+/*++
+
+Routine Description:
+
+    Moves the whole pixels of the motion not reported yet into a trackpad
+    report (NVSHIELD_INPUT_REPORT_SIZE bytes, as the controller sends
+    them), keeping the fractions for the next one.
+
+Return Value:
+
+    The length of the report, 0 if there is nothing to report or the
+    model has no trackpad.
+
+--*/
+{
+    LONG dx = State->mouseX / 256;   // toward zero, the sign stays in the remainder
+    LONG dy = State->mouseY / 256;
+
+    if ((dx == 0 && dy == 0) || State->model->TrackpadReportId == 0)
+        return 0;
+
+    State->mouseX -= dx * 256;
+    State->mouseY -= dy * 256;
+
+    RtlZeroMemory(Report, NVSHIELD_INPUT_REPORT_SIZE);
+    Report[0] = State->model->TrackpadReportId;
+    Report[1] = State->trackpadButtons;
+    Report[2] = (UCHAR)(dx & 0xFF);
+    Report[3] = (UCHAR)((dx >> 8) & 0xFF);
+    Report[4] = (UCHAR)(dy & 0xFF);
+    Report[5] = (UCHAR)((dy >> 8) & 0xFF);
+
+    return NVSHIELD_INPUT_REPORT_SIZE;
+}
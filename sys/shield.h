@@ -0,0 +1,897 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    shield.h
+
+Abstract:
+
+    Report translation and force feedback emulation core, shared by the
+    KMDF filter and the user-mode Linux daemon (see linux/).
+
+    Nothing in here may depend on WDF or on the USB stack: the caller
+    extracts the report buffers from its transport and acts on the
+    returned verdicts.
+
+Author:
+
+
+Environment:
+
+    kernel mode and user mode
+
+Revision History:
+
+--*/
+#ifndef _SHIELD_H_
+
+#define _SHIELD_H_
+
+#ifdef _KERNEL_MODE
+#include <wdm.h>
+#else
+#include <ntcompat.h>
+#endif
+
+typedef UCHAR HID_REPORT_DESCRIPTOR, *PHID_REPORT_DESCRIPTOR;
+
+extern HID_REPORT_DESCRIPTOR G_DefaultReportDescriptor[];
+extern const ULONG G_DefaultReportDescriptorLength;
+
+//
+// HID Report Descriptor items (descriptor.c)
+//
+#define NVSHIELD_HID_ITEM_MAIN              0
+#define NVSHIELD_HID_ITEM_GLOBAL            1
+#define NVSHIELD_HID_ITEM_LOCAL             2
+#define NVSHIELD_HID_ITEM_RESERVED          3
+
+#define NVSHIELD_HID_TAG_INPUT              0x8     // main
+#define NVSHIELD_HID_TAG_OUTPUT             0x9
+#define NVSHIELD_HID_TAG_COLLECTION         0xA
+#define NVSHIELD_HID_TAG_FEATURE            0xB
+#define NVSHIELD_HID_TAG_END_COLLECTION     0xC
+
+#define NVSHIELD_HID_TAG_USAGE_PAGE         0x0     // global
+#define NVSHIELD_HID_TAG_LOGICAL_MAXIMUM    0x2
+#define NVSHIELD_HID_TAG_PHYSICAL_MAXIMUM   0x4
+#define NVSHIELD_HID_TAG_REPORT_SIZE        0x7
+#define NVSHIELD_HID_TAG_REPORT_ID          0x8
+#define NVSHIELD_HID_TAG_REPORT_COUNT       0x9
+
+#define NVSHIELD_HID_TAG_USAGE              0x0     // local
+#define NVSHIELD_HID_TAG_USAGE_MINIMUM      0x1
+#define NVSHIELD_HID_TAG_USAGE_MAXIMUM      0x2
+
+typedef struct _NVSHIELD_HID_ITEM {
+    UCHAR Prefix;
+    UCHAR Type;             // NVSHIELD_HID_ITEM_*
+    UCHAR Tag;
+    UCHAR Size;             // data bytes
+    ULONG Data;             // little endian, not sign extended
+    const UCHAR* Raw;       // prefix and data
+    ULONG RawLength;
+} NVSHIELD_HID_ITEM, *PNVSHIELD_HID_ITEM;
+
+BOOLEAN
+NvShieldHidNextItem(
+    const UCHAR* Descriptor,
+    ULONG Length,
+    PULONG Offset,
+    PNVSHIELD_HID_ITEM Item
+);
+
+//
+// Effect classes a PID variant of G_DefaultReportDescriptor declares
+//
+#define NVSHIELD_PID_EFFECT_CONSTANT        0x01
+#define NVSHIELD_PID_EFFECT_RAMP            0x02
+#define NVSHIELD_PID_EFFECT_PERIODIC        0x04
+#define NVSHIELD_PID_EFFECT_CONDITION       0x08
+#define NVSHIELD_PID_EFFECT_CUSTOM          0x10
+#define NVSHIELD_PID_EFFECT_TYPES           0x1F
+#define NVSHIELD_PID_EFFECT_ENVELOPE        0x20    // Set Envelope report
+#define NVSHIELD_PID_EFFECT_ALL             0x3F
+
+typedef enum _NVSHIELD_PID_PROFILE {
+    NvShieldPidProfileFull,         // everything, G_DefaultReportDescriptor as is
+    NvShieldPidProfileRumble,       // constant force and periodic effects
+    NvShieldPidProfileConstant,     // constant force only
+    NvShieldPidProfileCount
+} NVSHIELD_PID_PROFILE;
+
+ULONG
+NvShieldPidProfileEffects(
+    NVSHIELD_PID_PROFILE Profile
+);
+
+ULONG
+NvShieldBuildReportDescriptor(
+    ULONG Effects,
+    PUCHAR Buffer,
+    ULONG Length
+);
+
+//
+// Where the gamepad controls sit in an input report, as declared by a
+// Report Descriptor. Bit offsets count from the start of the report,
+// report ID included; a BitSize of 0 means the control isn't there.
+//
+typedef enum _NVSHIELD_AXIS {
+    NvShieldAxisX,
+    NvShieldAxisY,
+    NvShieldAxisZ,
+    NvShieldAxisRz,
+    NvShieldAxisRx,         // left trigger
+    NvShieldAxisRy,         // right trigger
+    NvShieldAxisCount
+} NVSHIELD_AXIS;
+
+typedef struct _NVSHIELD_INPUT_FIELD {
+    USHORT BitOffset;
+    USHORT BitSize;
+} NVSHIELD_INPUT_FIELD, *PNVSHIELD_INPUT_FIELD;
+
+typedef struct _NVSHIELD_INPUT_LAYOUT {
+    UCHAR ReportId;
+    ULONG ReportSize;       // bytes, report ID included
+    NVSHIELD_INPUT_FIELD Buttons;
+    NVSHIELD_INPUT_FIELD Consumer;
+    NVSHIELD_INPUT_FIELD Hat;
+    NVSHIELD_INPUT_FIELD Axes[NvShieldAxisCount];
+} NVSHIELD_INPUT_LAYOUT, *PNVSHIELD_INPUT_LAYOUT;
+
+BOOLEAN
+NvShieldGetInputLayout(
+    const UCHAR* Descriptor,
+    ULONG Length,
+    UCHAR ReportId,
+    PNVSHIELD_INPUT_LAYOUT Layout
+);
+
+//
+// Length of every input report a Report Descriptor declares, report ID
+// included, 0 for the IDs it doesn't, so that an interrupt transfer
+// carrying several reports can be split, see
+// NvShieldTransformInputTransfer. Both are indexed by the report ID the
+// controller sends, which InputId gives the one presented for.
+//
+typedef struct _NVSHIELD_REPORT_SIZES {
+    USHORT Input[256];
+    UCHAR InputId[256];
+} NVSHIELD_REPORT_SIZES, *PNVSHIELD_REPORT_SIZES;
+
+BOOLEAN
+NvShieldGetInputReportSizes(
+    const UCHAR* Descriptor,
+    ULONG Length,
+    const UCHAR* IdMap,
+    PNVSHIELD_REPORT_SIZES Sizes
+);
+
+#define NVSHIELD_VENDOR_ID              0x0955
+#define NVSHIELD_PRODUCT_ID             0x7210  // 2015 controller
+#define NVSHIELD_PRODUCT_ID_2017        0x7214
+
+#define NVSHIELD_INPUT_REPORT_SIZE      16
+#define NVSHIELD_RUMBLE_REPORT_MAX      32
+#define NVSHIELD_PID_GET_REPORT_SIZE    5
+
+//
+// Controller models (model.c)
+//
+// Everything that differs between the controllers the driver binds to is
+// data here rather than code: the Report Descriptor presented to HidUsb,
+// which reports the input rewrites apply to, and the motor report.
+//
+// The Report Descriptor of a model either replaces the controller's own
+// outright, the variant of G_DefaultReportDescriptor the PID profile asks
+// for, or is built from the controller's own by
+// NvShieldPatchReportDescriptor: usages rewritten, the PID reports
+// inserted into the gamepad collection, and report IDs of the controller
+// that the PID reports use renumbered.
+//
+typedef struct _NVSHIELD_USAGE_PATCH {
+    ULONG Usage;            // page << 16 | usage, as the controller declares it
+    ULONG NewUsage;         // as presented
+} NVSHIELD_USAGE_PATCH, *PNVSHIELD_USAGE_PATCH;
+
+//
+// The motor report: Size bytes, report ID included, zero but for the
+// report ID, Command in byte 1 when non-zero, 1 at UpdateOffset when
+// non-zero, and the left and right motor levels at their offsets, 16 bits
+// little endian when MotorMax is 0, else one byte from 0 to MotorMax.
+//
+typedef struct _NVSHIELD_RUMBLE_FORMAT {
+    UCHAR ReportId;
+    UCHAR Size;             // up to NVSHIELD_RUMBLE_REPORT_MAX
+    UCHAR Command;
+    UCHAR UpdateOffset;     // flag the controller applies the levels on
+    UCHAR LeftOffset;
+    UCHAR RightOffset;
+    UCHAR MotorMax;
+} NVSHIELD_RUMBLE_FORMAT, *PNVSHIELD_RUMBLE_FORMAT;
+
+typedef struct _NVSHIELD_MODEL {
+    USHORT ProductId;
+
+    // Length of the controller's own Report Descriptor, which is replaced,
+    // or 0 to patch it with UsagePatches instead
+    USHORT DeviceReportDescriptorLength;
+    const NVSHIELD_USAGE_PATCH* UsagePatches;
+    ULONG UsagePatchCount;
+
+    // Input rewrites, 0 for the report IDs the model doesn't have
+    UCHAR GamepadReportId;
+    UCHAR ConsumerReportId;     // volume buttons of the gamepad report mirrored to
+    UCHAR ConsumerByte;         // where they are in the gamepad report
+    UCHAR ConsumerMask;
+    UCHAR TrackpadReportId;
+
+    NVSHIELD_RUMBLE_FORMAT Rumble;
+} NVSHIELD_MODEL, *PNVSHIELD_MODEL;
+
+extern const NVSHIELD_MODEL G_NvShieldModel2015;
+
+const NVSHIELD_MODEL*
+NvShieldFindModel(
+    USHORT ProductId
+);
+
+ULONG
+NvShieldPatchReportDescriptor(
+    const NVSHIELD_MODEL* Model,
+    ULONG Effects,
+    const UCHAR* Device,
+    ULONG DeviceLength,
+    PUCHAR Buffer,
+    ULONG Length,
+    PUCHAR IdMap
+);
+
+VOID
+NvShieldGetDeviceReportIds(
+    const UCHAR* IdMap,
+    PUCHAR DeviceIds
+);
+
+//
+// Configuration descriptor of the 2015 controller, whose HID descriptor
+// gets its wDescriptorLength patched to the length of the Report
+// Descriptor we present.
+//
+#define NVSHIELD_HID_DESCRIPTOR_OFFSET  18
+#define NVSHIELD_CONFIG_DESCRIPTOR_SIZE 34
+
+//
+// Force feedback effects, one per PID effect block. Create New Effect
+// (feature report 0x09) hands out the block indices, reported back by
+// Block Load (feature report 0x20); block n is effects[n - 1]. The motors
+// play the sum of every effect playing, see NvShieldMixRumble.
+//
+#define NVSHIELD_MAX_EFFECTS            16
+
+typedef enum _NVSHIELD_EFFECT_TYPE {
+    NvShieldEffectNone,                 // block free
+    NvShieldEffectConstant,
+    NvShieldEffectRamp,
+    NvShieldEffectSquare,
+    NvShieldEffectSine,
+    NvShieldEffectTriangle,
+    NvShieldEffectSawtoothUp,
+    NvShieldEffectSawtoothDown,
+    NvShieldEffectSpring,
+    NvShieldEffectDamper,
+    NvShieldEffectInertia,
+    NvShieldEffectFriction,
+    NvShieldEffectCustom,
+    NvShieldEffectTypeCount
+} NVSHIELD_EFFECT_TYPE;
+
+#define NVSHIELD_EFFECT_MAGNITUDE_MAX   255
+
+// Axes Enable and Direction Enable of Set Effect
+#define NVSHIELD_EFFECT_AXIS_X          0x01
+#define NVSHIELD_EFFECT_AXIS_Y          0x02
+#define NVSHIELD_EFFECT_POLAR           0x04
+
+//
+// Custom force effects play the samples uploaded with Set Custom Force
+// Data (output report 0x07) or Download Force Sample (0x08), one every
+// sample period, looping for the duration of the effect. The transport
+// calls NvShieldEffectTick at the time NvShieldEffectNextTick gives. Each
+// block has its slice of the sample arena of the device.
+//
+#define NVSHIELD_CUSTOM_SAMPLES         256     // per block
+#define NVSHIELD_CUSTOM_PERIOD_MS       10      // when the game gives none
+
+//
+// Condition effects (spring, damper, inertia and friction) play a force
+// computed from the left stick on every input report, see
+// NvShieldConditionUpdate: its position for a spring, its velocity for a
+// damper or friction, its acceleration for inertia. Set Condition (output
+// report 0x03) gives the parameters of each axis, X then Y. Velocity is
+// full scale when the stick crosses half its travel in
+// NVSHIELD_CONDITION_FULL_SCALE_US, and acceleration when velocity does.
+//
+#define NVSHIELD_CONDITION_AXES         2
+#define NVSHIELD_CONDITION_FULL_SCALE_US 100000
+
+typedef struct _NVSHIELD_CONDITION {
+    signed char centerOffset;       // -127 to 127 for the whole travel
+    signed char positiveCoefficient;
+    signed char negativeCoefficient;
+    UCHAR positiveSaturation;       // 0-255, the strongest force either way
+    UCHAR negativeSaturation;
+    UCHAR deadBand;                 // 0-255, either side of the center
+} NVSHIELD_CONDITION, *PNVSHIELD_CONDITION;
+
+typedef struct _NVSHIELD_EFFECT {
+    UCHAR type;             // NVSHIELD_EFFECT_TYPE
+    UCHAR gain;             // 0-255
+    UCHAR axes;             // NVSHIELD_EFFECT_AXIS_* and NVSHIELD_EFFECT_POLAR
+    UCHAR direction;        // polar, 0-255 for a turn clockwise from north
+    SHORT magnitude;        // -255 to 255, from the parameter report of the type
+    UCHAR isPlaying;
+    UCHAR isStarted;        // since the last NvShieldRumbleExpiry
+
+    // Rumble watchdog, see NvShieldRumbleExpiry
+    ULONG duration;         // ms, of Set Effect, 0 if infinite
+    ULONG playDuration;     // ms the current play lasts, 0 if infinite
+    ULONGLONG expires;      // 0 if infinite or not stamped yet
+
+    // Custom force playback, see NvShieldEffectTick
+    USHORT sampleCount;
+    USHORT samplePeriod;    // ms, 0 for NVSHIELD_CUSTOM_PERIOD_MS
+    ULONGLONG startTime;    // stamped by NvShieldRumbleExpiry
+    ULONG sampleStep;       // samples played since startTime
+
+    // Condition effects, see NvShieldConditionUpdate
+    NVSHIELD_CONDITION conditions[NVSHIELD_CONDITION_AXES];
+} NVSHIELD_EFFECT, *PNVSHIELD_EFFECT;
+
+//
+// Stick calibration
+//
+// Worn sticks come to rest off their center and may no longer reach the
+// ends of their travel. With the Calibrate setting on, the Calibrate
+// stage of the input pipeline, NvShieldCalibrateInput, keeps an estimate
+// of each stick axis: where it rests, as a running average of the
+// reports in which the stick has been still near the center for a while,
+// and how far it went either way, starting from NVSHIELD_CALIBRATION_REACH
+// of the travel. The axes are corrected through tables of the snapshot
+// that map the resting position to the center and the furthest positions
+// to the ends. The tables are built from what NvShieldTakeCalibration
+// gives, which the transport does outside of the report path whenever
+// NvShieldCalibrateInput finds the estimate moved away from the one they
+// came from, at most every NVSHIELD_CALIBRATION_PERIOD_MS, and stores
+// every NVSHIELD_CALIBRATION_SAVE_MS and when the controller goes away so
+// that the next session starts from it. Values are 16 bits centered on
+// 0x8000, whatever the size of the field.
+//
+#define NVSHIELD_CALIBRATION_AXES       4       // X, Y, Z, Rz, left stick first
+#define NVSHIELD_CALIBRATION_KNOTS      257     // table entries, 256 apart
+#define NVSHIELD_CALIBRATION_REACH      0x6800  // either side of the center, until the stick goes further
+#define NVSHIELD_CALIBRATION_REST       0x2000  // furthest from 0x8000 a stick may rest
+#define NVSHIELD_CALIBRATION_STILL      0x0100  // motion between two reports of a stick at rest
+#define NVSHIELD_CALIBRATION_SETTLE     16      // reports a stick stays still before it is at rest
+#define NVSHIELD_CALIBRATION_THRESHOLD  0x0100  // estimate motion that has the tables rebuilt
+#define NVSHIELD_CALIBRATION_PERIOD_MS  1000    // least time between two rebuilds
+#define NVSHIELD_CALIBRATION_SAVE_MS    300000  // least time between two saves of the estimate
+
+typedef struct _NVSHIELD_AXIS_CALIBRATION {
+    USHORT Center;
+    USHORT Min;
+    USHORT Max;
+} NVSHIELD_AXIS_CALIBRATION, *PNVSHIELD_AXIS_CALIBRATION;
+
+//
+// Configuration
+//
+// The tunables of a controller, NVSHIELD_SETTINGS (public.h), as compiled
+// by NvShieldCompileConfig into what the rewrites and the motor mix use
+// as is: the trackpad curve of each axis as a table of the motion
+// reported for every delta, the volume buttons as a mask of the gamepad
+// report, the stick calibration as a table per axis. A snapshot is never
+// written to once published. The core reads State->config with a single
+// load wherever it needs it, with no lock; the transport replaces it with
+// another snapshot and frees the one it replaced once nothing can still
+// be reading it.
+//
+#define NVSHIELD_TRACKPAD_DELTAS        511     // -255 to 255
+
+struct _NVSHIELD_SETTINGS;
+
+typedef struct _NVSHIELD_CONFIG {
+    SHORT TrackpadX[NVSHIELD_TRACKPAD_DELTAS];  // by delta + 255
+    SHORT TrackpadY[NVSHIELD_TRACKPAD_DELTAS];
+    UCHAR ConsumerMask;     // of the model's, the volume buttons mirrored
+    UCHAR RumbleGain;       // 0-255
+    UCHAR RumbleFlags;      // NVSHIELD_RUMBLE_*
+    UCHAR Calibrate;        // Sticks is only built while it is set
+    USHORT InputKeepAlive;  // ms, see NvShieldInputUnchanged; 0 for off
+    USHORT Sticks[NVSHIELD_CALIBRATION_AXES][NVSHIELD_CALIBRATION_KNOTS];
+} NVSHIELD_CONFIG, *PNVSHIELD_CONFIG;
+
+struct _NVSHIELD_STATE;
+
+//
+// Rewrites an input report whose ID it was registered for in place and
+// returns its new length, see NvShieldTransformInputReport.
+//
+typedef ULONG NVSHIELD_INPUT_HANDLER(
+    struct _NVSHIELD_STATE* State,
+    PUCHAR Report,
+    ULONG Length
+);
+typedef NVSHIELD_INPUT_HANDLER* PNVSHIELD_INPUT_HANDLER;
+
+typedef struct _NVSHIELD_STATE {
+
+    // Controller the reports come from, see NvShieldSetModel
+    const NVSHIELD_MODEL* model;
+
+    // Input rewrites by report ID, NULL for the reports that go up as
+    // they came; filled in from the model by NvShieldSetModel
+    PNVSHIELD_INPUT_HANDLER inputHandlers[256];
+
+    // Tunables, see NvShieldCompileConfig; defaultConfig, compiled from
+    // the default settings by NvShieldSetModel, until the transport
+    // publishes another snapshot
+    const NVSHIELD_CONFIG* volatile config;
+    NVSHIELD_CONFIG defaultConfig;
+
+    // Rumble state
+    UCHAR effectTypes[NvShieldEffectTypeCount]; // by Effect Type index presented, see NvShieldSetPidEffects
+    NVSHIELD_EFFECT effects[NVSHIELD_MAX_EFFECTS];
+    UCHAR loadedBlock;      // of the last Create New Effect, 0 if none was free
+    UCHAR customBlock;      // Download Force Sample appends to it, 0 for none
+    int isActuatorEnabled;  // Device Control, enable/disable actuators
+    int isPaused;           // Device Control, pause/continue
+
+    unsigned short rumbleGain;  // device gain, 0-255
+
+    // Motor report last let through by NvShieldBuildRumbleReport, all
+    // zeroes until there is one or once NvShieldRumbleReportLost
+    UCHAR lastRumbleReport[NVSHIELD_RUMBLE_REPORT_MAX];
+    ULONG rumbleSent;       // reports NvShieldBuildRumbleReport let through, less those lost
+    ULONG rumbleSuppressed; // and those it held back as unchanged
+
+    // Interrupt transfers NvShieldTransformInputTransfer stopped splitting
+    ULONG inputShort;       // at a report cut off by the end of the transfer
+    ULONG inputMismatched;  // at a report ID the descriptor doesn't declare
+
+    // Gamepad report last let through, see NvShieldInputUnchanged
+    ULONGLONG lastInput[NVSHIELD_INPUT_REPORT_SIZE / sizeof(ULONGLONG)];
+    ULONGLONG lastInputTime;    // ms
+    ULONG inputSuppressed;  // reports held back as unchanged
+
+    // Rumble watchdog, see NvShieldRumbleExpiry
+    ULONGLONG idleExpires;  // 0 if there is no inactivity timeout
+
+    // Stick calibration, see NvShieldCalibrateInput
+    NVSHIELD_AXIS_CALIBRATION calibration[NVSHIELD_CALIBRATION_AXES]; // the tables come from
+    ULONG calibrationCenter[NVSHIELD_CALIBRATION_AXES];  // resting position, 24.8 fixed point
+    USHORT calibrationMin[NVSHIELD_CALIBRATION_AXES];
+    USHORT calibrationMax[NVSHIELD_CALIBRATION_AXES];
+    USHORT calibrationLast[NVSHIELD_CALIBRATION_AXES];   // of the previous report
+    UCHAR calibrationStill[NVSHIELD_CALIBRATION_AXES / 2]; // reports each stick has been still for
+
+    // Left stick as condition effects last saw it, -32768 to 32767
+    ULONGLONG conditionTime;    // us, 0 before the first update
+    LONG conditionPosition[NVSHIELD_CONDITION_AXES];
+    LONG conditionVelocity[NVSHIELD_CONDITION_AXES];
+
+    // Sample arena of the custom force effects, a slice per block
+    signed char customSamples[NVSHIELD_MAX_EFFECTS][NVSHIELD_CUSTOM_SAMPLES];
+
+    // Trackpad state
+    UCHAR origX;
+    UCHAR origY;
+
+    int isTrackpadPressed;
+
+    // Consumer control
+    UCHAR lastCCState;
+
+    // Mouse emulation, see NvShieldMouseTick
+    UCHAR mouseCurve;       // NVSHIELD_MOUSE_CURVE
+    UCHAR trackpadButtons;  // of the last trackpad report, repeated in synthesized ones
+    LONG mouseX;            // motion not reported yet, in 1/256 pixel
+    LONG mouseY;
+} NVSHIELD_STATE, *PNVSHIELD_STATE;
+
+//
+// Mouse emulation: the right stick drives the pointer of the trackpad
+// collection (TrackpadReportId of the model, which models without one
+// don't get it on). The transport calls NvShieldMouseTick every
+// NVSHIELD_MOUSE_PERIOD_MS with the latest stick position, whether or not
+// a report came in meanwhile, and NvShieldBuildMouseReport whenever it
+// can deliver an input report; motion accumulates in between.
+//
+#define NVSHIELD_MOUSE_PERIOD_MS        4
+#define NVSHIELD_MOUSE_DEADZONE         0x800   // stick travel either side of 0x8000
+
+typedef enum _NVSHIELD_MOUSE_CURVE {
+    NvShieldMouseOff,
+    NvShieldMousePrecise,       // cubic, up to 1500 pixels/s
+    NvShieldMouseNormal,        // quadratic, up to 2500 pixels/s
+    NvShieldMouseFast,          // quadratic, up to 5000 pixels/s
+    NvShieldMouseCurveCount
+} NVSHIELD_MOUSE_CURVE;
+
+//
+// Decoded gamepad report, see NvShieldDecodeInputReport.
+//
+typedef struct _NVSHIELD_GAMEPAD_STATE {
+    USHORT Buttons;         // one bit per button, in descriptor order
+    UCHAR Hat;              // 0 = up, clockwise, out of range when released
+    UCHAR Consumer;         // one bit per consumer control
+    USHORT Axes[NvShieldAxisCount];
+} NVSHIELD_GAMEPAD_STATE, *PNVSHIELD_GAMEPAD_STATE;
+
+//
+// Input pipeline
+//
+// The transports run every input report through the stages of
+// NVSHIELD_INPUT_STAGES (public.h), in order, out of a function of type
+// NVSHIELD_INPUT_PIPELINE that NvShieldTransformInputTransfer calls for
+// each report of a transfer. The stages are called directly, so the list
+// costs nothing over writing them out by hand. Those reading the gamepad
+// controls get them from NvShieldInputGamepad, which decodes the report
+// for the first of them only: they make a single pass over it between
+// them, whichever of them runs.
+//
+typedef ULONG NVSHIELD_INPUT_PIPELINE(
+    PVOID Context,
+    PUCHAR Report,
+    ULONG Length
+);
+typedef NVSHIELD_INPUT_PIPELINE* PNVSHIELD_INPUT_PIPELINE;
+
+typedef struct _NVSHIELD_INPUT {
+    PUCHAR Report;
+    ULONG Length;           // the Rewrite stage updates it
+    const NVSHIELD_INPUT_LAYOUT* Layout;
+    UCHAR Decoded;          // NVSHIELD_INPUT_*
+    NVSHIELD_GAMEPAD_STATE Gamepad;
+} NVSHIELD_INPUT, *PNVSHIELD_INPUT;
+
+#define NVSHIELD_INPUT_PENDING      0
+#define NVSHIELD_INPUT_GAMEPAD      1
+#define NVSHIELD_INPUT_OTHER        2
+
+//
+// Per stage counters: the pipeline runs each stage through
+// NVSHIELD_RUN_STAGE, which counts the reports and time stamp counter
+// ticks spent in it in an NVSHIELD_STAGE_COUNTER array when built with
+// NVSHIELD_STAGE_TIMING, as checked builds of the driver are, and
+// compiles down to the bare call otherwise. The counters aren't atomic;
+// completions racing on several processors may lose a few.
+//
+#ifndef NVSHIELD_STAGE_TIMING
+#if defined(_KERNEL_MODE) && DBG
+#define NVSHIELD_STAGE_TIMING       1
+#else
+#define NVSHIELD_STAGE_TIMING       0
+#endif
+#endif
+
+#if NVSHIELD_STAGE_TIMING
+#define NVSHIELD_RUN_STAGE(Counters, Stage, Call) \
+    do { \
+        ULONGLONG stageStart_ = ReadTimeStampCounter(); \
+        Call; \
+        (Counters)[Stage].Cycles += ReadTimeStampCounter() - stageStart_; \
+        (Counters)[Stage].Reports++; \
+    } while (0)
+#else
+#define NVSHIELD_RUN_STAGE(Counters, Stage, Call) \
+    do { \
+        Call; \
+    } while (0)
+#endif
+
+//
+// Cache of the GET_REPORT answers that do go to the device, so that the
+// bursts DirectInput sends during enumeration and effect creation are
+// mostly answered without an EP0 round trip. Times are in milliseconds
+// on whatever monotonic clock the caller uses. The core doesn't lock it.
+//
+#define NVSHIELD_REPORT_CACHE_ENTRIES   8
+#define NVSHIELD_REPORT_CACHE_DATA_SIZE 64
+
+typedef struct _NVSHIELD_REPORT_CACHE_ENTRY {
+    USHORT Value;           // report type << 8 | report ID, 0 when free
+    USHORT Length;
+    ULONGLONG Expires;
+    UCHAR Data[NVSHIELD_REPORT_CACHE_DATA_SIZE];
+} NVSHIELD_REPORT_CACHE_ENTRY, *PNVSHIELD_REPORT_CACHE_ENTRY;
+
+typedef struct _NVSHIELD_REPORT_CACHE {
+    NVSHIELD_REPORT_CACHE_ENTRY Entries[NVSHIELD_REPORT_CACHE_ENTRIES];
+    ULONG Hits;
+    ULONG Misses;
+} NVSHIELD_REPORT_CACHE, *PNVSHIELD_REPORT_CACHE;
+
+//
+// What the transport should do with a SET_REPORT once the core has seen it.
+//
+typedef enum _NVSHIELD_PID_ACTION {
+    NvShieldPidForward,         // not emulated, send it to the device untouched
+    NvShieldPidComplete,        // consumed, complete it successfully
+    NvShieldPidUpdateRumble,    // motor state changed, send NvShieldBuildRumbleReport()
+    NvShieldPidInvalid          // too short for its report ID, fail it
+} NVSHIELD_PID_ACTION;
+
+VOID
+NvShieldInitState(
+    PNVSHIELD_STATE State
+);
+
+VOID
+NvShieldSetModel(
+    PNVSHIELD_STATE State,
+    const NVSHIELD_MODEL* Model
+);
+
+VOID
+NvShieldSetPidEffects(
+    PNVSHIELD_STATE State,
+    ULONG Effects
+);
+
+VOID
+NvShieldDefaultSettings(
+    struct _NVSHIELD_SETTINGS* Settings
+);
+
+BOOLEAN
+NvShieldCheckSettings(
+    struct _NVSHIELD_SETTINGS* Settings
+);
+
+VOID
+NvShieldCompileConfig(
+    PNVSHIELD_CONFIG Config,
+    const NVSHIELD_MODEL* Model,
+    const struct _NVSHIELD_SETTINGS* Settings,
+    const NVSHIELD_AXIS_CALIBRATION* Calibration
+);
+
+BOOLEAN
+NvShieldLoadCalibration(
+    PNVSHIELD_STATE State,
+    const NVSHIELD_AXIS_CALIBRATION* Calibration
+);
+
+VOID
+NvShieldTakeCalibration(
+    PNVSHIELD_STATE State,
+    PNVSHIELD_AXIS_CALIBRATION Calibration
+);
+
+ULONG
+NvShieldTransformInputReport(
+    PNVSHIELD_STATE State,
+    PUCHAR Buffer,
+    ULONG Length
+);
+
+ULONG
+NvShieldTransformInputTransfer(
+    PNVSHIELD_STATE State,
+    const NVSHIELD_REPORT_SIZES* Sizes,
+    PUCHAR Buffer,
+    ULONG Length,
+    PNVSHIELD_INPUT_PIPELINE Pipeline,
+    PVOID Context
+);
+
+BOOLEAN
+NvShieldInputUnchanged(
+    PNVSHIELD_STATE State,
+    const UCHAR* Buffer,
+    ULONG Length,
+    ULONGLONG Now
+);
+
+BOOLEAN
+NvShieldGetReport(
+    PNVSHIELD_STATE State,
+    USHORT Value,
+    PUCHAR Buffer,
+    ULONG Length
+);
+
+NVSHIELD_PID_ACTION
+NvShieldSetReport(
+    PNVSHIELD_STATE State,
+    USHORT Value,
+    const UCHAR* Buffer,
+    ULONG Length
+);
+
+BOOLEAN
+NvShieldPatchHidDescriptor(
+    PUCHAR Buffer,
+    ULONG Length,
+    ULONG ReportDescriptorLength
+);
+
+VOID
+NvShieldReportCacheInit(
+    PNVSHIELD_REPORT_CACHE Cache
+);
+
+BOOLEAN
+NvShieldReportCacheLookup(
+    PNVSHIELD_REPORT_CACHE Cache,
+    USHORT Value,
+    PUCHAR Buffer,
+    PULONG Length,
+    ULONGLONG Now
+);
+
+VOID
+NvShieldReportCacheStore(
+    PNVSHIELD_REPORT_CACHE Cache,
+    USHORT Value,
+    const UCHAR* Buffer,
+    ULONG Length,
+    ULONGLONG Now
+);
+
+VOID
+NvShieldReportCacheInvalidate(
+    PNVSHIELD_REPORT_CACHE Cache,
+    USHORT Value
+);
+
+struct _NVSHIELD_LATENCY_HISTOGRAM;
+
+VOID
+NvShieldLatencyRecord(
+    struct _NVSHIELD_LATENCY_HISTOGRAM* Histogram,
+    ULONGLONG Microseconds
+);
+
+BOOLEAN
+NvShieldDecodeInputReport(
+    const NVSHIELD_INPUT_LAYOUT* Layout,
+    const UCHAR* Report,
+    ULONG Length,
+    PNVSHIELD_GAMEPAD_STATE State
+);
+
+static __inline VOID
+NvShieldInputInit(
+    PNVSHIELD_INPUT Input,
+    const NVSHIELD_INPUT_LAYOUT* Layout,
+    PUCHAR Report,
+    ULONG Length
+)
+{
+    Input->Report = Report;
+    Input->Length = Length;
+    Input->Layout = Layout;
+    Input->Decoded = NVSHIELD_INPUT_PENDING;
+}
+
+//
+// The gamepad controls of the report going through the pipeline, NULL if
+// it isn't the gamepad report
+//
+static __inline const NVSHIELD_GAMEPAD_STATE*
+NvShieldInputGamepad(
+    PNVSHIELD_INPUT Input
+)
+{
+    if (Input->Decoded == NVSHIELD_INPUT_PENDING) {
+        Input->Decoded = NvShieldDecodeInputReport(Input->Layout, Input->Report,
+            Input->Length, &Input->Gamepad) ? NVSHIELD_INPUT_GAMEPAD : NVSHIELD_INPUT_OTHER;
+    }
+
+    return Input->Decoded == NVSHIELD_INPUT_GAMEPAD ? &Input->Gamepad : NULL;
+}
+
+BOOLEAN
+NvShieldCalibrateInput(
+    PNVSHIELD_STATE State,
+    PNVSHIELD_INPUT Input
+);
+
+ULONG
+NvShieldPatchEndpointIntervals(
+    PUCHAR Buffer,
+    ULONG Length,
+    UCHAR Interval
+);
+
+VOID
+NvShieldMixRumble(
+    const NVSHIELD_STATE* State,
+    PUSHORT Left,
+    PUSHORT Right
+);
+
+BOOLEAN
+NvShieldBuildRumbleReport(
+    PNVSHIELD_STATE State,
+    PUCHAR Report
+);
+
+VOID
+NvShieldRumbleReportLost(
+    PNVSHIELD_STATE State
+);
+
+ULONGLONG
+NvShieldRumbleExpiry(
+    PNVSHIELD_STATE State,
+    ULONGLONG Now,
+    ULONG InactivityTimeout
+);
+
+ULONGLONG
+NvShieldRumbleNextExpiry(
+    const NVSHIELD_STATE* State
+);
+
+BOOLEAN
+NvShieldRumbleExpire(
+    PNVSHIELD_STATE State,
+    ULONGLONG Now
+);
+
+BOOLEAN
+NvShieldEffectTick(
+    PNVSHIELD_STATE State,
+    ULONGLONG Now
+);
+
+ULONGLONG
+NvShieldEffectNextTick(
+    const NVSHIELD_STATE* State
+);
+
+BOOLEAN
+NvShieldConditionPlaying(
+    const NVSHIELD_STATE* State
+);
+
+BOOLEAN
+NvShieldConditionUpdate(
+    PNVSHIELD_STATE State,
+    USHORT X,
+    USHORT Y,
+    ULONGLONG Now
+);
+
+BOOLEAN
+NvShieldMouseStickActive(
+    USHORT X,
+    USHORT Y
+);
+
+BOOLEAN
+NvShieldMouseTick(
+    PNVSHIELD_STATE State,
+    USHORT X,
+    USHORT Y
+);
+
+ULONG
+NvShieldBuildMouseReport(
+    PNVSHIELD_STATE State,
+    PUCHAR Report
+);
+
+#endif   //_SHIELD_H_
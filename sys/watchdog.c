@@ -0,0 +1,265 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    watchdog.c
+
+Abstract:
+
+    Rumble watchdog: stops the effects of a controller once they have
+    played for their duration, or once the game has sent no PID report for
+    the RumbleTimeout setting, see NvShieldRumbleExpiry.
+
+    The deadlines of every controller sit in a single timer wheel, a ring
+    of WATCHDOG_SLOTS lists advanced by one kernel timer every
+    WATCHDOG_TICK_MS while any deadline is pending. Arming, moving or
+    dropping a deadline is a list operation under the wheel's lock, which
+    matters since every PID report moves it. Deadlines further away than
+    a turn of the wheel stay in their slot until their turn comes.
+
+Environment:
+
+    kernel mode only
+
+Revision History:
+
+--*/
+
+#include <hidusbfx2.h>
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text( INIT, NvShieldWatchdogDriverInit)
+#pragma alloc_text( PAGE, NvShieldWatchdogDriverCleanup)
+#pragma alloc_text( PAGE, NvShieldWatchdogInitialize)
+#endif
+
+#define WATCHDOG_TICK_MS    50
+#define WATCHDOG_SLOTS      64
+
+static struct {
+    KTIMER Timer;
+    KDPC Dpc;
+    KSPIN_LOCK Lock;
+
+    LIST_ENTRY Slots[WATCHDOG_SLOTS];
+    ULONGLONG Tick;         // last tick processed
+    ULONG Armed;            // deadlines in the wheel, the timer runs while non-zero
+} G_Watchdog;
+
+static KDEFERRED_ROUTINE watchdogDpc;
+
+static ULONGLONG
+watchdogNow(
+    VOID
+)
+{
+    return KeQueryInterruptTime() / 10000; // 100ns to ms
+}
+
+VOID
+NvShieldWatchdogDriverInit(
+    VOID
+)
+{
+    ULONG i;
+
+    KeInitializeTimer(&G_Watchdog.Timer);
+    KeInitializeDpc(&G_Watchdog.Dpc, watchdogDpc, NULL);
+    KeInitializeSpinLock(&G_Watchdog.Lock);
+
+    for (i = 0; i < WATCHDOG_SLOTS; i++)
+        InitializeListHead(&G_Watchdog.Slots[i]);
+
+    G_Watchdog.Tick = 0;
+    G_Watchdog.Armed = 0;
+}
+
+VOID
+NvShieldWatchdogDriverCleanup(
+    VOID
+)
+{
+    PAGED_CODE();
+
+    ASSERT(G_Watchdog.Armed == 0);
+
+    KeCancelTimer(&G_Watchdog.Timer);
+    KeFlushQueuedDpcs();
+}
+
+VOID
+NvShieldWatchdogInitialize(
+    PDEVICE_EXTENSION devContext,
+    ULONG RumbleTimeout
+)
+{
+    PAGED_CODE();
+
+    devContext->RumbleTimeout = RumbleTimeout;
+    devContext->WatchdogTick = 0;
+    InitializeListHead(&devContext->WatchdogLink);
+}
+
+static VOID
+watchdogInsert(
+    PDEVICE_EXTENSION devContext,
+    ULONGLONG Tick
+)
+{
+    // Under the wheel's lock, with the device out of it
+    if (G_Watchdog.Armed++ == 0) {
+        LARGE_INTEGER dueTime;
+
+        G_Watchdog.Tick = watchdogNow() / WATCHDOG_TICK_MS;
+
+        dueTime.QuadPart = -(LONGLONG)WATCHDOG_TICK_MS * 10000;
+        KeSetTimerEx(&G_Watchdog.Timer, dueTime, WATCHDOG_TICK_MS, &G_Watchdog.Dpc);
+    }
+
+    if (Tick <= G_Watchdog.Tick)
+        Tick = G_Watchdog.Tick + 1;
+
+    devContext->WatchdogTick = Tick;
+    InsertTailList(&G_Watchdog.Slots[Tick % WATCHDOG_SLOTS], &devContext->WatchdogLink);
+}
+
+static VOID
+watchdogRemove(
+    PDEVICE_EXTENSION devContext
+)
+{
+    // Under the wheel's lock
+    if (IsListEmpty(&devContext->WatchdogLink))
+        return;
+
+    RemoveEntryList(&devContext->WatchdogLink);
+    InitializeListHead(&devContext->WatchdogLink);
+    devContext->WatchdogTick = 0;
+
+    if (--G_Watchdog.Armed == 0)
+        KeCancelTimer(&G_Watchdog.Timer);
+}
+
+VOID
+NvShieldWatchdogArm(
+    PDEVICE_EXTENSION devContext,
+    ULONGLONG Expires
+)
+/*++
+
+Routine Description:
+
+    Sets when the motors of the device are stopped, in ms on the
+    KeQueryInterruptTime clock, replacing the previous deadline. 0 drops
+    it. Deadlines are rounded up to the next tick of the wheel.
+
+--*/
+{
+    ULONGLONG tick = (Expires + WATCHDOG_TICK_MS - 1) / WATCHDOG_TICK_MS;
+    KIRQL irql;
+
+    // Most reports of a game updating its effect every frame land here,
+    // and those of one whose motors are off on the second test
+    if (Expires != 0 && tick == devContext->WatchdogTick)
+        return;
+    if (Expires == 0 && IsListEmpty(&devContext->WatchdogLink))
+        return;
+
+    KeAcquireSpinLock(&G_Watchdog.Lock, &irql);
+
+    watchdogRemove(devContext);
+
+    if (Expires != 0)
+        watchdogInsert(devContext, tick);
+
+    KeReleaseSpinLock(&G_Watchdog.Lock, irql);
+}
+
+VOID
+NvShieldWatchdogCleanup(
+    PDEVICE_EXTENSION devContext
+)
+{
+    KIRQL irql;
+
+    // Expiries run under the lock, so none can be running for the device
+    // once this returns. Taken even when the device is out of the wheel,
+    // which the DPC takes it out of before stopping its motors; not
+    // pageable, for the same reason.
+    KeAcquireSpinLock(&G_Watchdog.Lock, &irql);
+    watchdogRemove(devContext);
+    KeReleaseSpinLock(&G_Watchdog.Lock, irql);
+}
+
+static VOID
+watchdogDpc(
+    PKDPC Dpc,
+    PVOID DeferredContext,
+    PVOID SystemArgument1,
+    PVOID SystemArgument2
+)
+/*++
+
+Routine Description:
+
+    Advances the wheel to the current tick and stops what has expired on
+    every device whose deadline has passed, through the same interrupt OUT
+    or SET_REPORT path the PID reports take, then moves the device on to
+    its next deadline, if any effect still plays.
+
+--*/
+{
+    ULONGLONG nowMs = watchdogNow();
+    ULONGLONG now = nowMs / WATCHDOG_TICK_MS;
+    PLIST_ENTRY entry, next;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(DeferredContext);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    KeAcquireSpinLockAtDpcLevel(&G_Watchdog.Lock);
+
+    // A turn of the wheel visits every slot
+    if (now - G_Watchdog.Tick > WATCHDOG_SLOTS)
+        G_Watchdog.Tick = now - WATCHDOG_SLOTS;
+
+    while (G_Watchdog.Armed != 0 && G_Watchdog.Tick < now) {
+        PLIST_ENTRY slot = &G_Watchdog.Slots[++G_Watchdog.Tick % WATCHDOG_SLOTS];
+
+        for (entry = slot->Flink; entry != slot; entry = next) {
+            PDEVICE_EXTENSION devContext = CONTAINING_RECORD(entry, DEVICE_EXTENSION, WatchdogLink);
+            ULONGLONG expires;
+            BOOLEAN expired;
+
+            next = entry->Flink;
+
+            if (devContext->WatchdogTick > now)
+                continue;
+
+            watchdogRemove(devContext);
+
+            // The only lock taken under the wheel's, see NVSHIELD_RUMBLE_LOCKED
+            KeAcquireSpinLockAtDpcLevel(&devContext->RumbleLock);
+            expired = NvShieldRumbleExpire(&devContext->Shield, nowMs);
+            expires = NvShieldRumbleNextExpiry(&devContext->Shield);
+            KeReleaseSpinLockFromDpcLevel(&devContext->RumbleLock);
+
+            if (expired)
+                NvShieldRumbleOutSend(devContext);
+
+            // Lands in a later tick, which this loop may still visit
+            if (expires != 0)
+                watchdogInsert(devContext, (expires + WATCHDOG_TICK_MS - 1) / WATCHDOG_TICK_MS);
+        }
+    }
+
+    KeReleaseSpinLockFromDpcLevel(&G_Watchdog.Lock);
+}
@@ -0,0 +1,525 @@
+/*++
+
+Module Name:
+
+    nvshldcap.c
+
+Abstract:
+
+    Drains the filter's capture ring into a pcap file that Wireshark opens
+    with its USBPcap dissector.
+
+        nvshldcap <file.pcap>
+
+    Capture runs until Ctrl+C. The ring is mapped into this process once;
+    records are read straight out of it, without an IOCTL per record.
+
+        nvshldcap -r
+
+    Prints the input report rate of every controller once a second instead,
+    to check the effect of the PollingInterval setting.
+
+        nvshldcap -t
+
+    Measures the latencies of every controller until Ctrl+C, then prints
+    their percentiles: how long the interrupt IN requests wait at the
+    device and spend in the filter, and the same for the motor reports.
+
+        nvshldcap -s
+
+    Prints the counters of every controller, then the totals of the
+    driver, then the time each stage of the input pipeline took if the
+    driver was built to count it.
+
+        nvshldcap -l
+
+    Prints the state of every controller ten times a second, read from the
+    shared state area rather than through HID.
+
+        nvshldcap -c [<device> <setting> <value>]
+
+    Prints the settings of every controller, or changes one setting of one
+    of them; the change applies at once and is kept in the registry.
+
+Environment:
+
+    user mode only
+
+--*/
+
+#include <windows.h>
+#include <winioctl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "..\..\sys\public.h"
+
+#define POLL_INTERVAL_MS    10
+#define STATE_INTERVAL_MS   100
+
+typedef struct _PCAP_FILE_HEADER {
+    ULONG magic_number;
+    USHORT version_major;
+    USHORT version_minor;
+    LONG thiszone;
+    ULONG sigfigs;
+    ULONG snaplen;
+    ULONG network;
+} PCAP_FILE_HEADER;
+
+static volatile LONG G_Stop = 0;
+
+static BOOL WINAPI
+ctrlHandler(
+    DWORD CtrlType
+)
+{
+    UNREFERENCED_PARAMETER(CtrlType);
+
+    InterlockedExchange(&G_Stop, 1);
+    return TRUE;
+}
+
+static BOOL
+setEnable(
+    HANDLE Device,
+    ULONG IoControlCode,
+    ULONG Enable
+)
+{
+    DWORD returned;
+
+    return DeviceIoControl(Device, IoControlCode,
+        &Enable, sizeof(Enable), NULL, 0, &returned, NULL);
+}
+
+static int
+measureRates(
+    HANDLE Device
+)
+{
+    NVSHIELD_REPORT_RATE rates[16];
+    DWORD returned, i;
+
+    if (!setEnable(Device, IOCTL_NVSHIELD_RATE_ENABLE, 1)) {
+        fwprintf(stderr, L"cannot enable rate measurement (error %lu)\n", GetLastError());
+        return 1;
+    }
+
+    fwprintf(stderr, L"measuring, press Ctrl+C to stop\n");
+
+    while (!G_Stop) {
+        Sleep(1000);
+
+        if (!DeviceIoControl(Device, IOCTL_NVSHIELD_RATE_QUERY, NULL, 0,
+                rates, sizeof(rates), &returned, NULL))
+            break;
+
+        for (i = 0; i < returned / sizeof(rates[0]); i++) {
+            if (rates[i].PollingInterval != 0)
+                wprintf(L"device %lu: %lu reports/s (bInterval forced to %lu)\n",
+                    rates[i].DeviceIndex, rates[i].ReportsPerSecond, rates[i].PollingInterval);
+            else
+                wprintf(L"device %lu: %lu reports/s\n",
+                    rates[i].DeviceIndex, rates[i].ReportsPerSecond);
+        }
+    }
+
+    setEnable(Device, IOCTL_NVSHIELD_RATE_ENABLE, 0);
+
+    return 0;
+}
+
+static const wchar_t* const latencyNames[] = {
+#define NVSHIELD_LATENCY_NAME(Name) L"" #Name,
+    NVSHIELD_LATENCIES(NVSHIELD_LATENCY_NAME)
+#undef NVSHIELD_LATENCY_NAME
+};
+
+static int
+measureLatencies(
+    HANDLE Device
+)
+{
+    static NVSHIELD_LATENCY_STATS latencies[16];
+    DWORD returned, i, j;
+
+    if (!setEnable(Device, IOCTL_NVSHIELD_LATENCY_ENABLE, 1)) {
+        fwprintf(stderr, L"cannot enable latency measurement (error %lu)\n", GetLastError());
+        return 1;
+    }
+
+    fwprintf(stderr, L"measuring, press Ctrl+C to stop\n");
+
+    while (!G_Stop)
+        Sleep(POLL_INTERVAL_MS);
+
+    if (!DeviceIoControl(Device, IOCTL_NVSHIELD_LATENCY_QUERY, NULL, 0,
+            latencies, sizeof(latencies), &returned, NULL)) {
+        fwprintf(stderr, L"cannot query the latencies (error %lu)\n", GetLastError());
+        setEnable(Device, IOCTL_NVSHIELD_LATENCY_ENABLE, 0);
+        return 1;
+    }
+
+    setEnable(Device, IOCTL_NVSHIELD_LATENCY_ENABLE, 0);
+
+    for (i = 0; i < returned / sizeof(latencies[0]); i++) {
+        for (j = 0; j < NvShieldLatencyCount; j++) {
+            const NVSHIELD_LATENCY_HISTOGRAM* histogram = &latencies[i].Latencies[j];
+
+            wprintf(L"device %lu: %-12s %lu samples, p50 %lu us, p99 %lu us, p99.9 %lu us, max %lu us\n",
+                latencies[i].DeviceIndex, latencyNames[j], NvShieldLatencyCountOf(histogram),
+                NvShieldLatencyPercentile(histogram, 500),
+                NvShieldLatencyPercentile(histogram, 990),
+                NvShieldLatencyPercentile(histogram, 999),
+                NvShieldLatencyPercentile(histogram, 1000));
+        }
+    }
+
+    return 0;
+}
+
+static ULONG
+drain(
+    PNVSHIELD_CAPTURE_RING Ring,
+    FILE* Out
+)
+{
+    PNVSHIELD_CAPTURE_ENTRY entry;
+    ULONG head, tail, records = 0;
+
+    head = Ring->Head;
+    MemoryBarrier(); // entries up to head are complete
+    tail = Ring->Tail;
+
+    while (tail != head) {
+        entry = (PNVSHIELD_CAPTURE_ENTRY)&Ring->Data[tail & (Ring->DataSize - 1)];
+
+        if (entry->Type == NVSHIELD_CAPTURE_ENTRY_RECORD) {
+            const NVSHIELD_PCAP_RECORD_HEADER* record = (const NVSHIELD_PCAP_RECORD_HEADER*)(entry + 1);
+
+            fwrite(record, 1, sizeof(*record) + record->incl_len, Out);
+            records++;
+        }
+
+        tail += entry->Length;
+    }
+
+    MemoryBarrier(); // done reading before the driver may overwrite
+    Ring->Tail = tail;
+
+    return records;
+}
+
+static const wchar_t* const stageNames[] = {
+#define NVSHIELD_STAGE_NAME(Name) L"" #Name,
+    NVSHIELD_INPUT_STAGES(NVSHIELD_STAGE_NAME)
+#undef NVSHIELD_STAGE_NAME
+};
+
+static int
+printStats(
+    HANDLE Device
+)
+{
+    NVSHIELD_DEVICE_STATS stats[16];
+    NVSHIELD_DRIVER_STATS total;
+    NVSHIELD_STAGE_STATS stages[16];
+    DWORD returned, i, j;
+
+    if (!DeviceIoControl(Device, IOCTL_NVSHIELD_STATS_QUERY, NULL, 0,
+            stats, sizeof(stats), &returned, NULL)) {
+        fwprintf(stderr, L"cannot query the counters (error %lu)\n", GetLastError());
+        return 1;
+    }
+
+    for (i = 0; i < returned / sizeof(stats[0]); i++) {
+        wprintf(L"device %lu: GET_REPORT cache %lu hits, %lu misses, "
+            L"rumble %lu sent, %lu suppressed, input %lu short, %lu mismatched, "
+            L"%lu unchanged held back\n",
+            stats[i].DeviceIndex, stats[i].ReportCacheHits, stats[i].ReportCacheMisses,
+            stats[i].RumbleReportsSent, stats[i].RumbleReportsSuppressed,
+            stats[i].InputReportsShort, stats[i].InputReportsMismatched,
+            stats[i].InputReportsSuppressed);
+    }
+
+    if (!DeviceIoControl(Device, IOCTL_NVSHIELD_DRIVER_STATS_QUERY, NULL, 0,
+            &total, sizeof(total), &returned, NULL)) {
+        fwprintf(stderr, L"cannot query the driver's counters (error %lu)\n", GetLastError());
+        return 1;
+    }
+
+    wprintf(L"driver: %I64u reports, %I64u rewritten, rumble %I64u sent, "
+        L"%I64u allocation failures, over %lu processors\n",
+        total.ReportsProcessed, total.ReportsRewritten, total.RumbleReportsSent,
+        total.AllocationFailures, total.Processors);
+
+    // Only checked builds count them
+    if (!DeviceIoControl(Device, IOCTL_NVSHIELD_STAGE_STATS_QUERY, NULL, 0,
+            stages, sizeof(stages), &returned, NULL))
+        return 0;
+
+    for (i = 0; i < returned / sizeof(stages[0]); i++) {
+        for (j = 0; j < NvShieldStageCount; j++) {
+            const NVSHIELD_STAGE_COUNTER* counter = &stages[i].Stages[j];
+
+            wprintf(L"device %lu: stage %-10s %I64u reports, %I64u cycles per report\n",
+                stages[i].DeviceIndex, stageNames[j], counter->Reports,
+                counter->Reports != 0 ? counter->Cycles / counter->Reports : 0);
+        }
+    }
+
+    return 0;
+}
+
+static const struct {
+    const wchar_t* Name;
+    ULONG Offset;
+} settingFields[] = {
+    { L"TrackpadScaleX",    FIELD_OFFSET(NVSHIELD_SETTINGS, TrackpadScaleX) },
+    { L"TrackpadScaleY",    FIELD_OFFSET(NVSHIELD_SETTINGS, TrackpadScaleY) },
+    { L"VolumeButtons",     FIELD_OFFSET(NVSHIELD_SETTINGS, VolumeButtons) },
+    { L"RumbleGain",        FIELD_OFFSET(NVSHIELD_SETTINGS, RumbleGain) },
+    { L"RumbleFlags",       FIELD_OFFSET(NVSHIELD_SETTINGS, RumbleFlags) },
+    { L"Calibrate",         FIELD_OFFSET(NVSHIELD_SETTINGS, Calibrate) },
+    { L"InputKeepAlive",    FIELD_OFFSET(NVSHIELD_SETTINGS, InputKeepAlive) },
+};
+
+#define SETTING_FIELD(Settings, i) \
+    ((PULONG)((PUCHAR)(Settings) + settingFields[i].Offset))
+
+static int
+changeSettings(
+    HANDLE Device,
+    int argc,
+    wchar_t** argv
+)
+{
+    NVSHIELD_SETTINGS settings[16];
+    DWORD returned, i, j;
+    ULONG index;
+
+    if (!DeviceIoControl(Device, IOCTL_NVSHIELD_SETTINGS_QUERY, NULL, 0,
+            settings, sizeof(settings), &returned, NULL)) {
+        fwprintf(stderr, L"cannot query the settings (error %lu)\n", GetLastError());
+        return 1;
+    }
+
+    if (argc == 2) {
+        for (i = 0; i < returned / sizeof(settings[0]); i++) {
+            wprintf(L"device %lu:", settings[i].DeviceIndex);
+            for (j = 0; j < ARRAYSIZE(settingFields); j++)
+                wprintf(L" %s=%lu", settingFields[j].Name, *SETTING_FIELD(&settings[i], j));
+            wprintf(L"\n");
+        }
+        return 0;
+    }
+
+    index = wcstoul(argv[2], NULL, 0);
+
+    for (i = 0; i < returned / sizeof(settings[0]); i++) {
+        if (settings[i].DeviceIndex == index)
+            break;
+    }
+    if (i == returned / sizeof(settings[0])) {
+        fwprintf(stderr, L"no device %lu\n", index);
+        return 1;
+    }
+
+    for (j = 0; j < ARRAYSIZE(settingFields); j++) {
+        if (_wcsicmp(argv[3], settingFields[j].Name) == 0)
+            break;
+    }
+    if (j == ARRAYSIZE(settingFields)) {
+        fwprintf(stderr, L"no setting %s\n", argv[3]);
+        return 1;
+    }
+
+    *SETTING_FIELD(&settings[i], j) = wcstoul(argv[4], NULL, 0);
+
+    if (!DeviceIoControl(Device, IOCTL_NVSHIELD_SETTINGS_SET, &settings[i], sizeof(settings[i]),
+            NULL, 0, &returned, NULL)) {
+        fwprintf(stderr, L"cannot change the settings (error %lu)\n", GetLastError());
+        return 1;
+    }
+
+    return 0;
+}
+
+static int
+watchState(
+    HANDLE Device
+)
+{
+    NVSHIELD_STATE_MAPPING mapping;
+    NVSHIELD_SHARED_STATE state;
+    LONG lastSequence[NVSHIELD_SHARED_STATE_SLOTS] = { 0 };
+    PUCHAR area;
+    DWORD returned;
+    ULONG i;
+
+    if (!DeviceIoControl(Device, IOCTL_NVSHIELD_STATE_MAP, NULL, 0,
+            &mapping, sizeof(mapping), &returned, NULL)) {
+        fwprintf(stderr, L"cannot map the shared state (error %lu)\n", GetLastError());
+        return 1;
+    }
+
+    area = (PUCHAR)(ULONG_PTR)mapping.AreaAddress;
+
+    fwprintf(stderr, L"watching, press Ctrl+C to stop\n");
+
+    while (!G_Stop) {
+        for (i = 0; i < mapping.SlotCount && i < NVSHIELD_SHARED_STATE_SLOTS; i++) {
+            const NVSHIELD_SHARED_STATE* slot =
+                (const NVSHIELD_SHARED_STATE*)(area + i * NVSHIELD_SHARED_STATE_SLOT_SIZE);
+
+            if (!NvShieldReadSharedState(slot, &state) || state.Sequence == lastSequence[i])
+                continue;
+            lastSequence[i] = state.Sequence;
+
+            wprintf(L"device %lu: buttons %03x hat %u consumer %02x"
+                L" axes %04x %04x %04x %04x triggers %04x %04x"
+                L" trackpad %x %3u,%3u (%.3f s)\n",
+                state.DeviceIndex, state.Buttons, state.Hat, state.Consumer,
+                state.Axes[0], state.Axes[1], state.Axes[2], state.Axes[3],
+                state.Axes[4], state.Axes[5],
+                state.TrackpadButtons, state.TrackpadX, state.TrackpadY,
+                (double)state.Timestamp / state.Frequency);
+        }
+
+        Sleep(STATE_INTERVAL_MS);
+    }
+
+    // Closing the handle unmaps the area
+    return 0;
+}
+
+int __cdecl
+wmain(
+    int argc,
+    wchar_t** argv
+)
+{
+    NVSHIELD_CAPTURE_MAPPING mapping;
+    PNVSHIELD_CAPTURE_RING ring;
+    PCAP_FILE_HEADER header;
+    ULONG records = 0;
+    DWORD returned;
+    HANDLE device;
+    FILE* out;
+
+    if (argc != 2 && !(argc == 5 && wcscmp(argv[1], L"-c") == 0)) {
+        fwprintf(stderr, L"usage: %s <file.pcap>\n"
+            L"       %s -r\n"
+            L"       %s -t\n"
+            L"       %s -s\n"
+            L"       %s -l\n"
+            L"       %s -c [<device> <setting> <value>]\n",
+            argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+        return 1;
+    }
+
+    device = CreateFileW(NVSHIELD_CONTROL_USER_PATH, GENERIC_READ | GENERIC_WRITE,
+        0, NULL, OPEN_EXISTING, 0, NULL);
+    if (device == INVALID_HANDLE_VALUE) {
+        fwprintf(stderr, L"cannot open %s (error %lu), is a controller plugged in?\n",
+            NVSHIELD_CONTROL_USER_PATH, GetLastError());
+        return 1;
+    }
+
+    SetConsoleCtrlHandler(ctrlHandler, TRUE);
+
+    if (wcscmp(argv[1], L"-s") == 0) {
+        int ret = printStats(device);
+
+        CloseHandle(device);
+        return ret;
+    }
+
+    if (wcscmp(argv[1], L"-l") == 0) {
+        int ret = watchState(device);
+
+        CloseHandle(device);
+        return ret;
+    }
+
+    if (wcscmp(argv[1], L"-c") == 0) {
+        int ret = changeSettings(device, argc, argv);
+
+        CloseHandle(device);
+        return ret;
+    }
+
+    if (wcscmp(argv[1], L"-t") == 0) {
+        int ret = measureLatencies(device);
+
+        CloseHandle(device);
+        return ret;
+    }
+
+    if (wcscmp(argv[1], L"-r") == 0) {
+        int ret = measureRates(device);
+
+        CloseHandle(device);
+        return ret;
+    }
+
+    if (!DeviceIoControl(device, IOCTL_NVSHIELD_CAPTURE_MAP, NULL, 0,
+            &mapping, sizeof(mapping), &returned, NULL)) {
+        fwprintf(stderr, L"cannot map the capture ring (error %lu)\n", GetLastError());
+        CloseHandle(device);
+        return 1;
+    }
+
+    ring = (PNVSHIELD_CAPTURE_RING)(ULONG_PTR)mapping.RingAddress;
+    if (ring->Magic != NVSHIELD_CAPTURE_MAGIC) {
+        fwprintf(stderr, L"unexpected capture ring format\n");
+        CloseHandle(device);
+        return 1;
+    }
+
+    if (_wfopen_s(&out, argv[1], L"wb") != 0) {
+        fwprintf(stderr, L"cannot create %s\n", argv[1]);
+        CloseHandle(device);
+        return 1;
+    }
+
+    header.magic_number = 0xA1B2C3D4;
+    header.version_major = 2;
+    header.version_minor = 4;
+    header.thiszone = 0;
+    header.sigfigs = 0;
+    header.snaplen = NVSHIELD_CAPTURE_SNAPLEN;
+    header.network = LINKTYPE_USBPCAP;
+    fwrite(&header, 1, sizeof(header), out);
+
+    // Forget whatever an earlier session left behind
+    ring->Tail = ring->Head;
+
+    if (!setEnable(device, IOCTL_NVSHIELD_CAPTURE_ENABLE, 1)) {
+        fwprintf(stderr, L"cannot enable capture (error %lu)\n", GetLastError());
+        fclose(out);
+        CloseHandle(device);
+        return 1;
+    }
+
+    fwprintf(stderr, L"capturing to %s, press Ctrl+C to stop\n", argv[1]);
+
+    while (!G_Stop) {
+        records += drain(ring, out);
+        Sleep(POLL_INTERVAL_MS);
+    }
+
+    setEnable(device, IOCTL_NVSHIELD_CAPTURE_ENABLE, 0);
+    records += drain(ring, out);
+
+    fwprintf(stderr, L"%lu records, %lu dropped\n", records, ring->Dropped);
+
+    fclose(out);
+
+    // Closing the handle unmaps the ring
+    CloseHandle(device);
+
+    return 0;
+}